@@ -3,7 +3,7 @@
 # Default rule
 # Build target executable from object files and report size
 .PHONY: build
-build: $(EXE)
+build: $(EXE) $(if $(HEAP_FREE),heapcheck)
 	@echo "\nBuild report:"
 	@$(SIZE) $<
 
@@ -38,6 +38,106 @@ $(BUILD_DIR)/%.o: $(SRC_DIR)/%.S | $(BUILD_DIR)
 $(EXE): $(OBJECTS) | $(BUILD_DIR)
 	$(CC) $(LDFLAGS) $(OBJECTS) -o $@
 
+# Fail if any object calls the C heap allocator. On the KL25Z the map file
+# must also show that the C library's allocator wasn't linked in (sections
+# dropped by the linker are listed ahead of the memory map, so skip them).
+HEAP_FUNCS = malloc|calloc|realloc|free|_malloc_r|_calloc_r|_realloc_r|_free_r
+
+.PHONY: heapcheck
+heapcheck: $(EXE)
+	@! $(NM) -u $(OBJECTS) | grep -wE "$(HEAP_FUNCS)" \
+	  || (echo "Heap allocator referenced" && false)
+ifeq ($(PLATFORM), KL25Z)
+	@! sed -n '/^Linker script and memory map/,$$p' $(MAPFILE) | grep -wE "_malloc_r|_sbrk" \
+	  || (echo "Heap allocator linked into $(EXE)" && false)
+endif
+	@echo "No heap allocator used"
+
+# Profile-guided build, objects are compiled with the profile of a training
+# run of the instrumented (pgo-gen) executable
+PGO_GEN_DIR = $(BUILD_BASE)/$(call variant,pgo-gen)
+PGO_GEN_EXE = $(TARGET)_$(call variant,pgo-gen).elf
+PGO_PROFILE = $(BUILD_BASE)/$(call variant,pgo)/profile.stamp
+
+ifeq ($(BUILD),pgo)
+$(OBJECTS): $(PGO_PROFILE)
+endif
+
+$(PGO_PROFILE):
+	$(MAKE) BUILD=pgo-gen build
+	rm -f $(PGO_GEN_DIR)/*.gcda
+	timeout --preserve-status -s INT $(PGO_SECONDS) ./$(PGO_GEN_EXE) < $(PGO_INPUT) > /dev/null
+	mkdir -p $(dir $@)
+	cp $(PGO_GEN_DIR)/*.gcda $(dir $@)
+	touch $@
+
+# Collect a new profile, then rebuild with it
+.PHONY: pgo
+pgo:
+	rm -f $(PGO_PROFILE)
+	$(MAKE) BUILD=pgo build
+
+# Size of every variant, and on HOST the speed of the profiling benchmarks
+VARIANTS = debug release pgo
+VARIANT_FLAGS = -DPROJECT3 -DLOG_OUT_ASCII -DPROFILER -DPROF_BUFFER_SIZE=$(PROF_BUFFER_SIZE)
+VARIANT_LOG = $(BUILD_BASE)/variants.log
+ifneq ($(PLATFORM), HOST)
+VARIANTS = debug release
+endif
+
+.PHONY: variants
+variants:
+	@for build in $(VARIANTS); do \
+	  $(MAKE) -s BUILD=$$build PROJFLAGS="$(VARIANT_FLAGS)" clean build > /dev/null || exit 1; \
+	done
+	@echo "\nSize report:"
+	@$(SIZE) $(foreach build,$(VARIANTS),$(TARGET)_$(call variant,$(build)).elf)
+ifeq ($(PLATFORM), HOST)
+	@$(foreach build,$(VARIANTS), \
+	  echo "\nSpeed report, $(build) (us for 10/100/1000/5000 bytes):"; \
+	  timeout --preserve-status -s INT 3 ./$(TARGET)_$(call variant,$(build)).elf \
+	    < /dev/null > $(VARIANT_LOG); \
+	  grep -E "^\| +(my_)?mem" $(VARIANT_LOG) | tail -4; \
+	  grep -E "ns each|records/s" $(VARIANT_LOG) | cut -d' ' -f2-;)
+	@rm -f $(VARIANT_LOG)
+endif
+
+# Microbenchmarks of the hot functions, compared with the recorded baseline.
+# Fails when a median slows down by more than PERF_THRESHOLD percent and the
+# difference is significant at PERF_ALPHA. perfbaseline records a new one.
+PERF_LIB = $(BUILD_BASE)/$(call variant,release)/lib$(TARGET).a
+PERF_BENCH = tests/perf/perf_bench.run
+PERF_CHECK = $(PYTHON) script/perfcheck.py --threshold $(PERF_THRESHOLD) \
+  --alpha $(PERF_ALPHA) --samples $(PERF_SAMPLES) $(PERF_BENCH) $(PERF_BASELINE)
+
+.PHONY: perfcheck perfbaseline perfbench
+ifeq ($(PLATFORM), HOST)
+perfbench:
+	$(MAKE) BUILD=release $(PERF_LIB)
+	$(MAKE) -C tests/perf
+
+perfcheck: perfbench
+	$(PERF_CHECK)
+
+perfbaseline: perfbench
+	$(PERF_CHECK) --update
+else
+perfcheck perfbaseline perfbench:
+	@echo Performance checks only supported for HOST
+endif
+
+# Native decoder and indexer for binary log captures, tools/binlog.run, built
+# against the release library like the microbenchmarks
+.PHONY: binlog
+ifeq ($(PLATFORM), HOST)
+binlog:
+	$(MAKE) BUILD=release $(PERF_LIB)
+	$(MAKE) -C tools
+else
+binlog:
+	@echo The binlog decoder is only built for HOST
+endif
+
 $(LIBNAME): $(LIB_OBJS)
 	$(AR) rv $(LIBNAME) $(LIB_OBJS)
 
@@ -108,3 +208,5 @@ clean-all:
 	rm -rf $(BUILD_BASE) $(dir $(EXE))*.elf
 	make -C tests/common clean
 	make -C tests/kl25z clean
+	make -C tests/perf clean
+	make -C tools clean
@@ -8,29 +8,53 @@
 # Common source files, all platforms
 COMMON_SRCS = \
   circular_buffer.c \
+  clock.c \
   conversion.c \
+  crash_log.c \
+  crc.c \
+  event.c \
+  frame.c \
   logger.c \
   log_queue.c \
+  lz.c \
   main.c \
   memory.c \
   nrf.c \
   platform.c \
+  pool.c \
   processor.c \
   profile.c \
-  project3.c
+  project3.c \
+  timer_wheel.c
 
 # Platform-specific source files
 ifeq ($(PLATFORM),HOST)
+  PLATFORM_SRCS += clock_sim.c
+  PLATFORM_SRCS += event_linux.c
   PLATFORM_SRCS += io_std.c
   PLATFORM_SRCS += gpio_fake.c
+  PLATFORM_SRCS += log_file.c
+  PLATFORM_SRCS += log_mpsc.c
+  PLATFORM_SRCS += nrf_sim.c
+  PLATFORM_SRCS += ring_map.c
   PLATFORM_SRCS += spi_fake.c
+  PLATFORM_SRCS += timer_linux.c
 
 else ifeq ($(PLATFORM),BBB)
+  PLATFORM_SRCS += clock_sim.c
+  PLATFORM_SRCS += event_linux.c
   PLATFORM_SRCS += io_std.c
   PLATFORM_SRCS += gpio_fake.c
+  PLATFORM_SRCS += log_file.c
+  PLATFORM_SRCS += log_mpsc.c
+  PLATFORM_SRCS += nrf_sim.c
+  PLATFORM_SRCS += ring_map.c
   PLATFORM_SRCS += spi_fake.c
+  PLATFORM_SRCS += timer_linux.c
 
 else ifeq ($(PLATFORM),KL25Z)
+  PLATFORM_SRCS += event_kl25z.c
+  PLATFORM_SRCS += fault_kl25z.c
   PLATFORM_SRCS += gpio_kl25z.c
   PLATFORM_SRCS += io_kl25z.c
   PLATFORM_SRCS += led_kl25z.c
@@ -39,6 +63,7 @@ else ifeq ($(PLATFORM),KL25Z)
   PLATFORM_SRCS += system_MKL25Z4.c
   PLATFORM_SRCS += timer_kl25z.c
   ifdef KL25Z_UART_NONBLOCK
+    CPPFLAGS += -DKL25Z_UART_NONBLOCK
     PLATFORM_SRCS += uart_kl25z_queued.c
     #PLATFORM_SRCS += uart_kl25z_dma.c
   else
@@ -5,7 +5,7 @@
 # Compiler, preprocessor, and linker flags common to all platforms
 CFLAGS = -std=c99
 CFLAGS += -Wall -Werror
-CFLAGS += -g -O0
+CFLAGS += -g
 
 CPPFLAGS += $(INCFLAGS)
 CPPFLAGS += $(PROJFLAGS)
@@ -20,6 +20,8 @@ ifeq ($(PLATFORM),HOST)
   # Enable POSIX timing functionality
   INCFLAGS += -I$(INC_DIR)/linux
   CFLAGS += -std=gnu99
+  LDFLAGS += -pthread
+  RELEASE_OPT = -O2
 else ifeq ($(PLATFORM),BBB)
   TOOLCHAIN = arm-linux-gnueabihf-
   # Enable POSIX timing functionality
@@ -27,6 +29,8 @@ else ifeq ($(PLATFORM),BBB)
   INCFLAGS += -I$(INC_DIR)/linux
   CFLAGS += -std=gnu99
   LDLAGS += -lrt
+  LDFLAGS += -pthread
+  RELEASE_OPT = -O2
 else ifeq ($(PLATFORM),KL25Z)
   TOOLCHAIN = arm-none-eabi-
   # Disable standard I/O functions (printf, etc), enable HW peripherals
@@ -41,6 +45,8 @@ else ifeq ($(PLATFORM),KL25Z)
   CFLAGS += -march=armv6-m
   # Generate code for Thumb mode, required for Cortex-M
   CFLAGS += -mthumb
+  # Flash is only 128 KB, so optimize for size
+  RELEASE_OPT = -Os
   INCFLAGS += -I$(INC_DIR)/CMSIS
   INCFLAGS += -I$(INC_DIR)/kl25z
   LDFLAGS += -T$(PLAT_DIR)/MKL25Z128xxx4_flash.ld
@@ -49,8 +55,9 @@ else ifeq ($(PLATFORM),KL25Z)
   # to choose the appropriate C runtime variant (armv6-m).
   LDFLAGS += -march=armv6-m
   LDFLAGS += -mthumb
-  ifdef PROF_BUFFER_SIZE
-    LDFLAGS += -Wl,--defsym=__buffer_size__=$(PROF_BUFFER_SIZE)
+  # Heap-free builds don't reserve any RAM for the C heap
+  ifdef HEAP_FREE
+    LDFLAGS += -Wl,--defsym=__heap_size__=0
   endif
   FLASH_SCRIPT = $(PLAT_DIR)/openocd_kl25z_flash.cfg
 else
@@ -59,10 +66,42 @@ endif
 
 INCFLAGS += -I$(INC_DIR)/common
 
+# Build variant flags
+#   debug   : No optimization
+#   release : Optimized for the platform, with link-time optimization and
+#             unused functions and data removed
+#   pgo     : Release, guided by the profile of a training run (HOST only)
+#   pgo-gen : Release, instrumented to collect that profile
+ifeq ($(BUILD),debug)
+  CFLAGS += -O0
+else ifneq ($(filter $(BUILD),release pgo pgo-gen),)
+  CFLAGS += $(RELEASE_OPT) -flto -ffunction-sections -fdata-sections
+  LDFLAGS += $(RELEASE_OPT) -flto -Wl,--gc-sections
+  # Archives of LTO objects need an index from the plugin-aware archiver
+  AR_PREFIX = gcc-
+else
+  $(error Invalid BUILD specified, must be one of: debug, release, pgo)
+endif
+
+ifneq ($(filter $(BUILD),pgo pgo-gen),)
+  ifneq ($(PLATFORM),HOST)
+    $(error BUILD=$(BUILD) runs the program for training, only PLATFORM=HOST is supported)
+  endif
+endif
+ifeq ($(BUILD),pgo-gen)
+  CFLAGS += -fprofile-generate
+  LDFLAGS += -fprofile-generate
+else ifeq ($(BUILD),pgo)
+  # Profile data is read from the build directory, next to each object.
+  # Functions the instrumented build dropped as unused have no profile.
+  CFLAGS += -fprofile-use -fprofile-correction -Wno-missing-profile
+endif
+
 # Define the compiler and binutils for our toolchain
 CC = $(TOOLCHAIN)gcc
 LD = $(TOOLCHAIN)ld
 SIZE = $(TOOLCHAIN)size
-AR = $(TOOLCHAIN)ar
+NM = $(TOOLCHAIN)nm
+AR = $(TOOLCHAIN)$(AR_PREFIX)ar
 
 OCD = openocd
@@ -0,0 +1,168 @@
+/**
+ * @file atomics.h
+ * @brief Atomic flag and counter updates shared with interrupt handlers
+ *
+ * The Cortex-M0+ has no exclusive loads and stores, so a read-modify-write of
+ * memory shared with an interrupt handler is made atomic by masking
+ * interrupts around it. On the KL25Z, the Bit Manipulation Engine (BME) can
+ * do the read-modify-write on the bus instead, as a single store to a
+ * decorated alias of the address. It only decorates the peripheral space
+ * (0x4000_0000-0x4007_FFFF). Peripheral registers use BME_OR(), BME_AND() and
+ * BME_XOR() directly. The atomic_*() functions use the BME for peripheral
+ * addresses and a short critical section for SRAM.
+ *
+ * On Linux, the atomic_*() functions are the GCC __atomic builtins, which
+ * follow the C11 memory model.
+ *
+ * A buffer with one producer and one consumer needs no read-modify-write at
+ * all, if each side only writes its own free-running counter. The producer
+ * fills a slot and then advances its counter, with ATOMIC_RELEASE() between
+ * the two, and the consumer reads the counter and then the slot, with
+ * ATOMIC_ACQUIRE() between them. The circular buffer and log queue work this
+ * way.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#ifndef __ATOMICS_H__
+#define __ATOMICS_H__
+
+#include <stdint.h>
+#include "platform.h"
+
+#ifdef KL25Z
+
+/* One core, so ordering against interrupt handlers only involves the compiler */
+#define ATOMIC_ACQUIRE() __atomic_signal_fence(__ATOMIC_ACQUIRE)
+#define ATOMIC_RELEASE() __atomic_signal_fence(__ATOMIC_RELEASE)
+
+/* BME operations, in address bits 28:26 of the decorated alias. Loads and
+   stores decode them differently. */
+#define BME_OP_AND  (1u << 26)  /* store */
+#define BME_OP_OR   (2u << 26)  /* store */
+#define BME_OP_XOR  (3u << 26)  /* store */
+#define BME_OP_LAC1 (2u << 26)  /* load, then clear one bit */
+#define BME_OP_LAS1 (3u << 26)  /* load, then set one bit */
+#define BME_BIT(bit) ((uint32_t) (bit) << 21)
+
+#define BME_PERIPH_BASE (0x40000000u)
+#define BME_PERIPH_SIZE (0x00080000u)
+
+/* Nonzero if `addr` is in the space the BME decorates */
+#define BME_PERIPH(addr) (((uintptr_t) (addr) - BME_PERIPH_BASE) < BME_PERIPH_SIZE)
+
+/* Decorated alias of a peripheral register, accessed with the same width */
+#define BME_ALIAS(reg, op) (*(volatile __typeof__(reg) *) ((uintptr_t) &(reg) | (op)))
+
+/* `reg |= bits`, `reg &= bits` and `reg ^= bits`, as one bus write. Interrupts
+   stay enabled, and a handler's update to the register can't be lost. */
+#define BME_OR(reg, bits)  (BME_ALIAS(reg, BME_OP_OR) = (bits))
+#define BME_AND(reg, bits) (BME_ALIAS(reg, BME_OP_AND) = (bits))
+#define BME_XOR(reg, bits) (BME_ALIAS(reg, BME_OP_XOR) = (bits))
+
+/**
+ * @brief Atomically set bits in a word
+ *
+ * @param[in,out] addr The word, in SRAM or a peripheral register
+ * @param[in]     bits The bits to set
+ **/
+__attribute__((always_inline)) static inline void atomic_set_bits(volatile uint32_t *addr, uint32_t bits)
+{
+  if( BME_PERIPH(addr) ) {
+    BME_OR(*addr, bits);
+  }
+  else {
+    START_CRITICAL();
+    *addr |= bits;
+    END_CRITICAL();
+  }
+}
+
+/**
+ * @brief Atomically clear bits in a word
+ *
+ * @param[in,out] addr The word, in SRAM or a peripheral register
+ * @param[in]     bits The bits to clear
+ **/
+__attribute__((always_inline)) static inline void atomic_clear_bits(volatile uint32_t *addr, uint32_t bits)
+{
+  if( BME_PERIPH(addr) ) {
+    BME_AND(*addr, ~bits);
+  }
+  else {
+    START_CRITICAL();
+    *addr &= ~bits;
+    END_CRITICAL();
+  }
+}
+
+/**
+ * @brief Atomically set one bit in a word, returning its old value
+ *
+ * @param[in,out] addr The word, in SRAM or a peripheral register
+ * @param[in]     bit  The bit number, 0 to 31
+ * @return Returns 1 if the bit was already set, 0 otherwise
+ **/
+__attribute__((always_inline)) static inline uint8_t atomic_test_and_set_bit(volatile uint32_t *addr, uint8_t bit)
+{
+  uint32_t old;
+
+  if( BME_PERIPH(addr) ) {
+    return *(volatile uint32_t *) ((uintptr_t) addr | BME_OP_LAS1 | BME_BIT(bit));
+  }
+  START_CRITICAL();
+  old = *addr;
+  *addr = old | (1u << bit);
+  END_CRITICAL();
+  return (old >> bit) & 1;
+}
+
+/**
+ * @brief Atomically add to a counter
+ *
+ * The BME has no add, so this always masks interrupts, for a few cycles.
+ *
+ * @param[in,out] addr  The counter
+ * @param[in]     delta Amount to add, may be negative
+ * @return Returns the new value of the counter
+ **/
+__attribute__((always_inline)) static inline uint32_t atomic_add(volatile uint32_t *addr, int32_t delta)
+{
+  uint32_t value;
+
+  START_CRITICAL();
+  value = *addr + delta;
+  *addr = value;
+  END_CRITICAL();
+  return value;
+}
+
+#else /* HOST/BBB */
+
+#define ATOMIC_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define ATOMIC_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+
+static inline void atomic_set_bits(volatile uint32_t *addr, uint32_t bits)
+{
+  __atomic_fetch_or(addr, bits, __ATOMIC_ACQ_REL);
+}
+
+static inline void atomic_clear_bits(volatile uint32_t *addr, uint32_t bits)
+{
+  __atomic_fetch_and(addr, ~bits, __ATOMIC_ACQ_REL);
+}
+
+static inline uint8_t atomic_test_and_set_bit(volatile uint32_t *addr, uint8_t bit)
+{
+  return (__atomic_fetch_or(addr, 1u << bit, __ATOMIC_ACQ_REL) >> bit) & 1;
+}
+
+static inline uint32_t atomic_add(volatile uint32_t *addr, int32_t delta)
+{
+  return __atomic_add_fetch(addr, delta, __ATOMIC_ACQ_REL);
+}
+
+#endif
+
+#endif /* __ATOMICS_H__ */
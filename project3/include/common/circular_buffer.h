@@ -8,6 +8,21 @@
  *
  * This circular buffer only supports data elements of type uint8_t.
  *
+ * Storage either comes from the arena (CB_init) or is a static array declared
+ * with CB_STORAGE (CB_init_static). Static storage is part of .bss, so running
+ * out of RAM is a link error rather than a failed init, and each array has its
+ * own .bss.ring.<name> section for the linker script to place. Buffers with a
+ * power-of-two size wrap with a mask instead of a compare.
+ *
+ * On Linux, CB_init_mapped() maps the storage twice, back to back (see
+ * ring_map.h). CB_peek() and CB_span() then never have to wrap, and
+ * CB_span() covers every stored item.
+ *
+ * Adding and removing take no lock and leave interrupts enabled, as long as
+ * there is one producer and one consumer, like an interrupt handler and the
+ * main loop. Each side only writes its own pointer and counter (see
+ * atomics.h).
+ *
  * @author Jeff Schornick
  * @date 2017/07/12
  **/
@@ -26,9 +41,27 @@ typedef struct
   volatile cb_item_t *head;   /* Points to the latest item added */
   volatile cb_item_t *tail;   /* Points one spot behind the earliest item added */
   size_t size;                /* Total number of items the buffer can store */
-  volatile size_t count;      /* Current number of items being stored */
+  volatile size_t added;      /* Items ever added, only written by the producer */
+  volatile size_t removed;    /* Items ever removed, only written by the consumer */
+  size_t mask;                /* size - 1 if size is a power of two, else 0 */
+#ifndef KL25Z
+  uint8_t mapped;             /* Storage is from ring_map() */
+#endif
 } CircBuf_t;
 
+#ifdef KL25Z
+#define CB_MAPPED(circbuf) (0)
+#else
+#define CB_MAPPED(circbuf) ((circbuf)->mapped)
+#endif
+
+/* Current number of items being stored */
+#define CB_count(circbuf) ((size_t) ((circbuf)->added - (circbuf)->removed))
+
+/* Declare static storage for a buffer of `size` items, aligned to `align` */
+#define CB_STORAGE(name, size, align) \
+  cb_item_t name[size] __attribute__((aligned(align), section(".bss.ring." #name)))
+
 typedef enum
 {
   CB_FALSE = 0, /* Buffer test was not true */
@@ -59,6 +92,33 @@ typedef enum
  **/
 CB_status_t CB_init(CircBuf_t *circbuf, size_t size);
 
+/**
+ * @brief Initialize a circular buffer over existing storage
+ *
+ * As CB_init(), but the buffer uses `storage` (usually declared with
+ * CB_STORAGE) instead of allocating. CB_destroy() leaves the storage alone.
+ *
+ * @param[in,out] circbuf A pointer to a circular buffer record
+ * @param[in]     storage Space for `size` elements
+ * @param[in]     size    The number of elements the buffer should hold
+ * @return Returns CB_OK after successful initialization, otherwise an error status
+ **/
+CB_status_t CB_init_static(CircBuf_t *circbuf, cb_item_t *storage, size_t size);
+
+#ifndef KL25Z
+/**
+ * @brief Initialize a circular buffer over storage mapped twice
+ *
+ * As CB_init(), but the storage comes from ring_map(), and `size` is rounded
+ * up to a whole number of pages.
+ *
+ * @param[in,out] circbuf A pointer to a circular buffer record
+ * @param[in]     size    The least number of elements the buffer should hold
+ * @return Returns CB_OK after successful initialization, otherwise an error status
+ **/
+CB_status_t CB_init_mapped(CircBuf_t *circbuf, size_t size);
+#endif
+
 /**
  * @brief Destroy (deallocate) an existing circular buffer
  *
@@ -78,6 +138,8 @@ CB_status_t CB_destroy(CircBuf_t *circbuf);
  * If the buffer is already full, the item will not be added and CB_FULL will be
  * returned.
  *
+ * Only one context may add to a buffer at a time.
+ *
  * @param[in,out] circbuf A pointer to an initialized circular buffer
  * @param[in]     data    The item to add to the buffer
  * @return Returns CB_OK if item is successfully added, otherwise and error status
@@ -93,6 +155,8 @@ CB_status_t CB_add_item(CircBuf_t *circbuf, cb_item_t item);
  * If the buffer is already empty, CB_EMPTY will be returned.
  * An error of CB_NULL will be returned if either parameter is null.
  *
+ * Only one context may remove from a buffer at a time.
+ *
  * @param[in,out] circbuf A pointer to an initialized circular buffer
  * @param[in]     data    The address where the removed item should be stored
  * @return Returns CB_OK if item is successfully added, otherwise and error status
@@ -115,7 +179,7 @@ __attribute__((always_inline)) static inline CB_status_t CB_is_full(CircBuf_t *c
     {
       return CB_NULL;
     }
-  if( circbuf->count != circbuf->size )
+  if( CB_count(circbuf) != circbuf->size )
     {
       return CB_FALSE;
     }
@@ -139,7 +203,7 @@ __attribute__((always_inline)) static inline CB_status_t CB_is_empty(CircBuf_t *
     {
       return CB_NULL;
     }
-  if( circbuf->count != 0 )
+  if( circbuf->added != circbuf->removed )
     {
       return CB_FALSE;
     }
@@ -164,5 +228,28 @@ __attribute__((always_inline)) static inline CB_status_t CB_is_empty(CircBuf_t *
  **/
 CB_status_t CB_peek(CircBuf_t *circbuf, size_t position, uint8_t *item);
 
+/**
+ * @brief Find the oldest items, to read them in place
+ *
+ * Sets `items` to the oldest item. The items after it, up to the count
+ * returned, are contiguous. That is every stored item if the buffer is
+ * mapped, otherwise only those before the end of the storage. Only the
+ * consumer may call this, and CB_consume() then removes the items.
+ *
+ * @param[in]  circbuf A pointer to an initialized circular buffer
+ * @param[out] items   Where to store the address of the oldest item
+ * @return Returns the number of contiguous items, 0 if empty or on error
+ **/
+size_t CB_span(CircBuf_t *circbuf, const volatile cb_item_t **items);
+
+/**
+ * @brief Remove the oldest items without copying them
+ *
+ * @param[in,out] circbuf A pointer to an initialized circular buffer
+ * @param[in]     count   The number of items to remove
+ * @return Returns CB_OK, CB_SIZE_ERR if fewer items are stored, or CB_NULL
+ **/
+CB_status_t CB_consume(CircBuf_t *circbuf, size_t count);
+
 #endif /* __CIRCULAR_BUFFER_H__ */
 
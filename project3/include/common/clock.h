@@ -0,0 +1,83 @@
+/**
+ * @file clock.h
+ * @brief Monotonic 64-bit clock extended from a wrapping hardware counter
+ *
+ * The hardware counter (SysTick on the KL25Z, a model of it on the host) is
+ * CLOCK_PERIOD ticks long and wraps every fraction of a second. Each wrap
+ * interrupt calls clock_wrap(), which carries the elapsed period into a tick
+ * count and a microsecond count. A read combines those with the live counter
+ * and is safe against a wrap happening mid-read, including a wrap whose
+ * interrupt is still pending because interrupts are masked.
+ *
+ * A once-per-second interrupt calls clock_second() with the wall clock seconds
+ * (the RTC on the KL25Z), so timestamps can be split into seconds and the
+ * microseconds since that second began.
+ *
+ * The platform's timer.h supplies CLOCK_PERIOD, CLOCK_TICKS_PER_US,
+ * clock_hw_count() and clock_hw_wrapped().
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/05
+ **/
+
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <stdint.h>
+
+/**
+ * @brief Restart the clock from zero
+ *
+ * Called when the hardware counter is (re)started, before its first wrap.
+ *
+ * @return Nothing returned
+ **/
+void clock_init(void);
+
+/**
+ * @brief Account for one wrap of the hardware counter
+ *
+ * Must be called from the counter wrap interrupt, exactly once per wrap.
+ *
+ * @return Nothing returned
+ **/
+void clock_wrap(void);
+
+/**
+ * @brief Mark the start of a wall clock second
+ *
+ * @param[in] secs The wall clock seconds that just began
+ * @return Nothing returned
+ **/
+void clock_second(uint32_t secs);
+
+/**
+ * @brief Return the hardware ticks since clock_init()
+ *
+ * Correct as long as the caller doesn't keep interrupts masked for more than
+ * one counter period.
+ *
+ * @return Returns the 64-bit tick count
+ **/
+uint64_t clock_ticks(void);
+
+/**
+ * @brief Return the microseconds since clock_init()
+ *
+ * @return Returns the 64-bit microsecond count
+ **/
+uint64_t clock_usecs(void);
+
+/**
+ * @brief Return the current wall clock time with microsecond resolution
+ *
+ * If the seconds interrupt is late, the seconds are carried forward from the
+ * last one seen, so the result never goes backwards.
+ *
+ * @param[out] secs  The wall clock seconds
+ * @param[out] usecs The microseconds into the current second (0-999999)
+ * @return Nothing returned
+ **/
+void clock_timestamp(uint32_t *secs, uint32_t *usecs);
+
+#endif /* __CLOCK_H__ */
@@ -0,0 +1,100 @@
+/**
+ * @file coroutine.h
+ * @brief Stackless coroutines for driver sequences
+ *
+ * Lets a driver sequence wait on hardware without blocking the core. A
+ * coroutine is a function that is called repeatedly. Each call resumes where
+ * the last one returned, at a CR_WAIT_UNTIL() or CR_YIELD(), and runs until it
+ * has to wait again. The resume point is kept in a CR_t as a line number
+ * (protothread style), so no stack is kept between calls.
+ *
+ * Local variables are not preserved across a wait. Anything needed after a wait
+ * must live in the coroutine's context struct, which embeds the CR_t. Waits
+ * can't be placed inside a switch statement, and only one wait or yield may
+ * appear per source line.
+ *
+ * Typical use:
+ *
+ *   CR_status_t my_cr(My_ctx_t *ctx)
+ *   {
+ *     CR_BEGIN(&ctx->cr);
+ *     start_hardware();
+ *     CR_WAIT_UNTIL(&ctx->cr, hardware_done());
+ *     CR_END(&ctx->cr);
+ *   }
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/08
+ **/
+
+#ifndef __COROUTINE_H__
+#define __COROUTINE_H__
+
+#include <stdint.h>
+
+/* Coroutine state, zero is the start of the coroutine */
+typedef struct {
+  uint16_t line;
+} CR_t;
+
+typedef enum
+{
+  CR_WAITING = 0,  /* Waiting on a condition       */
+  CR_YIELDED,      /* Gave up the core voluntarily */
+  CR_EXITED,       /* Finished early with CR_EXIT() */
+  CR_ENDED         /* Ran to CR_END()               */
+} CR_status_t;
+
+/* Check a CR_status_t for completion */
+#define CR_DONE(status) ((status) >= CR_EXITED)
+
+/* Restart a coroutine from the top on its next call */
+#define CR_INIT(cr) do { (cr)->line = 0; } while(0)
+
+#define CR_BEGIN(cr)                           \
+  { uint8_t cr_yielded = 1; (void) cr_yielded; \
+    switch( (cr)->line ) { case 0:
+
+#define CR_END(cr)   \
+    }                \
+    (cr)->line = 0;  \
+    return CR_ENDED; \
+  }
+
+/* Return to the caller until `cond` is true, checked again on every call */
+#define CR_WAIT_UNTIL(cr, cond)      \
+  do {                               \
+    (cr)->line = __LINE__;           \
+    case __LINE__:                   \
+    if( !(cond) ) {                  \
+      return CR_WAITING;             \
+    }                                \
+  } while(0)
+
+#define CR_WAIT_WHILE(cr, cond) CR_WAIT_UNTIL(cr, !(cond))
+
+/* Run a child coroutine call each time until it finishes */
+#define CR_WAIT_CR(cr, call) CR_WAIT_WHILE(cr, !CR_DONE(call))
+
+/* Return to the caller once, resuming here on the next call */
+#define CR_YIELD(cr)                 \
+  do {                               \
+    cr_yielded = 0;                  \
+    (cr)->line = __LINE__;           \
+    case __LINE__:                   \
+    if( !cr_yielded ) {              \
+      return CR_YIELDED;             \
+    }                                \
+  } while(0)
+
+/* Finish now, the next call starts over */
+#define CR_EXIT(cr)                  \
+  do {                               \
+    (cr)->line = 0;                  \
+    return CR_EXITED;                \
+  } while(0)
+
+/* Call a coroutine until it finishes, for blocking wrappers */
+#define CR_RUN(call) while( !CR_DONE(call) ) {}
+
+#endif /* __COROUTINE_H__ */
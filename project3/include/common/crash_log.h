@@ -0,0 +1,126 @@
+/**
+ * @file crash_log.h
+ * @brief Logs and registers saved at a fault, to be sent after the reset
+ *
+ * On the KL25Z, the logger keeps a Crash_log_t in NOINIT RAM (see
+ * platform.h), which the startup code leaves alone. The HardFault handler
+ * saves the registers the fault stacked and the newest unflushed logs into
+ * it, seals it with a magic number and CRC, and resets. The next
+ * logging_init() finds it valid, sends its logs as the previous session's,
+ * before any new ones, and clears it. RAM that has only been powered up
+ * fails the check.
+ *
+ * Nothing in the region is a pointer, so it can also be checked and read
+ * back from a copy at another address.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#ifndef __CRASH_LOG_H__
+#define __CRASH_LOG_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "logger.h"
+#include "log_queue.h"
+
+/* Bytes of logs kept, the newest that fit */
+#ifndef CRASH_LOG_SIZE
+#define CRASH_LOG_SIZE (512)
+#endif
+
+#define CRASH_MAGIC (0xC4A5B007)
+
+/* Registers stacked on exception entry, then the stack pointer from before
+   the exception and the EXC_RETURN value in LR */
+typedef struct
+{
+  uint32_t r0;
+  uint32_t r1;
+  uint32_t r2;
+  uint32_t r3;
+  uint32_t r12;
+  uint32_t lr;
+  uint32_t pc;
+  uint32_t xpsr;
+  uint32_t sp;
+  uint32_t exc_return;
+} Crash_regs_t;
+
+typedef struct
+{
+  uint32_t magic;      /* CRASH_MAGIC once sealed */
+  uint32_t crc;        /* CRC-32 of everything after this field */
+  Crash_regs_t regs;
+  uint32_t used;       /* Bytes of logs in `log` */
+  uint32_t dropped;    /* Unflushed logs that didn't fit */
+  uint8_t log[CRASH_LOG_SIZE]; /* Header and data of each log, oldest first */
+} Crash_log_t;
+
+/**
+ * @brief Start saving a crash, invalidating what was saved before
+ *
+ * @param[out] crash The crash region
+ * @param[in]  regs  Registers at the fault
+ **/
+void crash_begin(Crash_log_t *crash, const Crash_regs_t *regs);
+
+/**
+ * @brief Save the newest logs on a queue that fit in the crash region
+ *
+ * The queue is left as it was, older logs that don't fit are counted in
+ * `dropped`. Queues are saved in the order they are added.
+ *
+ * @param[in,out] crash The crash region
+ * @param[in]     queue The log queue
+ **/
+void crash_add_queue(Crash_log_t *crash, const Log_q *queue);
+
+/**
+ * @brief Seal the crash region with its CRC and magic number
+ *
+ * @param[in,out] crash The crash region
+ **/
+void crash_seal(Crash_log_t *crash);
+
+/**
+ * @brief Check for a sealed crash region
+ *
+ * @param[in] crash The crash region
+ * @return Returns 1 if the magic number and CRC match, 0 otherwise
+ **/
+uint8_t crash_valid(const Crash_log_t *crash);
+
+/**
+ * @brief Read the next saved log
+ *
+ * As with lq_remove(), `item->data` and `item->length` give the buffer for
+ * the log data, and data that doesn't fit is dropped.
+ *
+ * @param[in]     crash The crash region, checked with crash_valid()
+ * @param[in,out] pos   Offset of the next log in the region, start at 0
+ * @param[in,out] item  The log
+ * @return Returns LQ_OK, LQ_NULL for a NULL pointer, or LQ_EMPTY after the
+ *         last log
+ **/
+Log_status_t crash_remove(const Crash_log_t *crash, size_t *pos, Log_t *item);
+
+/**
+ * @brief Invalidate the crash region, once its logs are sent
+ *
+ * @param[out] crash The crash region
+ **/
+void crash_clear(Crash_log_t *crash);
+
+/**
+ * @brief Save the logger's unflushed logs and the registers at a fault
+ *
+ * Defined by the logger (KL25Z), for the HardFault handler.
+ *
+ * @param[in] regs Registers at the fault
+ **/
+void log_crash(const Crash_regs_t *regs);
+
+#endif /* __CRASH_LOG_H__ */
@@ -0,0 +1,33 @@
+/**
+ * @file crc.h
+ * @brief CRC-32 checksums
+ *
+ * The IEEE 802.3 CRC-32 (reflected, polynomial 0xEDB88320), as used by zlib.
+ * Table-driven, a nibble at a time on the KL25Z and slice-by-8 on Linux.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#ifndef __CRC_H__
+#define __CRC_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* CRC of no data, the starting value to pass to crc32() */
+#define CRC32_INIT (0)
+
+/**
+ * @brief Add data to a CRC-32
+ *
+ * Data can be added in pieces, the result is the same as in one call.
+ *
+ * @param[in] crc    CRC of the data so far, CRC32_INIT to start
+ * @param[in] data   Data to add
+ * @param[in] length Bytes of data
+ * @return Returns the CRC of the data so far followed by `data`
+ **/
+uint32_t crc32(uint32_t crc, const volatile uint8_t *data, size_t length);
+
+#endif /* __CRC_H__ */
@@ -0,0 +1,173 @@
+/**
+ * @file event.h
+ * @brief Cooperative event loop
+ *
+ * Interrupt handlers post events to a small queue instead of doing work in
+ * interrupt context. The main loop dispatches each event to its registered
+ * handler, runs expired software timers, and sleeps when there is nothing left
+ * to do: WFI on the KL25Z, epoll on Linux.
+ *
+ * Events that only mean "something is waiting" (bytes received, log queue
+ * filling) are signalled with ev_signal(), which queues at most one copy. The
+ * handler is expected to consume everything available.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/07
+ **/
+
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Queued events, must be a power of 2 */
+#define EV_QUEUE_SIZE (16)
+
+typedef enum
+{
+  EV_UART_RX = 0, /* Received bytes are waiting (stdin on Linux) */
+  EV_DMA_DONE,    /* DMA transfer complete, data is the channel */
+  EV_RTC_TICK,    /* RTC second, data is the seconds count */
+  EV_TIMER,       /* The timer wheel's timerfd expired (Linux only) */
+  EV_LOG_FLUSH,   /* The log queue crossed its flush watermark */
+  EV_ID_MAX
+} Event_id_t;
+
+typedef enum
+{
+  EV_OK = 0,    /* Operation successful */
+  EV_FULL,      /* Queue full, event was dropped */
+  EV_SIZE_ERR   /* Bad event id */
+} EV_status_t;
+
+typedef void (*EV_handler_t)(uint32_t data);
+
+/* Dispatch counters, times in microseconds */
+typedef struct {
+  uint32_t posted;       /* Events queued                             */
+  uint32_t coalesced;    /* Signals merged into one already queued    */
+  uint32_t dropped;      /* Events lost to a full queue               */
+  uint32_t dispatched;   /* Events passed to a handler                */
+  uint32_t latency_max;  /* Longest wait from post to dispatch        */
+  uint64_t latency_sum;  /* Total wait of dispatched events           */
+  uint64_t idle_us;      /* Time spent asleep waiting for events      */
+  uint32_t wakeups;      /* Times the loop slept and woke again       */
+} EV_stats_t;
+
+extern EV_stats_t ev_stats;
+
+/**
+ * @brief Empty the queue, drop all handlers and restart the statistics
+ *
+ * Only the log flush handler is registered again.
+ *
+ * @return Nothing returned
+ **/
+void ev_init(void);
+
+/**
+ * @brief Set the handler for an event, replacing any earlier one
+ *
+ * @param[in] id      The event
+ * @param[in] handler The handler, or NULL to ignore the event
+ * @return Returns EV_OK, or EV_SIZE_ERR for a bad id
+ **/
+EV_status_t ev_register(Event_id_t id, EV_handler_t handler);
+
+/**
+ * @brief Queue an event, safe from interrupt context
+ *
+ * Events with no registered handler are discarded without being queued.
+ *
+ * @param[in] id   The event
+ * @param[in] data Passed to the handler
+ * @return Returns EV_OK if queued, otherwise an error status
+ **/
+EV_status_t ev_post(Event_id_t id, uint32_t data);
+
+/**
+ * @brief Queue an event unless one is already waiting, safe from interrupt context
+ *
+ * @param[in] id The event, its handler gets 0 as data
+ * @return Returns EV_OK if queued or already waiting, otherwise an error status
+ **/
+EV_status_t ev_signal(Event_id_t id);
+
+/**
+ * @brief Check whether events or timer callbacks are waiting
+ *
+ * @return Returns 1 if the loop has work to do, 0 otherwise
+ **/
+uint8_t ev_ready(void);
+
+/**
+ * @brief Pass every queued event to its handler
+ *
+ * Events posted by handlers are dispatched in the same call.
+ *
+ * @return Returns the number of events dispatched
+ **/
+uint32_t ev_dispatch(void);
+
+/**
+ * @brief Run the event loop until ev_stop()
+ *
+ * Dispatches events and timer callbacks. When idle, flushes the log and
+ * sleeps until the next interrupt.
+ *
+ * @return Nothing returned
+ **/
+void ev_run(void);
+
+/**
+ * @brief Make ev_run() return once the current pass is finished
+ *
+ * Safe to call from an interrupt or signal handler. On Linux, SIGINT and
+ * SIGTERM call it, so the program can exit cleanly (flushing output and
+ * writing profile data).
+ *
+ * @return Nothing returned
+ **/
+void ev_stop(void);
+
+/**
+ * @brief Sleep until the next event
+ *
+ * Returns immediately if ev_ready(). Implemented per platform.
+ *
+ * @return Nothing returned
+ **/
+void ev_wait(void);
+
+/**
+ * @brief Log the dispatch latency and idle time since ev_init()
+ *
+ * @return Nothing returned
+ **/
+void ev_log_stats(void);
+
+#ifndef KL25Z
+
+/**
+ * @brief Signal an event whenever a file descriptor is readable
+ *
+ * Descriptors that can't be polled, like regular files, are always readable.
+ *
+ * @param[in] fd The file descriptor
+ * @param[in] id The event to signal
+ * @return Returns EV_OK, or EV_FULL if too many descriptors are watched
+ **/
+EV_status_t ev_watch_fd(int fd, Event_id_t id);
+
+/**
+ * @brief Stop watching a file descriptor
+ *
+ * @param[in] fd The file descriptor
+ * @return Nothing returned
+ **/
+void ev_unwatch_fd(int fd);
+
+#endif
+
+#endif /* __EVENT_H__ */
@@ -0,0 +1,137 @@
+/**
+ * @file frame.h
+ * @brief CRC-checked frames for the binary log stream
+ *
+ * Records are grouped into frames, so a receiver can find its place again
+ * after bytes are lost, corrupted or mixed in with other output:
+ *
+ *   uint8_t  sync[2];        FRAME_SYNC0, FRAME_SYNC1
+ *   uint16_t length;         bytes of payload, at most FRAME_LENGTH_MAX
+ *   uint8_t  seq;            frame count, to spot frames lost whole
+ *   uint8_t  record_header;  LOG_HEADER_SIZE of the sender
+ *   payload                  whole records, header then data
+ *   uint32_t crc;            CRC-32 of everything after the sync
+ *
+ * all little-endian. A reader scans for the sync, and takes a frame whose
+ * length is in range and whose CRC matches. Otherwise it moves on a byte and
+ * scans again, so a bad frame costs only the records in it. The CRC-32 lets
+ * a false sync through about once in 4 billion tries. script/binlog.py
+ * decodes the frames, as does frame_next().
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "log_queue.h"
+
+/* Most payload in one frame sent, which must hold the largest record */
+#ifndef FRAME_PAYLOAD
+#ifdef KL25Z
+#define FRAME_PAYLOAD (128)
+#else
+#define FRAME_PAYLOAD (1024)
+#endif
+#endif
+
+#define FRAME_SYNC0 (0xA5)
+#define FRAME_SYNC1 (0x5A)
+#define FRAME_HEADER (6)
+#define FRAME_CRC (4)
+#define FRAME_OVERHEAD (FRAME_HEADER + FRAME_CRC)
+/* Most payload a reader accepts, from any sender */
+#define FRAME_LENGTH_MAX (4096)
+
+typedef struct
+{
+  void (*out)(uint8_t *data, size_t length); /* Takes each frame */
+  uint16_t fill;      /* Bytes of payload so far */
+  uint8_t seq;        /* Sequence number of the frame being filled */
+  uint8_t frame[FRAME_OVERHEAD + FRAME_PAYLOAD]; /* Frame being built */
+} Frame_t;
+
+/* A frame found by frame_next(), pointing into the reader's buffer */
+typedef struct
+{
+  const uint8_t *payload;
+  uint16_t length;
+  uint8_t seq;
+  uint8_t record_header;
+} Frame_info_t;
+
+typedef struct
+{
+  uint8_t complete;   /* Set if the buffer holds the whole stream */
+  uint8_t synced;     /* Set once a frame has been found */
+  uint8_t seq;        /* Sequence number expected next */
+  uint32_t frames;    /* Good frames */
+  uint32_t lost;      /* Frames missing from the sequence */
+  size_t skipped;     /* Bytes passed over looking for a frame */
+} Frame_reader_t;
+
+/**
+ * @brief Start a framed stream
+ *
+ * @param[out] f             The framer
+ * @param[in]  out           Function given each frame, e.g. print_n()
+ * @param[in]  record_header Size of a record header, sent in every frame
+ **/
+void frame_init(Frame_t *f, void (*out)(uint8_t *data, size_t length), uint8_t record_header);
+
+/**
+ * @brief Add a record to the frame being filled
+ *
+ * The record is given in two parts, its header and data. Records are never
+ * split, if it doesn't fit, the frame so far is sent first.
+ *
+ * @param[in,out] f       The framer
+ * @param[in]     header  First part of the record
+ * @param[in]     hlength Bytes in `header`
+ * @param[in]     data    Second part of the record, may be NULL if `dlength` is 0
+ * @param[in]     dlength Bytes in `data`
+ * @return Returns LQ_OK, or LQ_SIZE_ERR if the record is bigger than FRAME_PAYLOAD
+ **/
+Log_status_t frame_add(Frame_t *f, const uint8_t *header, size_t hlength,
+                       const uint8_t *data, size_t dlength);
+
+/**
+ * @brief Send the frame being filled, if it has any records
+ *
+ * @param[in,out] f The framer
+ **/
+void frame_flush(Frame_t *f);
+
+/**
+ * @brief Clear a reader's state and counts
+ *
+ * @param[out] r        The reader
+ * @param[in]  complete Nonzero if frame_next() will be given the whole
+ *                      stream, so nothing more will arrive
+ **/
+void frame_reader_init(Frame_reader_t *r, uint8_t complete);
+
+/**
+ * @brief Find the next good frame in a buffer
+ *
+ * Scans from `*pos`, skipping (and counting) anything that isn't a good
+ * frame, and leaves `*pos` after the frame found. Gaps in the sequence are
+ * counted as lost frames.
+ *
+ * @param[in,out] r      The reader
+ * @param[in]     buf    Received bytes
+ * @param[in]     length Bytes in `buf`
+ * @param[in,out] pos    Where to start, updated past what has been read
+ * @param[out]    frame  The frame found
+ * @return Returns LQ_OK if a frame was found, LQ_NULL for a NULL pointer, or
+ *         LQ_EMPTY if there is no whole frame left, with `*pos` on where the
+ *         next may begin once more bytes arrive (unless `complete`)
+ **/
+Log_status_t frame_next(Frame_reader_t *r, const uint8_t *buf, size_t length, size_t *pos,
+                        Frame_info_t *frame);
+
+#endif /* __FRAME_H__ */
@@ -4,11 +4,20 @@
  *
  * Functions for initializing and configuring a GPIO port.
  *
+ * On the KL25Z, pin writes are inlined single stores to the fast GPIO (FGPIO)
+ * alias on the Cortex-M0+ single-cycle I/O port. On HOST/BBB, pin changes drive
+ * the simulated nRF module and are recorded in a trace that can be saved as a
+ * VCD file for a waveform viewer.
+ *
  * @author Jeff Schornick
  * @date 2017/07/31
  **/
 
+#ifndef __GPIO_H__
+#define __GPIO_H__
+
 #include <stdint.h>
+#include <stddef.h>
 #include "platform.h"
 
 /**
@@ -33,6 +42,11 @@ void gpio_nrf_init(void);
  **/
 void gpio_spi_init(void);
 
+#ifdef KL25Z
+
+/* The FGPIO alias of a GPIO port, a constant when `gpio` is */
+#define GPIO_FAST(gpio) ((FGPIO_Type *) ((uint32_t) (gpio) - GPIOA_BASE + FGPIOA_BASE))
+
 /**
  * @brief Raise a GPIO pin high, logic "1"
  *
@@ -40,7 +54,10 @@ void gpio_spi_init(void);
  * @param [in] pin  The pin on the port to raise high
  * @return Nothing returned.
  **/
-void gpio_high(GPIO_Type *gpio, uint8_t pin);
+__attribute__((always_inline)) static inline void gpio_high(GPIO_Type *gpio, uint8_t pin)
+{
+  GPIO_FAST(gpio)->PSOR = (1<<pin);  // set (high)
+}
 
 /**
  * @brief Bring a GPIO pin low, logic "0"
@@ -49,4 +66,77 @@ void gpio_high(GPIO_Type *gpio, uint8_t pin);
  * @param [in] pin  The pin on the port to bring low
  * @return Nothing returned.
  **/
+__attribute__((always_inline)) static inline void gpio_low(GPIO_Type *gpio, uint8_t pin)
+{
+  GPIO_FAST(gpio)->PCOR = (1<<pin);  // clear (low)
+}
+
+#else /* HOST/BBB */
+
+/* Number of pin transitions kept, older ones are overwritten */
+#define GPIO_TRACE_SIZE (1024)
+
+/* Highest pin number that can be traced */
+#define GPIO_TRACE_PINS (8)
+
+/* A recorded pin transition */
+typedef struct {
+  uint64_t time;   /* Simulated time, ns */
+  uint8_t pin;
+  uint8_t level;
+} GPIO_trace_t;
+
+/**
+ * @brief Raise a GPIO pin high, logic "1"
+ *
+ * @param [in] gpio The name of the fake pin
+ * @param [in] pin  The pin number
+ * @return Nothing returned.
+ **/
+void gpio_high(GPIO_Type *gpio, uint8_t pin);
+
+/**
+ * @brief Bring a GPIO pin low, logic "0"
+ *
+ * @param [in] gpio The name of the fake pin
+ * @param [in] pin  The pin number
+ * @return Nothing returned.
+ **/
 void gpio_low(GPIO_Type *gpio, uint8_t pin);
+
+/**
+ * @brief Discard all recorded pin transitions
+ *
+ * @return Nothing returned.
+ **/
+void gpio_trace_clear(void);
+
+/**
+ * @brief Return the number of pin transitions held in the trace
+ *
+ * @return Returns the number of transitions, at most GPIO_TRACE_SIZE
+ **/
+size_t gpio_trace_count(void);
+
+/**
+ * @brief Return a recorded pin transition
+ *
+ * @param[in] index The transition to return, 0 is the oldest held
+ * @return Returns a pointer to the transition, or NULL if out of range
+ **/
+const GPIO_trace_t *gpio_trace_get(size_t index);
+
+/**
+ * @brief Write the trace as a Value Change Dump
+ *
+ * Each traced pin becomes a 1-bit wire named after the pin, with a 1 ns
+ * timescale. Pins are undefined until their first recorded transition.
+ *
+ * @param[in] filename The VCD file to create
+ * @return Returns 0 on success, -1 if the file could not be written
+ **/
+int8_t gpio_trace_write_vcd(const char *filename);
+
+#endif
+
+#endif /* __GPIO_H__ */
@@ -43,8 +43,98 @@ void print_int(int32_t val);
 
 void print_int_pad(int32_t val, uint8_t padsize);
 
+/**
+ * @brief Copy waiting input into a null-terminated string
+ *
+ * Never blocks. Copies at most `maxlen`-1 characters of input that has
+ * already arrived.
+ *
+ * @param[out] str    Where to store the input
+ * @param[in]  maxlen The size of `str`, including the null terminator
+ * @return The number of characters copied, zero if none were waiting
+ **/
 size_t read_str(char *str, size_t maxlen);
 
+/**
+ * @brief Pull waiting input into the input buffer
+ *
+ * Takes as much input as the buffer has room for, in one large read, without
+ * blocking. On Linux, input comes from standard input or from the file opened
+ * with io_input_open(). On a bare-metal MCU, it comes from the serial port.
+ *
+ * @return The number of bytes added to the input buffer
+ **/
+size_t io_input_read(void);
+
+/**
+ * @brief Get the oldest contiguous span of buffered input
+ *
+ * The span can be used in place. It stays valid until io_input_consume() or
+ * the next io_input_read(). Buffered input may come in two spans when it
+ * wraps around the end of the buffer.
+ *
+ * @param[out] span Set to the start of the span
+ * @return The length of the span, zero if no input is buffered
+ **/
+size_t io_input_span(uint8_t **span);
+
+/**
+ * @brief Release input returned by io_input_span()
+ *
+ * @param[in] len The number of bytes used, at most the span length
+ * @return Nothing returned
+ **/
+void io_input_consume(size_t len);
+
+/**
+ * @brief Check for the end of the input stream
+ *
+ * @return Non-zero once the input has ended and all of it has been consumed
+ **/
+uint8_t io_input_eof(void);
+
+#ifndef KL25Z
+
+/**
+ * @brief Read input from a file or FIFO instead of standard input
+ *
+ * Lets recorded input be replayed. Opening a FIFO waits for a writer, so that
+ * an early read doesn't report the end of input.
+ *
+ * @param[in] path The file to read
+ * @return The new input file descriptor, or -1 if `path` could not be opened
+ **/
+int io_input_open(const char *path);
+
+/**
+ * @brief Get the input file descriptor, for polling
+ *
+ * @return The file descriptor read by io_input_read()
+ **/
+int io_input_fd(void);
+
+/* Output that could not be written */
+typedef struct {
+  uint32_t errors;     /* Failed write(2) calls         */
+  size_t dropped;      /* Bytes given up on             */
+  int last_error;      /* errno of the latest failure   */
+} IO_stats_t;
+
+extern IO_stats_t io_stats;
+
+/**
+ * @brief Write out all buffered output, at exit
+ *
+ * Unlike io_flush(), also writes a partial block to an O_DIRECT standard
+ * output, by dropping O_DIRECT first. Reports any output that was dropped on
+ * standard error. Registered with atexit() when output starts.
+ *
+ * @return Nothing returned
+ **/
+void io_finish(void);
+
+#endif
+
 /**
  * @brief Send a character to the output device
  *
@@ -61,6 +151,9 @@ void printchar(uint8_t chr);
 /**
  * @brief Flush the I/O device
  *
+ * On Linux, an O_DIRECT standard output is only written in whole blocks and
+ * keeps the rest buffered until io_finish().
+ *
  * @return Nothing returned
  **/
 void io_flush(void);
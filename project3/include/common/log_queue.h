@@ -4,6 +4,19 @@
  *
  * Fixed size log buffer?
  *
+ * As with the circular buffer, storage comes from the arena (lq_init) or is a
+ * static array declared with LQ_STORAGE (lq_init_static), in its own
+ * .bss.ring.<name> section.
+ *
+ * On Linux, lq_init_mapped() maps the storage twice, back to back (see
+ * ring_map.h), so items are copied on and off in one piece even where they
+ * wrap.
+ *
+ * The producer only writes the head and `added`, and the consumer only the
+ * tail and `removed`, so with a single producer, lq_add_spsc() and the
+ * consumer's lq_peek() and lq_remove() need no lock (see atomics.h). lq_add()
+ * masks interrupts to serialize producers in different contexts.
+ *
  * @author Jeff Schornick
  * @date 2017/07/23
  **/
@@ -22,9 +35,28 @@ typedef struct
   volatile uint8_t *head;   /* Points to the latest log item */
   volatile uint8_t *tail;   /* Points to the the first log item */
   size_t size;     /* Total amount of log data (bytes) */
-  volatile size_t free;     /* Number of free bytes in the queue */
+  volatile size_t added;    /* Bytes ever added, only written by the producer */
+  volatile size_t removed;  /* Bytes ever removed, only written by the consumer */
+  uint16_t seq;             /* Sequence number for the next item added */
+#ifndef KL25Z
+  uint8_t mapped;           /* Storage is from ring_map() */
+#endif
 } Log_q;
 
+#ifdef KL25Z
+#define LQ_MAPPED(queue) (0)
+#else
+#define LQ_MAPPED(queue) ((queue)->mapped)
+#endif
+
+/* Bytes of log data on the queue, and the space left */
+#define lq_used(queue) ((size_t) ((queue)->added - (queue)->removed))
+#define lq_free(queue) ((queue)->size - lq_used(queue))
+
+/* Declare static storage for a queue of `size` bytes, aligned to `align` */
+#define LQ_STORAGE(name, size, align) \
+  uint8_t name[size] __attribute__((aligned(align), section(".bss.ring." #name)))
+
 typedef enum
 {
   LQ_FALSE = 0, /* Buffer test was not true */
@@ -56,6 +88,33 @@ typedef enum
  **/
 Log_status_t lq_init(Log_q *queue, size_t size);
 
+/**
+ * @brief Initialize a log queue over existing storage
+ *
+ * As lq_init(), but the queue uses `storage` (usually declared with
+ * LQ_STORAGE) instead of allocating. lq_destroy() leaves the storage alone.
+ *
+ * @param[in,out] queue   A pointer to a log queue record
+ * @param[in]     storage Space for `size` bytes
+ * @param[in]     size    The number of bytes reserved for the log queue
+ * @return Returns LQ_OK after successful initialization, otherwise an error status
+ **/
+Log_status_t lq_init_static(Log_q *queue, uint8_t *storage, size_t size);
+
+#ifndef KL25Z
+/**
+ * @brief Initialize a log queue over storage mapped twice
+ *
+ * As lq_init(), but the storage comes from ring_map(), and `size` is rounded
+ * up to a whole number of pages.
+ *
+ * @param[in,out] queue A pointer to a log queue record
+ * @param[in]     size  The least number of bytes reserved for the log queue
+ * @return Returns LQ_OK after successful initialization, otherwise an error status
+ **/
+Log_status_t lq_init_mapped(Log_q *queue, size_t size);
+#endif
+
 /**
  * @brief Destroy (deallocate) an existing log queue
  *
@@ -75,12 +134,42 @@ Log_status_t lq_destroy(Log_q *queue);
  * If the buffer is already full, the item will not be added and LQ_FULL will be
  * returned.
  *
+ * The item's `seq` is set from the queue's sequence counter. Dropped items use
+ * up a number too, so gaps in the sequence show where logs were lost.
+ *
+ * Safe to call from any context, interrupts are masked while the item is
+ * copied.
+ *
  * @param[in,out] queue A pointer to an initialized log queue
  * @param[in]     item  Pointer to the log item to add
  * @return Returns LQ_OK if item is successfully added, otherwise and error status
  **/
 Log_status_t lq_add(Log_q *queue, Log_t *item);
 
+/**
+ * @brief Add a log item to a queue with a single producer
+ *
+ * As lq_add(), without masking interrupts. Only for queues that are never
+ * added to from two contexts at once, like a queue per interrupt priority.
+ *
+ * @param[in,out] queue A pointer to an initialized log queue
+ * @param[in]     item  Pointer to the log item to add
+ * @return Returns LQ_OK if item is successfully added, otherwise and error status
+ **/
+Log_status_t lq_add_spsc(Log_q *queue, Log_t *item);
+
+/**
+ * @brief Read the header of the oldest item without removing it
+ *
+ * Copies the header of the item at the tail into `item`. The data pointer
+ * and the queued data are left untouched.
+ *
+ * @param[in]  queue A pointer to an initialized log queue
+ * @param[out] item  Where to store the header
+ * @return Returns LQ_OK, LQ_EMPTY if there is no item, or LQ_NULL
+ **/
+Log_status_t lq_peek(Log_q *queue, Log_t *item);
+
 /**
  * @brief Remove an item from the log queue
  *
@@ -112,7 +201,7 @@ __attribute__((always_inline)) static inline Log_status_t lq_empty(Log_q *queue)
   if( queue == NULL ) {
     return LQ_NULL;
   }
-  if( queue->free != queue->size )
+  if( queue->added != queue->removed )
   {
     return LQ_FALSE;
   }
@@ -135,7 +224,7 @@ __attribute__((always_inline)) static inline Log_status_t lq_full(Log_q *queue)
   if( queue == NULL ) {
     return LQ_NULL;
   }
-  if( queue->free != 0 )
+  if( lq_used(queue) != queue->size )
   {
     return LQ_FALSE;
   }
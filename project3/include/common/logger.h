@@ -2,6 +2,19 @@
  * @file logger.h
  * @brief Logger function declarations
  *
+ * Logs are queued and written out later by log_flush(). Building with
+ * LOG_SHARDS gives each producer its own queue, so producers never contend for
+ * the same queue: one queue per thread on Linux, and one per interrupt
+ * priority level on the KL25Z (shard 0 is thread mode). log_flush() merges
+ * the shards by timestamp, so the output is still in time order. The NMI and
+ * HardFault handlers preempt every priority, so a sharded KL25Z build drops
+ * their logs rather than share a shard. Faults are kept by crash_log.h.
+ *
+ * On Linux the queues are lock-free multi-producer queues (log_mpsc.h), so any
+ * thread may log at once. Only one thread may flush at a time. A log that is
+ * still being written holds back the later logs of its queue until the next
+ * flush.
+ *
  * @author Jeff Schornick
  * @date 2017/07/27
 **/
@@ -11,6 +24,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "coroutine.h"
 
 typedef enum
 {
@@ -52,17 +66,35 @@ typedef struct
   Log_id_t id;    /* log type */
   Log_data_t type;  /* log data type */
   uint32_t time;    /* time in seconds */
-  uint32_t ms;    /* time in ms */
+  uint32_t us;    /* microseconds into that second */
+  uint8_t shard;  /* queue the log was added to */
+  uint16_t seq;   /* count of logs added to that queue, including drops */
   size_t length;  /* length of data */
   uint8_t *data;  /* log data of `length` bytes */
 } __attribute__((packed)) Log_t;
 
 #define LOG_HEADER_SIZE (sizeof(Log_t) - sizeof(uint8_t *))
 
+/* Name of each log id, as the ASCII log prints it */
+extern const char *log_id_str[];
+
+/* One log output per build, the makefile's LOG_OUT_BINARY default has to be
+   commented out to pick another */
+#if defined(LOG_OUT_NULL) + defined(LOG_OUT_ASCII) + defined(LOG_OUT_BINARY) + \
+    defined(LOG_OUT_FILE) + defined(LOG_OUT_LZ) + defined(LOG_OUT_FRAMED) > 1
+#error "Define only one of LOG_OUT_NULL/ASCII/BINARY/FILE/LZ/FRAMED"
+#endif
+
 #if defined(LOG_OUT_NULL)
 #define LOG_OUT(x)
 #elif defined(LOG_OUT_BINARY)
 #define LOG_OUT(x) log_send_binary(x)
+#elif defined(LOG_OUT_FILE)
+#define LOG_OUT(x) log_send_file(x)
+#elif defined(LOG_OUT_LZ)
+#define LOG_OUT(x) log_send_lz(x)
+#elif defined(LOG_OUT_FRAMED)
+#define LOG_OUT(x) log_send_framed(x)
 #else
 #define LOG_OUT(x) log_send_ascii(x)
 #endif
@@ -95,6 +127,12 @@ void log_val(Log_id_t, int32_t val, char *name);
 void log_info(const char *str);
 void log_flush(void);
 
+/* Flush the queue one log per call, done once the queue is empty */
+CR_status_t log_flush_cr(CR_t *cr);
+
+/* Log how the arena has been used */
+void log_mem_stats(void);
+
 #ifdef DISABLE_LOG
 #define LOGGING_INIT()
 #define LOG_ITEM(...)
@@ -122,6 +160,18 @@ void log_flush(void);
 
 void log_send_ascii(Log_t *log);
 void log_send_binary(Log_t *log);
+#ifdef LOG_OUT_LZ
+/* Binary records, compressed (see lz.h) */
+void log_send_lz(Log_t *log);
+#endif
+#ifdef LOG_OUT_FRAMED
+/* Binary records, in CRC-checked frames (see frame.h) */
+void log_send_framed(Log_t *log);
+#endif
+#ifdef LOG_OUT_FILE
+/* Binary records into the memory-mapped file LOG_OUT_FILE (see log_file.h) */
+void log_send_file(Log_t *log);
+#endif
 
 
 #endif /* __LOGGER_H__ */
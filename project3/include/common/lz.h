@@ -0,0 +1,110 @@
+/**
+ * @file lz.h
+ * @brief Streaming LZ compression of the binary log, in framed blocks
+ *
+ * An LZ4-style compressor small enough for the KL25Z. Input is cut into
+ * blocks of up to LZ_BLOCK bytes, and matches reach back up to LZ_WINDOW
+ * bytes, into earlier blocks too. Each block goes to the output function as
+ * one frame:
+ *
+ *   uint16_t raw;      bytes of input in the block, LZ_STORED set if the
+ *                      payload is the input itself (it didn't compress)
+ *   uint16_t length;   bytes of payload
+ *   payload
+ *
+ * both little-endian. A compressed payload is a run of sequences, each a
+ * token byte (literal count in the high nibble, match length - LZ_MIN_MATCH in
+ * the low nibble, 15 meaning more follows in bytes of 255 and a last byte
+ * under 255), the literals, and a 2-byte little-endian match offset. The last
+ * sequence of a block has literals only. script/binlog.py decodes it.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#ifndef __LZ_H__
+#define __LZ_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* History matches can reach back into */
+#ifndef LZ_WINDOW
+#define LZ_WINDOW (1024)
+#endif
+
+/* Most input in one frame */
+#ifndef LZ_BLOCK
+#define LZ_BLOCK (256)
+#endif
+
+/* Positions remembered, 2 bytes each, by a hash of the 4 bytes there */
+#ifndef LZ_HASH_BITS
+#ifdef KL25Z
+#define LZ_HASH_BITS (8)
+#else
+#define LZ_HASH_BITS (12)
+#endif
+#endif
+
+#define LZ_MIN_MATCH (4)
+#define LZ_STORED (0x8000)
+#define LZ_FRAME_HEADER (4)
+/* Largest frame, a stored block */
+#define LZ_FRAME_MAX (LZ_FRAME_HEADER + LZ_BLOCK)
+
+typedef struct
+{
+  void (*out)(uint8_t *data, size_t length); /* Takes each frame */
+  uint16_t start;     /* Start of the block being filled in `buf` */
+  uint16_t fill;      /* End of the input in `buf` */
+  uint8_t buf[LZ_WINDOW + LZ_BLOCK];      /* History, then the block */
+  uint16_t hash[1 << LZ_HASH_BITS];       /* Last position of each hash */
+  uint8_t frame[LZ_FRAME_MAX];            /* Frame being built */
+} LZ_t;
+
+/**
+ * @brief Start a compressed stream
+ *
+ * @param[out] lz  The compressor
+ * @param[in]  out Function given each frame, e.g. print_n()
+ **/
+void lz_init(LZ_t *lz, void (*out)(uint8_t *data, size_t length));
+
+/**
+ * @brief Add data to the stream
+ *
+ * Frames are sent as blocks fill up.
+ *
+ * @param[in,out] lz     The compressor
+ * @param[in]     data   Data to compress
+ * @param[in]     length Bytes of data
+ **/
+void lz_write(LZ_t *lz, const uint8_t *data, size_t length);
+
+/**
+ * @brief Send what has been added so far as a frame
+ *
+ * Later data can still match data from before the flush.
+ *
+ * @param[in,out] lz The compressor
+ **/
+void lz_flush(LZ_t *lz);
+
+/**
+ * @brief Decompress the payload of one compressed frame
+ *
+ * Matches may refer to the `history` bytes already decoded before `dst`,
+ * which must include the LZ_WINDOW bytes before the frame (or the whole
+ * stream so far, if shorter).
+ *
+ * @param[in]  src     Payload
+ * @param[in]  length  Bytes of payload
+ * @param[out] dst     Output, room for `raw` bytes
+ * @param[in]  history Bytes decoded before `dst`
+ * @param[in]  raw     Bytes of input in the block, from the frame header
+ * @return Returns `raw`, or 0 if the payload is corrupt
+ **/
+size_t lz_decompress(const uint8_t *src, size_t length, uint8_t *dst, size_t history, size_t raw);
+
+#endif /* __LZ_H__ */
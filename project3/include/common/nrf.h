@@ -9,12 +9,17 @@
  * @date 2017/07/31
  **/
 
+#ifndef __NRF_H__
+#define __NRF_H__
+
 #include <stdint.h>
+#include <stddef.h>
+#include "coroutine.h"
 
 #define NRF_CMD_READ           (0x00)  /* Read register    */
 #define NRF_CMD_WRITE          (0x20)  /* Write to regiser */
 #define NRF_CMD_RX_PAYLOAD     (0x61)  /* Read RX payload  */
-#define NRF_CMD_TX_PAYLOAD     (0x90)  /* Write TX payload */
+#define NRF_CMD_TX_PAYLOAD     (0xA0)  /* Write TX payload */
 #define NRF_CMD_FLUSH_TX       (0xE1)  /* Flush TX FIFO    */
 #define NRF_CMD_FLUSH_RX       (0xE2)  /* Flush RX FIFO    */
 #define NRF_CMD_REUSE_TX_PL    (0xE3)  /* Reuse last TX payload */
@@ -26,11 +31,32 @@
 #define NRF_CMD_NOP            (0xFF)  /* No operation. Can be used to read status. */
 
 #define NRF_REG_CONFIG         (0x00)  /* Configuration register     */
+#define NRF_REG_EN_AA          (0x01)  /* Enable auto-ACK per pipe   */
+#define NRF_REG_EN_RXADDR      (0x02)  /* Enable RX pipes            */
+#define NRF_REG_SETUP_AW       (0x03)  /* Address width              */
+#define NRF_REG_SETUP_RETR     (0x04)  /* Auto retransmit setup      */
 #define NRF_REG_RF_CH          (0x05)  /* RF Channel register        */
 #define NRF_REG_RF_SETUP       (0x06)  /* RF Setup register5         */
 #define NRF_REG_STATUS         (0x07)  /* Status register            */
+#define NRF_REG_OBSERVE_TX     (0x08)  /* Lost/retransmitted packets */
+#define NRF_REG_RPD            (0x09)  /* Received power detector    */
+#define NRF_REG_RX_ADDR_P0     (0x0A)  /* Pipe 0 address (5-bytes)  */
+#define NRF_REG_RX_ADDR_P1     (0x0B)  /* Pipe 1 address (5-bytes)  */
+#define NRF_REG_RX_ADDR_P2     (0x0C)  /* Pipe 2-5 address LSB      */
 #define NRF_REG_TX_ADDR        (0x10)  /* Transmit address (5-bytes) */
+#define NRF_REG_RX_PW_P0       (0x11)  /* Pipe 0-5 static width (0x11-0x16) */
 #define NRF_REG_FIFO_STATUS    (0x17)  /* FIFO Status register       */
+#define NRF_REG_DYNPD          (0x1C)  /* Dynamic payload per pipe   */
+#define NRF_REG_FEATURE        (0x1D)  /* Feature register           */
+
+#define NRF_ADDR_SIZE          (5)     /* Bytes in a full address    */
+#define NRF_MAX_PAYLOAD        (32)    /* Largest single payload     */
+#define NRF_NUM_PIPES          (6)     /* Number of RX data pipes    */
+#define NRF_TX_FIFO_DEPTH      (3)     /* Payloads held in TX FIFO   */
+#define NRF_RX_FIFO_DEPTH      (3)     /* Payloads held in RX FIFO   */
+
+/* Received payloads buffered by the driver until nrf_receive() */
+#define NRF_RX_QUEUE_DEPTH     (4)
 
 
 /*** CONFIG Register 0x00 ***/
@@ -39,8 +65,8 @@
 #define NRF_CNF_MASK_RX_DR(x)    (x<<6)
 #define NRF_CNF_MASK_TX_DS_MASK  (1<<5)  /* Mask interrupt from TX_DS  */
 #define NRF_CNF_MASK_TX_DS(x)    (x<<5)
-#define NRF_CNF_MASK_MAX_RT_MASK (1<<5)  /* Mask interrupt from MAX_RT */
-#define NRF_CNF_MASK_MAX_RT(x)   (x<<5)
+#define NRF_CNF_MASK_MAX_RT_MASK (1<<4)  /* Mask interrupt from MAX_RT */
+#define NRF_CNF_MASK_MAX_RT(x)   (x<<4)
 #define NRF_CNF_EN_CRC_MASK      (1<<3)  /* Enable CRC                 */
 #define NRF_CNF_EN_CRC(x)        (x<<3)
 #define NRF_CNF_CRCO_MASK        (1<<2)  /* CRC encoding, 0:1-byte, 1:2-bytes */
@@ -51,9 +77,17 @@
 #define NRF_CNF_PRIM_RX(x)       (x<<0)
 
 
+/*** SETUP_RETR Register 0x04 ***/
+
+#define NRF_RETR_ARD_MASK        (0xf<<4)  /* Retransmit delay, (x+1)*250us */
+#define NRF_RETR_ARD(x)          (x<<4)
+#define NRF_RETR_ARC_MASK        (0xf)     /* Retransmit count, 0:disabled  */
+#define NRF_RETR_ARC(x)          (x)
+
+
 /*** RF_CH (RF Channel) Register 0x05 ***/
 
-#define NRF_RFCH_RF_CH_MASK      (0x3d)  /* RF channel frequency */
+#define NRF_RFCH_RF_CH_MASK      (0x7f)  /* RF channel frequency */
 #define NRF_RFCH_RF_CH(x)          (x)
 
 
@@ -82,6 +116,12 @@
 #define NRF_STAT_TX_FULL_MASK    (   1)  /* TX FIFO full flag */
 #define NRF_STAT_TX_FULL(x)      (   x)
 
+/* All interrupt flags, cleared by writing 1 */
+#define NRF_STAT_IRQ_MASK        (NRF_STAT_RX_DR_MASK|NRF_STAT_TX_DS_MASK|NRF_STAT_MAX_RT_MASK)
+/* RX_P_NO value when the RX FIFO is empty */
+#define NRF_STAT_RX_P_NO_EMPTY   (7)
+#define NRF_STAT_PIPE(status)    (((status) & NRF_STAT_RX_P_NO_MASK) >> 1)
+
 
 /*** FIFO_STATUS Register 0x17 ***/
 
@@ -97,6 +137,158 @@
 #define NRF_FS_RX_EMPTY(x)        (   x)
 
 
+/*** DYNPD Register 0x1C ***/
+
+#define NRF_DYNPD_ALL_MASK        (0x3f)  /* Dynamic payload, all pipes */
+
+
+/*** FEATURE Register 0x1D ***/
+
+#define NRF_FEAT_EN_DPL_MASK      (1<<2)  /* Enable dynamic payload length */
+#define NRF_FEAT_EN_DPL(x)        (x<<2)
+#define NRF_FEAT_EN_ACK_PAY_MASK  (1<<1)  /* Enable payload with ACK       */
+#define NRF_FEAT_EN_ACK_PAY(x)    (x<<1)
+#define NRF_FEAT_EN_DYN_ACK_MASK  (   1)  /* Enable W_TX_PAYLOAD_NOACK     */
+#define NRF_FEAT_EN_DYN_ACK(x)    (   x)
+
+
+typedef enum
+{
+  NRF_OK = 0,    /* Operation successful */
+  NRF_FULL,      /* TX FIFO full, payload was not queued */
+  NRF_SIZE_ERR,  /* Payload empty or longer than NRF_MAX_PAYLOAD */
+  NRF_EMPTY,     /* No received payload available */
+  NRF_MAX_RT     /* Retransmit limit reached, packet was dropped */
+} NRF_status_t;
+
+
+/* Count of SPI transactions (chip select cycles) and register cache hits */
+typedef struct {
+  uint32_t transactions;
+  uint32_t cache_hits;
+  uint32_t tx_packets;  /* Payloads written to the TX FIFO          */
+  uint32_t rx_packets;  /* Payloads read from the RX FIFO           */
+  uint32_t rx_dropped;  /* Payloads lost because the queue was full */
+  uint32_t max_rt;      /* Transmissions abandoned after MAX_RT     */
+} NRF_stats_t;
+
+extern NRF_stats_t nrf_stats;
+
+/* A command transaction run as a coroutine, see nrf_command_cr() */
+typedef struct {
+  CR_t cr;
+  uint8_t *rx;                        /* Where the reply is copied      */
+  uint8_t length;                     /* Data bytes after the command   */
+  uint8_t buf[1 + NRF_MAX_PAYLOAD];   /* Command and data, then reply   */
+  uint8_t status;                     /* STATUS clocked out, once done  */
+} NRF_cmd_t;
+
+/* Draining the RX FIFO into the receive queue, as part of a stream */
+typedef struct {
+  CR_t cr;
+  NRF_cmd_t cmd;
+  uint8_t status;     /* STATUS with the current RX FIFO state     */
+  uint8_t pipe;
+  uint8_t width;
+  uint8_t slot;       /* Receive queue entry, or the depth to drop */
+} NRF_drain_t;
+
+/* A stream transmission run as a coroutine, see nrf_stream_cr() */
+typedef struct {
+  CR_t cr;
+  NRF_cmd_t cmd;
+  NRF_drain_t drain;
+  const uint8_t *data;
+  size_t length;
+  size_t queued;      /* Bytes written to the TX FIFO           */
+  size_t chunk;       /* Bytes in the payload being written     */
+  uint8_t inflight;   /* Upper bound on TX FIFO occupancy       */
+  uint8_t status;
+  uint8_t flags;
+  uint8_t fifo;
+  uint8_t config;     /* CONFIG before powering up                */
+  uint32_t wait;      /* Start of the power up delay, in us       */
+  size_t sent;        /* Result, valid once the coroutine is done */
+} NRF_stream_t;
+
+/* Set from interrupt context when the nRF IRQ line asserts */
+extern volatile uint8_t nrf_irq_pending;
+
+/**
+ * @brief Reset the driver and bring the nRF module to a known state
+ *
+ * Drops CE, clears the register cache and the receive queue, flushes both
+ * FIFOs and clears any pending interrupt flags.
+ *
+ * @return Nothing returned
+ **/
+void nrf_init(void);
+
+/**
+ * @brief Perform a single nRF command transaction
+ *
+ * Sends the command byte `cmd` followed by `length` bytes from `tx` in one
+ * full-duplex SPI transaction, storing the `length` bytes clocked back after
+ * the command at `rx`. A NULL `tx` sends NOPs, a NULL `rx` discards the reply.
+ *
+ * The nRF always clocks out its STATUS register while receiving the command
+ * byte. It is returned here and is also available from nrf_last_status().
+ *
+ * @param[in]  cmd    The command byte (including any register address)
+ * @param[in]  tx     The command data to send, or NULL
+ * @param[out] rx     Storage for the command reply, or NULL
+ * @param[in]  length The number of data bytes, up to NRF_MAX_PAYLOAD
+ * @return Returns the STATUS register value clocked out with the command
+ **/
+uint8_t nrf_command(uint8_t cmd, const uint8_t *tx, uint8_t *rx, size_t length);
+
+/**
+ * @brief Prepare a command transaction to run with nrf_command_cr()
+ *
+ * Arguments are the same as nrf_command(). The data at `tx` is copied, while
+ * `rx` must remain valid until the command is done.
+ *
+ * @param[out] c      The command to prepare
+ * @param[in]  cmd    The command byte (including any register address)
+ * @param[in]  tx     The command data to send, or NULL
+ * @param[out] rx     Storage for the command reply, or NULL
+ * @param[in]  length The number of data bytes, up to NRF_MAX_PAYLOAD
+ * @return Nothing returned
+ **/
+void nrf_command_start(NRF_cmd_t *c, uint8_t cmd, const uint8_t *tx, uint8_t *rx, size_t length);
+
+/**
+ * @brief Run a command transaction as a coroutine
+ *
+ * Waits for the SPI bus, then yields while the transfer is in progress. Once
+ * done, `c->status` holds the STATUS register clocked out with the command.
+ *
+ * @param[in,out] c The command, prepared with nrf_command_start()
+ * @return Returns the coroutine status, CR_ENDED when the command is done
+ **/
+CR_status_t nrf_command_cr(NRF_cmd_t *c);
+
+/**
+ * @brief Return the STATUS captured by the most recent command
+ *
+ * No SPI transaction is performed. The value may be out of date if the radio
+ * has changed state since the last command was issued.
+ *
+ * @return Returns the last captured 8-bit STATUS register value
+ **/
+uint8_t nrf_last_status(void);
+
+/**
+ * @brief Discard all cached nRF register values
+ *
+ * CONFIG, RF_SETUP, RF_CH, TX_ADDR and RX_PW_Px are only changed by the host, so
+ * their values are shadowed after the first read or write. The cache must be
+ * invalidated if the module is reset or power-cycled behind the driver's back.
+ *
+ * @return Nothing returned
+ **/
+void nrf_cache_invalidate(void);
+
 /**
  * @brief Read an nRF register and return the value
  *
@@ -228,3 +420,137 @@ void nrf_flush_tx_fifo(void);
  * @return Nothing returned.
  **/
 void nrf_flush_rx_fifo(void);
+
+/**
+ * @brief Enable dynamic payload length on all pipes
+ *
+ * Sets EN_DPL in FEATURE and enables every pipe in DYNPD, so that payloads of
+ * 1 to 32 bytes can be sent and their length recovered with R_RX_PL_WID.
+ * Optionally enables ACK payloads as well.
+ *
+ * @param[in] ack_payloads Nonzero to also enable payloads with ACK
+ * @return Nothing returned
+ **/
+void nrf_enable_dynamic_payloads(uint8_t ack_payloads);
+
+/**
+ * @brief Power up in primary receiver mode and start listening
+ *
+ * @return Nothing returned
+ **/
+void nrf_start_rx(void);
+
+/**
+ * @brief Return to standby by dropping CE
+ *
+ * @return Nothing returned
+ **/
+void nrf_standby(void);
+
+/**
+ * @brief Queue a single payload in the TX FIFO
+ *
+ * Writes `length` bytes from `data` with W_TX_PAYLOAD. The payload is sent
+ * once the module is in TX mode with CE high (see nrf_send_stream()).
+ *
+ * The STATUS returned with the command shows the FIFO state before the write.
+ * If the FIFO was already full the payload is discarded and NRF_FULL is
+ * returned.
+ *
+ * @param[in] data   The payload to send
+ * @param[in] length The number of bytes in the payload (1-32)
+ * @return Returns NRF_OK if queued, otherwise an error status
+ **/
+NRF_status_t nrf_write_payload(const uint8_t *data, size_t length);
+
+/**
+ * @brief Queue a payload to return with the next ACK on `pipe`
+ *
+ * Requires ACK payloads to be enabled with nrf_enable_dynamic_payloads().
+ *
+ * @param[in] pipe   The RX pipe the ACK payload belongs to (0-5)
+ * @param[in] data   The payload to attach to the ACK
+ * @param[in] length The number of bytes in the payload (1-32)
+ * @return Returns NRF_OK if queued, otherwise an error status
+ **/
+NRF_status_t nrf_write_ack_payload(uint8_t pipe, const uint8_t *data, size_t length);
+
+/**
+ * @brief Send a buffer as a stream of back-to-back packets
+ *
+ * Splits `length` bytes into payloads of up to NRF_MAX_PAYLOAD bytes and keeps
+ * the TX FIFO topped up with CE held high, so the radio never waits on SPI
+ * between packets. Free FIFO slots are tracked from TX_DS, so in steady state
+ * each packet costs a payload write, an interrupt flag clear and a STATUS check
+ * before sleeping. ACK payloads received along the way are drained into the
+ * receive queue.
+ *
+ * Payloads shorter than NRF_MAX_PAYLOAD require dynamic payload length.
+ *
+ * @param[in] data   The data to send
+ * @param[in] length The number of bytes to send
+ * @return Returns the number of bytes delivered. If the retransmit limit is
+ *         reached, the TX FIFO is flushed and the bytes in packets that had
+ *         left it are counted. That is exact unless the FIFO held one or two
+ *         packets and missed TX_DS flags leave it unclear which, then it is a
+ *         lower bound, short by at most one packet.
+ **/
+size_t nrf_send_stream(const uint8_t *data, size_t length);
+
+/**
+ * @brief Prepare a stream transmission to run with nrf_stream_cr()
+ *
+ * @param[out] s      The stream to prepare
+ * @param[in]  data   The data to send, must remain valid until done
+ * @param[in]  length The number of bytes to send
+ * @return Nothing returned
+ **/
+void nrf_stream_start(NRF_stream_t *s, const uint8_t *data, size_t length);
+
+/**
+ * @brief Run a stream transmission as a coroutine
+ *
+ * Same as nrf_send_stream(), but returns to the caller while waiting on SPI
+ * transfers and nRF interrupts. Once done, `s->sent` holds the number of bytes
+ * delivered.
+ *
+ * @param[in,out] s The stream, prepared with nrf_stream_start()
+ * @return Returns the coroutine status, done once the stream has been sent
+ **/
+CR_status_t nrf_stream_cr(NRF_stream_t *s);
+
+/**
+ * @brief Signal that the nRF IRQ line has asserted
+ *
+ * Called from the pin interrupt handler. Only sets `nrf_irq_pending`, the SPI
+ * work is deferred to nrf_service().
+ *
+ * @return Nothing returned
+ **/
+void nrf_irq(void);
+
+/**
+ * @brief Service nRF interrupt flags and drain the RX FIFO
+ *
+ * Clears any pending interrupt flags, then reads every payload waiting in the
+ * RX FIFO into the driver receive queue. Uses R_RX_PL_WID when dynamic payload
+ * length is enabled.
+ *
+ * @return Returns the STATUS register value read before clearing the flags
+ **/
+uint8_t nrf_service(void);
+
+/**
+ * @brief Take the oldest received payload from the receive queue
+ *
+ * Calls nrf_service() first if an IRQ is pending. Payloads longer than
+ * `maxlen` are truncated.
+ *
+ * @param[out] data   Storage for the payload
+ * @param[in]  maxlen The size of the storage at `data`
+ * @param[out] pipe   The pipe the payload arrived on, may be NULL
+ * @return Returns the payload length, or 0 if no payload is available
+ **/
+size_t nrf_receive(uint8_t *data, size_t maxlen, uint8_t *pipe);
+
+#endif /* __NRF_H__ */
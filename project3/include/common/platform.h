@@ -70,27 +70,54 @@ void platform_init(void);
 #define NRF_CE_PIN (11)   /* PTC11, J1:15 */
 #define NRF_CE NRF_CE_GPIO, NRF_CE_PIN
 
+/* nRF IRQ output, active low */
+#define NRF_IRQ_PORT (PORTD)
+#define NRF_IRQ_GPIO (GPIOD)
+#define NRF_IRQ_PIN (4)   /* PTD4, J1:6 */
+#define NRF_IRQ_IRQn (PORTD_IRQn)
+
 #if (CLOCK_SETUP == 1)
 #define BUS_CLOCK (24000000) /* 24 MHz */
 #endif
 
 
-/* Backup of PRIMASK before modifying it in critical section */
-extern uint32_t critical_primask;
+/**
+ * @brief Disable interrupts, returning the old PRIMASK
+ *
+ * @return Returns nonzero if interrupts were already disabled
+ **/
+__attribute__((always_inline)) static inline uint32_t critical_enter(void)
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  return primask;
+}
+
+/**
+ * @brief Restore the interrupt state saved by critical_enter()
+ *
+ * @param[in] primask The value critical_enter() returned
+ **/
+__attribute__((always_inline)) static inline void critical_exit(uint32_t primask)
+{
+  if( !primask ) {
+    __enable_irq();
+  }
+}
 
 /**
  * @brief Enter critical section
  *
  * Disables interrupts so that critial section can be completed as one logically
- * atomic unit. The old PRIMASK state is recorded so that we don't enable
- * interrupts if they had previously been disabled.
+ * atomic unit. The old PRIMASK state is kept in a local variable, so sections
+ * nest: only the outermost END_CRITICAL() enables interrupts again.
  *
- * At the end of the critical section, `critical_end()` should be called to
- * restore earlier interrupt state.
+ * Declares that variable, so it can be used once per block, with the matching
+ * END_CRITICAL() calls in the same block or blocks inside it.
  *
  * @return Nothing returned
  **/
-#define START_CRITICAL() critical_primask = __get_PRIMASK(); __disable_irq();
+#define START_CRITICAL() uint32_t critical_primask = critical_enter()
 
 /**
  * @brief Finish critical section
@@ -100,7 +127,32 @@ extern uint32_t critical_primask;
  *
  * @return Nothing returned
  **/
-#define END_CRITICAL() if(!critical_primask) { __enable_irq(); }
+#define END_CRITICAL() critical_exit(critical_primask)
+
+/* Memory placement (see MKL25Z128xxx4_flash.ld)
+ *
+ * RAMFUNC code and FASTDATA data are copied from flash into SRAM_U at reset,
+ * so hot paths run without flash wait states. Out-of-range calls between
+ * flash and SRAM go through linker veneers. RAMFUNC functions are never
+ * inlined, or the inlined copy would run from flash.
+ *
+ * SRAM_L and SRAM_U place zeroed buffers in one bank of SRAM. The core's
+ * stack, data and RAM code are in SRAM_U, so DMA into SRAM_L buffers doesn't
+ * stall it. Build with -DNO_RAMFUNC to run everything from flash, as a
+ * baseline for profile_ramfunc().
+ *
+ * NOINIT data in SRAM_U is neither loaded nor zeroed at startup, so it keeps
+ * its contents over a reset (see crash_log.h). */
+#ifdef NO_RAMFUNC
+#define RAMFUNC
+#define FASTDATA
+#else
+#define RAMFUNC __attribute__((section(".ramfunc"), noinline))
+#define FASTDATA __attribute__((section(".fastdata")))
+#endif
+#define SRAM_L __attribute__((section(".bss.sram_l")))
+#define SRAM_U __attribute__((section(".bss.sram_u")))
+#define NOINIT __attribute__((section(".noinit")))
 
 
 #else /* HOST/BBB */
@@ -109,11 +161,21 @@ extern uint32_t critical_primask;
 #define START_CRITICAL()
 #define END_CRITICAL()
 
+/* One bank of memory, code runs from wherever it is mapped */
+#define RAMFUNC
+#define FASTDATA
+#define SRAM_L
+#define SRAM_U
+#define NOINIT
+
 #define PORT_Type char
 #define GPIO_Type char
 
-#define NRF_CS "nrf_cs",1
-#define NRF_CE "nrf_ce",2
+/* Pins routed to the simulated nRF module by the fake GPIO driver */
+#define NRF_CS_PIN 1
+#define NRF_CS "nrf_cs",NRF_CS_PIN
+#define NRF_CE_PIN 2
+#define NRF_CE "nrf_ce",NRF_CE_PIN
 
 #endif
 
@@ -0,0 +1,136 @@
+/**
+ * @file pool.h
+ * @brief Fixed-block pools and an init-time arena, in place of malloc()
+ *
+ * Nothing in the project uses the C heap. Buffers of a known maximum size
+ * that outlive the call making them come from a fixed-block pool, with
+ * constant-time allocation and no fragmentation. Scratch space for one call
+ * belongs on the stack. Long-lived buffers sized at run time come from the
+ * arena. Those with a fixed size, like the logger and UART queues, are static
+ * (see CB_STORAGE and LQ_STORAGE).
+ *
+ * A pool is defined statically with POOL_DEFINE() and needs no init call, so
+ * it can be used from interrupt handlers (KL25Z) or any thread (Linux).
+ *
+ * The arena hands out space from one static block (ARENA_SIZE bytes). Space
+ * is only returned when the most recent allocation still in use is freed, so
+ * buffers that are created and destroyed in reverse order, as in the tests,
+ * reuse the same space. Anything freed out of order waits until everything
+ * allocated after it has been freed too.
+ *
+ * `make heapcheck` checks that no heap allocator is linked in.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Alignment of every block and arena allocation */
+#define POOL_ALIGN (8)
+
+#ifndef ARENA_SIZE
+#ifdef KL25Z
+/* The firmware's rings are all static, so nothing allocates from the arena
+   at run time. This leaves room for one small ring made with CB_init() while
+   debugging, and costs little of the 16 KB of RAM. */
+#define ARENA_SIZE (256)
+#else
+#define ARENA_SIZE (4 * 1024 * 1024)
+#endif
+#endif
+
+/* Space taken by a block of `size` bytes, which also holds the free link */
+#define POOL_BLOCK_SIZE(size) \
+  ((((size) < sizeof(void *) ? sizeof(void *) : (size)) + POOL_ALIGN - 1) & ~(size_t) (POOL_ALIGN - 1))
+
+typedef struct
+{
+  uint8_t *blocks;       /* Storage for `count` blocks */
+  size_t block_size;     /* Bytes per block, a multiple of POOL_ALIGN */
+  uint16_t count;        /* Number of blocks */
+  uint16_t fresh;        /* Blocks never handed out start here */
+  void *free;            /* Blocks handed back, linked through their first word */
+  uint16_t used;         /* Blocks in use now */
+  uint16_t high_water;   /* Most blocks ever in use at once */
+  uint32_t failures;     /* Allocations refused because all were in use */
+  volatile uint8_t lock; /* Linux only, interrupts are masked on the KL25Z */
+} Pool_t;
+
+typedef struct
+{
+  size_t size;          /* Total arena bytes */
+  size_t used;          /* Bytes held now, including freed ones not yet returned */
+  size_t high_water;    /* Most bytes ever held */
+  uint32_t failures;    /* Allocations refused for lack of space */
+} Arena_stats_t;
+
+extern Arena_stats_t arena_stats;
+
+#define POOL_INIT(storage, size, num) \
+  { .blocks = (storage), .block_size = POOL_BLOCK_SIZE(size), .count = (num) }
+
+/* Define a pool `name` of `num` blocks of at least `size` bytes each */
+#define POOL_DEFINE(name, size, num)                                        \
+  static uint8_t name##_blocks[(num) * POOL_BLOCK_SIZE(size)]               \
+    __attribute__((aligned(POOL_ALIGN)));                                   \
+  Pool_t name = POOL_INIT(name##_blocks, size, num)
+
+/**
+ * @brief Take a block from a pool
+ *
+ * Runs in constant time. Safe to call from interrupt handlers and threads.
+ *
+ * @param[in,out] pool The pool to allocate from
+ * @return Returns the block, or NULL if all blocks are in use
+ **/
+void *pool_alloc(Pool_t *pool);
+
+/**
+ * @brief Return a block to its pool
+ *
+ * Runs in constant time. NULL is ignored.
+ *
+ * @param[in,out] pool  The pool the block was taken from
+ * @param[in]     block The block to return
+ **/
+void pool_free(Pool_t *pool, void *block);
+
+/**
+ * @brief Allocate long-lived storage from the arena
+ *
+ * @param[in] size Bytes needed
+ * @return Returns the storage, aligned to POOL_ALIGN, or NULL if the arena
+ *         doesn't have `size` bytes left
+ **/
+void *arena_alloc(size_t size);
+
+/**
+ * @brief Free storage taken from the arena
+ *
+ * The space is returned at once if this was the latest allocation still in
+ * use, otherwise once every later allocation has been freed. NULL, and
+ * anything outside the arena like static storage, is ignored.
+ *
+ * @param[in] ptr Storage returned by arena_alloc()
+ **/
+void arena_free(void *ptr);
+
+/**
+ * @brief Log the usage statistics of a pool
+ *
+ * @param[in] pool The pool
+ * @param[in] name Name logged ahead of the statistics
+ **/
+void pool_log_stats(Pool_t *pool, const char *name);
+
+/**
+ * @brief Log the usage statistics of the arena
+ **/
+void arena_log_stats(void);
+
+#endif /* __POOL_H__ */
@@ -17,9 +17,8 @@ typedef struct {
   uint8_t *id;
 } Profile_Result_t;
 
-size_t id_length;
-
 extern uint32_t profile_overhead;
+extern uint32_t profile_cycle_overhead;
 
 void profile_calibrate(void);
 
@@ -36,4 +35,18 @@ void profile_calibrate(void);
     LOG_VAL(PROFILING_RESULT, (uint32_t) result , ID);          \
   }
 
+/* As PROFILE(), but in core cycles (nanoseconds on Linux, see get_cycles()) */
+#define PROFILE_CYCLES(ID,CODE,RESULT) {                        \
+    uint64_t start_cycles;                                      \
+    uint64_t end_cycles;                                        \
+    int32_t result;                                             \
+    start_cycles = get_cycles();                                \
+    CODE ;                                                      \
+    end_cycles = get_cycles();                                  \
+    result = end_cycles - start_cycles - profile_cycle_overhead; \
+    result = (result >=0) ? result : 0;                         \
+    *RESULT = result;                                           \
+    LOG_VAL(PROFILING_RESULT, (uint32_t) result , ID);          \
+  }
+
 #endif /* __PROFILE_H__ */
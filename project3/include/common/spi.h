@@ -5,13 +5,44 @@
  * Functions for initializing, configuring, and sending/receiving via a
  * SPI device.
  *
+ * All transfers are full-duplex: every byte clocked out produces a byte
+ * clocked in. The byte-oriented functions are thin wrappers around
+ * spi_transfer(), which keeps the transmitter and receiver in lock-step so
+ * that no received data is left stale in the peripheral.
+ *
  * @author Jeff Schornick
  * @date 2017/07/31
 **/
 
+#ifndef __SPI_H__
+#define __SPI_H__
+
 #include <stdint.h>
 #include <stddef.h>
 
+/* Byte clocked out when a transfer has no transmit data */
+#define SPI_FILL_BYTE (0xFF)
+
+/* Nominal SPI bit rate. On the KL25Z this is the 24MHz bus clock divided by 4,
+   the fake SPI backend uses the same value to model bus time. */
+#define SPI_CLOCK_HZ (6000000u)
+
+/* Time for a single byte on the wire, in nanoseconds */
+#define SPI_BYTE_NS ((8u * 1000000000u) / SPI_CLOCK_HZ)
+
+/* Transfers of at least this many bytes will use DMA (if enabled) */
+#define SPI_DMA_THRESHOLD (8)
+
+/* Bus usage counters, useful for benchmarking drivers built on SPI */
+typedef struct {
+  uint32_t transfers;  /* Number of calls to spi_transfer()        */
+  uint32_t bytes;      /* Total bytes exchanged on the bus          */
+  uint32_t dma;        /* Number of transfers performed through DMA */
+  uint64_t bus_ns;     /* Modeled bus time (fake SPI backend only)  */
+} SPI_stats_t;
+
+extern SPI_stats_t spi_stats;
+
 /**
  * @brief Enable and configure a SPI peripheral
  *
@@ -23,11 +54,96 @@
  **/
 void spi_init(void);
 
+/**
+ * @brief Exchange a block of bytes over the SPI bus (full-duplex)
+ *
+ * Clocks `length` bytes from `tx` out of the SPI device while storing the
+ * `length` bytes clocked in at `rx`. The transmitter is kept one byte ahead of
+ * the receiver so the bus never idles between bytes.
+ *
+ * Either buffer may be NULL: a NULL `tx` sends SPI_FILL_BYTE for every byte,
+ * and a NULL `rx` discards the received data. Since each byte is sent before
+ * it is received, `tx` and `rx` may point to the same buffer. The function returns once the
+ * last byte has been received, so the bus is idle on return.
+ *
+ * When built with SPI_DMA, transfers of at least SPI_DMA_THRESHOLD bytes are
+ * performed by the DMA controller.
+ *
+ * @param[in]  tx     Points to the bytes to send, or NULL
+ * @param[out] rx     Points to storage for the received bytes, or NULL
+ * @param[in]  length The number of bytes to exchange
+ * @return Nothing returned.
+ **/
+void spi_transfer(const uint8_t *tx, uint8_t *rx, size_t length);
+
+/**
+ * @brief Start a full-duplex transfer without waiting for it
+ *
+ * Same as spi_transfer(), except that it returns once the transfer is under
+ * way. The transfer is moved along by spi_poll(), which must be called until
+ * it reports completion before the bus is used again. Both buffers must remain
+ * valid until then.
+ *
+ * @param[in]  tx     Points to the bytes to send, or NULL
+ * @param[out] rx     Points to storage for the received bytes, or NULL
+ * @param[in]  length The number of bytes to exchange
+ * @return Nothing returned.
+ **/
+void spi_start(const uint8_t *tx, uint8_t *rx, size_t length);
+
+/**
+ * @brief Move the transfer started by spi_start() along
+ *
+ * Services the SPI peripheral without blocking.
+ *
+ * @return Returns 1 once the last byte has been received, 0 otherwise
+ **/
+uint8_t spi_poll(void);
+
+/**
+ * @brief Claim the SPI bus for a sequence of transfers
+ *
+ * Coroutines which yield while a transfer is in progress (see coroutine.h)
+ * claim the bus first, so no other sequence can start a transfer or change
+ * the chip select meanwhile. Blocking transfers don't claim the bus and must
+ * not be used while it is claimed.
+ *
+ * @return Returns 1 if the bus was free and is now claimed, 0 otherwise
+ **/
+uint8_t spi_acquire(void);
+
+/**
+ * @brief Release the SPI bus claimed with spi_acquire()
+ *
+ * @return Nothing returned.
+ **/
+void spi_release(void);
+
+/**
+ * @brief Give the device on the bus time while a driver waits for it
+ *
+ * Returns straight away on hardware. The fake backend moves the simulated
+ * device on to its next event, since nothing happens there otherwise.
+ *
+ * @return Nothing returned.
+ **/
+void spi_idle(void);
+
+/**
+ * @brief Return the time on the clock the device on the bus runs by
+ *
+ * Real time on hardware, the simulated time with the fake backend. Used for
+ * waits the device needs, like the nRF's power up, together with spi_idle().
+ *
+ * @return Returns a free-running count of microseconds
+ **/
+uint32_t spi_time_us(void);
+
 /**
  * @brief Receive a single byte from the SPI bus
  *
- * Receives a single byte of data from the SPI device and stores it at the
- * address specified by `byte`.
+ * Returns the byte which was clocked in while the most recent byte was sent by
+ * spi_write_byte(), storing it at the address specified by `byte`.
  *
  * @param[out] byte The address where the received byte should be stored
  * @return Nothing returned.
@@ -37,7 +153,8 @@ void spi_read_byte(uint8_t *byte);
 /**
  * @brief Send a single byte out the SPI bus
  *
- * Sends the byte of data passed in `byte` to the SPI device.
+ * Sends the byte of data passed in `byte` to the SPI device. The byte received
+ * at the same time is kept and can be retrieved with spi_read_byte().
  *
  * @param[in] byte The byte which should be sent as to the SPI device
  * @return Nothing returned.
@@ -77,3 +194,5 @@ void spi_receive_packet(uint8_t *p, size_t length, uint8_t nop);
  * @return Nothing returned.
  **/
 void spi_flush(void);
+
+#endif /* __SPI_H__ */
@@ -0,0 +1,171 @@
+/**
+ * @file timer_wheel.h
+ * @brief Hierarchical software timer wheel
+ *
+ * One-shot and periodic software timers with 1ms resolution, all driven by a
+ * single hardware timer. Timers are kept in TW_LEVELS wheels of TW_SLOTS slots,
+ * each level covering TW_SLOTS times the span of the one below, so starting,
+ * stopping and expiring a timer are constant time regardless of how many are
+ * running. Timers in the upper levels cascade down as their slot comes up.
+ *
+ * The wheel is tickless: instead of a fixed tick interrupt, the hardware timer
+ * is programmed for the next point where the wheel has work to do, and not at
+ * all when no timers are running.
+ *
+ * The hardware timer interrupt calls tw_advance(), which only moves expired
+ * timers to a ready list. Their callbacks run later, from tw_run() in the main
+ * loop, so they are free to log, block or start other timers.
+ *
+ * Timer records are owned by the caller, must start zeroed (static storage or
+ * `= {0}`), and must stay valid while active.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/06
+ **/
+
+#ifndef __TIMER_WHEEL_H__
+#define __TIMER_WHEEL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Wheel geometry, 4 levels of 64 slots spans 2^24 ticks (~4.6 hours) */
+#define TW_SLOT_BITS (6)
+#define TW_SLOTS     (1u << TW_SLOT_BITS)
+#define TW_SLOT_MASK (TW_SLOTS - 1)
+#define TW_LEVELS    (4)
+
+/* Length of one wheel tick */
+#define TW_TICK_US   (1000u)
+
+/* Longest delay or period that can be scheduled, in ticks */
+#define TW_MAX_TICKS ((1u << (TW_SLOT_BITS * TW_LEVELS)) - 1)
+
+/* Longest the hardware timer is programmed for, well inside the wrap of the
+   microsecond clock so elapsed time is never ambiguous (~35 minutes) */
+#define TW_MAX_SLEEP (0x80000000u / TW_TICK_US)
+
+/* Passed to the program hook when no timers are running */
+#define TW_IDLE      (UINT32_MAX)
+
+typedef void (*TW_callback_t)(void *arg);
+
+/* Returns a free-running microsecond count, may wrap */
+typedef uint32_t (*TW_clock_t)(void);
+
+/* Arms the hardware timer to call tw_advance() in `ticks`, or disarms on TW_IDLE */
+typedef void (*TW_program_t)(uint32_t ticks);
+
+typedef struct TW_timer
+{
+  struct TW_timer *next;    /* Next timer in the same slot or ready list     */
+  struct TW_timer **pprev;  /* The pointer to this timer, NULL when inactive */
+  uint32_t expires;         /* Wheel tick of the next expiry                 */
+  uint32_t period;          /* Ticks between expiries, 0 for one-shot        */
+  TW_callback_t callback;
+  void *arg;
+} TW_timer_t;
+
+typedef enum
+{
+  TW_OK = 0,    /* Operation successful */
+  TW_NULL,      /* Attempt to operate on null-pointer */
+  TW_SIZE_ERR   /* Delay or period longer than TW_MAX_TICKS */
+} TW_status_t;
+
+/* Scheduling activity counters */
+typedef struct {
+  uint32_t started;    /* Timers started or re-armed            */
+  uint32_t expired;    /* Timers moved to the ready list        */
+  uint32_t cascaded;   /* Timers moved down from an upper level */
+  uint32_t programmed; /* Calls to the program hook             */
+} TW_stats_t;
+
+extern TW_stats_t tw_stats;
+
+/**
+ * @brief Empty the wheel and start its clock
+ *
+ * Timers previously started are forgotten, not stopped.
+ *
+ * @param[in] clock   The microsecond time source
+ * @param[in] program The hardware timer hook, or NULL if tw_advance() is
+ *                    called some other way
+ * @return Returns TW_OK, or TW_NULL without a clock
+ **/
+TW_status_t tw_init(TW_clock_t clock, TW_program_t program);
+
+/**
+ * @brief Start (or restart) a timer
+ *
+ * The callback first runs `delay` ticks from now, then every `period` ticks
+ * after that if `period` is nonzero. Periodic timers keep their phase even if
+ * their callbacks run late.
+ *
+ * @param[in,out] timer    The timer record
+ * @param[in]     delay    Ticks until the first expiry
+ * @param[in]     period   Ticks between later expiries, 0 for a one-shot
+ * @param[in]     callback The function to run from tw_run()
+ * @param[in]     arg      Passed to `callback`
+ * @return Returns TW_OK if started, otherwise an error status
+ **/
+TW_status_t tw_start(TW_timer_t *timer, uint32_t delay, uint32_t period,
+                     TW_callback_t callback, void *arg);
+
+/**
+ * @brief Stop a timer
+ *
+ * A stopped timer's callback will not run, even if it had already expired.
+ * Stopping an inactive timer has no effect.
+ *
+ * @param[in,out] timer The timer record
+ * @return Returns TW_OK, or TW_NULL for a null timer
+ **/
+TW_status_t tw_stop(TW_timer_t *timer);
+
+/**
+ * @brief Check whether a timer is running or waiting to have its callback run
+ *
+ * @param[in] timer The timer record
+ * @return Returns 1 if active, 0 otherwise
+ **/
+uint8_t tw_active(const TW_timer_t *timer);
+
+/**
+ * @brief Bring the wheel up to the current time
+ *
+ * Moves expired timers to the ready list, then reprograms the hardware timer
+ * for the next deadline. Called from the hardware timer interrupt.
+ *
+ * @return Nothing returned
+ **/
+void tw_advance(void);
+
+/**
+ * @brief Run the callbacks of expired timers
+ *
+ * Periodic timers are re-armed before their callback runs.
+ *
+ * @return Returns the number of callbacks run
+ **/
+uint32_t tw_run(void);
+
+/**
+ * @brief Check for expired timers waiting on tw_run()
+ *
+ * @return Returns 1 if any callbacks are waiting, 0 otherwise
+ **/
+uint8_t tw_pending(void);
+
+/**
+ * @brief Return the ticks until the wheel next needs tw_advance()
+ *
+ * This is the earliest expiry in the lowest level, or the earliest cascade of
+ * an upper level, whichever comes first.
+ *
+ * @return Returns the ticks from the wheel's current time, or TW_IDLE if no
+ *         timers are running
+ **/
+uint32_t tw_next(void);
+
+#endif /* __TIMER_WHEEL_H__ */
@@ -13,6 +13,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "coroutine.h"
 
 #define MEM_FAIL 0
 
@@ -25,12 +26,26 @@
 
 #define DMA_AVAILABLE
 
+/* A memory move run as a coroutine, see memmove_dma_cr() */
+typedef struct {
+  CR_t cr;
+  uint8_t *src;
+  uint8_t *dst;
+  size_t length;       /* Bytes left to move              */
+  size_t offset;       /* Distance from src up to dst     */
+  size_t front_len;    /* Unaligned bytes moved by the CPU */
+  uint32_t align_mask;
+  uint8_t dma_align;
+} MEM_move_t;
+
 /**
  * @brief Move a range of bytes from source to destination
  *
  * Moves a range of bytes from a source region to a destination region. Assumes
  * at least `length` bytes of memory pointed to by `dst` has been allocated.
  *
+ * Returns once the move is complete, see memmove_dma_cr().
+ *
  * @param[in]  src    The source address of the memory region to move
  * @param[out] dst    The destination address for the moved region of memory
  * @param[in]  length The number of bytes in the memory region to move
@@ -41,6 +56,28 @@ uint8_t *memmove_dma(uint8_t *src, uint8_t *dst, size_t length);
 // Same as above, but with simple 8-bit DMA transfers only
 uint8_t *memmove_dma8(uint8_t *src, uint8_t *dst, size_t length);
 
+/**
+ * @brief Prepare a memory move to run with memmove_dma_cr()
+ *
+ * @param[out] m      The move to prepare
+ * @param[in]  src    The source address of the memory region to move
+ * @param[out] dst    The destination address for the moved region of memory
+ * @param[in]  length The number of bytes in the memory region to move
+ * @return Nothing returned
+**/
+void memmove_dma_start(MEM_move_t *m, uint8_t *src, uint8_t *dst, size_t length);
+
+/**
+ * @brief Run a memory move as a coroutine
+ *
+ * Same as memmove_dma(), but returns to the caller while each DMA block is in
+ * flight. Invalid arguments finish the move straight away.
+ *
+ * @param[in,out] m The move, prepared with memmove_dma_start()
+ * @return Returns the coroutine status, done once every byte has moved
+**/
+CR_status_t memmove_dma_cr(MEM_move_t *m);
+
 /**
  * @brief Sets every byte in a region of memory to a specified value.
  *
@@ -13,6 +13,7 @@
 #define __TIMER_H__
 
 #include "MKL25Z4.h"  /* include core_cm0plus.h */
+#include "clock.h"
 
 
 /*** SysTick, System Timer ***/
@@ -31,11 +32,27 @@
 #define MS_TO_TICKS(x) ( (DEFAULT_SYSTEM_CLOCK / 1000) * (x) )
 #define US_TO_TICKS(x) ( (DEFAULT_SYSTEM_CLOCK / 1000000) * (x) )
 
+/* Extended clock hardware, see clock.h */
+#define CLOCK_PERIOD       (SYSTICK_MAX + 1)
+#define CLOCK_TICKS_PER_US (DEFAULT_SYSTEM_CLOCK / 1000000)
+
+/* Ticks into the current SysTick period, counting up */
+__attribute__((always_inline)) static inline uint32_t clock_hw_count()
+{
+  return SYSTICK_MAX - SysTick->VAL;
+}
+
+/* SysTick has reloaded but its interrupt has not been taken yet */
+__attribute__((always_inline)) static inline uint8_t clock_hw_wrapped()
+{
+  return (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) ? 1 : 0;
+}
+
 /**
  * @brief Configure and enable the System Timer (SysTick)
  *
- * SysTick is initialized to decrement at each pulse of the core clock. No
- * interrupts will be generated.
+ * SysTick is initialized to decrement at each pulse of the core clock. Every
+ * reload interrupts to extend the count in clock.c.
  *
  * @return Nothing returned
 **/
@@ -105,29 +122,25 @@ __attribute__((always_inline)) static inline uint32_t elapsed_ticks(uint32_t sta
 #define TIMER_PS_VAL (7)
 #define TIMER_SCALE (128)
 
-/* Target timer period, 100ms */
-#define TIMER_TARGET_MS (100)
-
-/* Up-counting modulo value calculation (see KL25 TRM p563) */
-#define TIMER_MOD_VAL (((TIMER_CLK_FREQ / TIMER_SCALE) * TIMER_TARGET_MS) / 1000 - 1)
+/* Counter ticks per millisecond, and the longest period the 16-bit modulo
+   allows (~174ms). Longer software timer delays take several periods. */
+#define TIMER_COUNTS_PER_MS ((TIMER_CLK_FREQ / TIMER_SCALE) / 1000)
+#define TIMER_MAX_MS (0x10000u / TIMER_COUNTS_PER_MS)
 
 /* A counter incremented each time the timer overflows */
 extern volatile uint32_t timer_counter;
 
 /**
- * @brief Configure the TPM0 timer and enable it
+ * @brief Configure the TPM0 timer to drive the software timer wheel
  *
- * The TPM0 timer peripheral is configured to overflow every TIMER_TARGET_MS
- * milliseconds. Interrupts are configured such that the TPM0 ISR is called
- * every overflow.
+ * TPM0 is left stopped. The timer wheel programs it as a one-shot for its
+ * next deadline, and the TPM0 ISR advances the wheel on overflow.
  *
  * @return Nothing returned
 **/
 void timer_setup(void);
 
 
-extern volatile uint32_t timer_ticks;
-
 __attribute__((always_inline)) static inline void delay_ms(uint32_t ms)
 {
   ms = (ms > SYSTICK_MAX_MS) ? SYSTICK_MAX_MS : ms;
@@ -146,9 +159,26 @@ __attribute__((always_inline)) static inline uint32_t get_time()
   return RTC->TSR;
 }
 
+__attribute__((always_inline)) static inline void get_timestamp(uint32_t *secs, uint32_t *usecs)
+{
+  clock_timestamp(secs, usecs);
+}
+
+__attribute__((always_inline)) static inline uint64_t get_usecs64()
+{
+  return clock_usecs();
+}
+
+/* Wraps every ~71 minutes, differences are valid across the wrap */
 __attribute__((always_inline)) static inline uint32_t get_usecs()
 {
-  return TICKS_TO_US(elapsed_ticks(timer_ticks));
+  return (uint32_t) clock_usecs();
+}
+
+/* Core clock cycles, for profiling */
+__attribute__((always_inline)) static inline uint64_t get_cycles()
+{
+  return clock_ticks();
 }
 
 void rtc_setup(void);
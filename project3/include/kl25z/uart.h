@@ -37,8 +37,9 @@
    The system PLL clock is divided by 2 for UART0. */
 #define UART0_SBR (UART0_CLK_SPEED / (UART0_BAUD_RATE * UART0_OVERSAMPLING))
 
-/* The buffer size to use for the RX/TX circular buffers. */
-#define UART_BUF_SIZE 200  /* bytes */
+/* The buffer size to use for the RX/TX circular buffers, a power of two so
+   the buffers wrap with a mask. */
+#define UART_BUF_SIZE 256  /* bytes */
 
 extern CircBuf_t rxbuf;
 extern CircBuf_t txbuf;
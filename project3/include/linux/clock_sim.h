@@ -0,0 +1,79 @@
+/**
+ * @file clock_sim.h
+ * @brief Simulated SysTick counter for platforms without one
+ *
+ * Models the KL25Z SysTick as used by the extended clock: a 24-bit counter
+ * decrementing at the 48MHz core clock, reloading after zero and raising a
+ * wrap interrupt that calls clock_wrap(). Like the real interrupt, a wrap
+ * that occurs while interrupts are masked stays pending, and further wraps
+ * before it is taken are lost.
+ *
+ * Time only advances when the test says so, optionally on every counter read
+ * to force wraps into the middle of a clock read.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/05
+ **/
+
+#ifndef __CLOCK_SIM_H__
+#define __CLOCK_SIM_H__
+
+#include <stdint.h>
+
+/* Counter length and rate, matching the KL25Z SysTick at 48MHz */
+#define CLOCK_SIM_PERIOD       (0x01000000u)
+#define CLOCK_SIM_TICKS_PER_US (48u)
+
+/**
+ * @brief Reset the counter to the start of a period and call clock_init()
+ *
+ * Interrupts are unmasked and nothing is pending.
+ *
+ * @return Nothing returned
+ **/
+void clock_sim_reset(void);
+
+/**
+ * @brief Advance the counter
+ *
+ * Every wrap sets the pending flag. Unless masked, the wrap interrupt is
+ * taken immediately.
+ *
+ * @param[in] ticks The number of counter ticks to advance
+ * @return Nothing returned
+ **/
+void clock_sim_advance(uint32_t ticks);
+
+/**
+ * @brief Mask or unmask the wrap interrupt
+ *
+ * Unmasking takes a pending wrap interrupt.
+ *
+ * @param[in] masked Nonzero to mask the interrupt
+ * @return Nothing returned
+ **/
+void clock_sim_mask(uint8_t masked);
+
+/**
+ * @brief Advance the counter by a fixed amount on every read
+ *
+ * @param[in] ticks Ticks to advance after each clock_sim_val(), 0 to disable
+ * @return Nothing returned
+ **/
+void clock_sim_race(uint32_t ticks);
+
+/**
+ * @brief Read the current counter value, as the SysTick VAL register
+ *
+ * @return Returns the counter, counting down from CLOCK_SIM_PERIOD-1 to 0
+ **/
+uint32_t clock_sim_val(void);
+
+/**
+ * @brief Check for a pending wrap interrupt, as SCB ICSR PENDSTSET
+ *
+ * @return Returns 1 if a wrap interrupt is pending, 0 otherwise
+ **/
+uint8_t clock_sim_wrapped(void);
+
+#endif /* __CLOCK_SIM_H__ */
@@ -0,0 +1,121 @@
+/**
+ * @file log_file.h
+ * @brief Binary log records kept in a memory-mapped file (Linux)
+ *
+ * The file is preallocated, a header page followed by `size` bytes of
+ * records. Records are the same header and data bytes log_send_binary()
+ * writes, copied straight into the shared mapping, so a record costs no
+ * system call and is in the page cache (and survives the process crashing)
+ * as soon as it is written. lf_sync() also writes it to disk.
+ *
+ * The header holds two free-running byte counts, `head` (bytes ever written)
+ * and `tail` (start of the oldest record kept). Records live at their count
+ * modulo `size`. As with ring_map(), the record area is mapped twice, back to
+ * back, so records that wrap are still copied in one piece. When the file is
+ * full, LF_WRAP overwrites the oldest records and LF_STOP drops new ones.
+ *
+ * A reader (script/binlog.py) can decode the file while it is being written.
+ * The tail is moved before the records under it are overwritten, and the
+ * head after a record is complete, so a reader that copies out the records
+ * between the two and then reads the tail again knows which of them are
+ * whole. Reopening the file resumes after the records already in it.
+ *
+ * Only one context may write at a time, which the log flush already is.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#ifndef __LOG_FILE_H__
+#define __LOG_FILE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "logger.h"
+#include "log_queue.h"
+
+#define LF_MAGIC "BinlogMM"
+#define LF_VERSION (1)
+
+typedef enum
+{
+  LF_WRAP = 0,  /* Overwrite the oldest records when full */
+  LF_STOP       /* Drop new records when full */
+} Log_file_policy_t;
+
+/* Layout of the file's first page, little-endian on every Linux target */
+typedef struct
+{
+  char magic[8];            /* LF_MAGIC, not NUL terminated */
+  uint32_t version;         /* LF_VERSION */
+  uint32_t header_size;     /* Offset of the records in the file, one page */
+  uint64_t size;            /* Bytes of records, a whole number of pages */
+  uint32_t policy;          /* Log_file_policy_t */
+  uint32_t record_header;   /* LOG_HEADER_SIZE of the writer */
+  volatile uint64_t head;   /* Bytes of records ever written */
+  volatile uint64_t tail;   /* Count at the oldest record kept */
+  volatile uint64_t dropped; /* Records dropped, too big or with LF_STOP */
+} Log_file_header_t;
+
+typedef struct
+{
+  Log_file_header_t *header; /* The mapped file, NULL until opened */
+  uint8_t *records;          /* Record area, mapped twice */
+  size_t size;               /* Bytes in the record area */
+  size_t header_size;        /* Bytes before the record area */
+} Log_file_t;
+
+/**
+ * @brief Open (creating if needed) and map a log file
+ *
+ * An existing file with the same size and record header is resumed, any
+ * other file is cleared.
+ *
+ * @param[out] lf     The log file to open
+ * @param[in]  path   File name
+ * @param[in]  size   Bytes of records, rounded up to a whole number of pages
+ * @param[in]  policy What to do when the file is full
+ * @return Returns LQ_OK if the file is mapped, LQ_NULL for a NULL pointer,
+ *         LQ_SIZE_ERR for a zero size, or LQ_ALLOC_ERR if the file couldn't
+ *         be opened, allocated or mapped
+ **/
+Log_status_t lf_open(Log_file_t *lf, const char *path, size_t size, Log_file_policy_t policy);
+
+/**
+ * @brief Unmap a log file, leaving its records in the file
+ *
+ * @param[in,out] lf The log file
+ * @return Returns LQ_OK, or LQ_NULL if `lf` is NULL or wasn't opened
+ **/
+Log_status_t lf_close(Log_file_t *lf);
+
+/**
+ * @brief Append a record to the log file
+ *
+ * Copies the record header and `item->length` bytes of `item->data`.
+ *
+ * @param[in,out] lf   The log file
+ * @param[in]     item The record
+ * @return Returns LQ_OK if written, LQ_NULL for a NULL pointer or unopened
+ *         file, LQ_SIZE_ERR if the record is bigger than the file, or LQ_FULL
+ *         if the file is full and the policy is LF_STOP
+ **/
+Log_status_t lf_write(Log_file_t *lf, Log_t *item);
+
+/**
+ * @brief Write the mapped records out to disk, waiting until they are
+ *
+ * Only needed for the records to survive the system going down, not the
+ * process.
+ *
+ * @param[in] lf The log file
+ * @return Returns LQ_OK, LQ_NULL if the file isn't open, or LQ_ALLOC_ERR if
+ *         the sync failed
+ **/
+Log_status_t lf_sync(Log_file_t *lf);
+
+/* Bytes of records kept in the file */
+#define lf_used(lf) ((size_t) ((lf)->header->head - (lf)->header->tail))
+
+#endif /* __LOG_FILE_H__ */
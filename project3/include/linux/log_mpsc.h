@@ -0,0 +1,121 @@
+/**
+ * @file log_mpsc.h
+ * @brief Multi-producer, single-consumer log queue for Linux
+ *
+ * A lock-free alternative to Log_q for threaded builds. Any number of threads
+ * may add logs at once while one thread removes them.
+ *
+ * A producer reserves space for its record with a compare-and-swap on the
+ * queue head, then copies the record in and sets the record's commit word
+ * last. The consumer stops at the first record that isn't committed yet, so
+ * it never reads one that is half written. Records are removed in the order
+ * their space was reserved.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#ifndef __LOG_MPSC_H__
+#define __LOG_MPSC_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "logger.h"
+#include "log_queue.h"
+
+/* Records start on this alignment, so a commit word never wraps */
+#define LQM_ALIGN (8)
+
+typedef struct
+{
+  uint8_t *buffer;  /* The address of the data buffer allocation */
+  size_t size;      /* Size of the buffer, a power of two */
+  /* Bytes reserved (low 48 bits) and the next sequence number (high 16),
+     free running. Updated together so sequence numbers follow queue order. */
+  volatile uint64_t head __attribute__((aligned(64)));
+  /* Bytes removed, free running, only written by the consumer */
+  volatile uint64_t tail __attribute__((aligned(64)));
+} Log_mpsc_t;
+
+/**
+ * @brief Allocate and initialize a new multi-producer log queue
+ *
+ * @param[in,out] queue A pointer to an uninitialized queue
+ * @param[in]     size  Bytes of log data to reserve, a power of two of at
+ *                      least 64
+ * @return Returns LQ_OK, LQ_SIZE_ERR for a bad size, LQ_ALLOC_ERR or LQ_NULL
+ **/
+Log_status_t lqm_init(Log_mpsc_t *queue, size_t size);
+
+/**
+ * @brief Initialize a multi-producer log queue over existing storage
+ *
+ * As lqm_init(), but the queue uses `storage` (usually declared with
+ * LQ_STORAGE) instead of allocating. lqm_destroy() leaves the storage alone.
+ *
+ * @param[in,out] queue   A pointer to an uninitialized queue
+ * @param[in]     storage Space for `size` bytes, aligned to LQM_ALIGN
+ * @param[in]     size    Bytes of log data, a power of two of at least 64
+ * @return Returns LQ_OK, LQ_SIZE_ERR for a bad size or alignment, or LQ_NULL
+ **/
+Log_status_t lqm_init_static(Log_mpsc_t *queue, uint8_t *storage, size_t size);
+
+/**
+ * @brief Destroy (deallocate) a multi-producer log queue
+ *
+ * No thread may be using the queue.
+ *
+ * @param[in,out] queue A pointer to an initialized queue
+ * @return Returns LQ_OK, or LQ_NULL
+ **/
+Log_status_t lqm_destroy(Log_mpsc_t *queue);
+
+/**
+ * @brief Add a log item to the queue, from any thread
+ *
+ * The header and `length` bytes of data are copied onto the queue. The item's
+ * `seq` is set from the queue's sequence counter, and items dropped because
+ * the queue was full use up a number too, as with lq_add().
+ *
+ * @param[in,out] queue A pointer to an initialized queue
+ * @param[in,out] item  The item to add, its `seq` is set
+ * @return Returns LQ_OK, LQ_FULL if the item was dropped, or LQ_NULL
+ **/
+Log_status_t lqm_add(Log_mpsc_t *queue, Log_t *item);
+
+/**
+ * @brief Read the header of the oldest item without removing it
+ *
+ * Only the consumer thread may call this.
+ *
+ * @param[in]  queue A pointer to an initialized queue
+ * @param[out] item  Where to store the header
+ * @return Returns LQ_OK, LQ_EMPTY if the oldest item isn't committed yet or
+ *         there is none, or LQ_NULL
+ **/
+Log_status_t lqm_peek(Log_mpsc_t *queue, Log_t *item);
+
+/**
+ * @brief Remove the oldest item from the queue
+ *
+ * Only the consumer thread may call this. As with lq_remove(), at most
+ * `item->length` bytes of data are copied to `item->data`, and the rest of
+ * the data is dropped.
+ *
+ * @param[in,out] queue A pointer to an initialized queue
+ * @param[in,out] item  Where to store the item, with its data buffer set
+ * @return Returns LQ_OK, LQ_EMPTY if the oldest item isn't committed yet or
+ *         there is none, or LQ_NULL
+ **/
+Log_status_t lqm_remove(Log_mpsc_t *queue, Log_t *item);
+
+/**
+ * @brief Number of bytes reserved in the queue, committed or not
+ *
+ * @param[in] queue A pointer to an initialized queue
+ * @return Returns the bytes in use
+ **/
+size_t lqm_used(Log_mpsc_t *queue);
+
+#endif /* __LOG_MPSC_H__ */
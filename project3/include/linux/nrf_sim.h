@@ -0,0 +1,189 @@
+/**
+ * @file nrf_sim.h
+ * @brief Simulated nRF24L01+ modules for platforms without one
+ *
+ * Models the SPI command set, register file, TX/RX FIFOs, interrupt flags,
+ * auto-acknowledge and retransmission of an nRF24L01+ so the nRF driver can run
+ * unmodified on the host. NRF_SIM_INSTANCES modules share a loopback "air"
+ * link with configurable latency and loss. The fake SPI and GPIO drivers route
+ * chip select, chip enable and SPI bytes to the selected module.
+ *
+ * Time only advances when the fake SPI driver clocks bytes or the driver idles
+ * waiting for an interrupt, so results are deterministic and independent of
+ * host speed. Packet loss uses a fixed-seed generator for the same reason.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/02
+ **/
+
+#ifndef __NRF_SIM_H__
+#define __NRF_SIM_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Number of simulated modules sharing the air */
+#define NRF_SIM_INSTANCES (2)
+
+/* Settling time when entering TX or RX mode (Tstby2a) */
+#define NRF_SIM_SETTLE_NS (130000u)
+
+/* Auto retransmit delay step, SETUP_RETR ARD is in (x+1) steps */
+#define NRF_SIM_ARD_NS    (250000u)
+
+/* Time allowed to pass per idle call when no event is scheduled */
+#define NRF_SIM_IDLE_NS   (10000u)
+
+/* Activity counters for one simulated module */
+typedef struct {
+  uint32_t transmits;    /* Packets put on the air, including retransmits */
+  uint32_t retransmits;  /* Automatic retransmissions                     */
+  uint32_t lost;         /* Packets and ACKs sent by this module but lost */
+  uint32_t duplicates;   /* Retransmitted packets received and discarded  */
+} NRF_sim_stats_t;
+
+/**
+ * @brief Consumes packets received by a simulated module
+ *
+ * Stands in for a host that empties the RX FIFO instantly.
+ *
+ * @param[in]  data   The received payload
+ * @param[in]  length The payload length
+ * @param[out] ack    Storage for an ACK payload of up to NRF_MAX_PAYLOAD bytes
+ * @return Returns the ACK payload length, 0 for an empty ACK
+ **/
+typedef size_t (*NRF_sim_sink_t)(const uint8_t *data, size_t length, uint8_t *ack);
+
+/**
+ * @brief Power-on reset of every simulated module and the air link
+ *
+ * Restores register reset values, empties all FIFOs, clears the clock, the
+ * link settings and statistics, and selects module 0. Module 0 signals its IRQ
+ * through nrf_irq(), the others have no IRQ handler.
+ *
+ * @return Nothing returned
+ **/
+void nrf_sim_reset(void);
+
+/**
+ * @brief Select the module driven by the fake SPI and GPIO drivers
+ *
+ * The nRF driver keeps a single register cache and receive queue, so
+ * nrf_init() should be called after switching modules.
+ *
+ * @param[in] id The module to select (0 to NRF_SIM_INSTANCES-1)
+ * @return Nothing returned
+ **/
+void nrf_sim_select(uint8_t id);
+
+/**
+ * @brief Configure the air link shared by all modules
+ *
+ * `latency_ns` is added in each direction, so it also delays ACKs. An ACK
+ * arriving after the sender's retransmit delay (SETUP_RETR ARD) is missed.
+ *
+ * @param[in] latency_ns   One-way propagation delay in nanoseconds
+ * @param[in] loss_percent Chance of losing each packet or ACK (0-100)
+ * @return Nothing returned
+ **/
+void nrf_sim_set_link(uint32_t latency_ns, uint8_t loss_percent);
+
+/**
+ * @brief Set the handler called when a module's IRQ line asserts
+ *
+ * @param[in] id      The module
+ * @param[in] handler The handler, or NULL
+ * @return Nothing returned
+ **/
+void nrf_sim_set_irq(uint8_t id, void (*handler)(void));
+
+/**
+ * @brief Consume received packets directly instead of through the RX FIFO
+ *
+ * @param[in] id   The module
+ * @param[in] sink The consumer, or NULL to queue packets in the RX FIFO
+ * @return Nothing returned
+ **/
+void nrf_sim_set_sink(uint8_t id, NRF_sim_sink_t sink);
+
+/**
+ * @brief Return the activity counters of a module
+ *
+ * @param[in] id The module
+ * @return Returns a pointer to the module's counters
+ **/
+const NRF_sim_stats_t *nrf_sim_stats(uint8_t id);
+
+/**
+ * @brief Drive the chip select (CSN) line of the selected module
+ *
+ * A falling edge starts a new command, a rising edge completes it.
+ *
+ * @param[in] level The new pin level
+ * @return Nothing returned
+ **/
+void nrf_sim_cs(uint8_t level);
+
+/**
+ * @brief Drive the chip enable (CE) line of the selected module
+ *
+ * @param[in] level The new pin level
+ * @return Nothing returned
+ **/
+void nrf_sim_ce(uint8_t level);
+
+/**
+ * @brief Clock one byte through the SPI interface of the selected module
+ *
+ * @param[in] mosi The byte sent by the host
+ * @return Returns the byte clocked out by the module, 0xFF while deselected
+ **/
+uint8_t nrf_sim_exchange(uint8_t mosi);
+
+/**
+ * @brief Advance the simulated clock
+ *
+ * Runs every transmission, delivery, ACK and retransmission that falls within
+ * `ns`, raising IRQ lines as flags are set.
+ *
+ * @param[in] ns The number of nanoseconds to advance
+ * @return Nothing returned
+ **/
+void nrf_sim_advance(uint64_t ns);
+
+/**
+ * @brief Advance the simulated clock to the next scheduled event
+ *
+ * Used by the driver while waiting for an interrupt. Advances by
+ * NRF_SIM_IDLE_NS if nothing is scheduled.
+ *
+ * @return Nothing returned
+ **/
+void nrf_sim_idle(void);
+
+/**
+ * @brief Return the simulated time since reset
+ *
+ * @return Returns the elapsed simulated time in nanoseconds
+ **/
+uint64_t nrf_sim_time(void);
+
+/**
+ * @brief Deliver a packet to a module, bypassing the air link
+ *
+ * The packet is only received while listening (PWR_UP, PRIM_RX and CE set),
+ * on an enabled pipe, with room in the RX FIFO and, without dynamic payloads,
+ * only if `length` matches the pipe's RX_PW. A pending ACK payload for `pipe`
+ * is returned with the ACK.
+ *
+ * @param[in]  id     The receiving module
+ * @param[in]  pipe   The pipe the packet is addressed to (0-5)
+ * @param[in]  data   The payload
+ * @param[in]  length The payload length (1-32)
+ * @param[out] ack    Storage for an ACK payload, may be NULL
+ * @return Returns the ACK payload length, or -1 if the packet was not received
+ **/
+int16_t nrf_sim_inject(uint8_t id, uint8_t pipe, const uint8_t *data, size_t length,
+                       uint8_t *ack);
+
+#endif /* __NRF_SIM_H__ */
@@ -0,0 +1,47 @@
+/**
+ * @file ring_map.h
+ * @brief Ring buffer storage mapped twice, back to back (Linux)
+ *
+ * The same memfd pages are mapped at `base` and again at `base + size`, so
+ * any run of up to `size` bytes starting inside the ring is contiguous in
+ * memory, however it wraps. Copies on and off the ring never split, and
+ * records can be formatted, decoded or scanned in place.
+ *
+ * Used by CB_init_mapped() and lq_init_mapped().
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#ifndef __RING_MAP_H__
+#define __RING_MAP_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Round a ring size up to what ring_map() can map
+ *
+ * @param[in] size Bytes wanted
+ * @return Returns `size` rounded up to a whole number of pages
+ **/
+size_t ring_map_size(size_t size);
+
+/**
+ * @brief Map ring storage twice, back to back
+ *
+ * @param[in] size Bytes in the ring, a whole number of pages
+ * @return Returns the first mapping, with the second right after it, or NULL
+ *         if `size` isn't a whole number of pages or the mapping failed
+ **/
+uint8_t *ring_map(size_t size);
+
+/**
+ * @brief Unmap storage from ring_map()
+ *
+ * @param[in] base The value ring_map() returned, NULL is ignored
+ * @param[in] size The size passed to ring_map()
+ **/
+void ring_unmap(volatile uint8_t *base, size_t size);
+
+#endif /* __RING_MAP_H__ */
@@ -14,6 +14,22 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <stddef.h>
+#include "clock_sim.h"
+
+/* Extended clock hardware, see clock.h. Only the simulated counter is
+   available on these platforms, it runs when a test advances it. */
+#define CLOCK_PERIOD       CLOCK_SIM_PERIOD
+#define CLOCK_TICKS_PER_US CLOCK_SIM_TICKS_PER_US
+
+__attribute__((always_inline)) static inline uint32_t clock_hw_count()
+{
+  return (CLOCK_SIM_PERIOD - 1) - clock_sim_val();
+}
+
+__attribute__((always_inline)) static inline uint8_t clock_hw_wrapped()
+{
+  return clock_sim_wrapped();
+}
 
 __attribute__((always_inline)) static inline uint32_t get_time()
 {
@@ -22,11 +38,33 @@ __attribute__((always_inline)) static inline uint32_t get_time()
   return t.tv_sec;
 }
 
+__attribute__((always_inline)) static inline void get_timestamp(uint32_t *secs, uint32_t *usecs)
+{
+  struct timeval t;
+  gettimeofday( &t, NULL );
+  *secs = t.tv_sec;
+  *usecs = t.tv_usec;
+}
+
+__attribute__((always_inline)) static inline uint64_t get_usecs64()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t );
+  return ((uint64_t) t.tv_sec * 1000000u) + (t.tv_nsec / 1000);
+}
+
+/* Wraps every ~71 minutes, differences are valid across the wrap */
 __attribute__((always_inline)) static inline uint32_t get_usecs()
+{
+  return (uint32_t) get_usecs64();
+}
+
+/* No cycle counter to read, profiling counts nanoseconds instead */
+__attribute__((always_inline)) static inline uint64_t get_cycles()
 {
   struct timespec t;
   clock_gettime(CLOCK_MONOTONIC, &t );
-  return t.tv_nsec / 1000;
+  return ((uint64_t) t.tv_sec * 1000000000u) + t.tv_nsec;
 }
 
 __attribute__((always_inline)) static inline void delay_ms(uint32_t ms)
@@ -42,4 +80,11 @@ __attribute__((always_inline)) static inline void delay_us(uint16_t us)
   while( nanosleep( &t, &t ) );
 }
 
+/**
+ * @brief Set up a timerfd to drive the software timer wheel
+ *
+ * @return Nothing returned
+**/
+void timer_setup(void);
+
 #endif /* __TIMER_H__ */
@@ -2,6 +2,8 @@
 
 import sys
 import struct
+import mmap
+import zlib
 from datetime import datetime
 
 DEBUG=0
@@ -12,6 +14,23 @@ if len(sys.argv) < 2:
 
 logfile = open(sys.argv[1], "rb")
 
+# A LOG_OUT_FILE log starts with this instead of the stream magic
+fileMagic = "BinlogMM"
+fileHeader = '<8sIIQIIQQQ'
+# Record headers by size: KL25Z (short enums), BBB, HOST (64-bit size_t)
+recordFormats = { 17: '<BBIIBHI', 23: '<IIIIBHI', 27: '<IIIIBHQ' }
+
+# A LOG_OUT_LZ stream starts with this, then the record header size
+lzMagic = "Binlog_LZ"
+lzStored = 0x8000
+
+# A LOG_OUT_FRAMED stream starts with this, then CRC-checked frames
+framedMagic = "Binlog_Framed"
+frameSync = "\xa5\x5a"
+frameHeader = '<HBB'
+frameOverhead = 10
+frameLengthMax = 4096
+
 magicStr = "Binlog_Start"
 magicPos = 0
 
@@ -47,61 +66,251 @@ LogIds = [
   "DATA_MISC_COUNT",
   "HEARTBEAT" ]
 
-print "Magic: ",
-
-while True:
-    if not datastart:
-        byte = logfile.read(1)
-        if byte != magicStr[magicPos]:
-            if(magicPos > 0):
-                print
-                print "Magic: ",
-            magicPos = 0
-            continue
-        else:
-            magicPos += 1
-            print byte,
-            if magicPos >= len(magicStr):
-                print
-                datastart = 1
-            continue
-
-    header = struct.unpack('<BBIII', logfile.read(14))
+def print_record(header, data):
     id = header[0]
     type = header[1]
     time = header[2]
-    ms = header[3]
-    length = header[4]
+    us = header[3]
+    shard = header[4]
+    seq = header[5]
+    length = header[6]
 
     if DEBUG:
         print "Header: ", id
         print "  Id: ", id
         print "  Type: ", type
         print "  Time: ", time
-        print "  Millis: ", ms
+        print "  Micros: ", us
+        print "  Shard: ", shard
+        print "  Seq: ", seq
         print "  Length: ", length
 
     if id > len(LogIds):
         print "Bad id: ", id
-        continue
+        return
 
-    data = logfile.read(length)
-    print datetime.fromtimestamp(time).strftime('%Y-%m-%d %H:%M:%S'),
+    print datetime.fromtimestamp(time).strftime('%Y-%m-%d %H:%M:%S') + '.{:06d}'.format(us),
+    if shard:
+        print '<{}>'.format(shard),
     print '[{}]'.format(LogIds[id]),
     if type == LogType.LD_NULL:
         print
     elif type == LogType.LD_DATA:
         print " ".join(["0x{:02x}".format(ord(b)) for b in data])
     elif type == LogType.LD_INT:
-        val = struct.unpack('<I', data)[0]
+        val = struct.unpack('<i', data)[0]
         print val
     elif type == LogType.LD_STR:
         print data.decode()
     elif type == LogType.LD_NVAL:
-        val = struct.unpack('<I', data[0:4])[0]
+        val = struct.unpack('<i', data[0:4])[0]
         name = data[4:].decode()
         print name, "=", val
 
 
+def decode_file():
+    """Decode a LOG_OUT_FILE log, which may still be being written"""
+    mm = mmap.mmap(logfile.fileno(), 0, access=mmap.ACCESS_READ)
+    (magic, version, header_size, size, policy, record_header,
+     head, tail, dropped) = struct.unpack_from(fileHeader, mm, 0)
+    recordFormat = recordFormats[record_header]
+    print "Log file: {} bytes of records, {} dropped".format(size, dropped)
+
+    # Copy out the records, then read the tail again. The writer moves it past
+    # records before overwriting them, so the copy is good from there on.
+    ring = mm[header_size:header_size + size]
+    tail = struct.unpack_from(fileHeader, mm, 0)[7]
+    ring = ring + ring
+
+    pos = tail
+    while pos < head:
+        offset = pos % size
+        header = struct.unpack_from(recordFormat, ring, offset)
+        data = ring[offset + record_header:offset + record_header + header[6]]
+        print_record(header, data)
+        pos += record_header + header[6]
+    sys.exit(0)
+
+
+def lz_decompress(payload, out, raw):
+    """Decode one compressed LZ frame onto the end of out"""
+    end = len(out) + raw
+    pos = 0
+    while pos < len(payload):
+        token = ord(payload[pos])
+        pos += 1
+        count = token >> 4
+        if count == 15:
+            more = 255
+            while more == 255:
+                more = ord(payload[pos])
+                pos += 1
+                count += more
+        out.extend(payload[pos:pos + count])
+        pos += count
+        if pos >= len(payload):
+            break
+        offset = ord(payload[pos]) | (ord(payload[pos + 1]) << 8)
+        pos += 2
+        count = (token & 15) + 4
+        if (token & 15) == 15:
+            more = 255
+            while more == 255:
+                more = ord(payload[pos])
+                pos += 1
+                count += more
+        # Byte at a time, the match may overlap what it copies
+        for i in xrange(count):
+            out.append(out[-offset])
+    if len(out) != end:
+        raise ValueError("corrupt LZ frame")
+
+
+def decode_lz(stream, start):
+    """Decode a LOG_OUT_LZ stream, from the frames after the magic"""
+    record_header = ord(stream[start])
+    recordFormat = recordFormats[record_header]
+    out = bytearray()
+    pos = start + 1
+    frames = 0
+    while pos + 4 <= len(stream):
+        raw, length = struct.unpack_from('<HH', stream, pos)
+        pos += 4
+        payload = stream[pos:pos + length]
+        pos += length
+        if raw & lzStored:
+            out.extend(payload)
+        else:
+            lz_decompress(payload, out, raw)
+        frames += 1
+
+    print "LZ: {} bytes in {} frames, {} decoded".format(pos - start - 1, frames, len(out))
+    out = str(out)
+    pos = 0
+    while pos + record_header <= len(out):
+        header = struct.unpack_from(recordFormat, out, pos)
+        data = out[pos + record_header:pos + record_header + header[6]]
+        print_record(header, data)
+        pos += record_header + header[6]
+    sys.exit(0)
+
 
+def decode_framed(stream, start):
+    """Decode a LOG_OUT_FRAMED stream, skipping whatever isn't a good frame"""
+    pos = start
+    frames = 0
+    lost = 0
+    skipped = 0
+    seq = None
+    while True:
+        at = stream.find(frameSync, pos)
+        if at < 0 or at + frameOverhead > len(stream):
+            skipped += len(stream) - pos
+            break
+        length, frame_seq, record_header = struct.unpack_from(frameHeader, stream, at + 2)
+        end = at + 6 + length
+        if (length > frameLengthMax or end + 4 > len(stream) or
+            zlib.crc32(stream[at + 2:end]) & 0xffffffff !=
+            struct.unpack_from('<I', stream, end)[0]):
+            # Not a frame after all, look again from the next byte
+            skipped += at + 1 - pos
+            pos = at + 1
+            continue
+        skipped += at - pos
+        if seq is not None:
+            lost += (frame_seq - seq) & 0xff
+        seq = (frame_seq + 1) & 0xff
+        frames += 1
+
+        recordFormat = recordFormats[record_header]
+        offset = at + 6
+        while offset + record_header <= end:
+            header = struct.unpack_from(recordFormat, stream, offset)
+            data = stream[offset + record_header:offset + record_header + header[6]]
+            print_record(header, data)
+            offset += record_header + header[6]
+        pos = end + 4
+
+    print "Framed: {} frames, {} lost, {} bytes skipped".format(frames, lost, skipped)
+    sys.exit(0)
+
+
+def record_ok(header, avail):
+    """Whether a parsed header looks like a record, with its data in avail"""
+    return (header[0] < len(LogIds) and header[1] <= LogType.LD_NVAL and
+            header[3] < 1000000 and header[6] <= avail)
+
+
+def record_run(stream, pos, record_header, most):
+    """Records in a row from pos that parse with this header size, up to most"""
+    recordFormat = recordFormats[record_header]
+    count = 0
+    while count < most and pos + record_header <= len(stream):
+        header = struct.unpack_from(recordFormat, stream, pos)
+        if not record_ok(header, len(stream) - pos - record_header):
+            break
+        pos += record_header + header[6]
+        count += 1
+    return count
+
+
+def decode_raw(stream, start):
+    """Decode a Binlog_Start stream until a record doesn't parse, returning
+    where it stopped. The header size isn't sent, so take the layout that
+    parses the longest run, as tools/binlog.c does."""
+    runs = [(record_run(stream, start, size, 256), -size) for size in recordFormats]
+    run, record_header = max(runs)
+    record_header = -record_header
+    if run == 0:
+        print "No records after the magic"
+        return start
+    recordFormat = recordFormats[record_header]
+    pos = start
+    while pos + record_header <= len(stream):
+        header = struct.unpack_from(recordFormat, stream, pos)
+        if not record_ok(header, len(stream) - pos - record_header):
+            print "Bad record at offset", pos
+            break
+        data = stream[pos + record_header:pos + record_header + header[6]]
+        print_record(header, data)
+        pos += record_header + header[6]
+    return pos
+
+
+if logfile.read(len(fileMagic)) == fileMagic:
+    decode_file()
+logfile.seek(0)
+stream = logfile.read()
+if stream.find(framedMagic) >= 0:
+    decode_framed(stream, stream.find(framedMagic) + len(framedMagic))
+if stream.find(lzMagic) >= 0:
+    decode_lz(stream, stream.find(lzMagic) + len(lzMagic))
+logfile.seek(0)
+
+print "Magic: ",
+
+while True:
+    if not datastart:
+        byte = logfile.read(1)
+        if not byte:
+            print
+            break
+        if byte != magicStr[magicPos]:
+            if(magicPos > 0):
+                print
+                print "Magic: ",
+            magicPos = 0
+            continue
+        else:
+            magicPos += 1
+            print byte,
+            if magicPos >= len(magicStr):
+                print
+                datastart = 1
+            continue
 
+    # Look for the magic again after the records, the log may have restarted
+    logfile.seek(decode_raw(stream, logfile.tell()))
+    datastart = 0
+    magicPos = 0
+    print "Magic: ",
@@ -0,0 +1,156 @@
+#!/usr/bin/python
+"""
+Run the microbenchmarks and compare them with a recorded baseline.
+
+A benchmark has regressed when its median time is more than `threshold`
+percent above the baseline median, and a one-sided Mann-Whitney U test finds
+the slowdown significant at level `alpha`. The rank test makes no assumption
+about the shape of the timing distribution, so a few preempted samples can't
+fake or hide a regression. Exits with status 1 if anything regressed.
+
+Timings from another machine can't be compared, so if the baseline was
+recorded on a different CPU the check is skipped with a warning.
+
+Usage: perfcheck.py [--update] [--threshold PCT] [--alpha P] BENCH BASELINE
+"""
+
+from __future__ import print_function, division
+
+import argparse
+import collections
+import json
+import math
+import platform
+import subprocess
+import sys
+
+
+def median(values):
+    s = sorted(values)
+    mid = len(s) // 2
+    return s[mid] if len(s) % 2 else (s[mid - 1] + s[mid]) / 2
+
+
+def mann_whitney_p(base, new):
+    """One-sided p-value for `new` being stochastically larger than `base`,
+    with the normal approximation, tie correction and continuity correction"""
+    n1 = len(base)
+    n2 = len(new)
+    n = n1 + n2
+    pooled = sorted([(v, 0) for v in base] + [(v, 1) for v in new])
+
+    # Average ranks (1-based) over runs of tied values
+    rank_new = 0.0
+    ties = 0.0
+    i = 0
+    while i < n:
+        j = i
+        while j < n and pooled[j][0] == pooled[i][0]:
+            j += 1
+        rank = (i + 1 + j) / 2
+        rank_new += rank * sum(1 for k in range(i, j) if pooled[k][1])
+        ties += (j - i) ** 3 - (j - i)
+        i = j
+
+    u = rank_new - n2 * (n2 + 1) / 2
+    mean = n1 * n2 / 2
+    var = n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)))
+    if var <= 0:
+        return 1.0
+    z = (u - mean - 0.5) / math.sqrt(var)
+    return 0.5 * math.erfc(z / math.sqrt(2))
+
+
+def machine():
+    try:
+        with open('/proc/cpuinfo') as f:
+            for line in f:
+                if line.startswith('model name'):
+                    return line.split(':', 1)[1].strip()
+    except IOError:
+        pass
+    return platform.machine()
+
+
+def run_bench(bench, samples):
+    out = subprocess.check_output([bench, str(samples)])
+    return json.loads(out.decode('ascii'),
+                      object_pairs_hook=collections.OrderedDict)
+
+
+def write_results(f, results):
+    """JSON with one line per benchmark, so baseline updates diff well"""
+    f.write('{\n  "machine": %s,\n  "unit": %s,\n  "benchmarks": {\n'
+            % (json.dumps(results['machine']), json.dumps(results['unit'])))
+    f.write(',\n'.join('    %s: %s' % (json.dumps(name), json.dumps(samples))
+                       for name, samples in results['benchmarks'].items()))
+    f.write('\n  }\n}\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[1])
+    parser.add_argument('bench', help='benchmark executable')
+    parser.add_argument('baseline', help='baseline JSON file')
+    parser.add_argument('--update', action='store_true',
+                        help='record the results as the new baseline')
+    parser.add_argument('--threshold', type=float, default=10.0,
+                        help='allowed slowdown of the median, percent')
+    parser.add_argument('--alpha', type=float, default=0.01,
+                        help='significance level of the test')
+    parser.add_argument('--samples', type=int, default=25,
+                        help='samples per benchmark')
+    args = parser.parse_args()
+
+    results = run_bench(args.bench, args.samples)
+    results['machine'] = machine()
+
+    if args.update:
+        with open(args.baseline, 'w') as f:
+            write_results(f, results)
+        print('Baseline recorded in %s' % args.baseline)
+        return 0
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    if baseline.get('machine') != results['machine']:
+        print('Warning: baseline is from "%s", this is "%s"'
+              % (baseline.get('machine'), results['machine']))
+        print('Skipping the comparison, record a baseline here with '
+              '`make perfbaseline`')
+        return 0
+
+    limit = 1 + args.threshold / 100
+    failed = []
+    print('%-24s %12s %12s %8s %8s' % ('Benchmark', 'Baseline', 'Current',
+                                       'Change', 'p'))
+    for name, samples in results['benchmarks'].items():
+        base = baseline['benchmarks'].get(name)
+        if base is None:
+            print('%-24s %12s %9.1f ns     (new)' % (name, '-', median(samples)))
+            continue
+        ratio = median(samples) / median(base)
+        p_slower = mann_whitney_p(base, samples)
+        p_faster = mann_whitney_p(samples, base)
+        verdict = ''
+        if ratio > limit and p_slower < args.alpha:
+            verdict = 'REGRESSED'
+            failed.append(name)
+        elif ratio < 1 / limit and p_faster < args.alpha:
+            verdict = 'improved'
+        print('%-24s %9.1f ns %9.1f ns %+7.1f%% %8.4f  %s'
+              % (name, median(base), median(samples), (ratio - 1) * 100,
+                 min(p_slower, p_faster), verdict))
+    for name in baseline['benchmarks']:
+        if name not in results['benchmarks']:
+            print('%-24s missing from this run' % name)
+
+    if failed:
+        print('\n%d benchmark(s) regressed more than %g%%: %s'
+              % (len(failed), args.threshold, ', '.join(failed)))
+        return 1
+    print('\nNo regression over %g%% (alpha %g)' % (args.threshold, args.alpha))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
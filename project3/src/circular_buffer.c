@@ -9,12 +9,58 @@
  **/
 
 #include <stdint.h>
-#include <stdlib.h>
 #include "platform.h"
+#include "atomics.h"
+#include "pool.h"
 #include "circular_buffer.h"
+#ifndef KL25Z
+#include "ring_map.h"
+#endif
+
+/* Step a head or tail pointer forward, wrapping at the end of the buffer */
+__attribute__((always_inline)) static inline volatile cb_item_t *
+CB_next(CircBuf_t *circbuf, volatile cb_item_t *ptr)
+{
+  if( circbuf->mask )
+  {
+    return circbuf->buffer + ((ptr + 1 - circbuf->buffer) & circbuf->mask);
+  }
+  if( ++ptr == (circbuf->buffer + circbuf->size) )
+  {
+    ptr = circbuf->buffer;
+  }
+  return ptr;
+}
+
+CB_status_t CB_init_static(CircBuf_t *circbuf, cb_item_t *storage, size_t size)
+{
+  if( (circbuf == NULL) || (storage == NULL) )
+  {
+    return CB_NULL;
+  }
+  if( size <= 0 )
+  {
+    return CB_SIZE_ERR; /* Need a postive size */
+  }
+
+  circbuf->buffer = storage;
+  circbuf->head = circbuf->buffer;
+  circbuf->tail = circbuf->buffer;
+  circbuf->size = size;
+  circbuf->added = 0;
+  circbuf->removed = 0;
+  circbuf->mask = (size & (size - 1)) ? 0 : size - 1;
+#ifndef KL25Z
+  circbuf->mapped = 0;
+#endif
+
+  return CB_OK;
+}
 
 CB_status_t CB_init(CircBuf_t *circbuf, size_t size)
 {
+  cb_item_t *storage;
+
   if( circbuf == NULL )
   {
     return CB_NULL;
@@ -24,18 +70,39 @@ CB_status_t CB_init(CircBuf_t *circbuf, size_t size)
     return CB_SIZE_ERR; /* Need a postive size */
   }
 
-  circbuf->buffer = malloc(sizeof(cb_item_t) * size);
-  if( circbuf->buffer == NULL )
+  storage = arena_alloc(sizeof(cb_item_t) * size);
+  if( storage == NULL )
   {
     return CB_ALLOC_ERR;
   }
-  circbuf->head = circbuf->buffer;
-  circbuf->tail = circbuf->buffer;
-  circbuf->size = size;
-  circbuf->count = 0;
+  return CB_init_static(circbuf, storage, size);
+}
+
+#ifndef KL25Z
+CB_status_t CB_init_mapped(CircBuf_t *circbuf, size_t size)
+{
+  uint8_t *storage;
 
+  if( circbuf == NULL )
+  {
+    return CB_NULL;
+  }
+  if( size <= 0 )
+  {
+    return CB_SIZE_ERR; /* Need a postive size */
+  }
+
+  size = ring_map_size(sizeof(cb_item_t) * size) / sizeof(cb_item_t);
+  storage = ring_map(sizeof(cb_item_t) * size);
+  if( storage == NULL )
+  {
+    return CB_ALLOC_ERR;
+  }
+  CB_init_static(circbuf, storage, size);
+  circbuf->mapped = 1;
   return CB_OK;
 }
+#endif
 
 CB_status_t CB_destroy(CircBuf_t *circbuf)
 {
@@ -43,62 +110,69 @@ CB_status_t CB_destroy(CircBuf_t *circbuf)
   {
     return CB_NULL;
   }
-  free((void *) circbuf->buffer);
+#ifndef KL25Z
+  if( circbuf->mapped )
+  {
+    ring_unmap(circbuf->buffer, sizeof(cb_item_t) * circbuf->size);
+    circbuf->buffer = NULL;
+    circbuf->mapped = 0;
+    return CB_OK;
+  }
+#endif
+  /* Static storage isn't in the arena, so this leaves it alone */
+  arena_free((void *) circbuf->buffer);
   return CB_OK;
 }
 
-CB_status_t CB_add_item(CircBuf_t *circbuf, uint8_t item)
+RAMFUNC CB_status_t CB_add_item(CircBuf_t *circbuf, uint8_t item)
 {
+  volatile cb_item_t *head;
+
   if( circbuf == NULL )
   {
     return CB_NULL;
   }
-  if( circbuf->count == circbuf->size )
+  if( CB_count(circbuf) == circbuf->size )
   {
     return CB_FULL;
   }
 
-  /* NOTE: The modification of the head pointer, data buffer, and item count
-     below must be treated as a critical section. The code needs to be protected
-     to guarantee consistency when the circular buffer is modified and accessed
-     simultaneously both in and out of interrupt. */
+  /* NOTE: Only the producer writes the head pointer and `added`, so no
+     critical section is needed. The item is stored before `added` counts it,
+     and the consumer doesn't look at the slot until then. */
 
-  START_CRITICAL();
-  if( ++(circbuf->head) == (circbuf->buffer + circbuf->size) )
-  {
-    circbuf->head = circbuf->buffer;
-  }
-  *(circbuf->head) = item;
-  circbuf->count++;
-  END_CRITICAL();
+  ATOMIC_ACQUIRE();
+  head = CB_next(circbuf, circbuf->head);
+  *head = item;
+  circbuf->head = head;
+  ATOMIC_RELEASE();
+  circbuf->added++;
 
   return CB_OK;
 }
 
-CB_status_t CB_remove_item(CircBuf_t *circbuf, uint8_t *item)
+RAMFUNC CB_status_t CB_remove_item(CircBuf_t *circbuf, uint8_t *item)
 {
+  volatile cb_item_t *tail;
+
   if( circbuf == NULL || item == NULL)
   {
     return CB_NULL;
   }
-  if( circbuf->count == 0 )
+  if( circbuf->added == circbuf->removed )
   {
     return CB_EMPTY;
   }
 
-  /* NOTE: The modification of the tail pointer, data buffer, and item count
-     must be treated as a critical section. The code needs to be protected to
-     guarantee consistency when the circular buffer is modified and accessed
-     simultaneously both in and out of interrupt. */
+  /* NOTE: Only the consumer writes the tail pointer and `removed`. The item is
+     read before `removed` hands its slot back to the producer. */
 
-  START_CRITICAL();
-  if( ++(circbuf->tail) == (circbuf->buffer + circbuf->size) )
-  {
-    circbuf->tail = circbuf->buffer;
-  }
-  *item = *(circbuf->tail);
-  circbuf->count--;
-  END_CRITICAL();
+  ATOMIC_ACQUIRE();
+  tail = CB_next(circbuf, circbuf->tail);
+  *item = *tail;
+  circbuf->tail = tail;
+  ATOMIC_RELEASE();
+  circbuf->removed++;
 
   return CB_OK;
 }
@@ -109,7 +183,7 @@ CB_status_t CB_peek(CircBuf_t *circbuf, size_t position, uint8_t *item)
   {
     return CB_NULL;
   }
-  if( position+1 > circbuf->count )
+  if( position+1 > CB_count(circbuf) )
   {
     return CB_SIZE_ERR;
   }
@@ -119,9 +193,14 @@ CB_status_t CB_peek(CircBuf_t *circbuf, size_t position, uint8_t *item)
      guarantee consistency in the case of simultaneous read/modify in and out of
      interrupt. */
 
-  /* Find the peeked item, but wrap around if necessary */
+  /* Find the peeked item, but wrap around if necessary. The mapped buffer's
+     second copy is always there to read from. */
   START_CRITICAL();
-  if( circbuf->head - position >= circbuf->buffer )
+  if( CB_MAPPED(circbuf) )
+  {
+    *item = *((circbuf->head - position) + circbuf->size);
+  }
+  else if( circbuf->head - position >= circbuf->buffer )
   {
     *item = *(circbuf->head - position);
   }
@@ -134,3 +213,46 @@ CB_status_t CB_peek(CircBuf_t *circbuf, size_t position, uint8_t *item)
   return CB_OK;
 }
 
+
+size_t CB_span(CircBuf_t *circbuf, const volatile cb_item_t **items)
+{
+  size_t count;
+  size_t contiguous;
+
+  if( circbuf == NULL || items == NULL )
+  {
+    return 0;
+  }
+
+  count = CB_count(circbuf);
+  ATOMIC_ACQUIRE();
+  if( CB_MAPPED(circbuf) )
+  {
+    /* May point into the second copy, which is the same item */
+    *items = circbuf->tail + 1;
+    return count;
+  }
+  *items = CB_next(circbuf, circbuf->tail);
+  contiguous = (circbuf->buffer + circbuf->size) - *items;
+  return (count < contiguous) ? count : contiguous;
+}
+
+CB_status_t CB_consume(CircBuf_t *circbuf, size_t count)
+{
+  if( circbuf == NULL )
+  {
+    return CB_NULL;
+  }
+  if( count > CB_count(circbuf) )
+  {
+    return CB_SIZE_ERR;
+  }
+
+  /* As CB_remove_item(), the items are read before their slots are handed
+     back */
+  ATOMIC_RELEASE();
+  circbuf->tail = circbuf->buffer + ((circbuf->tail - circbuf->buffer) + count) % circbuf->size;
+  circbuf->removed += count;
+
+  return CB_OK;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file clock.c
+ * @brief Monotonic 64-bit clock extended from a wrapping hardware counter
+ *
+ * The wrap interrupt keeps the microseconds at the start of the current
+ * counter period, plus the ticks left over from dividing whole periods into
+ * microseconds, so reads only ever need 32-bit division.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/05
+ **/
+
+#include <stdint.h>
+#include "platform.h"
+#include "timer.h"
+#include "clock.h"
+
+static volatile uint32_t clock_periods;    /* Counter wraps since init        */
+static volatile uint64_t clock_period_us;  /* Microseconds at start of period */
+static volatile uint32_t clock_period_rem; /* Ticks short of the next us      */
+
+static volatile uint32_t clock_mark_secs;  /* Wall clock second last begun    */
+static volatile uint64_t clock_mark_us;    /* clock_usecs() when it began     */
+
+/* Consistent copy of the period state, and the ticks into that period. The
+   count exceeds CLOCK_PERIOD if a wrap is pending but not yet accounted. */
+static uint32_t clock_snapshot(uint32_t *periods, uint64_t *period_us, uint32_t *rem)
+{
+  uint32_t count;
+
+  do {
+    *periods = clock_periods;
+    *period_us = clock_period_us;
+    *rem = clock_period_rem;
+    count = clock_hw_count();
+    if( clock_hw_wrapped() ) {
+      /* Re-read so the count is certainly from after the wrap */
+      count = clock_hw_count() + CLOCK_PERIOD;
+    }
+  } while( *periods != clock_periods );
+
+  return count;
+}
+
+void clock_init(void)
+{
+  START_CRITICAL();
+  clock_periods = 0;
+  clock_period_us = 0;
+  clock_period_rem = 0;
+  clock_mark_secs = 0;
+  clock_mark_us = 0;
+  END_CRITICAL();
+}
+
+void clock_wrap(void)
+{
+  uint32_t rem = clock_period_rem + (CLOCK_PERIOD % CLOCK_TICKS_PER_US);
+
+  START_CRITICAL();
+  clock_period_us += (CLOCK_PERIOD / CLOCK_TICKS_PER_US) + (rem / CLOCK_TICKS_PER_US);
+  clock_period_rem = rem % CLOCK_TICKS_PER_US;
+  clock_periods++;
+  END_CRITICAL();
+}
+
+void clock_second(uint32_t secs)
+{
+  uint64_t now = clock_usecs();
+
+  START_CRITICAL();
+  clock_mark_us = now;
+  clock_mark_secs = secs;
+  END_CRITICAL();
+}
+
+uint64_t clock_ticks(void)
+{
+  uint32_t periods;
+  uint64_t period_us;
+  uint32_t rem;
+  uint32_t count = clock_snapshot(&periods, &period_us, &rem);
+
+  return ((uint64_t) periods * CLOCK_PERIOD) + count;
+}
+
+uint64_t clock_usecs(void)
+{
+  uint32_t periods;
+  uint64_t period_us;
+  uint32_t rem;
+  uint32_t count = clock_snapshot(&periods, &period_us, &rem);
+
+  return period_us + (rem + count) / CLOCK_TICKS_PER_US;
+}
+
+void clock_timestamp(uint32_t *secs, uint32_t *usecs)
+{
+  uint64_t mark;
+  uint32_t since;
+
+  do {
+    *secs = clock_mark_secs;
+    mark = clock_mark_us;
+  } while( *secs != clock_mark_secs );
+
+  since = (uint32_t) (clock_usecs() - mark);
+  *secs += since / 1000000u;
+  *usecs = since % 1000000u;
+}
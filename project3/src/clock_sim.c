@@ -0,0 +1,74 @@
+/**
+ * @file clock_sim.c
+ * @brief Simulated SysTick counter for platforms without one
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/05
+ **/
+
+#include <stdint.h>
+#include "clock.h"
+#include "clock_sim.h"
+
+static uint32_t sim_val;      /* Counter value, counts down          */
+static uint8_t sim_pending;   /* Wrap interrupt pending              */
+static uint8_t sim_masked;    /* Wrap interrupt masked (PRIMASK)     */
+static uint32_t sim_race;     /* Ticks to advance after each read    */
+
+/* Take the wrap interrupt if it is pending and allowed */
+static void clock_sim_service(void)
+{
+  if( sim_pending && !sim_masked ) {
+    sim_pending = 0;
+    clock_wrap();
+  }
+}
+
+void clock_sim_reset(void)
+{
+  sim_val = CLOCK_SIM_PERIOD - 1;
+  sim_pending = 0;
+  sim_masked = 0;
+  sim_race = 0;
+  clock_init();
+}
+
+void clock_sim_advance(uint32_t ticks)
+{
+  while( ticks ) {
+    if( ticks <= sim_val ) {
+      sim_val -= ticks;
+      ticks = 0;
+    }
+    else {
+      /* Through zero and reload */
+      ticks -= sim_val + 1;
+      sim_val = CLOCK_SIM_PERIOD - 1;
+      sim_pending = 1;
+      clock_sim_service();
+    }
+  }
+}
+
+void clock_sim_mask(uint8_t masked)
+{
+  sim_masked = masked;
+  clock_sim_service();
+}
+
+void clock_sim_race(uint32_t ticks)
+{
+  sim_race = ticks;
+}
+
+uint32_t clock_sim_val(void)
+{
+  uint32_t val = sim_val;
+  clock_sim_advance(sim_race);
+  return val;
+}
+
+uint8_t clock_sim_wrapped(void)
+{
+  return sim_pending;
+}
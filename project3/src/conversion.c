@@ -10,7 +10,6 @@
 
 #include <stdint.h>
 #include <stddef.h> /* NULL */
-#include <stdlib.h> /* malloc, free */
 #include "conversion.h"
 
 /* Byte masks for endianness conversion */
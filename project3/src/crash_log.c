@@ -0,0 +1,116 @@
+/**
+ * @file crash_log.c
+ * @brief Logs and registers saved at a fault, to be sent after the reset
+ *
+ * Called from the fault handler, so nothing here allocates or locks.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "memory.h"
+#include "crc.h"
+#include "logger.h"
+#include "log_queue.h"
+#include "crash_log.h"
+
+/* CRC of the region after the crc field, up to the end of the saved logs */
+static uint32_t crash_crc(const Crash_log_t *crash)
+{
+  const uint8_t *start = (const uint8_t *) &crash->regs;
+  size_t used = crash->used;
+
+  if( used > CRASH_LOG_SIZE ) {
+    used = CRASH_LOG_SIZE;
+  }
+  return crc32(CRC32_INIT, start, (const uint8_t *) &crash->log[used] - start);
+}
+
+void crash_begin(Crash_log_t *crash, const Crash_regs_t *regs)
+{
+  crash->magic = 0;
+  crash->regs = *regs;
+  crash->used = 0;
+  crash->dropped = 0;
+}
+
+void crash_add_queue(Crash_log_t *crash, const Log_q *queue)
+{
+  Log_q copy;
+  Log_t item;
+  uint8_t *saved;
+  size_t length;
+  size_t kept = lq_used(queue);
+
+  /* Logs are taken off a copy, which leaves the queue itself alone. First
+     drop the oldest until the rest fit. The fault may have left a log half
+     added, so lengths are checked rather than trusted. */
+  copy = *queue;
+  while( kept > CRASH_LOG_SIZE - crash->used ) {
+    lq_peek(&copy, &item);
+    if( LOG_HEADER_SIZE + item.length > kept ) {
+      return;
+    }
+    kept -= LOG_HEADER_SIZE + item.length;
+    item.length = 0;
+    lq_remove(&copy, &item);
+    crash->dropped++;
+  }
+
+  while( lq_peek(&copy, &item) == LQ_OK ) {
+    length = item.length;
+    if( LOG_HEADER_SIZE + length > CRASH_LOG_SIZE - crash->used ) {
+      return;
+    }
+    saved = &crash->log[crash->used];
+    item.data = saved + LOG_HEADER_SIZE;
+    lq_remove(&copy, &item);
+    my_memcpy( (uint8_t *) &item, saved, LOG_HEADER_SIZE );
+    crash->used += LOG_HEADER_SIZE + length;
+  }
+}
+
+void crash_seal(Crash_log_t *crash)
+{
+  crash->crc = crash_crc(crash);
+  crash->magic = CRASH_MAGIC;
+}
+
+uint8_t crash_valid(const Crash_log_t *crash)
+{
+  return (crash->magic == CRASH_MAGIC) && (crash->used <= CRASH_LOG_SIZE) &&
+    (crash->crc == crash_crc(crash));
+}
+
+Log_status_t crash_remove(const Crash_log_t *crash, size_t *pos, Log_t *item)
+{
+  size_t max_data;
+  size_t length;
+
+  if( (crash == NULL) || (pos == NULL) || (item == NULL) ) {
+    return LQ_NULL;
+  }
+  if( *pos + LOG_HEADER_SIZE > crash->used ) {
+    return LQ_EMPTY;
+  }
+
+  max_data = item->length;
+  my_memcpy( (uint8_t *) &crash->log[*pos], (uint8_t *) item, LOG_HEADER_SIZE );
+  length = item->length;
+  if( length > crash->used - *pos - LOG_HEADER_SIZE ) {
+    /* Can't happen in a valid region, but don't read past it */
+    length = crash->used - *pos - LOG_HEADER_SIZE;
+  }
+  item->length = (max_data < length) ? max_data : length;
+  my_memcpy( (uint8_t *) &crash->log[*pos + LOG_HEADER_SIZE], item->data, item->length );
+  *pos += LOG_HEADER_SIZE + length;
+
+  return LQ_OK;
+}
+
+void crash_clear(Crash_log_t *crash)
+{
+  crash->magic = 0;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file crc.c
+ * @brief CRC-32 checksums
+ *
+ * The KL25Z works a nibble at a time from a 16-entry table in flash. Linux
+ * uses slice-by-8, eight 256-entry tables (8KB) built at startup, which
+ * takes eight bytes per step.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "crc.h"
+
+#define CRC32_POLY (0xEDB88320)
+
+#ifdef KL25Z
+
+/* CRC of each nibble value, shifted through four bits */
+static const uint32_t crc32_nibble[16] = {
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+  0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+  0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t crc32(uint32_t crc, const volatile uint8_t *data, size_t length)
+{
+  crc = ~crc;
+  while( length-- ) {
+    crc ^= *data++;
+    crc = (crc >> 4) ^ crc32_nibble[crc & 0xf];
+    crc = (crc >> 4) ^ crc32_nibble[crc & 0xf];
+  }
+  return ~crc;
+}
+
+#else /* HOST/BBB */
+
+/* crc32_table[0] is the usual byte table, crc32_table[k] is the CRC of a
+   byte followed by k zero bytes */
+static uint32_t crc32_table[8][256];
+
+__attribute__((constructor)) static void crc32_init_tables(void)
+{
+  uint32_t crc;
+
+  for( uint32_t i = 0; i < 256; i++ ) {
+    crc = i;
+    for( uint8_t bit = 0; bit < 8; bit++ ) {
+      crc = (crc >> 1) ^ (CRC32_POLY & -(crc & 1));
+    }
+    crc32_table[0][i] = crc;
+  }
+  for( uint32_t i = 0; i < 256; i++ ) {
+    crc = crc32_table[0][i];
+    for( uint8_t k = 1; k < 8; k++ ) {
+      crc = (crc >> 8) ^ crc32_table[0][crc & 0xff];
+      crc32_table[k][i] = crc;
+    }
+  }
+}
+
+uint32_t crc32(uint32_t crc, const volatile uint8_t *data, size_t length)
+{
+  const uint8_t *p = (const uint8_t *) data;
+  uint32_t lo;
+  uint32_t hi;
+
+  crc = ~crc;
+  /* Little-endian loads, as on every Linux target here */
+  while( length >= 8 ) {
+    memcpy(&lo, p, 4);
+    memcpy(&hi, p + 4, 4);
+    lo ^= crc;
+    crc = crc32_table[7][lo & 0xff] ^ crc32_table[6][(lo >> 8) & 0xff] ^
+          crc32_table[5][(lo >> 16) & 0xff] ^ crc32_table[4][lo >> 24] ^
+          crc32_table[3][hi & 0xff] ^ crc32_table[2][(hi >> 8) & 0xff] ^
+          crc32_table[1][(hi >> 16) & 0xff] ^ crc32_table[0][hi >> 24];
+    p += 8;
+    length -= 8;
+  }
+  while( length-- ) {
+    crc = (crc >> 8) ^ crc32_table[0][(crc ^ *p++) & 0xff];
+  }
+  return ~crc;
+}
+
+#endif
@@ -11,9 +11,11 @@
 
 #include "MKL25Z4.h"
 #include "led.h"
+#include "platform.h"
 #include "logger.h"
 #include "dma.h"
 #include "io.h"
+#include "event.h"
 
 volatile uint8_t dma_transfer_complete;
 
@@ -77,7 +79,7 @@ void dma_transfer(uint8_t channel, void *src, void *dst, size_t len, uint8_t siz
   DMA0->DMA[channel].DCR |= DMA_DCR_START(1);
 }
 
-void DMA0_IRQHandler(void)
+RAMFUNC void DMA0_IRQHandler(void)
 {
   /* Check if interrupt was due to transfer complete */
   if( (DMA0->DMA[0].DSR_BCR & (DMA_DSR_BCR_DONE_MASK|DMA_ERROR_MASKS)) )
@@ -86,6 +88,7 @@ void DMA0_IRQHandler(void)
     DMA0->DMA[0].DSR_BCR |= DMA_DSR_BCR_DONE(1);
     /* Signal the main application */
     dma_transfer_complete = 1;
+    ev_post(EV_DMA_DONE, 0);
   }
 
   /* Check if there was also an error */
@@ -0,0 +1,200 @@
+/**
+ * @file event.c
+ * @brief Cooperative event loop
+ *
+ * The queue is a ring indexed by free-running 8-bit counters. Producers may be
+ * interrupt handlers, so they enqueue with interrupts masked. The only
+ * consumer is the main loop, and only it moves the tail, so it dequeues
+ * without masking.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/07
+ **/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "platform.h"
+#include "atomics.h"
+#include "timer.h"
+#include "timer_wheel.h"
+#include "logger.h"
+#include "event.h"
+
+#define EV_QUEUE_MASK (EV_QUEUE_SIZE - 1)
+
+typedef struct {
+  Event_id_t id;
+  uint32_t data;
+  uint32_t time;   /* get_usecs() when posted */
+} Event_t;
+
+EV_stats_t ev_stats;
+
+static Event_t ev_queue[EV_QUEUE_SIZE];
+static volatile uint8_t ev_head;        /* Next slot to fill */
+static volatile uint8_t ev_tail;        /* Next event to dispatch */
+static volatile uint32_t ev_signalled;  /* Signals currently queued, by id */
+static EV_handler_t ev_handlers[EV_ID_MAX];
+static uint32_t ev_start;
+static volatile uint8_t ev_stopped;
+
+static void ev_log_flush(uint32_t data)
+{
+  LOG_FLUSH();
+}
+
+/* Add to the queue, interrupts must be masked */
+static EV_status_t ev_enqueue(Event_id_t id, uint32_t data)
+{
+  Event_t *event;
+
+  if( (uint8_t) (ev_head - ev_tail) >= EV_QUEUE_SIZE ) {
+    ev_stats.dropped++;
+    return EV_FULL;
+  }
+  event = &ev_queue[ev_head & EV_QUEUE_MASK];
+  event->id = id;
+  event->data = data;
+  event->time = get_usecs();
+  ev_head++;
+  ev_stats.posted++;
+  return EV_OK;
+}
+
+void ev_init(void)
+{
+  START_CRITICAL();
+  ev_head = 0;
+  ev_tail = 0;
+  ev_signalled = 0;
+  for( uint8_t id = 0; id < EV_ID_MAX; id++ ) {
+    ev_handlers[id] = NULL;
+  }
+  ev_handlers[EV_LOG_FLUSH] = ev_log_flush;
+  ev_stats = (EV_stats_t) {0};
+  ev_start = get_usecs();
+  ev_stopped = 0;
+  END_CRITICAL();
+}
+
+EV_status_t ev_register(Event_id_t id, EV_handler_t handler)
+{
+  if( id >= EV_ID_MAX ) {
+    return EV_SIZE_ERR;
+  }
+  ev_handlers[id] = handler;
+  return EV_OK;
+}
+
+/* Events nobody handles are discarded here rather than queued */
+EV_status_t ev_post(Event_id_t id, uint32_t data)
+{
+  EV_status_t status = EV_OK;
+
+  if( id >= EV_ID_MAX ) {
+    return EV_SIZE_ERR;
+  }
+  if( ev_handlers[id] ) {
+    START_CRITICAL();
+    status = ev_enqueue(id, data);
+    END_CRITICAL();
+  }
+  return status;
+}
+
+EV_status_t ev_signal(Event_id_t id)
+{
+  EV_status_t status = EV_OK;
+
+  if( id >= EV_ID_MAX ) {
+    return EV_SIZE_ERR;
+  }
+  if( ev_handlers[id] ) {
+    START_CRITICAL();
+    if( ev_signalled & (1u << id) ) {
+      ev_stats.coalesced++;
+    }
+    else {
+      status = ev_enqueue(id, 0);
+      if( status == EV_OK ) {
+        ev_signalled |= (1u << id);
+      }
+    }
+    END_CRITICAL();
+  }
+  return status;
+}
+
+uint8_t ev_ready(void)
+{
+  return ((ev_head != ev_tail) || tw_pending()) ? 1 : 0;
+}
+
+uint32_t ev_dispatch(void)
+{
+  uint32_t count = 0;
+  Event_t event;
+  EV_handler_t handler;
+  uint32_t latency;
+
+  while( ev_head != ev_tail ) {
+    ATOMIC_ACQUIRE();
+    event = ev_queue[ev_tail & EV_QUEUE_MASK];
+    /* Cleared first, so a signal raised while handling is not lost */
+    atomic_clear_bits(&ev_signalled, 1u << event.id);
+    ATOMIC_RELEASE();
+    ev_tail++;
+
+    handler = ev_handlers[event.id];
+    if( handler ) {
+      latency = get_usecs() - event.time;
+      ev_stats.latency_sum += latency;
+      ev_stats.latency_max = (latency > ev_stats.latency_max) ? latency : ev_stats.latency_max;
+      ev_stats.dispatched++;
+      handler(event.data);
+      count++;
+    }
+  }
+
+  return count;
+}
+
+void ev_run(void)
+{
+  uint32_t start;
+
+  while( !ev_stopped ) {
+    ev_dispatch();
+    tw_run();
+    if( !ev_ready() && !ev_stopped ) {
+      /* Anything short of the flush watermark goes out before sleeping */
+      LOG_FLUSH();
+      start = get_usecs();
+      ev_wait();
+      ev_stats.idle_us += get_usecs() - start;
+      ev_stats.wakeups++;
+    }
+  }
+}
+
+void ev_stop(void)
+{
+  ev_stopped = 1;
+}
+
+void ev_log_stats(void)
+{
+  uint32_t elapsed = get_usecs() - ev_start;
+
+  LOG_VAL(INFO, ev_stats.dispatched, "Events dispatched");
+  LOG_VAL(INFO, ev_stats.coalesced, "Events coalesced");
+  LOG_VAL(INFO, ev_stats.dropped, "Events dropped");
+  if( ev_stats.dispatched ) {
+    LOG_VAL(INFO, (uint32_t) (ev_stats.latency_sum / ev_stats.dispatched), "Event latency avg us");
+  }
+  LOG_VAL(INFO, ev_stats.latency_max, "Event latency max us");
+  LOG_VAL(INFO, ev_stats.wakeups, "Event loop wakeups");
+  if( elapsed ) {
+    LOG_VAL(INFO, (uint32_t) (ev_stats.idle_us * 100 / elapsed), "Idle percent");
+  }
+}
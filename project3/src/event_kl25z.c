@@ -0,0 +1,25 @@
+/**
+ * @file event_kl25z.c
+ * @brief Event loop sleep for the KL25Z
+ *
+ * The core sleeps with WFI until the next interrupt. Deep sleep (STOP) is not
+ * used, since it stops the PLL clocking UART0 and TPM0.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/07
+ **/
+
+#include "MKL25Z4.h"
+#include "core_cm0plus.h"
+#include "event.h"
+
+void ev_wait(void)
+{
+  /* With PRIMASK set, an interrupt arriving after the check still ends WFI.
+     Its handler runs once interrupts are enabled again. */
+  __disable_irq();
+  if( !ev_ready() ) {
+    __WFI();
+  }
+  __enable_irq();
+}
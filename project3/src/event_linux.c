@@ -0,0 +1,87 @@
+/**
+ * @file event_linux.c
+ * @brief Event loop sleep for Linux platforms
+ *
+ * File descriptors stand in for interrupt sources. The loop sleeps in
+ * epoll_wait() and signals the matching event for each readable descriptor.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/07
+ **/
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include "event.h"
+
+#define EV_MAX_FDS (4)
+
+typedef struct {
+  int fd;
+  Event_id_t id;
+  uint8_t always;   /* Not pollable (regular file), treat as always readable */
+} EV_fd_t;
+
+static int ev_epoll = -1;
+static EV_fd_t ev_fds[EV_MAX_FDS];
+static uint8_t ev_nfds;
+
+EV_status_t ev_watch_fd(int fd, Event_id_t id)
+{
+  struct epoll_event event = { 0 };
+
+  if( id >= EV_ID_MAX ) {
+    return EV_SIZE_ERR;
+  }
+  if( ev_nfds >= EV_MAX_FDS ) {
+    return EV_FULL;
+  }
+  if( ev_epoll < 0 ) {
+    ev_epoll = epoll_create1(EPOLL_CLOEXEC);
+  }
+
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  ev_fds[ev_nfds].fd = fd;
+  ev_fds[ev_nfds].id = id;
+  ev_fds[ev_nfds].always = (epoll_ctl(ev_epoll, EPOLL_CTL_ADD, fd, &event) < 0);
+  ev_nfds++;
+  return EV_OK;
+}
+
+void ev_unwatch_fd(int fd)
+{
+  for( uint8_t i = 0; i < ev_nfds; i++ ) {
+    if( ev_fds[i].fd == fd ) {
+      if( !ev_fds[i].always ) {
+        epoll_ctl(ev_epoll, EPOLL_CTL_DEL, fd, NULL);
+      }
+      ev_fds[i] = ev_fds[--ev_nfds];
+      return;
+    }
+  }
+}
+
+void ev_wait(void)
+{
+  struct epoll_event ready[EV_MAX_FDS];
+  int count;
+
+  for( uint8_t i = 0; i < ev_nfds; i++ ) {
+    if( ev_fds[i].always ) {
+      ev_signal(ev_fds[i].id);
+    }
+  }
+  if( ev_epoll < 0 ) {
+    return;
+  }
+
+  count = epoll_wait(ev_epoll, ready, EV_MAX_FDS, ev_ready() ? 0 : -1);
+  for( int i = 0; i < count; i++ ) {
+    for( uint8_t j = 0; j < ev_nfds; j++ ) {
+      if( ev_fds[j].fd == ready[i].data.fd ) {
+        ev_signal(ev_fds[j].id);
+      }
+    }
+  }
+}
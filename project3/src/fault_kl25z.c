@@ -0,0 +1,61 @@
+/**
+ * @file fault_kl25z.c
+ * @brief HardFault handler for the KL25Z
+ *
+ * Saves the faulting registers and the unflushed logs in the crash region
+ * (see crash_log.h), then resets. They are sent by the next logging_init().
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <stdint.h>
+#include "MKL25Z4.h"
+#include "core_cm0plus.h"
+#include "crash_log.h"
+
+/* xPSR bit set when the exception added a word to align the stack frame */
+#define FAULT_XPSR_ALIGNED (1u << 9)
+
+/* Called by HardFault_Handler() with the stacked registers */
+__attribute__((used, noreturn)) void fault_save(uint32_t *frame, uint32_t exc_return)
+{
+  Crash_regs_t regs;
+
+  regs.r0 = frame[0];
+  regs.r1 = frame[1];
+  regs.r2 = frame[2];
+  regs.r3 = frame[3];
+  regs.r12 = frame[4];
+  regs.lr = frame[5];
+  regs.pc = frame[6];
+  regs.xpsr = frame[7];
+  regs.sp = (uint32_t) &frame[8] + ((regs.xpsr & FAULT_XPSR_ALIGNED) ? 4 : 0);
+  regs.exc_return = exc_return;
+
+  log_crash(&regs);
+  NVIC_SystemReset();
+  while( 1 );
+}
+
+/* Bit 2 of EXC_RETURN picks the stack the registers were pushed on. The
+   handler is naked so nothing else is pushed before they are found. */
+__attribute__((naked)) void HardFault_Handler(void)
+{
+  __asm volatile(
+    "  movs r0, #4     \n"
+    "  mov  r1, lr     \n"
+    "  tst  r0, r1     \n"
+    "  beq  1f         \n"
+    "  mrs  r0, psp    \n"
+    "  b    2f         \n"
+    "1:                \n"
+    "  mrs  r0, msp    \n"
+    "2:                \n"
+    "  ldr  r2, 3f     \n"
+    "  bx   r2         \n"
+    "  .align 2        \n"
+    "3:                \n"
+    "  .word fault_save\n"
+  );
+}
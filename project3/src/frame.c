@@ -0,0 +1,136 @@
+/**
+ * @file frame.c
+ * @brief CRC-checked frames for the binary log stream
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "memory.h"
+#include "crc.h"
+#include "log_queue.h"
+#include "frame.h"
+
+static inline uint16_t frame_read16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t frame_read32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+void frame_init(Frame_t *f, void (*out)(uint8_t *data, size_t length), uint8_t record_header)
+{
+  f->out = out;
+  f->fill = 0;
+  f->seq = 0;
+  f->frame[0] = FRAME_SYNC0;
+  f->frame[1] = FRAME_SYNC1;
+  f->frame[5] = record_header;
+}
+
+Log_status_t frame_add(Frame_t *f, const uint8_t *header, size_t hlength,
+                       const uint8_t *data, size_t dlength)
+{
+  uint8_t *payload = &f->frame[FRAME_HEADER];
+
+  if( hlength + dlength > FRAME_PAYLOAD ) {
+    return LQ_SIZE_ERR;
+  }
+  if( f->fill + hlength + dlength > FRAME_PAYLOAD ) {
+    frame_flush(f);
+  }
+  my_memcpy( (uint8_t *) header, payload + f->fill, hlength );
+  my_memcpy( (uint8_t *) data, payload + f->fill + hlength, dlength );
+  f->fill += hlength + dlength;
+  return LQ_OK;
+}
+
+void frame_flush(Frame_t *f)
+{
+  uint8_t *end = &f->frame[FRAME_HEADER + f->fill];
+  uint32_t crc;
+
+  if( f->fill == 0 ) {
+    return;
+  }
+  f->frame[2] = f->fill & 0xff;
+  f->frame[3] = f->fill >> 8;
+  f->frame[4] = f->seq++;
+  crc = crc32(CRC32_INIT, &f->frame[2], FRAME_HEADER - 2 + f->fill);
+  end[0] = crc & 0xff;
+  end[1] = (crc >> 8) & 0xff;
+  end[2] = (crc >> 16) & 0xff;
+  end[3] = crc >> 24;
+  f->out(f->frame, FRAME_OVERHEAD + f->fill);
+  f->fill = 0;
+}
+
+void frame_reader_init(Frame_reader_t *r, uint8_t complete)
+{
+  r->complete = complete;
+  r->synced = 0;
+  r->seq = 0;
+  r->frames = 0;
+  r->lost = 0;
+  r->skipped = 0;
+}
+
+Log_status_t frame_next(Frame_reader_t *r, const uint8_t *buf, size_t length, size_t *pos,
+                        Frame_info_t *frame)
+{
+  const uint8_t *p;
+  size_t at;
+  uint16_t payload;
+
+  if( (r == NULL) || (buf == NULL) || (pos == NULL) || (frame == NULL) ) {
+    return LQ_NULL;
+  }
+
+  for( at = *pos; at + FRAME_OVERHEAD <= length; at++ ) {
+    p = &buf[at];
+    if( (p[0] != FRAME_SYNC0) || (p[1] != FRAME_SYNC1) ) {
+      continue;
+    }
+    payload = frame_read16(&p[2]);
+    if( payload > FRAME_LENGTH_MAX ) {
+      continue;
+    }
+    if( at + FRAME_OVERHEAD + payload > length ) {
+      if( r->complete ) {
+        continue;
+      }
+      /* Maybe the rest hasn't arrived yet */
+      break;
+    }
+    if( crc32(CRC32_INIT, &p[2], FRAME_HEADER - 2 + payload) !=
+        frame_read32(&p[FRAME_HEADER + payload]) ) {
+      continue;
+    }
+
+    if( r->synced ) {
+      r->lost += (uint8_t) (p[4] - r->seq);
+    }
+    r->synced = 1;
+    r->seq = p[4] + 1;
+    r->frames++;
+    r->skipped += at - *pos;
+    frame->payload = &p[FRAME_HEADER];
+    frame->length = payload;
+    frame->seq = p[4];
+    frame->record_header = p[5];
+    *pos = at + FRAME_OVERHEAD + payload;
+    return LQ_OK;
+  }
+
+  if( r->complete ) {
+    at = length;
+  }
+  r->skipped += at - *pos;
+  *pos = at;
+  return LQ_EMPTY;
+}
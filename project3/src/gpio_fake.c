@@ -2,32 +2,136 @@
  * @file gpio_fake.c
  * @brief Function declarations for fake GPIO
  *
- * Functions for initializing and configuring a fake GPIO 
+ * Functions for initializing and configuring a fake GPIO. The nRF chip select
+ * and chip enable pins drive the simulated nRF module.
+ *
+ * Every level change is recorded in a ring of GPIO_TRACE_SIZE transitions,
+ * timestamped with the simulated nRF clock so that pin activity lines up with
+ * the modeled SPI and radio timing.
  *
  * @author Jeff Schornick
  * @date 2017/07/31
  **/
 
 #include <stdint.h>
-#include "logger.h"
+#include <stddef.h>
+#include <stdio.h>
 #include "gpio.h"
+#include "nrf_sim.h"
+
+static GPIO_trace_t gpio_trace[GPIO_TRACE_SIZE];
+static size_t gpio_trace_head;   /* Next entry to write */
+static size_t gpio_trace_held;   /* Number of valid entries */
+
+/* Pin names and current levels, a pin is unknown until it has a name */
+static const char *gpio_names[GPIO_TRACE_PINS];
+static uint8_t gpio_levels[GPIO_TRACE_PINS];
+
+/* Forward a pin change to the simulated devices */
+static void gpio_fake_set(uint8_t pin, uint8_t level)
+{
+  if( pin == NRF_CS_PIN ) {
+    nrf_sim_cs(level);
+  }
+  else if( pin == NRF_CE_PIN ) {
+    nrf_sim_ce(level);
+  }
+}
 
+/* Record a level change in the trace ring */
+static void gpio_fake_record(const char *name, uint8_t pin, uint8_t level)
+{
+  if( (pin >= GPIO_TRACE_PINS) || (gpio_names[pin] && (gpio_levels[pin] == level)) ) {
+    return;
+  }
+  gpio_names[pin] = name;
+  gpio_levels[pin] = level;
+
+  gpio_trace[gpio_trace_head].time = nrf_sim_time();
+  gpio_trace[gpio_trace_head].pin = pin;
+  gpio_trace[gpio_trace_head].level = level;
+  gpio_trace_head = (gpio_trace_head + 1) % GPIO_TRACE_SIZE;
+  if( gpio_trace_held < GPIO_TRACE_SIZE ) {
+    gpio_trace_held++;
+  }
+}
 
-inline void gpio_high(GPIO_Type *gpio, uint8_t pin)
+void gpio_high(GPIO_Type *gpio, uint8_t pin)
 {
-  LOG_VAL(INFO, 1,gpio);
+  gpio_fake_record(gpio, pin, 1);
+  gpio_fake_set(pin, 1);
 }
 
-inline void gpio_low(GPIO_Type *gpio, uint8_t pin)
+void gpio_low(GPIO_Type *gpio, uint8_t pin)
 {
-  LOG_VAL(INFO, 0, gpio);
+  gpio_fake_record(gpio, pin, 0);
+  gpio_fake_set(pin, 0);
 }
 
 void gpio_spi_init(void)
 {
 }
 
+/* The simulated clock restarts, so earlier trace timestamps are meaningless */
 void gpio_nrf_init(void)
 {
+  nrf_sim_reset();
+  gpio_trace_clear();
+}
+
+void gpio_trace_clear(void)
+{
+  gpio_trace_head = 0;
+  gpio_trace_held = 0;
 }
 
+size_t gpio_trace_count(void)
+{
+  return gpio_trace_held;
+}
+
+const GPIO_trace_t *gpio_trace_get(size_t index)
+{
+  if( index >= gpio_trace_held ) {
+    return NULL;
+  }
+  index += GPIO_TRACE_SIZE + gpio_trace_head - gpio_trace_held;
+  return &gpio_trace[index % GPIO_TRACE_SIZE];
+}
+
+int8_t gpio_trace_write_vcd(const char *filename)
+{
+  FILE *vcd = fopen(filename, "w");
+  const GPIO_trace_t *t;
+  uint64_t time = 0;
+  uint8_t pin;
+
+  if( !vcd ) {
+    return -1;
+  }
+
+  /* Pins are identified by a single printable character, '!' onwards */
+  fprintf(vcd, "$timescale 1ns $end\n$scope module gpio $end\n");
+  for( pin = 0; pin < GPIO_TRACE_PINS; pin++ ) {
+    if( gpio_names[pin] ) {
+      fprintf(vcd, "$var wire 1 %c %s $end\n", '!' + pin, gpio_names[pin]);
+    }
+  }
+  fprintf(vcd, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+  for( pin = 0; pin < GPIO_TRACE_PINS; pin++ ) {
+    if( gpio_names[pin] ) {
+      fprintf(vcd, "x%c\n", '!' + pin);
+    }
+  }
+  fprintf(vcd, "$end\n");
+
+  for( size_t i = 0; (t = gpio_trace_get(i)); i++ ) {
+    if( t->time != time ) {
+      time = t->time;
+      fprintf(vcd, "#%llu\n", (unsigned long long) time);
+    }
+    fprintf(vcd, "%u%c\n", t->level, '!' + t->pin);
+  }
+
+  return (fclose(vcd) == 0) ? 0 : -1;
+}
@@ -12,18 +12,9 @@
 #include "MKL25Z4.h"
 #include "logger.h"
 #include "gpio.h"
+#include "nrf.h"
 
 
-__attribute__((always_inline)) inline void gpio_high(GPIO_Type *gpio, uint8_t pin)
-{
-  gpio->PSOR = (1<<pin);  // set (high)
-}
-
-__attribute__((always_inline)) inline void gpio_low(GPIO_Type *gpio, uint8_t pin)
-{
-  gpio->PCOR = (1<<pin);  // clear (low)
-}
-
 /**
  * @brief Sets the pin mux mode for a port/pin pair
  *
@@ -66,11 +57,29 @@ void gpio_nrf_init(void)
   NRF_CS_GPIO->PDDR |= (1<<NRF_CS_PIN);  /* 1 -> output mode */
   gpio_high(NRF_CS);  // High = disabled (active low)
 
-  // Set GPIO direction for nRF SPI CS as output
+  // Set GPIO direction for nRF CE as output
   set_mux_mode(NRF_CE_PORT, NRF_CE_PIN, GPIO_MUX_MODE);
   NRF_CE_GPIO->PDDR |= (1<<NRF_CE_PIN);  /* 1 -> output mode */
-  gpio_high(NRF_CE);  // High = disabled (active low)
+  gpio_low(NRF_CE);  // Low = standby (active high)
+
+  // Enable Port D clock for nRF IRQ
+  SIM->SCGC5 |= SIM_SCGC5_PORTD(1); // 1 = enabled
+
+  // IRQ is an open-drain, active low input. Interrupt on falling edge.
+  set_mux_mode(NRF_IRQ_PORT, NRF_IRQ_PIN, GPIO_MUX_MODE);
+  NRF_IRQ_GPIO->PDDR &= ~(1<<NRF_IRQ_PIN);  /* 0 -> input mode */
+  NRF_IRQ_PORT->PCR[NRF_IRQ_PIN] |= PORT_PCR_PE(1) | PORT_PCR_PS(1);  /* pull-up */
+  NRF_IRQ_PORT->PCR[NRF_IRQ_PIN] |= PORT_PCR_ISF(1) | PORT_PCR_IRQC(0xA);
+  NVIC_ClearPendingIRQ(NRF_IRQ_IRQn);
+  NVIC_EnableIRQ(NRF_IRQ_IRQn);
 
   LOG_STR(GPIO_INITIALIZED, "NRF pins");
 }
 
+
+void PORTD_IRQHandler(void)
+{
+  // Only the nRF IRQ pin interrupts on port D, SPI work is deferred
+  NRF_IRQ_PORT->ISFR = (1<<NRF_IRQ_PIN);  // write 1 to clear
+  nrf_irq();
+}
@@ -71,6 +71,45 @@ size_t read_str(char *str, size_t maxlen)
   return to_read;
 }
 
+/* Input is copied out of the UART queue into a linear buffer, so spans never
+   wrap and the buffer restarts once it has all been consumed */
+#define IO_IN_SIZE (64)
+
+static uint8_t io_in[IO_IN_SIZE];
+static size_t io_in_start;
+static size_t io_in_end;
+
+size_t io_input_read(void)
+{
+  size_t avail = UART_queued_rx();
+  size_t space = IO_IN_SIZE - io_in_end;
+  size_t to_read = (space <= avail) ? space : avail;
+
+  UART_receive_n(&io_in[io_in_end], to_read);
+  io_in_end += to_read;
+  return to_read;
+}
+
+size_t io_input_span(uint8_t **span)
+{
+  *span = &io_in[io_in_start];
+  return io_in_end - io_in_start;
+}
+
+void io_input_consume(size_t len)
+{
+  io_in_start += len;
+  if( io_in_start == io_in_end ) {
+    io_in_start = io_in_end = 0;
+  }
+}
+
+/* The serial port never ends */
+uint8_t io_input_eof(void)
+{
+  return 0;
+}
+
 void printchar(uint8_t chr)
 {
   UART_send(chr);
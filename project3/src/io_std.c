@@ -2,52 +2,359 @@
  * @file io_std.c
  * @brief C standard I/O routines conforming to a platform-independent API
  *
+ * Output is formatted into a private buffer and handed to the kernel with a
+ * single write(2) when the buffer fills or on io_flush(). Integers and hex
+ * bytes are formatted with lookup tables rather than printf().
+ *
+ * When the buffer fills, it is written out in whole IO_OUT_CHUNK blocks from
+ * an aligned address, which suits pipes and O_DIRECT files. io_flush() writes
+ * the partial block too, unless standard output was opened with O_DIRECT,
+ * which only takes whole blocks. That tail waits for the next block, or for
+ * io_finish() at exit, which drops O_DIRECT to write it. Output that can't be
+ * written is counted in `io_stats` and reported at exit.
+ *
+ * Input is read into a ring buffer with large reads, only after poll() says
+ * they won't block. Standard input isn't switched to O_NONBLOCK, since a
+ * terminal shares that flag with standard output and the shell.
+ *
  * @author Jeff Schornick
  * @date 2017/07/15
  **/
 
+#define _GNU_SOURCE
 #include <stdint.h>
-#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include "io.h"
+
+/* Write size while running, a multiple of PIPE_BUF and of disk blocks */
+#define IO_OUT_CHUNK (4096)
+#define IO_OUT_SIZE  (16 * IO_OUT_CHUNK)
+
+/* Longest formatted int32_t, "-2147483648" */
+#define IO_INT_MAX (11)
+
+static uint8_t io_out[IO_OUT_SIZE] __attribute__((aligned(IO_OUT_CHUNK)));
+static size_t io_out_len;
+static uint8_t io_out_started;
+
+/* Input ring, a power of two no larger than a process_chars() count */
+#define IO_IN_SIZE (32 * 1024)
+
+static uint8_t io_in[IO_IN_SIZE];
+static size_t io_in_head;  /* Free running, total bytes read    */
+static size_t io_in_tail;  /* Free running, total bytes consumed */
+static int io_in_fd = STDIN_FILENO;
+static uint8_t io_in_ended;
+
+/* "00" through "99", so each lookup produces two decimal digits */
+#define IO_DIGITS(tens) tens"0" tens"1" tens"2" tens"3" tens"4" \
+                        tens"5" tens"6" tens"7" tens"8" tens"9"
+static const char io_digits[200] =
+  IO_DIGITS("0") IO_DIGITS("1") IO_DIGITS("2") IO_DIGITS("3") IO_DIGITS("4")
+  IO_DIGITS("5") IO_DIGITS("6") IO_DIGITS("7") IO_DIGITS("8") IO_DIGITS("9");
+
+static const char io_hex[] = "0123456789abcdef";
+
+IO_stats_t io_stats;
+
+/* Hand bytes to the kernel, retrying partial and interrupted writes. Output
+   that can't be written is dropped and counted in `io_stats`. */
+static void io_write(const uint8_t *data, size_t len)
+{
+  ssize_t written;
+
+  while( len > 0 ) {
+    written = write(STDOUT_FILENO, data, len);
+    if( written < 0 ) {
+      if( errno == EINTR ) {
+        continue;
+      }
+      io_stats.errors++;
+      io_stats.dropped += len;
+      io_stats.last_error = errno;
+      return;
+    }
+    data += written;
+    len -= written;
+  }
+}
+
+/* Write out the whole chunks, keeping the partial one at the front */
+static void io_drain(void)
+{
+  size_t chunks = io_out_len & ~((size_t) IO_OUT_CHUNK - 1);
+
+  io_write(io_out, chunks);
+  memmove(io_out, io_out + chunks, io_out_len - chunks);
+  io_out_len -= chunks;
+}
+
+/* Make sure `len` bytes fit in the buffer, `len` must be below IO_OUT_CHUNK */
+static inline uint8_t *io_room(size_t len)
+{
+  if( !io_out_started ) {
+    io_out_started = 1;
+    atexit(io_finish);
+  }
+  if( IO_OUT_SIZE - io_out_len < len ) {
+    io_drain();
+  }
+  return &io_out[io_out_len];
+}
+
+static void io_append(const uint8_t *data, size_t len)
+{
+  size_t n;
+
+  while( len > 0 ) {
+    io_room(1);
+    n = IO_OUT_SIZE - io_out_len;
+    n = (len < n) ? len : n;
+    memcpy(&io_out[io_out_len], data, n);
+    io_out_len += n;
+    data += n;
+    len -= n;
+  }
+}
+
+/* Format `val` backwards from `end`, returning the first character */
+static char *io_format_int(int32_t val, char *end)
+{
+  uint32_t u = (val < 0) ? -(uint32_t) val : (uint32_t) val;
+  const char *pair;
+  char *p = end;
+
+  while( u >= 100 ) {
+    pair = &io_digits[(u % 100) * 2];
+    u /= 100;
+    *--p = pair[1];
+    *--p = pair[0];
+  }
+  if( u >= 10 ) {
+    *--p = io_digits[u * 2 + 1];
+    *--p = io_digits[u * 2];
+  }
+  else {
+    *--p = '0' + u;
+  }
+  if( val < 0 ) {
+    *--p = '-';
+  }
+  return p;
+}
 
 void print_str(const char *str)
 {
-  printf( "%s", str);
+  io_append( (const uint8_t *) str, strlen(str));
 }
 
 void print_n(uint8_t *str, size_t len)
 {
-  fwrite(str, 1, len, stdout);
+  io_append(str, len);
 }
 
 void print_int(int32_t val)
 {
-  printf( "%d", val);
+  char buf[IO_INT_MAX];
+  char *start = io_format_int(val, buf + IO_INT_MAX);
+  size_t len = buf + IO_INT_MAX - start;
+
+  memcpy(io_room(len), start, len);
+  io_out_len += len;
 }
 
+/* Right aligned in `padsize` characters, like "%*d" */
 void print_int_pad(int32_t val, uint8_t padsize)
 {
-  printf( "%*d", padsize, val);
+  char buf[IO_INT_MAX];
+  char *start = io_format_int(val, buf + IO_INT_MAX);
+  size_t len = buf + IO_INT_MAX - start;
+  size_t pad = (padsize > len) ? padsize - len : 0;
+  uint8_t *out = io_room(pad + len);
+
+  memset(out, ' ', pad);
+  memcpy(out + pad, start, len);
+  io_out_len += pad + len;
 }
 
 void print_bytes(uint8_t *data, size_t len)
 {
+  uint8_t *out;
+
   for(;len>0; len--) {
-    printf("%#04x ", *data++);
+    out = io_room(5);
+    out[0] = '0';
+    out[1] = 'x';
+    out[2] = io_hex[*data >> 4];
+    out[3] = io_hex[*data & 0xf];
+    out[4] = ' ';
+    io_out_len += 5;
+    data++;
   }
 }
 
+size_t io_input_read(void)
+{
+  struct pollfd ready = { .fd = io_in_fd, .events = POLLIN };
+  struct iovec iov[2];
+  size_t head = io_in_head & (IO_IN_SIZE - 1);
+  size_t space = IO_IN_SIZE - (io_in_head - io_in_tail);
+  ssize_t count;
+
+  if( io_in_ended || space == 0 ) {
+    return 0;
+  }
+  if( io_in_head == io_in_tail ) {
+    /* Empty, start over so the read lands in one span */
+    io_in_head = io_in_tail = head = 0;
+  }
+  if( poll(&ready, 1, 0) <= 0 ) {
+    return 0;
+  }
+
+  /* Free space runs from the head to the end of the ring, then wraps */
+  iov[0].iov_base = &io_in[head];
+  iov[0].iov_len = (head + space > IO_IN_SIZE) ? IO_IN_SIZE - head : space;
+  iov[1].iov_base = io_in;
+  iov[1].iov_len = space - iov[0].iov_len;
+  do {
+    count = readv(io_in_fd, iov, iov[1].iov_len ? 2 : 1);
+  } while( count < 0 && errno == EINTR );
+
+  if( count <= 0 ) {
+    /* End of file, or an error that will keep it from ever being read */
+    if( count == 0 || errno != EAGAIN ) {
+      io_in_ended = 1;
+    }
+    return 0;
+  }
+  io_in_head += count;
+  return count;
+}
+
+size_t io_input_span(uint8_t **span)
+{
+  size_t tail = io_in_tail & (IO_IN_SIZE - 1);
+  size_t len = io_in_head - io_in_tail;
+
+  *span = &io_in[tail];
+  return (tail + len > IO_IN_SIZE) ? IO_IN_SIZE - tail : len;
+}
+
+void io_input_consume(size_t len)
+{
+  io_in_tail += len;
+}
+
+uint8_t io_input_eof(void)
+{
+  return io_in_ended && (io_in_head == io_in_tail);
+}
+
+int io_input_open(const char *path)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  if( fd < 0 ) {
+    return -1;
+  }
+  if( io_in_fd != STDIN_FILENO ) {
+    close(io_in_fd);
+  }
+  io_in_fd = fd;
+  io_in_head = io_in_tail = 0;
+  io_in_ended = 0;
+  return fd;
+}
+
+int io_input_fd(void)
+{
+  return io_in_fd;
+}
+
 size_t read_str(char *str, size_t maxlen)
 {
-  return strlen( fgets(str, maxlen, stdin));
+  uint8_t *span;
+  size_t len;
+  size_t copied = 0;
+
+  io_input_read();
+  while( copied < maxlen - 1 && (len = io_input_span(&span)) > 0 ) {
+    len = (len < maxlen - 1 - copied) ? len : maxlen - 1 - copied;
+    memcpy(str + copied, span, len);
+    io_input_consume(len);
+    copied += len;
+  }
+  str[copied] = '\0';
+  return copied;
 }
 
 void printchar(uint8_t chr)
 {
-  putchar(chr);
+  *io_room(1) = chr;
+  io_out_len++;
 }
 
 void io_flush(void)
 {
-  fflush(stdout);
+  int flags = fcntl(STDOUT_FILENO, F_GETFL);
+
+  io_drain();
+  if( (flags < 0) || !(flags & O_DIRECT) ) {
+    io_write(io_out, io_out_len);
+    io_out_len = 0;
+  }
+}
+
+/* Copy a string or an integer into a message, returning its new end */
+static char *io_put_str(char *p, const char *str)
+{
+  size_t len = strlen(str);
+
+  memcpy(p, str, len);
+  return p + len;
+}
+
+static char *io_put_int(char *p, int32_t val)
+{
+  char buf[IO_INT_MAX];
+  char *start = io_format_int(val, buf + IO_INT_MAX);
+
+  memcpy(p, start, buf + IO_INT_MAX - start);
+  return p + (buf + IO_INT_MAX - start);
+}
+
+void io_finish(void)
+{
+  char msg[64];
+  char *p = msg;
+  int flags;
+
+  io_drain();
+  if( io_out_len > 0 ) {
+    /* O_DIRECT only writes whole blocks, the tail goes out without it */
+    flags = fcntl(STDOUT_FILENO, F_GETFL);
+    if( (flags >= 0) && (flags & O_DIRECT) ) {
+      fcntl(STDOUT_FILENO, F_SETFL, flags & ~O_DIRECT);
+    }
+    io_write(io_out, io_out_len);
+    io_out_len = 0;
+  }
+
+  if( io_stats.dropped ) {
+    p = io_put_str(p, "io: dropped ");
+    p = io_put_int(p, (int32_t) io_stats.dropped);
+    p = io_put_str(p, " bytes of output, errno ");
+    p = io_put_int(p, io_stats.last_error);
+    *p++ = '\n';
+    if( write(STDERR_FILENO, msg, p - msg) < 0 ) {
+      /* Nowhere left to report it */
+    }
+  }
 }
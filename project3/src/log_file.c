@@ -0,0 +1,179 @@
+/**
+ * @file log_file.c
+ * @brief Binary log records kept in a memory-mapped file (Linux)
+ *
+ * The header page and record area are mapped from the file together, then
+ * the record area again right after them, the same way ring_map() maps a
+ * ring.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "memory.h"
+#include "atomics.h"
+#include "logger.h"
+#include "log_queue.h"
+#include "ring_map.h"
+#include "log_file.h"
+
+/* Map the file's header page and records, with the records mapped twice */
+static uint8_t *lf_map(int fd, size_t header_size, size_t size)
+{
+  uint8_t *base;
+
+  base = mmap(NULL, header_size + 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if( base == MAP_FAILED ) {
+    return NULL;
+  }
+  if( (mmap(base, header_size + size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+            fd, 0) == MAP_FAILED) ||
+      (mmap(base + header_size + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+            fd, header_size) == MAP_FAILED) ) {
+    munmap(base, header_size + 2 * size);
+    return NULL;
+  }
+  return base;
+}
+
+Log_status_t lf_open(Log_file_t *lf, const char *path, size_t size, Log_file_policy_t policy)
+{
+  Log_file_header_t *header;
+  size_t header_size;
+  uint8_t *base;
+  int fd;
+
+  if( (lf == NULL) || (path == NULL) ) {
+    return LQ_NULL;
+  }
+  if( size == 0 ) {
+    return LQ_SIZE_ERR;
+  }
+
+  header_size = ring_map_size(sizeof(Log_file_header_t));
+  size = ring_map_size(size);
+
+  fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if( fd < 0 ) {
+    return LQ_ALLOC_ERR;
+  }
+  /* Allocate every block now, so a full disk can't fault a record store */
+  if( posix_fallocate(fd, 0, header_size + size) != 0 ) {
+    close(fd);
+    return LQ_ALLOC_ERR;
+  }
+  base = lf_map(fd, header_size, size);
+  /* The mappings hold on to the file */
+  close(fd);
+  if( base == NULL ) {
+    return LQ_ALLOC_ERR;
+  }
+
+  header = (Log_file_header_t *) base;
+  if( (memcmp(header->magic, LF_MAGIC, sizeof(header->magic)) != 0) ||
+      (header->version != LF_VERSION) ||
+      (header->header_size != header_size) ||
+      (header->size != size) ||
+      (header->record_header != LOG_HEADER_SIZE) ||
+      (header->head - header->tail > size) ) {
+    memset(header, 0, sizeof(*header));
+    header->version = LF_VERSION;
+    header->header_size = header_size;
+    header->size = size;
+    header->record_header = LOG_HEADER_SIZE;
+    /* Valid once the rest is */
+    ATOMIC_RELEASE();
+    memcpy(header->magic, LF_MAGIC, sizeof(header->magic));
+  }
+  header->policy = policy;
+
+  lf->header = header;
+  lf->records = base + header_size;
+  lf->size = size;
+  lf->header_size = header_size;
+
+  return LQ_OK;
+}
+
+Log_status_t lf_close(Log_file_t *lf)
+{
+  if( (lf == NULL) || (lf->header == NULL) ) {
+    return LQ_NULL;
+  }
+
+  munmap(lf->header, lf->header_size + 2 * lf->size);
+  lf->header = NULL;
+  lf->records = NULL;
+  lf->size = 0;
+
+  return LQ_OK;
+}
+
+Log_status_t lf_write(Log_file_t *lf, Log_t *item)
+{
+  Log_file_header_t *header;
+  size_t length;
+  uint64_t head;
+  uint64_t tail;
+  Log_t oldest;
+
+  if( (lf == NULL) || (lf->header == NULL) || (item == NULL) ) {
+    return LQ_NULL;
+  }
+
+  header = lf->header;
+  length = LOG_HEADER_SIZE + item->length;
+  if( length > lf->size ) {
+    header->dropped++;
+    return LQ_SIZE_ERR;
+  }
+
+  head = header->head;
+  tail = header->tail;
+  if( head + length - tail > lf->size ) {
+    if( header->policy == LF_STOP ) {
+      header->dropped++;
+      return LQ_FULL;
+    }
+    /* Give up whole records from the oldest, until this one fits */
+    do {
+      my_memcpy( lf->records + (tail % lf->size), (uint8_t *) &oldest, LOG_HEADER_SIZE );
+      /* A record running past the head is corrupt (a torn write before a
+         resume), none of the rest can be trusted so the file starts over */
+      if( (head - tail < LOG_HEADER_SIZE) ||
+          (oldest.length > head - tail - LOG_HEADER_SIZE) ) {
+        tail = head;
+        break;
+      }
+      tail += LOG_HEADER_SIZE + oldest.length;
+    } while( head + length - tail > lf->size );
+    /* Readers see the new tail before any of the old records change */
+    __atomic_store_n(&header->tail, tail, __ATOMIC_RELAXED);
+    ATOMIC_RELEASE();
+  }
+
+  /* Runs on into the second mapping if it wraps */
+  my_memcpy( (uint8_t *) item, lf->records + (head % lf->size), LOG_HEADER_SIZE );
+  my_memcpy( item->data, lf->records + (head % lf->size) + LOG_HEADER_SIZE, item->length );
+  __atomic_store_n(&header->head, head + length, __ATOMIC_RELEASE);
+
+  return LQ_OK;
+}
+
+Log_status_t lf_sync(Log_file_t *lf)
+{
+  if( (lf == NULL) || (lf->header == NULL) ) {
+    return LQ_NULL;
+  }
+  if( msync(lf->header, lf->header_size + lf->size, MS_SYNC) < 0 ) {
+    return LQ_ALLOC_ERR;
+  }
+  return LQ_OK;
+}
@@ -0,0 +1,229 @@
+/**
+ * @file log_mpsc.c
+ * @brief Multi-producer, single-consumer log queue for Linux
+ *
+ * Each record is a 32-bit commit word, then the log header and data, padded
+ * to LQM_ALIGN. The commit word is zero until the producer has copied the
+ * whole record, then holds the padded record length. The consumer zeroes each
+ * record as it removes it, so unreserved space always reads as uncommitted.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <string.h>
+#include "logger.h"
+#include "pool.h"
+#include "log_queue.h"
+#include "log_mpsc.h"
+
+#define LQM_POS_BITS (48)
+#define LQM_POS_MASK ((1ULL << LQM_POS_BITS) - 1)
+#define LQM_COMMIT_SIZE (sizeof(uint32_t))
+
+/* Bytes a record with `length` bytes of data takes on the queue */
+#define LQM_RECORD_SIZE(length) \
+  ((LQM_COMMIT_SIZE + LOG_HEADER_SIZE + (length) + LQM_ALIGN - 1) & ~(size_t) (LQM_ALIGN - 1))
+
+/* Bad sizes are refused before anything is allocated */
+static inline uint8_t lqm_size_ok(size_t size)
+{
+  return (size >= 64) && !(size & (size - 1)) && (size <= LQM_POS_MASK);
+}
+
+Log_status_t lqm_init_static(Log_mpsc_t *queue, uint8_t *storage, size_t size)
+{
+  if( (queue == NULL) || (storage == NULL) ) {
+    return LQ_NULL;
+  }
+  if( !lqm_size_ok(size) || ((uintptr_t) storage & (LQM_ALIGN - 1)) ) {
+    return LQ_SIZE_ERR;
+  }
+
+  /* Zero commit words, so the queue starts out empty */
+  memset(storage, 0, size);
+  queue->buffer = storage;
+  queue->size = size;
+  queue->head = 0;
+  queue->tail = 0;
+
+  return LQ_OK;
+}
+
+Log_status_t lqm_init(Log_mpsc_t *queue, size_t size)
+{
+  uint8_t *storage;
+
+  if( queue == NULL ) {
+    return LQ_NULL;
+  }
+  if( !lqm_size_ok(size) ) {
+    return LQ_SIZE_ERR;
+  }
+
+  storage = arena_alloc(size);
+  if( storage == NULL ) {
+    return LQ_ALLOC_ERR;
+  }
+  return lqm_init_static(queue, storage, size);
+}
+
+Log_status_t lqm_destroy(Log_mpsc_t *queue)
+{
+  if( queue == NULL ) {
+    return LQ_NULL;
+  }
+
+  arena_free(queue->buffer);
+  queue->buffer = NULL;
+  queue->size = 0;
+
+  return LQ_OK;
+}
+
+/* Copy `length` bytes onto the queue at byte `pos`, wrapping as needed */
+static void lqm_copy_in(Log_mpsc_t *queue, uint64_t pos, const uint8_t *bytes, size_t length)
+{
+  size_t offset = pos & (queue->size - 1);
+  size_t contiguous = queue->size - offset;
+
+  if( contiguous < length ) {
+    memcpy(&queue->buffer[offset], bytes, contiguous);
+    memcpy(queue->buffer, bytes + contiguous, length - contiguous);
+  }
+  else {
+    memcpy(&queue->buffer[offset], bytes, length);
+  }
+}
+
+static void lqm_copy_out(Log_mpsc_t *queue, uint64_t pos, uint8_t *bytes, size_t length)
+{
+  size_t offset = pos & (queue->size - 1);
+  size_t contiguous = queue->size - offset;
+
+  if( contiguous < length ) {
+    memcpy(bytes, &queue->buffer[offset], contiguous);
+    memcpy(bytes + contiguous, queue->buffer, length - contiguous);
+  }
+  else {
+    memcpy(bytes, &queue->buffer[offset], length);
+  }
+}
+
+static void lqm_clear(Log_mpsc_t *queue, uint64_t pos, size_t length)
+{
+  size_t offset = pos & (queue->size - 1);
+  size_t contiguous = queue->size - offset;
+
+  if( contiguous < length ) {
+    memset(&queue->buffer[offset], 0, contiguous);
+    memset(queue->buffer, 0, length - contiguous);
+  }
+  else {
+    memset(&queue->buffer[offset], 0, length);
+  }
+}
+
+static inline uint32_t *lqm_commit_word(Log_mpsc_t *queue, uint64_t pos)
+{
+  return (uint32_t *) &queue->buffer[pos & (queue->size - 1)];
+}
+
+Log_status_t lqm_add(Log_mpsc_t *queue, Log_t *item)
+{
+  size_t length;
+  uint64_t head;
+  uint64_t next;
+  uint64_t pos;
+  uint64_t tail;
+  uint16_t seq;
+  uint8_t full;
+
+  if( (queue == NULL) || (item == NULL) ) {
+    return LQ_NULL;
+  }
+
+  /* Reserve the space and take a sequence number in one step. Seeing the
+     consumer's tail (acquire) also means its clearing of the space is done. */
+  length = LQM_RECORD_SIZE(item->length);
+  head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+  do {
+    pos = head & LQM_POS_MASK;
+    seq = head >> LQM_POS_BITS;
+    tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    full = ((pos - tail) & LQM_POS_MASK) + length > queue->size;
+    next = full ? pos : ((pos + length) & LQM_POS_MASK);
+    next |= (uint64_t) (uint16_t) (seq + 1) << LQM_POS_BITS;
+  } while( !__atomic_compare_exchange_n(&queue->head, &head, next, 1,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) );
+
+  item->seq = seq;
+  if( full ) {
+    return LQ_FULL;
+  }
+  lqm_copy_in(queue, pos + LQM_COMMIT_SIZE, (uint8_t *) item, LOG_HEADER_SIZE);
+  if( item->length ) {
+    lqm_copy_in(queue, pos + LQM_COMMIT_SIZE + LOG_HEADER_SIZE, item->data, item->length);
+  }
+  /* Publish the record, the copies above are visible to whoever sees this */
+  __atomic_store_n(lqm_commit_word(queue, pos), (uint32_t) length, __ATOMIC_RELEASE);
+
+  return LQ_OK;
+}
+
+Log_status_t lqm_peek(Log_mpsc_t *queue, Log_t *item)
+{
+  uint64_t tail;
+
+  if( (queue == NULL) || (item == NULL) ) {
+    return LQ_NULL;
+  }
+
+  tail = queue->tail;
+  if( __atomic_load_n(lqm_commit_word(queue, tail), __ATOMIC_ACQUIRE) == 0 ) {
+    return LQ_EMPTY;
+  }
+  lqm_copy_out(queue, tail + LQM_COMMIT_SIZE, (uint8_t *) item, LOG_HEADER_SIZE);
+
+  return LQ_OK;
+}
+
+Log_status_t lqm_remove(Log_mpsc_t *queue, Log_t *item)
+{
+  size_t max_data;
+  size_t copy_size;
+  uint64_t tail;
+  uint32_t length;
+
+  if( (queue == NULL) || (item == NULL) ) {
+    return LQ_NULL;
+  }
+
+  tail = queue->tail;
+  length = __atomic_load_n(lqm_commit_word(queue, tail), __ATOMIC_ACQUIRE);
+  if( length == 0 ) {
+    return LQ_EMPTY;
+  }
+
+  /* Save the buffer size, the header read overwrites it */
+  max_data = item->length;
+  lqm_copy_out(queue, tail + LQM_COMMIT_SIZE, (uint8_t *) item, LOG_HEADER_SIZE);
+  copy_size = (max_data < item->length) ? max_data : item->length;
+  if( copy_size ) {
+    lqm_copy_out(queue, tail + LQM_COMMIT_SIZE + LOG_HEADER_SIZE, item->data, copy_size);
+  }
+  item->length = copy_size;
+
+  /* Clear the record before handing its space back to the producers */
+  lqm_clear(queue, tail, length);
+  __atomic_store_n(&queue->tail, (tail + length) & LQM_POS_MASK, __ATOMIC_RELEASE);
+
+  return LQ_OK;
+}
+
+size_t lqm_used(Log_mpsc_t *queue)
+{
+  uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+
+  return ((head & LQM_POS_MASK) - queue->tail) & LQM_POS_MASK;
+}
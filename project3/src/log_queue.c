@@ -8,14 +8,44 @@
  * @date 2017/07/27
 **/
 
-#include <stdlib.h>
+#include <stddef.h>
 #include "memory.h"
 #include "platform.h"
+#include "atomics.h"
+#include "pool.h"
 #include "logger.h"
 #include "log_queue.h"
+#ifndef KL25Z
+#include "ring_map.h"
+#endif
+
+Log_status_t lq_init_static(Log_q *queue, uint8_t *storage, size_t size)
+{
+  if( (queue == NULL) || (storage == NULL) ) {
+    return LQ_NULL;
+  }
+  if( size <= 0 ) {
+    return LQ_SIZE_ERR;
+  }
+
+  queue->buffer = storage;
+  queue->head = queue->buffer;
+  queue->tail = queue->buffer;
+  queue->size = size;
+  queue->added = 0;
+  queue->removed = 0;
+  queue->seq = 0;
+#ifndef KL25Z
+  queue->mapped = 0;
+#endif
+
+  return LQ_OK;
+}
 
 Log_status_t lq_init(Log_q *queue, size_t size)
 {
+  uint8_t *storage;
+
   if( queue == NULL ) {
     return LQ_NULL;
   }
@@ -23,18 +53,36 @@ Log_status_t lq_init(Log_q *queue, size_t size)
     return LQ_SIZE_ERR;
   }
 
-  queue->buffer = malloc( size );
-  if( queue->buffer == NULL )
+  storage = arena_alloc( size );
+  if( storage == NULL )
   {
     return LQ_ALLOC_ERR;
   }
-  queue->head = queue->buffer;
-  queue->tail = queue->buffer;
-  queue->size = size;
-  queue->free = size;
+  return lq_init_static(queue, storage, size);
+}
+
+#ifndef KL25Z
+Log_status_t lq_init_mapped(Log_q *queue, size_t size)
+{
+  uint8_t *storage;
+
+  if( queue == NULL ) {
+    return LQ_NULL;
+  }
+  if( size <= 0 ) {
+    return LQ_SIZE_ERR;
+  }
 
+  size = ring_map_size(size);
+  storage = ring_map(size);
+  if( storage == NULL ) {
+    return LQ_ALLOC_ERR;
+  }
+  lq_init_static(queue, storage, size);
+  queue->mapped = 1;
   return LQ_OK;
 }
+#endif
 
 Log_status_t lq_destroy(Log_q *queue)
 {
@@ -42,19 +90,35 @@ Log_status_t lq_destroy(Log_q *queue)
     return LQ_NULL;
   }
 
-  free((void *) queue->buffer);
+#ifndef KL25Z
+  if( queue->mapped ) {
+    ring_unmap(queue->buffer, queue->size);
+    queue->buffer = NULL;
+    queue->mapped = 0;
+  }
+#endif
+  arena_free((void *) queue->buffer);
   queue->buffer = NULL;
   queue->size = 0;
-  queue->free = 0;
+  queue->added = 0;
+  queue->removed = 0;
 
   return LQ_OK;
 }
 
 /* internal use only, does not perform any checking */
-void lq_add_bytes(Log_q *queue, uint8_t *bytes, size_t length)
+RAMFUNC void lq_add_bytes(Log_q *queue, uint8_t *bytes, size_t length)
 {
   size_t contiguous = (queue->buffer + queue->size) - queue->head;
-  if( contiguous < length )  /* wrap required */
+  if( LQ_MAPPED(queue) )  /* runs on into the second mapping, no split */
+  {
+    my_memcpy( bytes, (uint8_t *) queue->head, length );
+    queue->head += length;
+    if( contiguous <= length ) {
+      queue->head -= queue->size;
+    }
+  }
+  else if( contiguous < length )  /* wrap required */
   {
     // First copy the data which fits up to the end of the buffer
     my_memcpy( bytes, (uint8_t *) queue->head, contiguous );
@@ -68,35 +132,66 @@ void lq_add_bytes(Log_q *queue, uint8_t *bytes, size_t length)
     my_memcpy( bytes, (uint8_t *) queue->head, length);
     queue->head += length;
   }
-
-  queue->free -= length;
 }
 
-Log_status_t lq_add(Log_q *queue, Log_t *item)
+/* Copy the item onto the queue, for one producer at a time. The data is in
+   place before `added` counts it, and the consumer won't read it until then. */
+__attribute__((always_inline)) static inline Log_status_t lq_push(Log_q *queue, Log_t *item)
 {
-  if( queue == NULL ) {
-    return LQ_NULL;
-  }
+  size_t length = LOG_HEADER_SIZE + item->length;
 
+  item->seq = queue->seq++;
   /* The item header and data will be stored directly on the queue, but not the data pointer */
-  if( queue->free < (LOG_HEADER_SIZE + item->length) ) {
+  if( lq_free(queue) < length ) {
     return LQ_FULL;
   }
-
-  START_CRITICAL();
+  ATOMIC_ACQUIRE();
   lq_add_bytes(queue, (uint8_t *) item, LOG_HEADER_SIZE);
   lq_add_bytes(queue, item->data, item->length);
-  END_CRITICAL();
+  ATOMIC_RELEASE();
+  queue->added += length;
 
   return LQ_OK;
 }
 
+RAMFUNC Log_status_t lq_add(Log_q *queue, Log_t *item)
+{
+  Log_status_t status;
+
+  if( queue == NULL ) {
+    return LQ_NULL;
+  }
+
+  START_CRITICAL();
+  status = lq_push(queue, item);
+  END_CRITICAL();
+
+  return status;
+}
+
+RAMFUNC Log_status_t lq_add_spsc(Log_q *queue, Log_t *item)
+{
+  if( queue == NULL ) {
+    return LQ_NULL;
+  }
+
+  return lq_push(queue, item);
+}
+
 
 /* internal use only, does not perform any checking */
 void lq_remove_bytes(Log_q *queue, uint8_t *bytes, size_t length)
 {
   size_t contiguous = (queue->buffer + queue->size) - queue->tail;
-  if( contiguous < length )  /* wrap required */
+  if( LQ_MAPPED(queue) )  /* runs on into the second mapping, no split */
+  {
+    my_memcpy( (uint8_t *) queue->tail, bytes, length );
+    queue->tail += length;
+    if( contiguous <= length ) {
+      queue->tail -= queue->size;
+    }
+  }
+  else if( contiguous < length )  /* wrap required */
   {
     // First copy the data which fits up to the end of the buffer
     my_memcpy( (uint8_t *) queue->tail, bytes, contiguous );
@@ -110,7 +205,6 @@ void lq_remove_bytes(Log_q *queue, uint8_t *bytes, size_t length)
     my_memcpy( (uint8_t *) queue->tail, bytes, length );
     queue->tail += length;
   }
-  queue->free += length;
 }
 
 /* internal only, no checking! */
@@ -120,7 +214,31 @@ void lq_drop_bytes(Log_q *queue, size_t length)
   if( queue->tail >= (queue->buffer + queue->size) ) {
     queue->tail -= queue->size;
   }
-  queue->free += length;
+}
+
+Log_status_t lq_peek(Log_q *queue, Log_t *item)
+{
+  size_t contiguous;
+
+  if( (queue == NULL) || (item == NULL) ) {
+    return LQ_NULL;
+  }
+  if( lq_empty(queue) ) {
+    return LQ_EMPTY;
+  }
+
+  ATOMIC_ACQUIRE();
+  contiguous = (queue->buffer + queue->size) - queue->tail;
+  if( !LQ_MAPPED(queue) && (contiguous < LOG_HEADER_SIZE) ) {
+    my_memcpy( (uint8_t *) queue->tail, (uint8_t *) item, contiguous );
+    my_memcpy( (uint8_t *) queue->buffer, (uint8_t *) item + contiguous,
+               LOG_HEADER_SIZE - contiguous );
+  }
+  else {
+    my_memcpy( (uint8_t *) queue->tail, (uint8_t *) item, LOG_HEADER_SIZE );
+  }
+
+  return LQ_OK;
 }
 
 Log_status_t lq_remove(Log_q *queue, Log_t *item)
@@ -134,17 +252,22 @@ Log_status_t lq_remove(Log_q *queue, Log_t *item)
 
   size_t max_data = item->length;  /* save so we don't copy in too much data */
   size_t copy_size;
+  size_t length;
 
-  START_CRITICAL();
+  /* Only the consumer moves the tail, the item is copied out before
+     `removed` hands its space back to the producer */
+  ATOMIC_ACQUIRE();
   /* read header */
   lq_remove_bytes(queue, (uint8_t *) item, LOG_HEADER_SIZE);
+  length = LOG_HEADER_SIZE + item->length;
   copy_size = (max_data < item->length) ? max_data : item->length;
   /* read data */
   lq_remove_bytes(queue, item->data, copy_size);
   if( copy_size < item->length ) {
     lq_drop_bytes(queue, item->length - copy_size);
   }
-  END_CRITICAL();
+  ATOMIC_RELEASE();
+  queue->removed += length;
 
   item->length = copy_size;
 
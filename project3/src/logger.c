@@ -7,20 +7,171 @@
  * @date 2017/07/27
  **/
 
-#include <stdlib.h>
 #include <string.h>
 
 #include "io.h"
 #include "conversion.h"
 #include "log_queue.h"
+#include "platform.h"
 #include "timer.h"
+#include "event.h"
 #include "logger.h"
+#include "pool.h"
+#ifdef KL25Z
+#include "crash_log.h"
+#else
+#include "log_mpsc.h"
+#endif
+#ifdef LOG_OUT_LZ
+#include "lz.h"
+#endif
+#ifdef LOG_OUT_FRAMED
+#include "frame.h"
+#endif
+#ifdef LOG_OUT_FILE
+#ifdef KL25Z
+#error "LOG_OUT_FILE is for Linux builds, the KL25Z has no files"
+#endif
+#include "log_file.h"
+#endif
+#ifdef LOG_MUTEX
+#ifdef KL25Z
+#error "LOG_MUTEX is for Linux builds, the KL25Z queues mask interrupts"
+#endif
+#include <pthread.h>
+#endif
 
+#ifdef KL25Z
 #define SYSTEM_LOG_SIZE (1000)
+#else
+#define SYSTEM_LOG_SIZE (256 * 1024)
+#endif
+
+#if defined(LOG_SHARDS) && defined(KL25Z)
+/* Thread mode, plus one per NVIC priority level */
+#define LOG_SHARD_COUNT (1 + (1 << __NVIC_PRIO_BITS))
+/* Thread mode keeps the full log, interrupt handlers only log a little */
+#define LOG_SHARD_SIZE(shard) ((shard) ? 128 : SYSTEM_LOG_SIZE)
+#define LOG_STORAGE_SIZE (SYSTEM_LOG_SIZE + (LOG_SHARD_COUNT - 1) * 128)
+#elif defined(LOG_SHARDS)
+#define LOG_SHARD_COUNT (8)
+#define LOG_SHARD_SIZE(shard) (SYSTEM_LOG_SIZE / LOG_SHARD_COUNT)
+#define LOG_STORAGE_SIZE (SYSTEM_LOG_SIZE)
+#else
+#define LOG_SHARD_COUNT (1)
+#define LOG_SHARD_SIZE(shard) (SYSTEM_LOG_SIZE)
+#define LOG_STORAGE_SIZE (SYSTEM_LOG_SIZE)
+#endif
+
+#ifdef KL25Z
+#define LOG_SHARD_ALIGN (4)
+#else
+#define LOG_SHARD_ALIGN (64)  /* One cache line each, so shards don't share */
+#endif
+
+/* Shard queues. Linux threads share the lock-free multi-producer queue,
+   unless LOG_MUTEX selects Log_q with a mutex (to benchmark against). On the
+   KL25Z, a single queue is shared by every priority, so lq_add() masks
+   interrupts. Each shard has one producer at a time and adds without. */
+#if defined(KL25Z) || defined(LOG_MUTEX)
+typedef Log_q Log_shard_q_t;
+#define log_q_init(q, storage, size) lq_init_static(q, storage, size)
+#if defined(KL25Z) && defined(LOG_SHARDS)
+#define log_q_add(q, log)    lq_add_spsc(q, log)
+#else
+#define log_q_add(q, log)    lq_add(q, log)
+#endif
+#define log_q_peek(q, log)   lq_peek(q, log)
+#define log_q_remove(q, log) lq_remove(q, log)
+#define log_q_used(q)        lq_used(q)
+#else
+typedef Log_mpsc_t Log_shard_q_t;
+#define log_q_init(q, storage, size) lqm_init_static(q, storage, size)
+#define log_q_add(q, log)    lqm_add(q, log)
+#define log_q_peek(q, log)   lqm_peek(q, log)
+#define log_q_remove(q, log) lqm_remove(q, log)
+#define log_q_used(q)        lqm_used(q)
+#endif
+
+/* Longest data a flush prints, anything past this is dropped */
+#define LOG_FLUSH_MAX (50)
+
+/* Largest LOG_VAL() data, the value and its name. Longer names are cut short
+   so the whole record, terminator included, survives the flush. */
+#define LOG_VAL_SIZE (LOG_FLUSH_MAX)
+
+typedef struct {
+  Log_shard_q_t queue;
+  #ifdef LOG_MUTEX
+  pthread_mutex_t lock;    /* Taken by the producers and the flush */
+  #endif
+} __attribute__((aligned(LOG_SHARD_ALIGN))) Log_shard_t;
+
+static Log_shard_t log_shards[LOG_SHARD_COUNT];
+
+/* Shard queues are carved out of one static block, in shard order */
+static LQ_STORAGE(log_storage, LOG_STORAGE_SIZE, LOG_SHARD_ALIGN);
+
+/* Flush state, the flush is the only consumer. A shard's oldest header stays
+   valid until the flush removes it. */
+static Log_t log_heads[LOG_SHARD_COUNT];
+static uint8_t log_head_valid[LOG_SHARD_COUNT];
 
-Log_q system_log;
 uint32_t log_epoch;
 
+#ifdef LOG_MUTEX
+#define LOG_LOCK(shard) pthread_mutex_lock(&(shard)->lock)
+#define LOG_UNLOCK(shard) pthread_mutex_unlock(&(shard)->lock)
+#else
+#define LOG_LOCK(shard)
+#define LOG_UNLOCK(shard)
+#endif
+
+#ifdef KL25Z
+#define log_in_loop() (1)
+#else
+/* The event queue belongs to the thread that started logging. Other threads
+   can't signal it, their logs go out with that thread's next flush. */
+static __thread uint8_t log_loop_thread;
+#define log_in_loop() (log_loop_thread)
+#endif
+
+#if LOG_SHARD_COUNT == 1
+#define log_shard() (&log_shards[0])
+#elif defined(KL25Z)
+/* Handlers at the same priority can't preempt each other, so each shard only
+   has one producer running at a time. NMI and HardFault preempt any handler,
+   including each other, so they get no shard (NULL) and can't log. */
+static inline Log_shard_t *log_shard(void)
+{
+  uint32_t exception = __get_IPSR() & 0x3f;
+
+  if( exception == 0 ) {
+    return &log_shards[0];
+  }
+  if( exception < 11 ) {
+    return NULL;
+  }
+  return &log_shards[1 + NVIC_GetPriority( (IRQn_Type) (exception - 16))];
+}
+#else
+static __thread Log_shard_t *log_thread_shard;
+static uint8_t log_next_shard;
+
+/* Threads take shards in turn, sharing only once there are more threads than
+   shards */
+static inline Log_shard_t *log_shard(void)
+{
+  uint8_t next;
+
+  if( log_thread_shard == NULL ) {
+    next = __atomic_fetch_add(&log_next_shard, 1, __ATOMIC_RELAXED);
+    log_thread_shard = &log_shards[next % LOG_SHARD_COUNT];
+  }
+  return log_thread_shard;
+}
+#endif
+
 /* ** RAW LOGGING **/
 
 void log_raw_data(uint8_t *data, size_t length)
@@ -40,21 +191,53 @@ void log_raw_int(int32_t val)
 
 /* ** QUEUED LOGGING **/
 
+/* Stamp a log with the current time (Log_t is packed, so no member pointers) */
+static void log_stamp(Log_t *log)
+{
+  uint32_t secs;
+  uint32_t usecs;
+  get_timestamp(&secs, &usecs);
+  log->time = secs;
+  log->us = usecs;
+}
+
+/* Queue a stamped log on the caller's shard. The event loop is asked to flush
+   once the shard is 3/4 full, before logs are lost. */
+static void log_add(Log_t *log)
+{
+  Log_shard_t *shard = log_shard();
+  Log_shard_q_t *queue;
+
+  #if defined(LOG_SHARDS) && defined(KL25Z)
+  if( shard == NULL ) {
+    return;
+  }
+  #endif
+  queue = &shard->queue;
+  log->shard = shard - log_shards;
+  LOG_LOCK(shard);
+  log_q_add(queue, log);
+  LOG_UNLOCK(shard);
+  if( log_in_loop() && log_q_used(queue) >= queue->size * 3 / 4 ) {
+    ev_signal(EV_LOG_FLUSH);
+  }
+}
+
 void log_item(Log_t *item)
 {
-  item->time = get_time();
-  lq_add(&system_log, item);
+  log_stamp(item);
+  log_add(item);
 }
 
 void logx(Log_id_t id, Log_data_t type, void *data, size_t length)
 {
   Log_t log;
-  log.time = get_time();
+  log_stamp(&log);
   log.id = id;
   log.type = type;
   log.length = length;
   log.data = data;
-  lq_add(&system_log, &log);
+  log_add(&log);
 }
 
 void log_data(Log_id_t id, void *data, size_t length)
@@ -75,17 +258,24 @@ void log_int(Log_id_t id, int32_t val)
 void log_val(Log_id_t id, int32_t val, char *name)
 {
   Log_t log;
-  log.time = get_time();
+  uint8_t data[LOG_VAL_SIZE];
+  size_t name_len = strlen(name);
+
+  /* Only needed until log_add() has copied it into the queue */
+  log.data = data;
+  if( name_len > LOG_VAL_SIZE - sizeof(val) - 1 ) {
+    name_len = LOG_VAL_SIZE - sizeof(val) - 1;
+  }
+  log_stamp(&log);
   log.id = id;
   log.type = LD_NVAL;
-  log.length = sizeof(val) + strlen(name) + 1;
-  log.data = malloc(log.length);
+  log.length = sizeof(val) + name_len + 1;
 
   /* Data format is 4-byte integer, then the null-terminated string */
-  *( (uint32_t *) log.data) = val;
-  strncpy((char *) log.data+ sizeof(val), name, log.length-sizeof(val));
-  lq_add(&system_log, &log);
-  free(log.data);
+  memcpy(log.data, &val, sizeof(val));
+  memcpy(log.data + sizeof(val), name, name_len);
+  log.data[sizeof(val) + name_len] = '\0';
+  log_add(&log);
 }
 
 void log_id(Log_id_t id)
@@ -98,18 +288,105 @@ void log_info(const char *str)
   logx(INFO, LD_STR, (void *) str, strlen(str) + 1);
 }
 
+/* The shard holding the oldest log, NULL if all are empty. Within a shard,
+   logs are already in order. Logs stamped in the same microsecond go by
+   sequence number, so shards logging together interleave rather than one
+   shard's burst going first, then to the lower shard. */
+static Log_shard_t *log_oldest(void)
+{
+  Log_shard_t *shard;
+  Log_t *oldest = NULL;
+  uint8_t oldest_shard = 0;
+
+  for( uint8_t i = 0; i < LOG_SHARD_COUNT; i++ ) {
+    shard = &log_shards[i];
+    if( !log_head_valid[i] ) {
+      LOG_LOCK(shard);
+      log_head_valid[i] = (log_q_peek(&shard->queue, &log_heads[i]) == LQ_OK);
+      LOG_UNLOCK(shard);
+      if( !log_head_valid[i] ) {
+        continue;
+      }
+    }
+    if( (oldest == NULL) || (log_heads[i].time < oldest->time) ||
+        ((log_heads[i].time == oldest->time) && (log_heads[i].us < oldest->us)) ||
+        ((log_heads[i].time == oldest->time) && (log_heads[i].us == oldest->us) &&
+         ((int16_t) (log_heads[i].seq - oldest->seq) < 0)) ) {
+      oldest = &log_heads[i];
+      oldest_shard = i;
+    }
+  }
+  return oldest ? &log_shards[oldest_shard] : NULL;
+}
+
+#ifdef LOG_OUT_LZ
+static LZ_t log_lz;
+
+void log_send_lz(Log_t *log)
+{
+  lz_write(&log_lz, (uint8_t *) log, LOG_HEADER_SIZE);
+  lz_write(&log_lz, log->data, log->length);
+}
+#endif
+
+#ifdef LOG_OUT_FRAMED
+static Frame_t log_frame;
+
+void log_send_framed(Log_t *log)
+{
+  frame_add(&log_frame, (uint8_t *) log, LOG_HEADER_SIZE, log->data, log->length);
+}
+#endif
+
+/* Send out everything flushed so far */
+static void log_out_flush(void)
+{
+  #ifdef LOG_OUT_LZ
+  lz_flush(&log_lz);
+  #endif
+  #ifdef LOG_OUT_FRAMED
+  frame_flush(&log_frame);
+  #endif
+  io_flush();
+}
+
+static void log_flush_one(Log_shard_t *shard)
+{
+  /* Only one context flushes at a time, so this can be shared */
+  static uint8_t data[LOG_FLUSH_MAX];
+  Log_t log;
+  log.data = data;
+  log.length = LOG_FLUSH_MAX;
+  LOG_LOCK(shard);
+  log_q_remove(&shard->queue, &log);
+  LOG_UNLOCK(shard);
+  log_head_valid[shard - log_shards] = 0;
+  LOG_OUT(&log);
+}
+
 void log_flush(void)
 {
-  while( !lq_empty(&system_log) )
+  Log_shard_t *shard;
+
+  while( (shard = log_oldest()) != NULL )
   {
-    Log_t log;
-    log.data = malloc(50);
-    log.length = 50;
-    lq_remove(&system_log, &log);
-    LOG_OUT(&log);
-    free(log.data);
+    log_flush_one(shard);
   }
-  io_flush();
+  log_out_flush();
+}
+
+CR_status_t log_flush_cr(CR_t *cr)
+{
+  Log_shard_t *shard;
+
+  CR_BEGIN(cr);
+  while( (shard = log_oldest()) != NULL )
+  {
+    log_flush_one(shard);
+    CR_YIELD(cr);
+  }
+  log_out_flush();
+  CR_END(cr);
 }
 
 const char *log_id_str[] =
@@ -137,10 +414,26 @@ const char *log_id_str[] =
     "HEARTBEAT"
   };
 
+/* Print a string from log data, stopping at the end of the data if the flush
+   cut off its terminator */
+static void log_print_data_str(uint8_t *str, size_t len)
+{
+  uint8_t *end = memchr(str, '\0', len);
+
+  print_n(str, end ? (size_t) (end - str) : len);
+}
+
 // display log as ascii through output device
 void log_send_ascii(Log_t *log)
 {
+  int32_t val;
+
   print_int(log->time);
+  print_str(".");
+  for( uint32_t place = 100000; (place > 1) && (log->us < place); place /= 10 ) {
+    print_str("0");
+  }
+  print_int(log->us);
   print_str(" [");
   print_str( log_id_str[log->id] );
   print_str("] ");
@@ -148,15 +441,17 @@ void log_send_ascii(Log_t *log)
     case LD_NULL:
       break;
     case LD_INT:
-      print_int( *(log->data) );
+      memcpy(&val, log->data, sizeof(val));
+      print_int(val);
       break;
     case LD_STR:
-      print_str( (char *) log->data );
+      log_print_data_str(log->data, log->length);
       break;
     case LD_NVAL:
-      print_str( (char *) log->data+4);
+      memcpy(&val, log->data, sizeof(val));
+      log_print_data_str(log->data + sizeof(val), log->length - sizeof(val));
       print_str(" = ");
-      print_int(*((uint32_t *) log->data));
+      print_int(val);
       break;
     case LD_DATA:
       switch(log->id) {
@@ -178,19 +473,145 @@ void log_send_binary(Log_t *log)
   print_n(log->data, log->length);
 }
 
+#ifdef LOG_OUT_FILE
+#ifndef LOG_FILE_SIZE
+#define LOG_FILE_SIZE (16 * 1024 * 1024)
+#endif
+#ifdef LOG_FILE_STOP
+#define LOG_FILE_POLICY LF_STOP
+#else
+#define LOG_FILE_POLICY LF_WRAP
+#endif
+
+static Log_file_t log_file;
+
+void log_send_file(Log_t *log)
+{
+  lf_write(&log_file, log);
+}
+#endif
+
+#ifdef KL25Z
+/* Unflushed logs from a HardFault, kept over the reset */
+static NOINIT Crash_log_t log_crash_region;
+
+void log_crash(const Crash_regs_t *regs)
+{
+  crash_begin(&log_crash_region, regs);
+  for( uint8_t i = 0; i < LOG_SHARD_COUNT; i++ ) {
+    crash_add_queue(&log_crash_region, &log_shards[i].queue);
+  }
+  crash_seal(&log_crash_region);
+}
+
+/* Send a log now, ahead of anything queued */
+static void log_send_now(Log_id_t id, Log_data_t type, void *data, size_t length)
+{
+  Log_t log;
+
+  log_stamp(&log);
+  log.id = id;
+  log.type = type;
+  log.shard = 0;
+  log.seq = 0;
+  log.length = length;
+  log.data = data;
+  LOG_OUT(&log);
+}
+
+static void log_send_str(Log_id_t id, const char *str)
+{
+  log_send_now(id, LD_STR, (void *) str, strlen(str) + 1);
+}
+
+/* Send the name and value of a register saved at the fault */
+static void log_send_reg(uint32_t val, const char *name)
+{
+  uint8_t data[LOG_VAL_SIZE];
+  size_t name_len = strlen(name);
+
+  if( name_len > LOG_VAL_SIZE - sizeof(val) - 1 ) {
+    name_len = LOG_VAL_SIZE - sizeof(val) - 1;
+  }
+  memcpy(data, &val, sizeof(val));
+  memcpy(data + sizeof(val), name, name_len);
+  data[sizeof(val) + name_len] = '\0';
+  log_send_now(ERROR, LD_NVAL, data, sizeof(val) + name_len + 1);
+}
+
+/* Send the logs saved by a fault in the previous session, if there are any,
+   before any from this one */
+static void log_crash_drain(void)
+{
+  static uint8_t data[LOG_FLUSH_MAX];
+  const Crash_regs_t *regs = &log_crash_region.regs;
+  size_t pos = 0;
+  Log_t log;
+
+  if( !crash_valid(&log_crash_region) ) {
+    return;
+  }
+  log_send_str(ERROR, "Previous session faulted");
+  log_send_reg(regs->pc, "Fault PC");
+  log_send_reg(regs->lr, "Fault LR");
+  log_send_reg(regs->sp, "Fault SP");
+  log_send_reg(regs->xpsr, "Fault xPSR");
+  log_send_reg(log_crash_region.dropped, "Fault dropped");
+  log.data = data;
+  log.length = LOG_FLUSH_MAX;
+  while( crash_remove(&log_crash_region, &pos, &log) == LQ_OK ) {
+    LOG_OUT(&log);
+    log.length = LOG_FLUSH_MAX;
+  }
+  log_send_str(INFO, "Previous session end");
+  log_out_flush();
+  crash_clear(&log_crash_region);
+}
+#endif
+
 /* init the logging system? */
 void logging_init()
 {
+  uint8_t *storage = log_storage;
+
   #if defined(LOG_OUT_BINARY)
   print_str("Binlog_Start");
+  #elif defined(LOG_OUT_FILE)
+  if( lf_open(&log_file, LOG_OUT_FILE, LOG_FILE_SIZE, LOG_FILE_POLICY) != LQ_OK ) {
+    LOG_RAW_STRING("Log file failed to open!\n");
+  }
+  #elif defined(LOG_OUT_LZ)
+  /* The decoder needs the size of a record header, which differs by platform */
+  print_str("Binlog_LZ");
+  printchar(LOG_HEADER_SIZE);
+  lz_init(&log_lz, print_n);
+  #elif defined(LOG_OUT_FRAMED)
+  print_str("Binlog_Framed");
+  frame_init(&log_frame, print_n, LOG_HEADER_SIZE);
   #endif
   log_epoch = get_time();
-  if(lq_init(&system_log, SYSTEM_LOG_SIZE) == LQ_OK)
-  {
-    LOG_ID( LOGGER_INITIALIZED );
-  }
-  else
+  #ifdef KL25Z
+  log_crash_drain();
+  #else
+  log_loop_thread = 1;
+  #endif
+  for( uint8_t i = 0; i < LOG_SHARD_COUNT; i++ )
   {
-    LOG_RAW_STRING("Logger failed to initialize!\n");
+    log_head_valid[i] = 0;
+    #ifdef LOG_MUTEX
+    pthread_mutex_init(&log_shards[i].lock, NULL);
+    #endif
+    if(log_q_init(&log_shards[i].queue, storage, LOG_SHARD_SIZE(i)) != LQ_OK)
+    {
+      LOG_RAW_STRING("Logger failed to initialize!\n");
+      return;
+    }
+    storage += LOG_SHARD_SIZE(i);
   }
+  LOG_ID( LOGGER_INITIALIZED );
+}
+
+void log_mem_stats(void)
+{
+  arena_log_stats();
 }
@@ -0,0 +1,232 @@
+/**
+ * @file lz.c
+ * @brief Streaming LZ compression of the binary log, in framed blocks
+ *
+ * Greedy matching with one remembered position per hash, as in LZ4's fast
+ * mode. Compression costs a hash and a compare per input byte that isn't
+ * part of a match.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "lz.h"
+
+#define LZ_NONE (0xffff)
+#define LZ_BUF_SIZE (LZ_WINDOW + LZ_BLOCK)
+#define LZ_NIBBLE_MAX (15)
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t lz_hash(const uint8_t *p)
+{
+  return (lz_read32(p) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Write a length past the 15 the token holds, returning the new end */
+static uint8_t *lz_put_length(uint8_t *op, size_t length)
+{
+  while( length >= 255 ) {
+    *op++ = 255;
+    length -= 255;
+  }
+  *op++ = length;
+  return op;
+}
+
+/* Write a sequence, returning the new end, or NULL if it would pass `end` */
+static uint8_t *lz_put_sequence(uint8_t *op, uint8_t *end, const uint8_t *literals,
+                                size_t literal_count, size_t offset, size_t match)
+{
+  uint8_t *token = op++;
+  size_t match_code = match ? match - LZ_MIN_MATCH : 0;
+
+  /* Worst case: extra length bytes, the literals and the offset */
+  if( op + literal_count + (literal_count + match_code) / 255 + 4 > end ) {
+    return NULL;
+  }
+  *token = ((literal_count < LZ_NIBBLE_MAX ? literal_count : LZ_NIBBLE_MAX) << 4);
+  if( literal_count >= LZ_NIBBLE_MAX ) {
+    op = lz_put_length(op, literal_count - LZ_NIBBLE_MAX);
+  }
+  memcpy(op, literals, literal_count);
+  op += literal_count;
+  if( match ) {
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    *token |= (match_code < LZ_NIBBLE_MAX ? match_code : LZ_NIBBLE_MAX);
+    if( match_code >= LZ_NIBBLE_MAX ) {
+      op = lz_put_length(op, match_code - LZ_NIBBLE_MAX);
+    }
+  }
+  return op;
+}
+
+/* Compress buf[start, fill) into the frame and send it */
+static void lz_emit(LZ_t *lz)
+{
+  const uint8_t *buf = lz->buf;
+  uint8_t *payload = &lz->frame[LZ_FRAME_HEADER];
+  uint8_t *end = payload + (lz->fill - lz->start);
+  uint8_t *op = payload;
+  size_t raw = lz->fill - lz->start;
+  size_t ip = lz->start;
+  size_t anchor = ip;
+  size_t ref;
+  size_t match;
+  uint32_t h;
+
+  while( (op != NULL) && (ip + LZ_MIN_MATCH <= lz->fill) ) {
+    h = lz_hash(&buf[ip]);
+    ref = lz->hash[h];
+    lz->hash[h] = ip;
+    if( (ref == LZ_NONE) || (ip - ref > LZ_WINDOW) ||
+        (lz_read32(&buf[ref]) != lz_read32(&buf[ip])) ) {
+      ip++;
+      continue;
+    }
+    match = LZ_MIN_MATCH;
+    while( (ip + match < lz->fill) && (buf[ref + match] == buf[ip + match]) ) {
+      match++;
+    }
+    op = lz_put_sequence(op, end, &buf[anchor], ip - anchor, ip - ref, match);
+    ip += match;
+    anchor = ip;
+  }
+  if( op != NULL ) {
+    op = lz_put_sequence(op, end, &buf[anchor], lz->fill - anchor, 0, 0);
+  }
+
+  if( (op == NULL) || (op >= end) ) {
+    /* Didn't compress, send the block as it is */
+    memcpy(payload, &buf[lz->start], raw);
+    op = payload + raw;
+    raw |= LZ_STORED;
+  }
+  lz->frame[0] = raw & 0xff;
+  lz->frame[1] = raw >> 8;
+  lz->frame[2] = (op - payload) & 0xff;
+  lz->frame[3] = (op - payload) >> 8;
+  lz->out(lz->frame, op - lz->frame);
+  lz->start = lz->fill;
+}
+
+/* Once the buffer is full, keep the last LZ_WINDOW bytes as history */
+static void lz_slide(LZ_t *lz)
+{
+  uint16_t shift = lz->fill - LZ_WINDOW;
+
+  memmove(lz->buf, &lz->buf[shift], LZ_WINDOW);
+  for( uint32_t i = 0; i < (1 << LZ_HASH_BITS); i++ ) {
+    lz->hash[i] = (lz->hash[i] != LZ_NONE && lz->hash[i] >= shift) ? lz->hash[i] - shift : LZ_NONE;
+  }
+  lz->start = LZ_WINDOW;
+  lz->fill = LZ_WINDOW;
+}
+
+void lz_init(LZ_t *lz, void (*out)(uint8_t *data, size_t length))
+{
+  lz->out = out;
+  lz->start = 0;
+  lz->fill = 0;
+  memset(lz->hash, 0xff, sizeof(lz->hash));
+}
+
+void lz_write(LZ_t *lz, const uint8_t *data, size_t length)
+{
+  size_t n;
+
+  while( length ) {
+    /* Up to the end of the block, or of the buffer after a flush */
+    n = LZ_BLOCK - (lz->fill - lz->start);
+    if( n > LZ_BUF_SIZE - lz->fill ) {
+      n = LZ_BUF_SIZE - lz->fill;
+    }
+    if( n > length ) {
+      n = length;
+    }
+    memcpy(&lz->buf[lz->fill], data, n);
+    lz->fill += n;
+    data += n;
+    length -= n;
+    if( (lz->fill - lz->start == LZ_BLOCK) || (lz->fill == LZ_BUF_SIZE) ) {
+      lz_emit(lz);
+    }
+    if( lz->fill == LZ_BUF_SIZE ) {
+      lz_slide(lz);
+    }
+  }
+}
+
+void lz_flush(LZ_t *lz)
+{
+  if( lz->fill != lz->start ) {
+    lz_emit(lz);
+  }
+}
+
+size_t lz_decompress(const uint8_t *src, size_t length, uint8_t *dst, size_t history, size_t raw)
+{
+  const uint8_t *end = src + length;
+  size_t out = 0;
+  size_t count;
+  size_t offset;
+  uint8_t token;
+  uint8_t more;
+
+  while( src < end ) {
+    token = *src++;
+    count = token >> 4;
+    if( count == LZ_NIBBLE_MAX ) {
+      do {
+        if( src >= end ) {
+          return 0;
+        }
+        more = *src++;
+        count += more;
+      } while( more == 255 );
+    }
+    if( (count > (size_t) (end - src)) || (count > raw - out) ) {
+      return 0;
+    }
+    memcpy(&dst[out], src, count);
+    src += count;
+    out += count;
+    if( src == end ) {
+      break;  /* The last sequence has no match */
+    }
+
+    if( end - src < 2 ) {
+      return 0;
+    }
+    offset = src[0] | (src[1] << 8);
+    src += 2;
+    count = (token & LZ_NIBBLE_MAX) + LZ_MIN_MATCH;
+    if( (token & LZ_NIBBLE_MAX) == LZ_NIBBLE_MAX ) {
+      do {
+        if( src >= end ) {
+          return 0;
+        }
+        more = *src++;
+        count += more;
+      } while( more == 255 );
+    }
+    if( (offset == 0) || (offset > history + out) || (count > raw - out) ) {
+      return 0;
+    }
+    /* Byte at a time, the match may overlap what it copies */
+    for( ; count; count-- ) {
+      dst[out] = *(dst + out - offset);
+      out++;
+    }
+  }
+  return (out == raw) ? raw : 0;
+}
@@ -10,6 +10,7 @@
 
 #include <stdint.h>
 #include <stddef.h>  /* size_t, NULL */
+#include "platform.h"
 #include "memory.h"
 
 #ifdef MEMORY_USES_DMA
@@ -18,7 +19,7 @@
 
 #else
 
-uint8_t *my_memmove(uint8_t *src, uint8_t *dst, size_t length)
+RAMFUNC uint8_t *my_memmove(uint8_t *src, uint8_t *dst, size_t length)
 {
   /* NULL arguments are invalid, return 0 address to indicate failure */
   if ((src == NULL) || (dst == NULL) || (length <= 0))
@@ -49,7 +50,7 @@ uint8_t *my_memmove(uint8_t *src, uint8_t *dst, size_t length)
   return dst;
 }
 
-uint8_t *my_memset(uint8_t *src, size_t length, uint8_t value) {
+RAMFUNC uint8_t *my_memset(uint8_t *src, size_t length, uint8_t value) {
   /* NULL src is invalid */
   if ((src == NULL) || (length <= 0))
   {
@@ -67,7 +68,7 @@ uint8_t *my_memset(uint8_t *src, size_t length, uint8_t value) {
 }
 #endif
 
-uint8_t *my_memcpy(uint8_t *src, uint8_t *dst, size_t length) {
+RAMFUNC uint8_t *my_memcpy(uint8_t *src, uint8_t *dst, size_t length) {
   /* Per the project specification, my_memmove() performs an equivalent
      operation to my_memcopy(), though less stringent and allowing for potential
      corruption when the memory regions overlap. */
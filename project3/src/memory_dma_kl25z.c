@@ -4,6 +4,10 @@
  *
  * Functions which perform memory transfers via DMA on the KL25Z.
  *
+ * memmove_dma() is a coroutine (see coroutine.h) underneath. Overlapping moves
+ * are done as a chain of DMA blocks, and the coroutine returns to its caller
+ * while each one is in flight.
+ *
  * @author Jeff Schornick
  * @date 2017/07/27
 **/
@@ -65,15 +69,32 @@ uint8_t *memmove_dma8(uint8_t *src, uint8_t *dst, size_t length)
   return dst;
 }
 
-uint8_t *memmove_dma(uint8_t *src, uint8_t *dst, size_t length)
+/* Start a DMA block move, returning 0 if there is nothing to move */
+static uint8_t memmove_dma_block(uint8_t *src, uint8_t *dst, size_t length, uint8_t size)
 {
-  /* NULL arguments are invalid, return 0 address to indicate failure */
-  if ((src == NULL) || (dst == NULL) || (length <= 0))
-  {
-    return MEM_FAIL;
+  if( length == 0 ) {
+    return 0;
   }
+  dma_transfer(DMA_MEM_CHAN, src, dst, length, size, DMA_INC);
+  return 1;
+}
+
+void memmove_dma_start(MEM_move_t *m, uint8_t *src, uint8_t *dst, size_t length)
+{
+  m->src = src;
+  m->dst = dst;
+  m->length = length;
+  CR_INIT(&m->cr);
+}
+
+CR_status_t memmove_dma_cr(MEM_move_t *m)
+{
+  CR_BEGIN(&m->cr);
 
-  uint8_t *orig_dst = dst;
+  if ((m->src == NULL) || (m->dst == NULL) || (m->length == 0) || (m->src == m->dst))
+  {
+    CR_EXIT(&m->cr);
+  }
 
   // Src and dest need transfer using a common alignment
   //   Even if begin/end aren't on a boundary, we can still take advantage in the
@@ -83,38 +104,36 @@ uint8_t *memmove_dma(uint8_t *src, uint8_t *dst, size_t length)
   //         0x    1x       -> 16-bit  (only low bit matches)
   //         1y    0y       -> 16-bit  (only low bit matches)
   //         x0    y1       ->  8-bit  (low bit mismatch)
-  uint8_t src_align = (uint32_t ) src & 0x3;
-  uint8_t dst_align = (uint32_t ) dst & 0x3;
-  uint8_t dma_align = DMA_8_BIT;
-  uint32_t align_mask = ALIGN_MASK_8;
-  if ( src_align == dst_align) {
-    dma_align = DMA_32_BIT;
-    align_mask = ALIGN_MASK_32;
+  m->dma_align = DMA_8_BIT;
+  m->align_mask = ALIGN_MASK_8;
+  if ( ((uint32_t) m->src & 0x3) == ((uint32_t) m->dst & 0x3) ) {
+    m->dma_align = DMA_32_BIT;
+    m->align_mask = ALIGN_MASK_32;
   }
-  else if ((src_align & 0x1) == (dst_align & 0x1)) {
-    dma_align = DMA_16_BIT;
-    align_mask = ALIGN_MASK_16;
+  else if ( ((uint32_t) m->src & 0x1) == ((uint32_t) m->dst & 0x1) ) {
+    m->dma_align = DMA_16_BIT;
+    m->align_mask = ALIGN_MASK_16;
   }
 
   /* **  Source may be inside dest ** */
-  if( src > dst )
+  if( m->src > m->dst )
   {
     /* When src > dst, it is safe to start the copy at the first byte of src.
        The transfer can be performed in one shot without corruption. */
 
     // align start bytes of src/dst as best possible
     // Set any initial bytes aligned to 32-bit (length allowing)
-    if ( ((dma_align == DMA_16_BIT) || (dma_align == DMA_32_BIT)) && ( (uint32_t) src & 0x1) && (length >= 1) ) {
+    if ( (m->dma_align != DMA_8_BIT) && ( (uint32_t) m->src & 0x1) && (m->length >= 1) ) {
       // last bit of addreses are both 1, align to 0
-      *dst++ = *src++;
-      length--;
+      *m->dst++ = *m->src++;
+      m->length--;
     }
-    if ( (dma_align == DMA_32_BIT) && ( (uint32_t) src & 0x2) && (length >= 2) ) {
+    if ( (m->dma_align == DMA_32_BIT) && ( (uint32_t) m->src & 0x2) && (m->length >= 2) ) {
       // last 2 bits of address are 1x... align to 0x
-      my_memcpy(src, dst, 2);
-      src += 2;
-      dst += 2;
-      length -= 2;
+      my_memcpy(m->src, m->dst, 2);
+      m->src += 2;
+      m->dst += 2;
+      m->length -= 2;
     }
     // Start bytes are now optimally aligned
 
@@ -122,89 +141,105 @@ uint8_t *memmove_dma(uint8_t *src, uint8_t *dst, size_t length)
     //   If we don't overlap, tranfer and odd ends first, then do an efficient DMA of the middle,
     //   If we do overlap, we have to do the middle first, and wait for the DMA to complete if there are odd end bytes
 
-    if( (src >= dst+length) && (length & 0x3) && (length > 0) ) {
+    if( (m->src >= m->dst + m->length) && (m->length & 0x3) ) {
       // copy any unaligned end final bytes first
-      my_memcpy(src + MEM_ALIGN32(length), dst + MEM_ALIGN32(length), (length & 0x3));
+      my_memcpy(m->src + MEM_ALIGN32(m->length), m->dst + MEM_ALIGN32(m->length), (m->length & 0x3));
       // only the middle is left
-      length = MEM_ALIGN32(length);
-      dma_transfer(DMA_MEM_CHAN, src, dst, length, dma_align, DMA_INC);
+      m->length = MEM_ALIGN32(m->length);
+      if( memmove_dma_block(m->src, m->dst, m->length, m->dma_align) ) {
+        CR_WAIT_UNTIL(&m->cr, dma_transfer_complete);
+      }
     } else {
       // middle first, in dma_align sized chunks
-      dma_transfer(DMA_MEM_CHAN, src, dst, (length & align_mask), dma_align, DMA_INC);
-      src += (length & align_mask);
-      dst += (length & align_mask);
-      length -= (length & align_mask);
-      if ( length > 0 ) {
+      if( memmove_dma_block(m->src, m->dst, (m->length & m->align_mask), m->dma_align) ) {
+        CR_WAIT_UNTIL(&m->cr, dma_transfer_complete);
+      }
+      m->src += (m->length & m->align_mask);
+      m->dst += (m->length & m->align_mask);
+      m->length -= (m->length & m->align_mask);
+      if ( m->length > 0 ) {
         // have to copy odd ends last
-        dma_wait(DMA_MEM_CHAN);
-        my_memcpy(src, dst, length);
+        my_memcpy(m->src, m->dst, m->length);
       }
     }
-
-    // TODO: if we overlap and length ends oddly, we have to DMA < 32-bit... are we?
-    // TODO: verify if overlap offset < 4, we're doing 8/16 bit transfers (should be okay due to dma_align)
-
   }
 
 
   /* **  Dest may be inside source! ** */
-  else if (src < dst)
+  else
   {
     /* When src < dst, we need to avoid potentially overwriting the end of src
        before it is moved. Unfortunately, the DMA controller can't run the copy
        backwards, so alternately calculate the largest chunk that can be transfered.
        Worst case when dst-src=1, best case when dst-src>=len (on shot).
-       NOTE: At some chunk size it's probably best to use a temporary buffer
+       Each chunk must land before the next one is read.
      */
     // We're need to WORK BACKWARDS, so align END bytes to 32-bit
-    if ( ((dma_align == DMA_16_BIT) || (dma_align == DMA_32_BIT)) && !( (uint32_t) (src+length-1) & 0x1) && (length >= 1) ) {
+    if ( (m->dma_align != DMA_8_BIT) && !( (uint32_t) (m->src + m->length - 1) & 0x1) && (m->length >= 1) ) {
       // last bit of final addreses are both 0, align to 1 (so aligned when transfering 16-bit)
-      *(dst + length -1 ) = *(src + length - 1);
-      length--;
+      *(m->dst + m->length - 1) = *(m->src + m->length - 1);
+      m->length--;
     }
-    if ( (dma_align == DMA_32_BIT) && !( (uint32_t) (src+length-1) & 0x2) && (length >= 2) ) {
+    if ( (m->dma_align == DMA_32_BIT) && !( (uint32_t) (m->src + m->length - 1) & 0x2) && (m->length >= 2) ) {
       // last 2 bits of last addresses are 01... align to 11 (last 00..11 will be transfered as 32-bit)
-      my_memcpy(src+length-2, dst+length-2, 2);
-      length -= 2;
+      my_memcpy(m->src + m->length - 2, m->dst + m->length - 2, 2);
+      m->length -= 2;
     }
 
     // ends now aligned, copy middle and first bytes
-    size_t front_len = length & (~align_mask);
-    size_t offset = dst - src;
+    m->front_len = m->length & (~m->align_mask);
+    m->offset = m->dst - m->src;
     // when no overlap, copy any odd first bytes first so we can chunk DMA the middle
-    if( (length <= offset) && (front_len > 0) ) {
-      my_memcpy(src, dst, front_len);
-      src += front_len;
-      dst += front_len;
-      length -= front_len;
+    if( (m->length <= m->offset) && (m->front_len > 0) ) {
+      my_memcpy(m->src, m->dst, m->front_len);
+      m->src += m->front_len;
+      m->dst += m->front_len;
+      m->length -= m->front_len;
     }
 
     // The offset determines how much dma at a time
     // there is certainly a minimum offset for which dma is slower than CPU copies
-    while( length != 0 )
+    while( m->length != 0 )
     {
-      if ( length > offset)  /* partial transfer */
+      if ( m->length > m->offset )  /* partial transfer */
       {
-        length -= offset;
+        m->length -= m->offset;
         // if offset is unaligned, it would be reflected in dma_align
         // so we can alwasy transfer the full offset using dma_align-sized blocks
-        dma_transfer(DMA_MEM_CHAN, src+length, dst+length, offset, dma_align, DMA_INC);
+        memmove_dma_block(m->src + m->length, m->dst + m->length, m->offset, m->dma_align);
+        CR_WAIT_UNTIL(&m->cr, dma_transfer_complete);
       }
       else /* we can finish the transfer */
       {
-        front_len = length & (~align_mask);
-        dma_transfer(DMA_MEM_CHAN, src + front_len, dst + front_len, (length&align_mask), dma_align, DMA_INC);
-        if(front_len) {
-          dma_wait(DMA_MEM_CHAN);
-          my_memcpy(src, dst, front_len);
+        m->front_len = m->length & (~m->align_mask);
+        if( memmove_dma_block(m->src + m->front_len, m->dst + m->front_len,
+                              (m->length & m->align_mask), m->dma_align) ) {
+          CR_WAIT_UNTIL(&m->cr, dma_transfer_complete);
         }
-        length = 0;
+        if( m->front_len ) {
+          my_memcpy(m->src, m->dst, m->front_len);
+        }
+        m->length = 0;
       }
     }
+  }
+
+  CR_END(&m->cr);
+}
 
+uint8_t *memmove_dma(uint8_t *src, uint8_t *dst, size_t length)
+{
+  MEM_move_t move;
+
+  /* NULL arguments are invalid, return 0 address to indicate failure */
+  if ((src == NULL) || (dst == NULL) || (length <= 0))
+  {
+    return MEM_FAIL;
   }
 
-  return orig_dst;
+  memmove_dma_start(&move, src, dst, length);
+  CR_RUN(memmove_dma_cr(&move));
+  return dst;
 }
 
 
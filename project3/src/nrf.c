@@ -5,6 +5,15 @@
  * Functions for configuring and sending/receiving via a Nordic nRF 24L01+
  * module over SPI.
  *
+ * Every command is a single chip-select framed, full-duplex SPI transfer (see
+ * nrf_command()), which also captures the STATUS register the nRF clocks out
+ * with the command byte. Registers that only the host can modify are shadowed
+ * so that read-modify-write sequences need no extra SPI reads.
+ *
+ * Commands and the stream transmitter are coroutines (see coroutine.h) so they
+ * can give up the core while SPI transfers and the radio are busy. The usual
+ * blocking functions run them to completion.
+ *
  * @author Jeff Schornick
  * @date 2017/07/31
  **/
@@ -13,8 +22,64 @@
 #include "spi.h"
 #include "gpio.h"
 #include "logger.h"
+#include "memory.h"
 #include "nrf.h"
 
+/* Power down to standby transition (Tpd2stby), rounded up */
+#define NRF_POWER_UP_MS (2)
+
+/* Waits for the module run by the SPI backend's clock (see spi_idle()), so
+   they also work against the simulated module */
+#define NRF_IDLE() spi_idle()
+#define NRF_ELAPSED_US(start) (spi_time_us() - (start))
+
+/* Issue a command from within a coroutine, returning while it runs */
+#define NRF_CR_COMMAND(cr, c, cmd, tx, rx, length)    \
+  do {                                                 \
+    nrf_command_start((c), (cmd), (tx), (rx), (length)); \
+    CR_WAIT_CR((cr), nrf_command_cr(c));               \
+  } while(0)
+
+/* Cache valid flags */
+#define NRF_CACHED_CONFIG   (1<<0)
+#define NRF_CACHED_RF_SETUP (1<<1)
+#define NRF_CACHED_RF_CH    (1<<2)
+#define NRF_CACHED_TX_ADDR  (1<<3)
+#define NRF_CACHED_RX_PW(p) (1<<(4+(p)))
+
+/* Shadow copies of host-controlled registers */
+typedef struct {
+  uint16_t valid;
+  uint8_t config;
+  uint8_t rf_setup;
+  uint8_t rf_ch;
+  uint8_t tx_addr[NRF_ADDR_SIZE];
+  uint8_t rx_pw[NRF_NUM_PIPES];
+} NRF_cache_t;
+
+static NRF_cache_t nrf_cache;
+
+/* A received payload waiting for nrf_receive() */
+typedef struct {
+  uint8_t pipe;
+  uint8_t length;
+  uint8_t data[NRF_MAX_PAYLOAD];
+} NRF_packet_t;
+
+static NRF_packet_t nrf_rx_queue[NRF_RX_QUEUE_DEPTH];
+static NRF_packet_t nrf_rx_discard;  /* Read into when the queue is full */
+static uint8_t nrf_rx_head;   /* Oldest queued packet  */
+static uint8_t nrf_rx_count;  /* Number of queued packets */
+
+/* Set when dynamic payload length has been enabled */
+static uint8_t nrf_dynamic;
+
+volatile uint8_t nrf_irq_pending;
+
+/* STATUS clocked out during the most recent command */
+static uint8_t nrf_status;
+
+NRF_stats_t nrf_stats;
 
 __attribute__((always_inline)) static inline void nrf_chip_enable()
 {
@@ -40,47 +105,132 @@ __attribute__((always_inline)) static inline void nrf_transmit_disable()
   //nrf_write_register(NRF_REG_CONFIG, NRF_PWR_UP(0));
 }
 
-uint8_t nrf_read_register(uint8_t reg)
+/* Returns the shadow storage for `reg`, or NULL if it isn't cached */
+static uint8_t *nrf_cache_entry(uint8_t reg, uint16_t *flag)
 {
-  nrf_chip_enable();
+  if( (reg >= NRF_REG_RX_PW_P0) && (reg < NRF_REG_RX_PW_P0 + NRF_NUM_PIPES) ) {
+    *flag = NRF_CACHED_RX_PW(reg - NRF_REG_RX_PW_P0);
+    return &nrf_cache.rx_pw[reg - NRF_REG_RX_PW_P0];
+  }
+  switch(reg) {
+    case NRF_REG_CONFIG:
+      *flag = NRF_CACHED_CONFIG;
+      return &nrf_cache.config;
+    case NRF_REG_RF_SETUP:
+      *flag = NRF_CACHED_RF_SETUP;
+      return &nrf_cache.rf_setup;
+    case NRF_REG_RF_CH:
+      *flag = NRF_CACHED_RF_CH;
+      return &nrf_cache.rf_ch;
+    default:
+      return NULL;
+  }
+}
+
+/* Returns 1 with the shadowed value of `reg` if it is cached */
+static uint8_t nrf_cache_lookup(uint8_t reg, uint8_t *value)
+{
+  uint16_t flag;
+  uint8_t *entry = nrf_cache_entry(reg, &flag);
+  if( entry && (nrf_cache.valid & flag) ) {
+    nrf_stats.cache_hits++;
+    *value = *entry;
+    return 1;
+  }
+  return 0;
+}
 
-  spi_write_byte(NRF_CMD_READ|reg);
+/* Shadow a value read from or written to `reg`, if it is cached */
+static void nrf_cache_store(uint8_t reg, uint8_t value)
+{
+  uint16_t flag;
+  uint8_t *entry = nrf_cache_entry(reg, &flag);
+  if( entry ) {
+    *entry = value;
+    nrf_cache.valid |= flag;
+  }
+}
 
-  // The nRF automatically sends a status byte, read it before tyring to
-  // read the result
-  uint8_t status;
-  spi_read_byte(&status);
-  //log_val(status, "  R stat");
+void nrf_command_start(NRF_cmd_t *c, uint8_t cmd, const uint8_t *tx, uint8_t *rx, size_t length)
+{
+  if( length > NRF_MAX_PAYLOAD ) {
+    length = NRF_MAX_PAYLOAD;
+  }
+
+  /* Build the whole command up front so it goes out in one burst */
+  c->buf[0] = cmd;
+  if( tx ) {
+    my_memcpy( (uint8_t *) tx, &c->buf[1], length );
+  }
+  else if( length > 0 ) {
+    my_memset( &c->buf[1], length, NRF_CMD_NOP );
+  }
+  c->rx = rx;
+  c->length = length;
+  CR_INIT(&c->cr);
+}
 
-  uint8_t result;
-  spi_write_byte(NRF_CMD_NOP);
-  spi_read_byte(&result);
+CR_status_t nrf_command_cr(NRF_cmd_t *c)
+{
+  CR_BEGIN(&c->cr);
 
+  CR_WAIT_UNTIL(&c->cr, spi_acquire());
+  nrf_chip_enable();
+  spi_start(c->buf, c->buf, c->length + 1);
+  CR_WAIT_UNTIL(&c->cr, spi_poll());
   nrf_chip_disable();
-  return result;
+  spi_release();
+  nrf_stats.transactions++;
+
+  if( c->rx ) {
+    my_memcpy( &c->buf[1], c->rx, c->length );
+  }
+  c->status = c->buf[0];
+  nrf_status = c->status;
+
+  CR_END(&c->cr);
 }
 
-void nrf_write_register(uint8_t reg, uint8_t value)
+uint8_t nrf_command(uint8_t cmd, const uint8_t *tx, uint8_t *rx, size_t length)
 {
-  nrf_chip_enable();
+  NRF_cmd_t c;
 
-  spi_write_byte(NRF_CMD_WRITE|reg);
-  spi_write_byte(value);
+  nrf_command_start(&c, cmd, tx, rx, length);
+  CR_RUN(nrf_command_cr(&c));
+  return c.status;
+}
 
-  uint8_t status;
-  spi_read_byte(&status);
+uint8_t nrf_last_status(void)
+{
+  return nrf_status;
+}
 
-  nrf_chip_disable();
+void nrf_cache_invalidate(void)
+{
+  nrf_cache.valid = 0;
+}
+
+uint8_t nrf_read_register(uint8_t reg)
+{
+  uint8_t result;
+  if( nrf_cache_lookup(reg, &result) ) {
+    return result;
+  }
+
+  nrf_command(NRF_CMD_READ|reg, NULL, &result, 1);
+  nrf_cache_store(reg, result);
+  return result;
+}
+
+void nrf_write_register(uint8_t reg, uint8_t value)
+{
+  nrf_command(NRF_CMD_WRITE|reg, &value, NULL, 1);
+  nrf_cache_store(reg, value);
 }
 
 uint8_t nrf_read_status(void)
 {
-  uint8_t status;
-  nrf_chip_enable();
-  spi_write_byte(NRF_CMD_NOP);
-  spi_read_byte(&status);
-  nrf_chip_disable();
-  return status;
+  return nrf_command(NRF_CMD_NOP, NULL, NULL, 0);
 }
 
 
@@ -121,38 +271,381 @@ uint8_t nrf_read_fifo_status(void)
 
 void nrf_read_tx_addr(uint8_t * address)
 {
-  uint8_t status;
-  nrf_chip_enable();
+  if( nrf_cache.valid & NRF_CACHED_TX_ADDR ) {
+    nrf_stats.cache_hits++;
+  }
+  else {
+    nrf_command(NRF_CMD_READ|NRF_REG_TX_ADDR, NULL, nrf_cache.tx_addr, NRF_ADDR_SIZE);
+    nrf_cache.valid |= NRF_CACHED_TX_ADDR;
+  }
+  my_memcpy(nrf_cache.tx_addr, address, NRF_ADDR_SIZE);
+}
 
-  spi_write_byte(NRF_CMD_READ|NRF_REG_TX_ADDR);
-  spi_read_byte(&status);
-  spi_receive_packet( address, 5, NRF_CMD_NOP);
+void nrf_write_tx_addr(uint8_t * address)
+{
+  nrf_command(NRF_CMD_WRITE|NRF_REG_TX_ADDR, address, NULL, NRF_ADDR_SIZE);
+  my_memcpy(address, nrf_cache.tx_addr, NRF_ADDR_SIZE);
+  nrf_cache.valid |= NRF_CACHED_TX_ADDR;
+}
 
-  nrf_chip_disable();
+void nrf_flush_tx_fifo(void)
+{
+  nrf_command(NRF_CMD_FLUSH_TX, NULL, NULL, 0);
 }
 
-void nrf_write_tx_addr(uint8_t * address)
+void nrf_flush_rx_fifo(void)
 {
-  uint8_t status;
-  nrf_chip_enable();
+  nrf_command(NRF_CMD_FLUSH_RX, NULL, NULL, 0);
+}
 
-  spi_write_byte(NRF_CMD_WRITE|NRF_REG_TX_ADDR);
-  spi_read_byte(&status);
-  spi_send_packet( address, 5);
+/* Write 1 to clear the given STATUS flags. The returned STATUS was clocked out
+   before the write, so the cleared flags are masked off. */
+static uint8_t nrf_clear_irq(uint8_t flags)
+{
+  return nrf_command(NRF_CMD_WRITE|NRF_REG_STATUS, &flags, NULL, 1) & ~flags;
+}
 
-  nrf_chip_disable();
+/* CONFIG powered up in the requested mode */
+static inline uint8_t nrf_config_up(uint8_t config, uint8_t prim_rx)
+{
+  return (config & ~NRF_CNF_PRIM_RX_MASK) | NRF_CNF_PWR_UP(1) | NRF_CNF_PRIM_RX(prim_rx);
 }
 
-void nrf_flush_tx_fifo(void)
+/* Update CONFIG for the requested mode, waiting for the oscillator if the
+   module was powered down. Writes are skipped if nothing changes. */
+static void nrf_power_up(uint8_t prim_rx)
 {
-  nrf_chip_enable();
-  spi_write_byte(NRF_CMD_FLUSH_TX);
-  nrf_chip_disable();
+  uint8_t config = nrf_read_config();
+  uint8_t update = nrf_config_up(config, prim_rx);
+  uint32_t start;
+  if( update != config ) {
+    nrf_write_config(update);
+    if( !(config & NRF_CNF_PWR_MASK) ) {
+      start = spi_time_us();
+      while( NRF_ELAPSED_US(start) < NRF_POWER_UP_MS * 1000u ) {
+        NRF_IDLE();
+      }
+    }
+  }
 }
 
-void nrf_flush_rx_fifo(void)
+void nrf_init(void)
 {
-  nrf_chip_enable();
-  spi_write_byte(NRF_CMD_FLUSH_TX);
+  nrf_transmit_disable();
   nrf_chip_disable();
+  nrf_cache_invalidate();
+  nrf_dynamic = 0;
+  nrf_rx_head = 0;
+  nrf_rx_count = 0;
+  nrf_irq_pending = 0;
+  nrf_flush_tx_fifo();
+  nrf_flush_rx_fifo();
+  nrf_clear_irq(NRF_STAT_IRQ_MASK);
+}
+
+void nrf_enable_dynamic_payloads(uint8_t ack_payloads)
+{
+  uint8_t ack = ack_payloads ? 1 : 0;
+  nrf_write_register(NRF_REG_FEATURE, NRF_FEAT_EN_DPL(1) | NRF_FEAT_EN_ACK_PAY(ack));
+  nrf_write_register(NRF_REG_DYNPD, NRF_DYNPD_ALL_MASK);
+  nrf_dynamic = 1;
+}
+
+void nrf_start_rx(void)
+{
+  nrf_power_up(1);
+  nrf_transmit_enable();
+}
+
+void nrf_standby(void)
+{
+  nrf_transmit_disable();
+}
+
+NRF_status_t nrf_write_payload(const uint8_t *data, size_t length)
+{
+  if( (length == 0) || (length > NRF_MAX_PAYLOAD) ) {
+    return NRF_SIZE_ERR;
+  }
+  if( nrf_command(NRF_CMD_TX_PAYLOAD, data, NULL, length) & NRF_STAT_TX_FULL_MASK ) {
+    return NRF_FULL;
+  }
+  nrf_stats.tx_packets++;
+  return NRF_OK;
+}
+
+NRF_status_t nrf_write_ack_payload(uint8_t pipe, const uint8_t *data, size_t length)
+{
+  if( (length == 0) || (length > NRF_MAX_PAYLOAD) || (pipe >= NRF_NUM_PIPES) ) {
+    return NRF_SIZE_ERR;
+  }
+  if( nrf_command(NRF_CMD_W_ACK_PL|pipe, data, NULL, length) & NRF_STAT_TX_FULL_MASK ) {
+    return NRF_FULL;
+  }
+  return NRF_OK;
+}
+
+/* The receive queue entry `slot`, or the discard buffer past the end */
+static inline NRF_packet_t *nrf_rx_packet(uint8_t slot)
+{
+  return (slot < NRF_RX_QUEUE_DEPTH) ? &nrf_rx_queue[slot] : &nrf_rx_discard;
+}
+
+static void nrf_drain_start(NRF_drain_t *d, uint8_t status)
+{
+  d->status = status;
+  CR_INIT(&d->cr);
+}
+
+/* Read every payload in the RX FIFO into the receive queue. `status` must
+   reflect the current RX FIFO state. With dynamic payloads, R_RX_PL_WID
+   returns a fresh STATUS along with the width, so each packet costs two
+   transactions. A payload joins the queue once it has been read, and the
+   entry it goes to stays the same if nrf_receive() runs meanwhile. */
+static CR_status_t nrf_drain_cr(NRF_drain_t *d)
+{
+  NRF_packet_t *packet;
+
+  CR_BEGIN(&d->cr);
+
+  while( 1 )
+  {
+    if( nrf_dynamic ) {
+      NRF_CR_COMMAND(&d->cr, &d->cmd, NRF_CMD_R_RX_WID, NULL, &d->width, 1);
+      d->status = d->cmd.status;
+    }
+    d->pipe = NRF_STAT_PIPE(d->status);
+    if( d->pipe >= NRF_NUM_PIPES ) {
+      break;  /* RX FIFO empty */
+    }
+    if( !nrf_dynamic && !nrf_cache_lookup(NRF_REG_RX_PW_P0 + d->pipe, &d->width) ) {
+      NRF_CR_COMMAND(&d->cr, &d->cmd, NRF_CMD_READ|(NRF_REG_RX_PW_P0 + d->pipe), NULL, &d->width, 1);
+      nrf_cache_store(NRF_REG_RX_PW_P0 + d->pipe, d->width);
+    }
+    if( (d->width == 0) || (d->width > NRF_MAX_PAYLOAD) ) {
+      /* Corrupt width, the datasheet requires the RX FIFO to be flushed */
+      NRF_CR_COMMAND(&d->cr, &d->cmd, NRF_CMD_FLUSH_RX, NULL, NULL, 0);
+      break;
+    }
+
+    d->slot = NRF_RX_QUEUE_DEPTH;
+    if( nrf_rx_count < NRF_RX_QUEUE_DEPTH ) {
+      d->slot = (nrf_rx_head + nrf_rx_count) % NRF_RX_QUEUE_DEPTH;
+    }
+    NRF_CR_COMMAND(&d->cr, &d->cmd, NRF_CMD_RX_PAYLOAD, NULL, nrf_rx_packet(d->slot)->data, d->width);
+    packet = nrf_rx_packet(d->slot);
+    packet->pipe = d->pipe;
+    packet->length = d->width;
+    if( d->slot < NRF_RX_QUEUE_DEPTH ) {
+      nrf_rx_count++;
+      nrf_stats.rx_packets++;
+    }
+    else {
+      nrf_stats.rx_dropped++;
+    }
+
+    if( !nrf_dynamic ) {
+      NRF_CR_COMMAND(&d->cr, &d->cmd, NRF_CMD_NOP, NULL, NULL, 0);
+      d->status = d->cmd.status;
+    }
+  }
+
+  CR_END(&d->cr);
+}
+
+static void nrf_drain_rx(uint8_t status)
+{
+  NRF_drain_t d;
+
+  nrf_drain_start(&d, status);
+  CR_RUN(nrf_drain_cr(&d));
+}
+
+uint8_t nrf_service(void)
+{
+  nrf_irq_pending = 0;
+  uint8_t status = nrf_read_status();
+  uint8_t flags = status & NRF_STAT_IRQ_MASK;
+
+  if( flags & NRF_STAT_MAX_RT_MASK ) {
+    /* Drop the failed packet before clearing MAX_RT lets it restart */
+    nrf_flush_tx_fifo();
+    nrf_stats.max_rt++;
+  }
+  if( flags ) {
+    /* Clear first, so a packet arriving while draining raises a new IRQ */
+    nrf_clear_irq(flags);
+  }
+  nrf_drain_rx(status);
+  return status;
+}
+
+size_t nrf_receive(uint8_t *data, size_t maxlen, uint8_t *pipe)
+{
+  if( nrf_irq_pending ) {
+    nrf_service();
+  }
+  if( nrf_rx_count == 0 ) {
+    return 0;
+  }
+
+  NRF_packet_t *packet = &nrf_rx_queue[nrf_rx_head];
+  size_t length = (packet->length < maxlen) ? packet->length : maxlen;
+  my_memcpy(packet->data, data, length);
+  if( pipe ) {
+    *pipe = packet->pipe;
+  }
+  nrf_rx_head = (nrf_rx_head + 1) % NRF_RX_QUEUE_DEPTH;
+  nrf_rx_count--;
+  return length;
+}
+
+void nrf_irq(void)
+{
+  nrf_irq_pending = 1;
+}
+
+void nrf_stream_start(NRF_stream_t *s, const uint8_t *data, size_t length)
+{
+  s->data = data;
+  s->length = length;
+  s->queued = 0;
+  s->inflight = 0;
+  s->sent = 0;
+  CR_INIT(&s->cr);
+}
+
+CR_status_t nrf_stream_cr(NRF_stream_t *s)
+{
+  CR_BEGIN(&s->cr);
+
+  /* As nrf_power_up(0), without blocking on the bus or the oscillator */
+  if( !nrf_cache_lookup(NRF_REG_CONFIG, &s->config) ) {
+    NRF_CR_COMMAND(&s->cr, &s->cmd, NRF_CMD_READ|NRF_REG_CONFIG, NULL, &s->config, 1);
+    nrf_cache_store(NRF_REG_CONFIG, s->config);
+  }
+  s->flags = nrf_config_up(s->config, 0);
+  if( s->flags != s->config ) {
+    NRF_CR_COMMAND(&s->cr, &s->cmd, NRF_CMD_WRITE|NRF_REG_CONFIG, &s->flags, NULL, 1);
+    nrf_cache_store(NRF_REG_CONFIG, s->flags);
+    s->wait = spi_time_us();
+    while( !(s->config & NRF_CNF_PWR_MASK) && (NRF_ELAPSED_US(s->wait) < NRF_POWER_UP_MS * 1000u) ) {
+      NRF_IDLE();
+      CR_YIELD(&s->cr);
+    }
+  }
+  /* Only a pin write, no SPI */
+  nrf_transmit_enable();
+
+  NRF_CR_COMMAND(&s->cr, &s->cmd, NRF_CMD_NOP, NULL, NULL, 0);
+  s->status = s->cmd.status;
+  while( 1 )
+  {
+    if( s->status & NRF_STAT_IRQ_MASK )
+    {
+      /* Clearing the flags reports which were set in the same command. MAX_RT
+         is left set, clearing it would restart the failed packet. */
+      nrf_irq_pending = 0;
+      s->flags = NRF_STAT_TX_DS_MASK|NRF_STAT_RX_DR_MASK;
+      NRF_CR_COMMAND(&s->cr, &s->cmd, NRF_CMD_WRITE|NRF_REG_STATUS, &s->flags, NULL, 1);
+      s->flags = s->cmd.status & NRF_STAT_IRQ_MASK;
+      s->status = s->cmd.status & ~NRF_STAT_IRQ_MASK;
+
+      if( s->flags & NRF_STAT_TX_DS_MASK ) {
+        /* Coalesced TX_DS flags only undercount, keeping `inflight` safe */
+        s->inflight -= (s->inflight > 0);
+      }
+      if( s->flags & NRF_STAT_RX_DR_MASK ) {
+        nrf_drain_start(&s->drain, s->status);
+        CR_WAIT_CR(&s->cr, nrf_drain_cr(&s->drain));
+        s->status = nrf_last_status();
+      }
+      if( s->flags & NRF_STAT_MAX_RT_MASK ) {
+        /* Everything before the failed packet was delivered. It and the
+           packets behind it are still in the FIFO: all of it when TX_FULL is
+           set, otherwise one or two, at most `inflight`. Only the short last
+           packet can be under NRF_MAX_PAYLOAD, and it is never delivered. */
+        s->sent = (s->queued + NRF_MAX_PAYLOAD - 1) / NRF_MAX_PAYLOAD;
+        if( s->status & NRF_STAT_TX_FULL_MASK ) {
+          s->inflight = NRF_TX_FIFO_DEPTH;
+        }
+        else {
+          s->inflight = (s->inflight < NRF_TX_FIFO_DEPTH - 1) ? s->inflight : NRF_TX_FIFO_DEPTH - 1;
+          s->inflight = (s->inflight > 0) ? s->inflight : 1;
+        }
+        s->inflight = (s->inflight < s->sent) ? s->inflight : s->sent;
+        s->sent = (s->sent - s->inflight) * NRF_MAX_PAYLOAD;
+        nrf_transmit_disable();
+        NRF_CR_COMMAND(&s->cr, &s->cmd, NRF_CMD_FLUSH_TX, NULL, NULL, 0);
+        s->flags = NRF_STAT_MAX_RT_MASK;
+        NRF_CR_COMMAND(&s->cr, &s->cmd, NRF_CMD_WRITE|NRF_REG_STATUS, &s->flags, NULL, 1);
+        nrf_stats.max_rt++;
+        CR_EXIT(&s->cr);
+      }
+      continue;
+    }
+
+    /* Top up the FIFO while there is certainly room */
+    if( (s->queued < s->length) && (s->inflight < NRF_TX_FIFO_DEPTH) )
+    {
+      s->chunk = s->length - s->queued;
+      s->chunk = (s->chunk > NRF_MAX_PAYLOAD) ? NRF_MAX_PAYLOAD : s->chunk;
+      NRF_CR_COMMAND(&s->cr, &s->cmd, NRF_CMD_TX_PAYLOAD, &s->data[s->queued], NULL, s->chunk);
+      s->status = s->cmd.status;
+      if( s->status & NRF_STAT_TX_FULL_MASK ) {
+        /* The payload was dropped, wait for the FIFO to drain */
+        s->inflight = NRF_TX_FIFO_DEPTH;
+        continue;
+      }
+      s->queued += s->chunk;
+      s->inflight++;
+      nrf_stats.tx_packets++;
+      continue;
+    }
+
+    /* Check the real FIFO state before waiting, clearing the pending flag
+       first so an IRQ raised after the check is not missed */
+    nrf_irq_pending = 0;
+    if( s->queued < s->length )
+    {
+      NRF_CR_COMMAND(&s->cr, &s->cmd, NRF_CMD_NOP, NULL, NULL, 0);
+      s->status = s->cmd.status;
+      if( !(s->status & NRF_STAT_TX_FULL_MASK) ) {
+        s->inflight = NRF_TX_FIFO_DEPTH - 1;
+        continue;
+      }
+    }
+    else
+    {
+      NRF_CR_COMMAND(&s->cr, &s->cmd, NRF_CMD_READ|NRF_REG_FIFO_STATUS, NULL, &s->fifo, 1);
+      s->status = s->cmd.status;
+      if( (s->fifo & NRF_FS_TX_EMPTY_MASK) && !(s->status & NRF_STAT_IRQ_MASK) ) {
+        break;
+      }
+    }
+    if( s->status & NRF_STAT_IRQ_MASK ) {
+      continue;
+    }
+
+    while( !nrf_irq_pending ) {
+      NRF_IDLE();
+      CR_YIELD(&s->cr);
+    }
+    /* The flags are read back while clearing them, skip a STATUS read */
+    s->status = NRF_STAT_IRQ_MASK;
+  }
+
+  nrf_transmit_disable();
+  s->sent = s->queued;
+
+  CR_END(&s->cr);
+}
+
+size_t nrf_send_stream(const uint8_t *data, size_t length)
+{
+  NRF_stream_t stream;
+
+  nrf_stream_start(&stream, data, length);
+  CR_RUN(nrf_stream_cr(&stream));
+  return stream.sent;
 }
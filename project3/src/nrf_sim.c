@@ -0,0 +1,677 @@
+/**
+ * @file nrf_sim.c
+ * @brief Simulated nRF24L01+ modules for platforms without one
+ *
+ * Commands are decoded a byte at a time as they are clocked in, and take
+ * effect when chip select is released, as on the real module. The TX FIFO is
+ * shared between outgoing payloads (PTX) and ACK payloads (PRX).
+ *
+ * A transmission is simulated as a sequence of events on a shared clock:
+ *   1. After the TX settling time and on-air time (plus link latency) the
+ *      packet arrives. Every other listening module on the same channel, data
+ *      rate and address width checks its pipe addresses, and the first match
+ *      accepts it.
+ *   2. The ACK arrives after the receiver's settling time and the ACK's own
+ *      on-air time. If it was lost, or would arrive after the retransmit delay,
+ *      the sender instead retransmits after ARD, up to ARC times, then raises
+ *      MAX_RT.
+ * Retransmissions keep their packet ID so receivers can discard duplicates.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/02
+ **/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "memory.h"
+#include "nrf.h"
+#include "nrf_sim.h"
+
+#define NRF_SIM_NUM_REGS  (0x20)
+#define NRF_SIM_NO_EVENT  (UINT64_MAX)
+#define NRF_SIM_NO_PID    (0xff)  /* Skip duplicate detection */
+
+/* Transmitter state */
+typedef enum {
+  NRF_SIM_TX_IDLE = 0,
+  NRF_SIM_TX_AIR,     /* Packet on the air, event on arrival  */
+  NRF_SIM_TX_WAIT     /* Waiting for ACK, event on ACK or ARD */
+} NRF_sim_tx_t;
+
+/* A payload held in one of the FIFOs, both are NRF_TX_FIFO_DEPTH deep */
+typedef struct {
+  uint8_t pipe;
+  uint8_t noack;
+  uint8_t length;
+  uint8_t data[NRF_MAX_PAYLOAD];
+} NRF_sim_payload_t;
+
+typedef struct {
+  NRF_sim_payload_t entry[NRF_TX_FIFO_DEPTH];
+  uint8_t head;
+  uint8_t count;
+} NRF_sim_fifo_t;
+
+/* Complete state of one simulated module */
+typedef struct {
+  uint8_t reg[NRF_SIM_NUM_REGS];
+  uint8_t rx_addr_p0[NRF_ADDR_SIZE];
+  uint8_t rx_addr_p1[NRF_ADDR_SIZE];
+  uint8_t tx_addr[NRF_ADDR_SIZE];
+  uint8_t flags;            /* STATUS interrupt flags     */
+  uint8_t reuse;            /* REUSE_TX_PL active         */
+  NRF_sim_fifo_t tx;
+  NRF_sim_fifo_t rx;
+
+  uint8_t cs;
+  uint8_t ce;
+  uint8_t irq;              /* IRQ asserted (active low pin) */
+  void (*irq_handler)(void);
+  NRF_sim_sink_t sink;
+
+  uint8_t cmd;              /* Command in progress        */
+  uint8_t count;            /* Bytes clocked since CS low */
+  uint8_t buf[NRF_MAX_PAYLOAD];
+
+  NRF_sim_tx_t tx_state;
+  uint64_t event;           /* Time of the next tx_state event */
+  uint64_t tx_end;          /* End of the current packet's air time */
+  uint8_t pid;              /* 2-bit packet ID of the FIFO head */
+  uint8_t arc_cnt;          /* Retransmits of the current packet */
+  uint8_t plos_cnt;         /* Packets lost since RF_CH was written */
+  int16_t ack_length;       /* ACK payload received, -1 if no ACK */
+  uint8_t ack[NRF_MAX_PAYLOAD];
+
+  uint8_t last_pid[NRF_NUM_PIPES];   /* Duplicate detection per pipe */
+  uint16_t last_crc[NRF_NUM_PIPES];
+
+  NRF_sim_stats_t stats;
+} NRF_sim_t;
+
+static NRF_sim_t sims[NRF_SIM_INSTANCES];
+static NRF_sim_t *sim = &sims[0];  /* Module driven by SPI and GPIO */
+
+static uint64_t sim_now;           /* Simulated time, ns */
+static uint32_t link_latency_ns;
+static uint8_t link_loss_percent;
+static uint32_t link_random;       /* Loss generator state */
+
+/* Register reset values from the datasheet */
+static const uint8_t nrf_sim_reset_regs[NRF_SIM_NUM_REGS] = {
+  [NRF_REG_CONFIG]     = 0x08,
+  [NRF_REG_EN_AA]      = 0x3f,
+  [NRF_REG_EN_RXADDR]  = 0x03,
+  [NRF_REG_SETUP_AW]   = 0x03,
+  [NRF_REG_SETUP_RETR] = 0x03,
+  [NRF_REG_RF_CH]      = 0x02,
+  [NRF_REG_RF_SETUP]   = 0x0f,
+  [NRF_REG_RX_ADDR_P2] = 0xc3,
+  [NRF_REG_RX_ADDR_P2+1] = 0xc4,
+  [NRF_REG_RX_ADDR_P2+2] = 0xc5,
+  [NRF_REG_RX_ADDR_P2+3] = 0xc6,
+};
+
+static void nrf_sim_start_tx(NRF_sim_t *s);
+
+static NRF_sim_payload_t *fifo_head(NRF_sim_fifo_t *fifo)
+{
+  return fifo->count ? &fifo->entry[fifo->head] : NULL;
+}
+
+static NRF_sim_payload_t *fifo_push(NRF_sim_fifo_t *fifo)
+{
+  if( fifo->count == NRF_TX_FIFO_DEPTH ) {
+    return NULL;
+  }
+  return &fifo->entry[(fifo->head + fifo->count++) % NRF_TX_FIFO_DEPTH];
+}
+
+static void fifo_pop(NRF_sim_fifo_t *fifo)
+{
+  if( fifo->count ) {
+    fifo->head = (fifo->head + 1) % NRF_TX_FIFO_DEPTH;
+    fifo->count--;
+  }
+}
+
+static uint8_t nrf_sim_status(NRF_sim_t *s)
+{
+  NRF_sim_payload_t *rx = fifo_head(&s->rx);
+  uint8_t pipe = rx ? rx->pipe : NRF_STAT_RX_P_NO_EMPTY;
+  return s->flags
+    | NRF_STAT_RX_P_NO(pipe)
+    | NRF_STAT_TX_FULL((s->tx.count == NRF_TX_FIFO_DEPTH));
+}
+
+static uint8_t nrf_sim_fifo_status(NRF_sim_t *s)
+{
+  /* The register field macros don't parenthesize their argument */
+  return NRF_FS_TX_REUSE(s->reuse)
+    | NRF_FS_TX_FULL((s->tx.count == NRF_TX_FIFO_DEPTH))
+    | NRF_FS_TX_EMPTY((s->tx.count == 0))
+    | NRF_FS_RX_FULL((s->rx.count == NRF_RX_FIFO_DEPTH))
+    | NRF_FS_RX_EMPTY((s->rx.count == 0));
+}
+
+/* Returns storage for the multi-byte address registers, NULL otherwise */
+static uint8_t *nrf_sim_addr(NRF_sim_t *s, uint8_t reg)
+{
+  switch(reg) {
+    case NRF_REG_RX_ADDR_P0: return s->rx_addr_p0;
+    case NRF_REG_RX_ADDR_P1: return s->rx_addr_p1;
+    case NRF_REG_TX_ADDR:    return s->tx_addr;
+    default:                 return NULL;
+  }
+}
+
+/* Update the IRQ line, signalling the host on assertion */
+static void nrf_sim_update_irq(NRF_sim_t *s)
+{
+  uint8_t masked = (s->reg[NRF_REG_CONFIG] & NRF_STAT_IRQ_MASK) ^ NRF_STAT_IRQ_MASK;
+  uint8_t irq = (s->flags & masked) != 0;
+  if( irq && !s->irq && s->irq_handler ) {
+    s->irq_handler();
+  }
+  s->irq = irq;
+}
+
+static uint8_t nrf_sim_powered(NRF_sim_t *s)
+{
+  return (s->reg[NRF_REG_CONFIG] & NRF_CNF_PWR_MASK) != 0;
+}
+
+static uint8_t nrf_sim_prx(NRF_sim_t *s)
+{
+  return (s->reg[NRF_REG_CONFIG] & NRF_CNF_PRIM_RX_MASK) != 0;
+}
+
+static uint8_t nrf_sim_listening(NRF_sim_t *s)
+{
+  return s->ce && nrf_sim_powered(s) && nrf_sim_prx(s);
+}
+
+static uint8_t nrf_sim_dynamic(NRF_sim_t *s, uint8_t pipe)
+{
+  return (s->reg[NRF_REG_FEATURE] & NRF_FEAT_EN_DPL_MASK)
+    && (s->reg[NRF_REG_DYNPD] & (1<<pipe));
+}
+
+static uint8_t nrf_sim_aw(NRF_sim_t *s)
+{
+  return s->reg[NRF_REG_SETUP_AW] + 2;
+}
+
+/* On-air time of a packet with `length` payload bytes */
+static uint64_t nrf_sim_air_ns(NRF_sim_t *s, size_t length)
+{
+  uint32_t bits = (1 + nrf_sim_aw(s) + length + 2) * 8 + 9;
+  uint32_t ns_per_bit = (s->reg[NRF_REG_RF_SETUP] & NRF_RFS_RF_DR_MASK) ? 500 : 1000;
+  return (uint64_t) bits * ns_per_bit;
+}
+
+/* Stand-in for the packet CRC, used only for duplicate detection */
+static uint16_t nrf_sim_crc(const uint8_t *data, size_t length)
+{
+  uint16_t crc = length;
+  while( length-- ) {
+    crc = (crc << 1 | crc >> 15) ^ *data++;
+  }
+  return crc;
+}
+
+/* Decide whether the link drops a packet (xorshift32) */
+static uint8_t nrf_sim_lost(void)
+{
+  if( link_loss_percent == 0 ) {
+    return 0;
+  }
+  link_random ^= link_random << 13;
+  link_random ^= link_random >> 17;
+  link_random ^= link_random << 5;
+  return (link_random % 100) < link_loss_percent;
+}
+
+/* Returns the pipe of receiver `s` that matches `addr`, or NRF_NUM_PIPES */
+static uint8_t nrf_sim_match(NRF_sim_t *s, const uint8_t *addr)
+{
+  uint8_t aw = nrf_sim_aw(s);
+  uint8_t pipe;
+
+  for( pipe = 0; pipe < NRF_NUM_PIPES; pipe++ ) {
+    uint8_t *base = (pipe == 0) ? s->rx_addr_p0 : s->rx_addr_p1;
+    uint8_t lsb = (pipe < 2) ? base[0] : s->reg[NRF_REG_RX_ADDR_P2 + pipe - 2];
+    uint8_t i = 1;
+    if( !(s->reg[NRF_REG_EN_RXADDR] & (1<<pipe)) || (lsb != addr[0]) ) {
+      continue;
+    }
+    while( (i < aw) && (base[i] == addr[i]) ) {
+      i++;
+    }
+    if( i == aw ) {
+      break;
+    }
+  }
+  return pipe;
+}
+
+/* Receiver `s` takes a packet on `pipe`. Returns the ACK payload length, or -1
+   if the packet is not acknowledged. */
+static int16_t nrf_sim_accept(NRF_sim_t *s, uint8_t pipe, const uint8_t *data, size_t length,
+                              uint8_t dynamic, uint8_t pid, uint8_t *ack)
+{
+  NRF_sim_payload_t *payload;
+  int16_t ack_length = 0;
+  uint16_t crc = nrf_sim_crc(data, length);
+  uint8_t auto_ack = (s->reg[NRF_REG_EN_AA] & (1<<pipe)) != 0;
+  uint8_t ack_pay = (s->reg[NRF_REG_FEATURE] & NRF_FEAT_EN_ACK_PAY_MASK) != 0;
+
+  if( !nrf_sim_listening(s) || !(s->reg[NRF_REG_EN_RXADDR] & (1<<pipe)) ) {
+    return -1;
+  }
+  /* A mismatched packet format or width fails the CRC */
+  if( (nrf_sim_dynamic(s, pipe) != dynamic)
+      || (!dynamic && (length != s->reg[NRF_REG_RX_PW_P0 + pipe])) ) {
+    return -1;
+  }
+
+  if( (pid != NRF_SIM_NO_PID) && (pid == s->last_pid[pipe]) && (crc == s->last_crc[pipe]) ) {
+    /* Our ACK was lost, acknowledge again but drop the copy */
+    s->stats.duplicates++;
+    return auto_ack ? 0 : -1;
+  }
+
+  if( s->sink ) {
+    uint8_t sink_ack[NRF_MAX_PAYLOAD];
+    size_t n = s->sink(data, length, sink_ack);
+    if( ack_pay && n ) {
+      ack_length = (n > NRF_MAX_PAYLOAD) ? NRF_MAX_PAYLOAD : n;
+      my_memcpy(sink_ack, ack, ack_length);
+    }
+  }
+  else {
+    if( !(payload = fifo_push(&s->rx)) ) {
+      return -1;  /* No room, packet is not acknowledged */
+    }
+    payload->pipe = pipe;
+    payload->length = length;
+    my_memcpy((uint8_t *) data, payload->data, length);
+    s->flags |= NRF_STAT_RX_DR_MASK;
+
+    /* ACK payloads are taken from the TX FIFO in order, if addressed to pipe */
+    payload = fifo_head(&s->tx);
+    if( auto_ack && ack_pay && payload && (payload->pipe == pipe) ) {
+      ack_length = payload->length;
+      my_memcpy(payload->data, ack, ack_length);
+      fifo_pop(&s->tx);
+      s->flags |= NRF_STAT_TX_DS_MASK;
+    }
+  }
+  s->last_pid[pipe] = pid;
+  s->last_crc[pipe] = crc;
+  nrf_sim_update_irq(s);
+  return auto_ack ? ack_length : -1;
+}
+
+/* Put the TX FIFO head (back) on the air */
+static void nrf_sim_attempt(NRF_sim_t *s)
+{
+  NRF_sim_payload_t *tx = fifo_head(&s->tx);
+  s->tx_state = NRF_SIM_TX_AIR;
+  s->tx_end = sim_now + NRF_SIM_SETTLE_NS + nrf_sim_air_ns(s, tx->length);
+  s->event = s->tx_end + link_latency_ns;
+  s->stats.transmits++;
+}
+
+/* Start sending the TX FIFO head if the module is an idle, enabled PTX */
+static void nrf_sim_start_tx(NRF_sim_t *s)
+{
+  if( !fifo_head(&s->tx) || !s->ce || !nrf_sim_powered(s) || nrf_sim_prx(s)
+      || (s->tx_state != NRF_SIM_TX_IDLE) || (s->flags & NRF_STAT_MAX_RT_MASK) ) {
+    return;
+  }
+  s->pid = (s->pid + 1) & 0x3;
+  s->arc_cnt = 0;
+  nrf_sim_attempt(s);
+}
+
+/* The FIFO head was delivered (and acknowledged, if required) */
+static void nrf_sim_tx_done(NRF_sim_t *s)
+{
+  NRF_sim_payload_t *rx;
+
+  if( !s->reuse ) {
+    fifo_pop(&s->tx);
+  }
+  s->flags |= NRF_STAT_TX_DS_MASK;
+  if( (s->ack_length > 0) && (s->reg[NRF_REG_FEATURE] & NRF_FEAT_EN_ACK_PAY_MASK)
+      && (rx = fifo_push(&s->rx)) ) {
+    rx->pipe = 0;
+    rx->length = s->ack_length;
+    my_memcpy(s->ack, rx->data, rx->length);
+    s->flags |= NRF_STAT_RX_DR_MASK;
+  }
+  s->tx_state = NRF_SIM_TX_IDLE;
+  s->event = NRF_SIM_NO_EVENT;
+  nrf_sim_update_irq(s);
+  nrf_sim_start_tx(s);
+}
+
+/* The packet reaches the other modules */
+static void nrf_sim_arrive(NRF_sim_t *s)
+{
+  NRF_sim_payload_t *tx = fifo_head(&s->tx);
+  uint8_t retr = s->reg[NRF_REG_SETUP_RETR];
+  uint64_t timeout;
+  uint8_t pipe;
+
+  if( !tx ) {
+    /* Flushed while on the air */
+    s->tx_state = NRF_SIM_TX_IDLE;
+    s->event = NRF_SIM_NO_EVENT;
+    return;
+  }
+
+  s->ack_length = -1;
+  if( nrf_sim_lost() ) {
+    s->stats.lost++;
+  }
+  else {
+    for( NRF_sim_t *r = sims; r < &sims[NRF_SIM_INSTANCES]; r++ ) {
+      if( (r == s) || !nrf_sim_listening(r)
+          || (r->reg[NRF_REG_RF_CH] != s->reg[NRF_REG_RF_CH])
+          || (r->reg[NRF_REG_SETUP_AW] != s->reg[NRF_REG_SETUP_AW])
+          || ((r->reg[NRF_REG_RF_SETUP] ^ s->reg[NRF_REG_RF_SETUP]) & NRF_RFS_RF_DR_MASK) ) {
+        continue;
+      }
+      if( (pipe = nrf_sim_match(r, s->tx_addr)) < NRF_NUM_PIPES ) {
+        s->ack_length = nrf_sim_accept(r, pipe, tx->data, tx->length,
+                                       nrf_sim_dynamic(s, 0), s->pid, s->ack);
+        break;
+      }
+    }
+  }
+
+  if( tx->noack || !(s->reg[NRF_REG_EN_AA] & 1) ) {
+    s->ack_length = 0;
+    nrf_sim_tx_done(s);
+    return;
+  }
+
+  /* ACKs come back to pipe 0, and must beat the retransmit delay */
+  timeout = s->tx_end + ((retr >> 4) + 1) * (uint64_t) NRF_SIM_ARD_NS;
+  s->tx_state = NRF_SIM_TX_WAIT;
+  s->event = sim_now + NRF_SIM_SETTLE_NS + link_latency_ns
+    + nrf_sim_air_ns(s, (s->ack_length > 0) ? s->ack_length : 0);
+  if( (s->ack_length >= 0) && nrf_sim_lost() ) {
+    s->stats.lost++;
+    s->ack_length = -1;
+  }
+  if( (s->ack_length < 0) || (s->event > timeout)
+      || (nrf_sim_match(s, s->tx_addr) != 0) ) {
+    s->ack_length = -1;
+    s->event = timeout;
+  }
+}
+
+/* The ACK arrived or the retransmit delay expired */
+static void nrf_sim_ack(NRF_sim_t *s)
+{
+  if( s->ack_length >= 0 ) {
+    nrf_sim_tx_done(s);
+  }
+  else if( s->arc_cnt < (s->reg[NRF_REG_SETUP_RETR] & NRF_RETR_ARC_MASK) ) {
+    s->arc_cnt++;
+    s->stats.retransmits++;
+    nrf_sim_attempt(s);
+  }
+  else {
+    /* Packet stays in the FIFO, nothing more is sent until MAX_RT clears */
+    s->plos_cnt += (s->plos_cnt < 15);
+    s->flags |= NRF_STAT_MAX_RT_MASK;
+    s->tx_state = NRF_SIM_TX_IDLE;
+    s->event = NRF_SIM_NO_EVENT;
+    nrf_sim_update_irq(s);
+  }
+}
+
+void nrf_sim_reset(void)
+{
+  my_memset((uint8_t *) sims, sizeof(sims), 0);
+  for( NRF_sim_t *s = sims; s < &sims[NRF_SIM_INSTANCES]; s++ ) {
+    my_memcpy((uint8_t *) nrf_sim_reset_regs, s->reg, NRF_SIM_NUM_REGS);
+    my_memset(s->rx_addr_p0, NRF_ADDR_SIZE, 0xe7);
+    my_memset(s->rx_addr_p1, NRF_ADDR_SIZE, 0xc2);
+    my_memset(s->tx_addr, NRF_ADDR_SIZE, 0xe7);
+    my_memset(s->last_pid, NRF_NUM_PIPES, NRF_SIM_NO_PID);
+    s->cs = 1;
+    s->event = NRF_SIM_NO_EVENT;
+  }
+  sims[0].irq_handler = nrf_irq;
+  sim = &sims[0];
+  sim_now = 0;
+  link_latency_ns = 0;
+  link_loss_percent = 0;
+  link_random = 0x2545f491;
+}
+
+void nrf_sim_select(uint8_t id)
+{
+  if( id < NRF_SIM_INSTANCES ) {
+    sim = &sims[id];
+  }
+}
+
+void nrf_sim_set_link(uint32_t latency_ns, uint8_t loss_percent)
+{
+  link_latency_ns = latency_ns;
+  link_loss_percent = (loss_percent > 100) ? 100 : loss_percent;
+}
+
+void nrf_sim_set_irq(uint8_t id, void (*handler)(void))
+{
+  if( id < NRF_SIM_INSTANCES ) {
+    sims[id].irq_handler = handler;
+  }
+}
+
+void nrf_sim_set_sink(uint8_t id, NRF_sim_sink_t sink)
+{
+  if( id < NRF_SIM_INSTANCES ) {
+    sims[id].sink = sink;
+  }
+}
+
+const NRF_sim_stats_t *nrf_sim_stats(uint8_t id)
+{
+  return &sims[(id < NRF_SIM_INSTANCES) ? id : 0].stats;
+}
+
+/* Apply a completed W_REGISTER command */
+static void nrf_sim_write_reg(NRF_sim_t *s, uint8_t reg, uint8_t length)
+{
+  uint8_t *addr = nrf_sim_addr(s, reg);
+  if( addr ) {
+    my_memcpy(s->buf, addr, (length < NRF_ADDR_SIZE) ? length : NRF_ADDR_SIZE);
+  }
+  else if( reg == NRF_REG_STATUS ) {
+    s->flags &= ~(s->buf[0] & NRF_STAT_IRQ_MASK);
+  }
+  else if( (reg != NRF_REG_FIFO_STATUS) && (reg != NRF_REG_OBSERVE_TX)
+           && (reg != NRF_REG_RPD) ) {
+    s->reg[reg] = s->buf[0];
+    if( reg == NRF_REG_RF_CH ) {
+      s->plos_cnt = 0;
+    }
+  }
+}
+
+/* Apply the command clocked in since CS went low */
+static void nrf_sim_commit(NRF_sim_t *s)
+{
+  uint8_t length = s->count ? s->count - 1 : 0;
+  uint8_t cmd = s->cmd;
+  NRF_sim_payload_t *payload;
+
+  if( s->count == 0 ) {
+    return;
+  }
+
+  if( (cmd & 0xe0) == NRF_CMD_WRITE ) {
+    if( length ) {
+      nrf_sim_write_reg(s, cmd & 0x1f, length);
+    }
+  }
+  else if( cmd == NRF_CMD_RX_PAYLOAD ) {
+    if( length ) {
+      fifo_pop(&s->rx);
+    }
+  }
+  else if( (cmd == NRF_CMD_TX_PAYLOAD) || (cmd == NRF_CMD_W_ACK_PL_NOACK)
+           || ((cmd & 0xf8) == NRF_CMD_W_ACK_PL) ) {
+    if( length && (payload = fifo_push(&s->tx)) ) {
+      payload->pipe = cmd & 0x07;
+      payload->noack = (cmd == NRF_CMD_W_ACK_PL_NOACK);
+      payload->length = length;
+      my_memcpy(s->buf, payload->data, length);
+      s->reuse = 0;
+    }
+  }
+  else if( cmd == NRF_CMD_FLUSH_TX ) {
+    s->tx.count = 0;
+    s->reuse = 0;
+  }
+  else if( cmd == NRF_CMD_FLUSH_RX ) {
+    s->rx.count = 0;
+  }
+  else if( cmd == NRF_CMD_REUSE_TX_PL ) {
+    s->reuse = 1;
+  }
+
+  nrf_sim_update_irq(s);
+  nrf_sim_start_tx(s);
+}
+
+void nrf_sim_cs(uint8_t level)
+{
+  if( level && !sim->cs ) {
+    nrf_sim_commit(sim);
+  }
+  else if( !level && sim->cs ) {
+    sim->count = 0;
+  }
+  sim->cs = level;
+}
+
+void nrf_sim_ce(uint8_t level)
+{
+  sim->ce = level;
+  nrf_sim_start_tx(sim);
+}
+
+uint8_t nrf_sim_exchange(uint8_t mosi)
+{
+  NRF_sim_t *s = sim;
+  NRF_sim_payload_t *rx;
+  uint8_t index;
+  uint8_t miso = 0;
+
+  if( s->cs ) {
+    return 0xff;
+  }
+  if( s->count == 0 ) {
+    s->cmd = mosi;
+    s->count = 1;
+    return nrf_sim_status(s);
+  }
+
+  index = s->count - 1;
+  if( index < NRF_MAX_PAYLOAD ) {
+    s->buf[index] = mosi;
+    s->count++;
+  }
+
+  if( (s->cmd & 0xe0) == NRF_CMD_READ ) {
+    uint8_t reg = s->cmd & 0x1f;
+    uint8_t *addr = nrf_sim_addr(s, reg);
+    if( addr ) {
+      miso = (index < NRF_ADDR_SIZE) ? addr[index] : 0;
+    }
+    else if( reg == NRF_REG_STATUS ) {
+      miso = nrf_sim_status(s);
+    }
+    else if( reg == NRF_REG_FIFO_STATUS ) {
+      miso = nrf_sim_fifo_status(s);
+    }
+    else if( reg == NRF_REG_OBSERVE_TX ) {
+      miso = (s->plos_cnt << 4) | s->arc_cnt;
+    }
+    else {
+      miso = s->reg[reg];
+    }
+  }
+  else if( s->cmd == NRF_CMD_RX_PAYLOAD ) {
+    rx = fifo_head(&s->rx);
+    miso = (rx && (index < rx->length)) ? rx->data[index] : 0;
+  }
+  else if( s->cmd == NRF_CMD_R_RX_WID ) {
+    rx = fifo_head(&s->rx);
+    miso = rx ? rx->length : 0;
+  }
+  return miso;
+}
+
+/* The module with the earliest pending event, or NULL */
+static NRF_sim_t *nrf_sim_next(void)
+{
+  NRF_sim_t *next = NULL;
+  for( NRF_sim_t *s = sims; s < &sims[NRF_SIM_INSTANCES]; s++ ) {
+    if( (s->event != NRF_SIM_NO_EVENT) && (!next || (s->event < next->event)) ) {
+      next = s;
+    }
+  }
+  return next;
+}
+
+void nrf_sim_advance(uint64_t ns)
+{
+  uint64_t end = sim_now + ns;
+  NRF_sim_t *s;
+
+  while( (s = nrf_sim_next()) && (s->event <= end) ) {
+    sim_now = s->event;
+    if( s->tx_state == NRF_SIM_TX_AIR ) {
+      nrf_sim_arrive(s);
+    }
+    else {
+      nrf_sim_ack(s);
+    }
+  }
+  sim_now = end;
+}
+
+void nrf_sim_idle(void)
+{
+  NRF_sim_t *s = nrf_sim_next();
+  nrf_sim_advance( s ? s->event - sim_now : NRF_SIM_IDLE_NS );
+}
+
+uint64_t nrf_sim_time(void)
+{
+  return sim_now;
+}
+
+int16_t nrf_sim_inject(uint8_t id, uint8_t pipe, const uint8_t *data, size_t length,
+                       uint8_t *ack)
+{
+  uint8_t discard[NRF_MAX_PAYLOAD];
+  NRF_sim_t *s;
+
+  if( (id >= NRF_SIM_INSTANCES) || (pipe >= NRF_NUM_PIPES)
+      || (length == 0) || (length > NRF_MAX_PAYLOAD) ) {
+    return -1;
+  }
+  /* Sent in whatever format the pipe expects */
+  s = &sims[id];
+  return nrf_sim_accept(s, pipe, data, length, nrf_sim_dynamic(s, pipe), NRF_SIM_NO_PID,
+                        ack ? ack : discard);
+}
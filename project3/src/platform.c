@@ -11,6 +11,16 @@
 
 #include "logger.h"
 #include "platform.h"
+#include "timer_wheel.h"
+#include "event.h"
+
+/* Periodic housekeeping, run from the main loop rather than an ISR */
+static TW_timer_t heartbeat_timer;
+
+static void heartbeat(void *arg)
+{
+  LOG_ID(HEARTBEAT);
+}
 
 #ifdef KL25Z
 
@@ -24,12 +34,20 @@
 #include "spi.h"
 #include "gpio.h"
 
+static TW_timer_t led_timer;
+
+static void led_blink(void *arg)
+{
+  led_toggle(GREEN_LED);
+}
+
 void platform_init(void) {
 
   led_setup();
   led_on(GREEN_LED);
 
   systick_setup();
+  ev_init();
   timer_setup();
   rtc_setup();
 
@@ -45,16 +63,38 @@ void platform_init(void) {
 
   spi_init();
 
+  tw_start(&led_timer, 1000, 1000, led_blink, NULL);
+  tw_start(&heartbeat_timer, 1000, 1000, heartbeat, NULL);
+
   LOG_ID(SYSTEM_INITIALIZED);
   LOG_FLUSH();
 }
 
-uint32_t critical_primask = 0;
-
 #else
 
+#include <signal.h>
+#include "spi.h"
+#include "gpio.h"
+#include "timer.h"
+
+/* Leave the event loop, so main() returns and exit handlers run */
+static void platform_stop(int signum)
+{
+  ev_stop();
+}
+
 void platform_init(void) {
+ struct sigaction stop = { .sa_handler = platform_stop };
+
+ ev_init();
+ sigaction(SIGINT, &stop, NULL);
+ sigaction(SIGTERM, &stop, NULL);
  LOGGING_INIT();
+ gpio_spi_init();
+ gpio_nrf_init();
+ spi_init();
+ timer_setup();
+ tw_start(&heartbeat_timer, 1000, 1000, heartbeat, NULL);
  LOG_ID(SYSTEM_INITIALIZED);
  LOG_FLUSH();
 }
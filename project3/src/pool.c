@@ -0,0 +1,135 @@
+/**
+ * @file pool.c
+ * @brief Fixed-block pools and an init-time arena
+ *
+ * A pool hands out blocks it has never used in order, then reuses returned
+ * blocks from a free list linked through the blocks themselves. Neither needs
+ * setting up, so a statically initialized pool is ready to use.
+ *
+ * Each arena allocation is preceded by a header pointing to the allocation
+ * before it, so the allocations in use form a stack. The low bit of the
+ * pointer marks an allocation that has been freed but not yet returned.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "platform.h"
+#include "logger.h"
+#include "pool.h"
+
+#ifdef KL25Z
+#define POOL_LOCK(lock)   START_CRITICAL()
+#define POOL_UNLOCK(lock) END_CRITICAL()
+#else
+#define POOL_LOCK(lock) while( __atomic_test_and_set((lock), __ATOMIC_ACQUIRE) ) {}
+#define POOL_UNLOCK(lock) __atomic_clear((lock), __ATOMIC_RELEASE)
+#endif
+
+#define ARENA_FREED (1)
+#define ARENA_HEADER_SIZE POOL_BLOCK_SIZE(sizeof(uintptr_t))
+
+static uint8_t arena[ARENA_SIZE] __attribute__((aligned(POOL_ALIGN)));
+static uintptr_t *arena_last;  /* Header of the latest allocation held */
+static volatile uint8_t arena_lock;
+
+Arena_stats_t arena_stats = { .size = ARENA_SIZE };
+
+void *pool_alloc(Pool_t *pool)
+{
+  void *block;
+
+  POOL_LOCK(&pool->lock);
+  if( pool->free != NULL ) {
+    block = pool->free;
+    pool->free = *(void **) block;
+  }
+  else if( pool->fresh < pool->count ) {
+    block = &pool->blocks[pool->fresh * pool->block_size];
+    pool->fresh++;
+  }
+  else {
+    pool->failures++;
+    POOL_UNLOCK(&pool->lock);
+    return NULL;
+  }
+  pool->used++;
+  if( pool->used > pool->high_water ) {
+    pool->high_water = pool->used;
+  }
+  POOL_UNLOCK(&pool->lock);
+
+  return block;
+}
+
+void pool_free(Pool_t *pool, void *block)
+{
+  if( block == NULL ) {
+    return;
+  }
+
+  POOL_LOCK(&pool->lock);
+  *(void **) block = pool->free;
+  pool->free = block;
+  pool->used--;
+  POOL_UNLOCK(&pool->lock);
+}
+
+void *arena_alloc(size_t size)
+{
+  size_t needed = ARENA_HEADER_SIZE + POOL_BLOCK_SIZE(size);
+  uintptr_t *header;
+
+  POOL_LOCK(&arena_lock);
+  if( ARENA_SIZE - arena_stats.used < needed ) {
+    arena_stats.failures++;
+    POOL_UNLOCK(&arena_lock);
+    return NULL;
+  }
+  header = (uintptr_t *) &arena[arena_stats.used];
+  *header = (uintptr_t) arena_last;
+  arena_last = header;
+  arena_stats.used += needed;
+  if( arena_stats.used > arena_stats.high_water ) {
+    arena_stats.high_water = arena_stats.used;
+  }
+  POOL_UNLOCK(&arena_lock);
+
+  return (uint8_t *) header + ARENA_HEADER_SIZE;
+}
+
+void arena_free(void *ptr)
+{
+  uintptr_t *header;
+
+  if( ((uint8_t *) ptr < arena + ARENA_HEADER_SIZE) || ((uint8_t *) ptr >= arena + ARENA_SIZE) ) {
+    return;
+  }
+  header = (uintptr_t *) ((uint8_t *) ptr - ARENA_HEADER_SIZE);
+
+  POOL_LOCK(&arena_lock);
+  *header |= ARENA_FREED;
+  /* Return the space of every freed allocation at the top of the stack */
+  while( (arena_last != NULL) && (*arena_last & ARENA_FREED) ) {
+    arena_stats.used = (uint8_t *) arena_last - arena;
+    arena_last = (uintptr_t *) (*arena_last & ~(uintptr_t) ARENA_FREED);
+  }
+  POOL_UNLOCK(&arena_lock);
+}
+
+void pool_log_stats(Pool_t *pool, const char *name)
+{
+  LOG_STR(INFO, name);
+  LOG_VAL(INFO, pool->used, "Pool blocks used");
+  LOG_VAL(INFO, pool->high_water, "Pool high water");
+  LOG_VAL(INFO, pool->failures, "Pool failures");
+}
+
+void arena_log_stats(void)
+{
+  LOG_VAL(INFO, arena_stats.used, "Arena bytes used");
+  LOG_VAL(INFO, arena_stats.high_water, "Arena high water");
+  LOG_VAL(INFO, arena_stats.failures, "Arena failures");
+}
@@ -15,6 +15,7 @@
 #include "profile.h"
 
 uint32_t profile_overhead = 0;
+uint32_t profile_cycle_overhead = 0;
 
 void profile_calibrate() {
   uint32_t start_time;
@@ -23,4 +24,8 @@ void profile_calibrate() {
   end_time = get_usecs();
   profile_overhead = end_time - start_time;
   LOG_VAL(INFO, profile_overhead, "Profile overhead");
+
+  uint64_t start_cycles = get_cycles();
+  profile_cycle_overhead = get_cycles() - start_cycles;
+  LOG_VAL(INFO, profile_cycle_overhead, "Profile cycle overhead");
 }
@@ -14,15 +14,32 @@
 #include "platform.h"
 #include "logger.h"
 #include "nrf.h"
+#include "spi.h"
+#include "gpio.h"
 #include "conversion.h"
 #include "string.h"  // memmove, memset
 #include "profile.h"
 #include "memory.h"
 #include "io.h"
 #include "processor.h"
+#include "timer.h"
+#include "timer_wheel.h"
+#include "circular_buffer.h"
+#include "log_queue.h"
+#include "event.h"
 #ifdef KL25Z
 #include "memory_dma.h"
 #include "dma.h"
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include "nrf_sim.h"
+#endif
+
+// The blocking KL25Z UART driver has no RX interrupt, so nothing would ever
+// post EV_UART_RX and bytes arriving between polls would overrun UART0->D
+#if defined(DATAPROCESSOR) && defined(KL25Z) && !defined(KL25Z_UART_NONBLOCK)
+#error "DATAPROCESSOR on the KL25Z needs the queued UART driver (KL25Z_UART_NONBLOCK=1)"
 #endif
 
 
@@ -40,7 +57,7 @@ void logging_demo(void)
 
   // Log queue logging
   Log_t foo;
-  foo = foo;
+  (void) foo;
   foo.id = INFO;
   foo.type = LD_STR;
   foo.length = 10;
@@ -55,15 +72,18 @@ void logging_demo(void)
 }
 
 
+/* Read back from the module rather than the register cache, so the demo checks
+   that each write reached it */
 void nrf_demo() {
 
   uint8_t addr[5];
   LOG_INFO("Read NRF Registers");
+  nrf_cache_invalidate();
   LOG_VAL(INFO, nrf_read_config(), "CONFIG");
   LOG_VAL(INFO, nrf_read_rf_setup(), "RF_SETUP");
   LOG_VAL(INFO, nrf_read_rf_ch(), "RF_CH");
   LOG_VAL(INFO, nrf_read_fifo_status(), "FIFO_STATUS");
-  LOG_VAL(INFO, nrf_read_status(), "STATUS");
+  LOG_VAL(INFO, nrf_last_status(), "STATUS");
   nrf_read_tx_addr(addr);
   LOG_DATA(NRF_ADDRESS, addr, 5);
   LOG_FLUSH();
@@ -75,11 +95,13 @@ void nrf_demo() {
 
   LOG_INFO("Disabling CRC");
   nrf_write_config( config_reg & ~NRF_CNF_EN_CRC_MASK);
+  nrf_cache_invalidate();
   config_reg = nrf_read_config();
   LOG_VAL(INFO, config_reg, "CONFIG");
 
   LOG_INFO("Enabling CRC");
   nrf_write_config( config_reg | NRF_CNF_EN_CRC(1) );
+  nrf_cache_invalidate();
   LOG_VAL(INFO, nrf_read_config(), "CONFIG");
 
   uint8_t rf_setup;
@@ -89,12 +111,14 @@ void nrf_demo() {
   LOG_INFO("Setting power to -6dBm");
   rf_setup &= ~NRF_RFS_RF_PWR_MASK;
   nrf_write_rf_setup( rf_setup | NRF_RFS_RF_PWR(2));
+  nrf_cache_invalidate();
   rf_setup = nrf_read_rf_setup();
   LOG_VAL(INFO, rf_setup, "RF_SETUP");
 
   LOG_INFO("Setting power to -12dBm");
   rf_setup &= ~NRF_RFS_RF_PWR_MASK;
   nrf_write_rf_setup( rf_setup | NRF_RFS_RF_PWR(1));
+  nrf_cache_invalidate();
   rf_setup = nrf_read_rf_setup();
   LOG_VAL(INFO, rf_setup, "RF_SETUP");
 
@@ -102,22 +126,22 @@ void nrf_demo() {
   uint8_t test_addr2[] = { 0xab, 0xcd, 0xef, 0x01, 0x02 };
   LOG_INFO("Change TX Address");
   nrf_write_tx_addr(test_addr1);
+  nrf_cache_invalidate();
   nrf_read_tx_addr(addr);
   LOG_DATA(NRF_ADDRESS, addr, 5);
   nrf_write_tx_addr(test_addr2);
+  nrf_cache_invalidate();
   nrf_read_tx_addr(addr);
   LOG_DATA(NRF_ADDRESS, addr, 5);
+
+  LOG_VAL(INFO, nrf_stats.transactions, "NRF SPI transactions");
+  LOG_VAL(INFO, nrf_stats.cache_hits, "NRF cache hits");
   LOG_FLUSH();
 }
 
-#ifdef KL25Z
-extern uint32_t __BUFFER_START;
-uint8_t *buffer1 = (uint8_t *) &__BUFFER_START;
-uint8_t *buffer2 = ((uint8_t *) &__BUFFER_START) + PROF_BUFFER_SIZE;
-#else
-uint8_t buffer1[PROF_BUFFER_SIZE];
-uint8_t buffer2[PROF_BUFFER_SIZE];
-#endif
+/* The DMA copies between the two SRAM banks */
+SRAM_L uint8_t buffer1[PROF_BUFFER_SIZE];
+SRAM_U uint8_t buffer2[PROF_BUFFER_SIZE];
 
 void print_result(char *func, uint32_t *results, uint8_t sizes) {
   print_str("| ");
@@ -199,8 +223,415 @@ void profile_memory() {
 
 }
 
-#define MAX_CHARS 100  /* Maximum to read at a time */
-uint8_t chars[MAX_CHARS];
+#define RAMFUNC_BENCH_LOOPS (100)
+
+/* Cycles per call of the functions that run from SRAM on the KL25Z (RAMFUNC).
+   Build with -DNO_RAMFUNC to get the same numbers running from flash. */
+void profile_ramfunc() {
+
+  static CB_STORAGE(bench_cb_storage, 64, 4);
+  static LQ_STORAGE(bench_lq_storage, 256, 4);
+  CircBuf_t cb;
+  Log_q lq;
+  Log_t log;
+  Log_t out;
+  int32_t val = 42;
+  int32_t val_out;
+  uint8_t item;
+  uint32_t cycles;
+
+  LOG_ID(PROFILING_STARTED);
+  #ifdef NO_RAMFUNC
+  LOG_INFO("RAMFUNC disabled, hot functions run from flash");
+  #endif
+  CB_init_static(&cb, bench_cb_storage, sizeof(bench_cb_storage));
+  lq_init_static(&lq, bench_lq_storage, sizeof(bench_lq_storage));
+  memset(&log, 0, sizeof(log));
+  log.id = INFO;
+  log.type = LD_INT;
+  log.length = sizeof(val);
+  log.data = (uint8_t *) &val;
+
+  PROFILE_CYCLES( "my_memmove 64", for(uint8_t i=0; i<RAMFUNC_BENCH_LOOPS; i++) {
+      my_memmove(buffer2, buffer2 + 64, 64);
+    } , &cycles );
+  LOG_VAL(INFO, cycles / RAMFUNC_BENCH_LOOPS, "my_memmove 64 cycles");
+  PROFILE_CYCLES( "my_memset 64", for(uint8_t i=0; i<RAMFUNC_BENCH_LOOPS; i++) {
+      my_memset(buffer2, 64, i);
+    } , &cycles );
+  LOG_VAL(INFO, cycles / RAMFUNC_BENCH_LOOPS, "my_memset 64 cycles");
+  PROFILE_CYCLES( "CB add+remove", for(uint8_t i=0; i<RAMFUNC_BENCH_LOOPS; i++) {
+      CB_add_item(&cb, i);
+      CB_remove_item(&cb, &item);
+    } , &cycles );
+  LOG_VAL(INFO, cycles / RAMFUNC_BENCH_LOOPS, "CB add+remove cycles");
+  PROFILE_CYCLES( "lq_add+lq_remove", for(uint8_t i=0; i<RAMFUNC_BENCH_LOOPS; i++) {
+      lq_add(&lq, &log);
+      out.data = (uint8_t *) &val_out;
+      out.length = sizeof(val_out);
+      lq_remove(&lq, &out);
+    } , &cycles );
+  LOG_VAL(INFO, cycles / RAMFUNC_BENCH_LOOPS, "lq_add+lq_remove cycles");
+  LOG_ID(PROFILING_COMPLETED);
+  LOG_FLUSH();
+}
+
+/* Compare per-byte SPI calls against single full-duplex transfers. The HOST
+   numbers are only meaningful when the fake SPI is built with SPI_FAKE_DELAY. */
+void profile_spi() {
+
+  uint8_t tx[33] = { NRF_CMD_WRITE | NRF_REG_TX_ADDR, 0x01, 0x02, 0x03, 0x04, 0x05 };
+  uint8_t rx[33];
+  uint32_t elapsed;
+
+  LOG_ID(PROFILING_STARTED);
+  spi_stats.transfers = 0;
+  spi_stats.bytes = 0;
+  spi_stats.bus_ns = 0;
+
+  PROFILE( "spi_write_byte x6", for(uint8_t i=0; i<6; i++) { spi_write_byte(tx[i]); } , &elapsed );
+  PROFILE( "spi_send_packet 6", spi_write_byte(tx[0]); spi_send_packet(&tx[1], 5) , &elapsed );
+  PROFILE( "spi_transfer 6", spi_transfer(tx, rx, 6) , &elapsed );
+  PROFILE( "spi_transfer 33", spi_transfer(tx, rx, 33) , &elapsed );
+  LOG_FLUSH();
+
+  LOG_VAL(INFO, spi_stats.transfers, "SPI transfers");
+  LOG_VAL(INFO, spi_stats.bytes, "SPI bytes");
+  LOG_VAL(INFO, spi_stats.dma, "SPI DMA transfers");
+  LOG_VAL(INFO, spi_stats.bus_ns / 1000, "SPI modeled bus us");
+  LOG_ID(PROFILING_COMPLETED);
+  LOG_FLUSH();
+}
+
+#ifdef KL25Z
+#define TW_BENCH_TIMERS (200)
+#else
+#define TW_BENCH_TIMERS (4000)
+#endif
+TW_timer_t bench_timers[TW_BENCH_TIMERS];
+
+void bench_callback(void *arg) {
+}
+
+/* Timer wheel scheduling cost with many timers running. The first batch is
+   spread over every level of the wheel, the second all expire together. */
+void profile_timers() {
+
+  uint32_t elapsed;
+  uint32_t next = 0;
+  uint32_t fired = 0;
+  uint32_t seed = 1;
+
+  /* Only logged, so unused with DISABLE_LOG */
+  (void) next;
+  (void) fired;
+
+  LOG_ID(PROFILING_STARTED);
+  LOG_VAL(INFO, TW_BENCH_TIMERS, "Timers");
+  PROFILE( "tw_start spread", for(uint32_t i=0; i<TW_BENCH_TIMERS; i++) {
+      seed = seed * 1103515245 + 12345;
+      tw_start(&bench_timers[i], 1 + (seed >> 8) % 1000000, 0, bench_callback, NULL);
+    } , &elapsed );
+  LOG_VAL(INFO, (uint32_t) ((uint64_t) elapsed * 1000 / TW_BENCH_TIMERS), "tw_start ns each");
+  PROFILE( "tw_next", next = tw_next(), &elapsed );
+  LOG_VAL(INFO, next, "tw_next ticks");
+  PROFILE( "tw_stop all", for(uint32_t i=0; i<TW_BENCH_TIMERS; i++) { tw_stop(&bench_timers[i]); } , &elapsed );
+  LOG_VAL(INFO, (uint32_t) ((uint64_t) elapsed * 1000 / TW_BENCH_TIMERS), "tw_stop ns each");
+  LOG_FLUSH();
+
+  for(uint32_t i=0; i<TW_BENCH_TIMERS; i++) {
+    tw_start(&bench_timers[i], 1 + i % 10, 0, bench_callback, NULL);
+  }
+  delay_ms(20);
+  PROFILE( "tw_advance+tw_run", tw_advance(); fired = tw_run(), &elapsed );
+  LOG_VAL(INFO, fired, "Callbacks run");
+  LOG_VAL(INFO, (uint32_t) ((uint64_t) elapsed * 1000 / TW_BENCH_TIMERS), "Expiry ns each");
+  LOG_VAL(INFO, tw_stats.cascaded, "Timers cascaded");
+  LOG_VAL(INFO, tw_stats.programmed, "Timer reprograms");
+  LOG_ID(PROFILING_COMPLETED);
+  LOG_FLUSH();
+}
+
+#ifdef KL25Z
+#define LOG_BENCH_RECORDS (256)
+#else
+#define LOG_BENCH_RECORDS (65536)
+#endif
+
+#define LOG_BENCH_BATCHES (LOG_BENCH_RECORDS / 16)
+
+static uint32_t log_bench_flush_us[LOG_BENCH_BATCHES];
+
+static int log_bench_cmp(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a;
+  uint32_t y = *(const uint32_t *) b;
+  return (x > y) - (x < y);
+}
+
+/* Records per second through log_flush(), in batches of 16 that fit the log
+   queue, and the 99th percentile time to flush a batch. On HOST, redirect
+   stdout to measure formatting rather than a tty, or build with LOG_OUT_FILE
+   to compare the memory-mapped file. */
+void profile_log() {
+
+  uint8_t addr[] = { 0xe7, 0x00, 0x5a, 0x0f, 0xff };
+  uint32_t elapsed = 0;
+  uint32_t start;
+
+  /* Only logged, so unused with DISABLE_LOG */
+  (void) addr;
+  LOG_ID(PROFILING_STARTED);
+  LOG_FLUSH();
+  for(uint32_t batch=0; batch<LOG_BENCH_BATCHES; batch++) {
+    uint32_t records = batch * 16;
+    (void) records;
+    for(uint8_t i=0; i<4; i++) {
+      LOG_VAL(INFO, records * 1000 + i, "Record");
+      LOG_INT(DATA_ALPHA_COUNT, -(int32_t) records);
+      LOG_DATA(NRF_ADDRESS, addr, sizeof(addr));
+      LOG_ID(HEARTBEAT);
+    }
+    start = get_usecs();
+    LOG_FLUSH();
+    log_bench_flush_us[batch] = get_usecs() - start;
+    elapsed += log_bench_flush_us[batch];
+  }
+  qsort(log_bench_flush_us, LOG_BENCH_BATCHES, sizeof(uint32_t), log_bench_cmp);
+  LOG_VAL(INFO, LOG_BENCH_RECORDS, "Log records flushed");
+  LOG_VAL(INFO, elapsed, "Log flush us");
+  if( elapsed ) {
+    LOG_VAL(INFO, (uint32_t) ((uint64_t) LOG_BENCH_RECORDS * 1000000 / elapsed), "Log records/s");
+  }
+  LOG_VAL(INFO, log_bench_flush_us[LOG_BENCH_BATCHES * 99 / 100], "Log flush p99 us");
+  LOG_ID(PROFILING_COMPLETED);
+  LOG_FLUSH();
+}
+
+#ifndef KL25Z
+#define LOG_BENCH_THREADS (16)
+#define LOG_BENCH_ROUNDS (16)
+/* Records per thread per round, a round from every thread must fit the log */
+#define LOG_BENCH_BURST (256)
+
+static pthread_barrier_t log_bench_barrier;
+static uint32_t log_bench_start[LOG_BENCH_THREADS];
+static uint32_t log_bench_end[LOG_BENCH_THREADS];
+
+/* Log a burst each round, timing it in the thread itself */
+static void *log_bench_thread(void *arg)
+{
+  uintptr_t id = (uintptr_t) arg;
+
+  for(uint32_t round=0; round<LOG_BENCH_ROUNDS; round++) {
+    pthread_barrier_wait(&log_bench_barrier);
+    log_bench_start[id] = get_usecs();
+    for(uint32_t i=0; i<LOG_BENCH_BURST; i++) {
+      LOG_INT(DATA_TOTAL_COUNT, i);
+    }
+    log_bench_end[id] = get_usecs();
+    pthread_barrier_wait(&log_bench_barrier);
+  }
+  return NULL;
+}
+
+/* Logging throughput with 1, 2, 4, 8 and 16 threads logging at once, from the
+   first thread starting a round to the last one finishing. Each round is
+   flushed (untimed) before the next, so no records are dropped. Compare
+   builds with and without LOG_SHARDS and LOG_MUTEX. */
+void profile_log_threads() {
+
+  pthread_t threads[LOG_BENCH_THREADS];
+  uint32_t elapsed;
+  uint32_t first;
+  uint32_t last;
+  uint32_t records;
+
+  /* Only logged, so unused with DISABLE_LOG */
+  (void) records;
+  LOG_ID(PROFILING_STARTED);
+  LOG_VAL(INFO, sysconf(_SC_NPROCESSORS_ONLN), "Log bench cores");
+  LOG_FLUSH();
+  for(uint8_t count=1; count<=LOG_BENCH_THREADS; count*=2) {
+    pthread_barrier_init(&log_bench_barrier, NULL, count + 1);
+    for(uintptr_t i=0; i<count; i++) {
+      pthread_create(&threads[i], NULL, log_bench_thread, (void *) i);
+    }
+    elapsed = 0;
+    for(uint32_t round=0; round<LOG_BENCH_ROUNDS; round++) {
+      pthread_barrier_wait(&log_bench_barrier);
+      pthread_barrier_wait(&log_bench_barrier);
+      first = log_bench_start[0];
+      last = log_bench_end[0];
+      for(uint8_t i=1; i<count; i++) {
+        first = ((int32_t) (log_bench_start[i] - first) < 0) ? log_bench_start[i] : first;
+        last = ((int32_t) (log_bench_end[i] - last) > 0) ? log_bench_end[i] : last;
+      }
+      elapsed += last - first;
+      LOG_FLUSH();
+    }
+    for(uint8_t i=0; i<count; i++) {
+      pthread_join(threads[i], NULL);
+    }
+    pthread_barrier_destroy(&log_bench_barrier);
+
+    records = count * LOG_BENCH_ROUNDS * LOG_BENCH_BURST;
+    LOG_VAL(INFO, count, "Log bench threads");
+    if( elapsed ) {
+      LOG_VAL(INFO, (uint32_t) ((uint64_t) records * 1000000 / elapsed), "Log threaded records/s");
+    }
+    LOG_FLUSH();
+  }
+  LOG_ID(PROFILING_COMPLETED);
+  LOG_FLUSH();
+}
+#endif
+
+#define NRF_STREAM_BYTES (32 * NRF_MAX_PAYLOAD)
+
+#ifndef KL25Z
+/* The second simulated radio swallows everything it receives */
+size_t nrf_sim_demo_sink(const uint8_t *data, size_t length, uint8_t *ack) {
+  return 0;
+}
+#endif
+
+/* Stream a buffer to the nRF peer, reporting the SPI cost per packet and the
+   packet rate. On HOST the peer is a second simulated radio, and the rate is
+   taken from the simulated clock. */
+void nrf_stream_demo() {
+
+  /* Default pipe 0 address, so the ACKs reach our own pipe 0 too */
+  uint8_t peer_addr[] = { 0xe7, 0xe7, 0xe7, 0xe7, 0xe7 };
+  uint32_t elapsed;
+  size_t sent = 0;
+  uint32_t packets;
+  uint32_t transactions;
+
+  /* Only logged, so unused with DISABLE_LOG */
+  (void) sent;
+  (void) transactions;
+  #ifndef KL25Z
+  uint64_t start;
+  nrf_sim_select(1);
+  nrf_init();
+  nrf_enable_dynamic_payloads(0);
+  nrf_start_rx();
+  nrf_sim_set_sink(1, nrf_sim_demo_sink);
+  nrf_sim_select(0);
+  nrf_init();
+  start = nrf_sim_time();
+  #endif
+
+  packets = nrf_stats.tx_packets;
+  transactions = nrf_stats.transactions;
+  LOG_INFO("Streaming to NRF peer");
+  nrf_write_tx_addr(peer_addr);
+  nrf_enable_dynamic_payloads(0);
+  PROFILE( "nrf_send_stream", sent = nrf_send_stream(buffer1, NRF_STREAM_BYTES), &elapsed );
+  #ifndef KL25Z
+  elapsed = (nrf_sim_time() - start) / 1000;
+  #endif
+
+  packets = nrf_stats.tx_packets - packets;
+  LOG_VAL(INFO, sent, "NRF bytes sent");
+  LOG_VAL(INFO, packets, "NRF packets sent");
+  LOG_VAL(INFO, nrf_stats.transactions - transactions, "NRF SPI transactions");
+  LOG_VAL(INFO, elapsed, "NRF stream us");
+  if( elapsed ) {
+    LOG_VAL(INFO, (uint32_t) ((uint64_t) packets * 1000000 / elapsed), "NRF packets/s");
+  }
+  LOG_FLUSH();
+}
+
+/* Logs queued for each run of the overlap demo */
+#define OVERLAP_LOGS (16)
+
+static void overlap_fill_log(void)
+{
+  for( uint32_t i = 0; i < OVERLAP_LOGS; i++ ) {
+    LOG_VAL(INFO, i, "Overlap log");
+  }
+}
+
+/* Stream to the nRF peer and flush the log, first one after the other, then as
+   two coroutines sharing the core. The gain is the log output done while SPI
+   transfers are in flight, so on HOST it needs SPI_FAKE_DELAY. */
+void nrf_overlap_demo() {
+
+  NRF_stream_t stream;
+  CR_t flush;
+  uint8_t streaming = 1;
+  uint8_t flushing = 1;
+  uint32_t start;
+  uint32_t serial_us;
+  uint32_t overlap_us;
+
+  /* Only logged, so unused with DISABLE_LOG */
+  (void) serial_us;
+  (void) overlap_us;
+  LOG_INFO("Streaming to NRF peer, then flushing the log");
+  LOG_FLUSH();
+  overlap_fill_log();
+  start = get_usecs();
+  nrf_send_stream(buffer1, NRF_STREAM_BYTES);
+  LOG_FLUSH();
+  serial_us = get_usecs() - start;
+
+  LOG_INFO("Streaming to NRF peer while flushing the log");
+  LOG_FLUSH();
+  overlap_fill_log();
+  start = get_usecs();
+  nrf_stream_start(&stream, buffer1, NRF_STREAM_BYTES);
+  CR_INIT(&flush);
+  while( streaming || flushing ) {
+    if( streaming ) {
+      streaming = !CR_DONE(nrf_stream_cr(&stream));
+    }
+    if( flushing ) {
+      flushing = !CR_DONE(log_flush_cr(&flush));
+    }
+  }
+  overlap_us = get_usecs() - start;
+
+  LOG_VAL(INFO, serial_us, "Stream then flush us");
+  LOG_VAL(INFO, overlap_us, "Stream with flush us");
+  LOG_FLUSH();
+}
+
+#ifdef DATAPROCESSOR
+/* Input is waiting. Takes one buffer's worth per event, so replaying a file
+   doesn't starve the rest of the loop. */
+static void input_event(uint32_t data)
+{
+  uint8_t *span;
+  size_t count;
+
+  io_input_read();
+  while( (count = io_input_span(&span)) > 0 ) {
+    process_chars(span, count);
+    io_input_consume(count);
+  }
+  #ifndef KL25Z
+  if( io_input_eof() ) {
+    ev_unwatch_fd(io_input_fd());
+    LOG_ID(DATA_ANALYSIS_COMPLETED);
+    log_statistics();
+  }
+  #endif
+}
+#endif
+
+#ifdef PROFILER
+static TW_timer_t ev_stats_timer;
+
+static void event_stats(void *arg)
+{
+  ev_log_stats();
+  log_mem_stats();
+}
+#endif
+
 void project3(void)
 {
   platform_init();
@@ -212,29 +643,43 @@ void project3(void)
   profile_memory();
   profile_memory();
   profile_memory();
+  profile_ramfunc();
+  profile_spi();
+  profile_timers();
+  profile_log();
+  #ifndef KL25Z
+  profile_log_threads();
+  #endif
   #endif
 
   #ifdef NRF
+  nrf_init();
   nrf_demo();
+  nrf_stream_demo();
+  nrf_overlap_demo();
+  #ifdef GPIO_TRACE_VCD
+  gpio_trace_write_vcd(GPIO_TRACE_VCD);
+  #endif
   #endif
 
   #ifdef DATAPROCESSOR
   processor_init();
-  while (1) {
-    size_t rx_count;
-    rx_count = read_str( (char *) chars, MAX_CHARS);
-    if( rx_count > 0 ) {
-      process_chars( chars, rx_count );
-    }
-    LOG_FLUSH();
+  ev_register(EV_UART_RX, input_event);
+  #ifndef KL25Z
+  #ifdef DATAPROCESSOR_INPUT
+  if( io_input_open(DATAPROCESSOR_INPUT) < 0 ) {
+    LOG_STR(ERROR, "Can't open " DATAPROCESSOR_INPUT);
   }
   #endif
+  ev_watch_fd(io_input_fd(), EV_UART_RX);
+  #endif
+  #endif
 
-  // Show a few heartbeats...
-  while(1)
-  {
-    LOG_FLUSH();
-  }
+  #ifdef PROFILER
+  tw_start(&ev_stats_timer, 10000, 10000, event_stats, NULL);
+  #endif
+
+  ev_run();
   LOG_ID(SYSTEM_HALTED);
   LOG_FLUSH();
 }
@@ -0,0 +1,63 @@
+/**
+ * @file ring_map.c
+ * @brief Ring buffer storage mapped twice, back to back (Linux)
+ *
+ * Both halves are reserved together first, so nothing else can be mapped in
+ * between, then the memfd is mapped over each half.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "ring_map.h"
+
+size_t ring_map_size(size_t size)
+{
+  size_t page = sysconf(_SC_PAGESIZE);
+
+  return (size + page - 1) & ~(page - 1);
+}
+
+uint8_t *ring_map(size_t size)
+{
+  uint8_t *base;
+  int fd;
+
+  if( (size == 0) || (size != ring_map_size(size)) ) {
+    return NULL;
+  }
+
+  fd = memfd_create("ring", MFD_CLOEXEC);
+  if( fd < 0 ) {
+    return NULL;
+  }
+  if( ftruncate(fd, size) < 0 ) {
+    close(fd);
+    return NULL;
+  }
+
+  base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if( base != MAP_FAILED ) {
+    if( (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) ||
+        (mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) ) {
+      munmap(base, 2 * size);
+      base = MAP_FAILED;
+    }
+  }
+  /* The mappings hold on to the pages */
+  close(fd);
+
+  return (base == MAP_FAILED) ? NULL : base;
+}
+
+void ring_unmap(volatile uint8_t *base, size_t size)
+{
+  if( base != NULL ) {
+    munmap((void *) base, 2 * size);
+  }
+}
@@ -5,13 +5,47 @@
  * Functions for initializing, configuring, and sending/receiving via a
  * SPI device when no SPI hardware is available.
  *
+ * Bytes are exchanged with the simulated nRF module (see nrf_sim.h), which
+ * only responds while its chip select is low. Bus time is modeled using the
+ * same bit rate as the KL25Z driver, accumulated in `spi_stats` and advances
+ * the simulation clock. When built with SPI_FAKE_DELAY, each transfer also
+ * takes its modeled duration in real time, so that the throughput of drivers
+ * built on SPI can be benchmarked on the host. spi_poll() reports completion
+ * only once that time has passed, which lets coroutines overlap other work
+ * with the transfer.
+ *
  * @author Jeff Schornick
  * @date 2017/07/31
 **/
 
 #include <stdint.h>
 #include <stddef.h>
+#include <time.h>
 #include "logger.h"
+#include "spi.h"
+#include "nrf_sim.h"
+
+/* Modeled software overhead to start/finish a transfer */
+#define SPI_FAKE_SETUP_NS (500)
+
+SPI_stats_t spi_stats;
+
+/* Byte received during the last spi_write_byte() */
+static uint8_t spi_last_rx;
+
+static uint8_t spi_owned;
+
+#ifdef SPI_FAKE_DELAY
+/* Real time when the transfer in progress completes */
+static uint64_t spi_fake_done_ns;
+
+static uint64_t spi_fake_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec;
+}
+#endif
 
 void spi_init(void)
 {
@@ -19,30 +53,87 @@ void spi_init(void)
   LOG_INFO("Using fake SPI driver");
 }
 
+/* The data is exchanged straight away, only the completion is delayed */
+void spi_start(const uint8_t *tx, uint8_t *rx, size_t length)
+{
+  uint64_t ns = SPI_FAKE_SETUP_NS + (uint64_t) length * SPI_BYTE_NS;
+
+  spi_stats.transfers++;
+  spi_stats.bytes += length;
+  spi_stats.bus_ns += ns;
+
+  for( size_t i = 0; i < length; i++ ) {
+    /* Read before write, `tx` and `rx` may be the same buffer */
+    uint8_t miso = nrf_sim_exchange( tx ? tx[i] : SPI_FILL_BYTE );
+    if( rx ) {
+      rx[i] = miso;
+    }
+  }
+  nrf_sim_advance(ns);
+
+#ifdef SPI_FAKE_DELAY
+  spi_fake_done_ns = spi_fake_now() + ns;
+#endif
+}
+
+uint8_t spi_poll(void)
+{
+#ifdef SPI_FAKE_DELAY
+  return (spi_fake_now() >= spi_fake_done_ns) ? 1 : 0;
+#else
+  return 1;
+#endif
+}
+
+void spi_transfer(const uint8_t *tx, uint8_t *rx, size_t length)
+{
+  spi_start(tx, rx, length);
+  /* Spin, sleeping would be far too coarse for a single transfer */
+  while( !spi_poll() ) {};
+}
+
+uint8_t spi_acquire(void)
+{
+  if( spi_owned ) {
+    return 0;
+  }
+  spi_owned = 1;
+  return 1;
+}
+
+void spi_release(void)
+{
+  spi_owned = 0;
+}
+
+void spi_idle(void)
+{
+  nrf_sim_idle();
+}
+
+uint32_t spi_time_us(void)
+{
+  return (uint32_t) (nrf_sim_time() / 1000);
+}
+
 void spi_read_byte(uint8_t *byte)
 {
-  LOG_INFO("Fake SPI read");
-  *byte = 42;
+  *byte = spi_last_rx;
 }
 
 void spi_write_byte(uint8_t byte)
 {
-  LOG_VAL(INFO, byte, "Fake SPI write");
+  spi_transfer(&byte, &spi_last_rx, 1);
 }
 
 void spi_send_packet(uint8_t *p, size_t length)
 {
-  while( length-- > 0) {
-    LOG_VAL(INFO, *p++, "Fake SPI send");
-  }
+  spi_transfer(p, NULL, length);
 }
 
 void spi_receive_packet(uint8_t *p, size_t length, uint8_t nop)
 {
-  LOG_INFO("Fake SPI RX packet");
-  while( length-- > 0) {
-    *p++ = 0xab;
-  }
+  spi_transfer(NULL, p, length);
 }
 
 void spi_flush(void)
@@ -5,6 +5,15 @@
  * Functions for initializing, configuring, and sending/receiving via a
  * SPI device on the KL25Z.
  *
+ * SPI0 has a single transmit buffer in front of the shift register, so at most
+ * two bytes can be in flight. spi_transfer() keeps the transmitter exactly one
+ * byte ahead of the receiver and always drains the receive buffer, which means
+ * the status byte of a command is never stale and no settling delay is needed.
+ *
+ * A transfer is run by spi_poll(), which moves bytes whenever the peripheral
+ * is ready and returns as soon as it would have to wait. spi_transfer() just
+ * polls until done, coroutines return to their caller instead.
+ *
  * @author Jeff Schornick
  * @date 2017/07/31
 **/
@@ -15,12 +24,40 @@
 #include "logger.h"
 #include "platform.h"
 #include "spi.h"
+#include "dma.h"
 #include "timer.h"
 
 #define SPI_PRESCALE (0) /* 1x */
 #define SPI_DIVIDER  (1) /* 2^2 = 4x --> 6MHz */
 #define SPI_CLOCK ( BUS_CLOCK / ((SPI_PRESCALE+1) * (1 << (SPI_DIVIDER+1))) )  /* Ref: p677 */
 
+/* Bytes allowed on the bus before the first is received (TX buffer + shifter) */
+#define SPI_MAX_IN_FLIGHT (2)
+
+/* DMA channels and request sources used for SPI0 bursts (KL25 TRM p64) */
+#define SPI_DMA_TX_CHAN   (1)
+#define SPI_DMA_RX_CHAN   (2)
+#define SPI_DMA_SRC_RX    (16)
+#define SPI_DMA_SRC_TX    (17)
+
+SPI_stats_t spi_stats;
+
+/* Byte received during the last spi_write_byte() */
+static uint8_t spi_last_rx;
+
+/* The transfer in progress */
+typedef struct {
+  const uint8_t *tx;
+  uint8_t *rx;
+  size_t length;
+  size_t sent;
+  size_t received;
+  uint8_t dma;
+} SPI_xfer_t;
+
+static SPI_xfer_t spi_xfer;
+static uint8_t spi_owned;
+
 void spi_init(void)
 {
 
@@ -39,8 +76,8 @@ void spi_init(void)
   // SPI0_C2
   //  MODFEN=0 : disable mode fault, SS is normal GPIO (3-wire mode)
   //  SPC0=0 : separate MOSI/MISO (not single-wire)
-  //  TXDMAE=0 : No TX DMA
-  //  RXDMAE=0 : No RX DMA
+  //  TXDMAE=0 : No TX DMA (enabled per transfer)
+  //  RXDMAE=0 : No RX DMA (enabled per transfer)
   SPI0->C2 = 0;
 
   // SPI0_BR (baud rate)
@@ -49,44 +86,193 @@ void spi_init(void)
   //  Baud rate = (Bus Clock) / ((Prescale+1) * (2^(Divider+1)))
   SPI0->BR = SPI_BR_SPPR(SPI_PRESCALE) | SPI_BR_SPR(SPI_DIVIDER);
 
+#ifdef SPI_DMA
+  // Route the SPI0 DMA requests to the TX/RX channels
+  SIM->SCGC6 |= SIM_SCGC6_DMAMUX(1);
+  SIM->SCGC7 |= SIM_SCGC7_DMA(1);
+  DMAMUX0->CHCFG[SPI_DMA_TX_CHAN] = DMAMUX_CHCFG_ENBL(1) | DMAMUX_CHCFG_SOURCE(SPI_DMA_SRC_TX);
+  DMAMUX0->CHCFG[SPI_DMA_RX_CHAN] = DMAMUX_CHCFG_ENBL(1) | DMAMUX_CHCFG_SOURCE(SPI_DMA_SRC_RX);
+#endif
+
   // Enable the SPI device
   SPI0->C1 |= SPI_C1_SPE(1);
 
   LOG_VAL(SPI_INITIALIZED, SPI_CLOCK, "SPI0_CLK");
 }
 
+#ifdef SPI_DMA
+/**
+ * @brief Start exchanging a block of bytes using the DMA controller
+ *
+ * The RX channel is armed before the TX channel so that no received byte can
+ * be missed. Both channels use cycle-steal mode, moving one byte per request
+ * from the SPI peripheral. Completion is detected by polling the RX channel,
+ * see spi_poll_dma().
+ **/
+static void spi_start_dma(const uint8_t *tx, uint8_t *rx, size_t length)
+{
+  static uint8_t fill = SPI_FILL_BYTE;
+  static uint8_t sink;
+
+  DMA0->DMA[SPI_DMA_RX_CHAN].DSR_BCR = DMA_DSR_BCR_DONE(1);
+  DMA0->DMA[SPI_DMA_RX_CHAN].SAR = (uint32_t) &SPI0->D;
+  DMA0->DMA[SPI_DMA_RX_CHAN].DAR = (uint32_t) (rx ? rx : &sink);
+  DMA0->DMA[SPI_DMA_RX_CHAN].DSR_BCR = DMA_DSR_BCR_BCR(length);
+  DMA0->DMA[SPI_DMA_RX_CHAN].DCR =
+    DMA_DCR_ERQ(1)             // start on peripheral request
+    | DMA_DCR_CS(1)            // one byte per request
+    | DMA_DCR_D_REQ(1)         // drop request when BCR reaches zero
+    | DMA_DCR_SSIZE(DMA_8_BIT)
+    | DMA_DCR_DSIZE(DMA_8_BIT)
+    | DMA_DCR_DINC(rx ? 1 : 0);
+
+  DMA0->DMA[SPI_DMA_TX_CHAN].DSR_BCR = DMA_DSR_BCR_DONE(1);
+  DMA0->DMA[SPI_DMA_TX_CHAN].SAR = (uint32_t) (tx ? tx : &fill);
+  DMA0->DMA[SPI_DMA_TX_CHAN].DAR = (uint32_t) &SPI0->D;
+  DMA0->DMA[SPI_DMA_TX_CHAN].DSR_BCR = DMA_DSR_BCR_BCR(length);
+  DMA0->DMA[SPI_DMA_TX_CHAN].DCR =
+    DMA_DCR_ERQ(1)
+    | DMA_DCR_CS(1)
+    | DMA_DCR_D_REQ(1)
+    | DMA_DCR_SSIZE(DMA_8_BIT)
+    | DMA_DCR_DSIZE(DMA_8_BIT)
+    | DMA_DCR_SINC(tx ? 1 : 0);
+
+  SPI0->C2 |= SPI_C2_RXDMAE(1) | SPI_C2_TXDMAE(1);
+  spi_stats.dma++;
+}
+
+/* Returns 1 once the RX channel is done, leaving the channels idle */
+static uint8_t spi_poll_dma(void)
+{
+  if( !(DMA0->DMA[SPI_DMA_RX_CHAN].DSR_BCR & (DMA_DSR_BCR_DONE_MASK|DMA_ERROR_MASKS)) ) {
+    return 0;
+  }
+
+  SPI0->C2 &= ~(SPI_C2_RXDMAE_MASK | SPI_C2_TXDMAE_MASK);
+  DMA0->DMA[SPI_DMA_TX_CHAN].DSR_BCR = DMA_DSR_BCR_DONE(1);
+  DMA0->DMA[SPI_DMA_RX_CHAN].DSR_BCR = DMA_DSR_BCR_DONE(1);
+  spi_xfer.dma = 0;
+  spi_xfer.received = spi_xfer.length;
+  return 1;
+}
+#endif
+
+void spi_start(const uint8_t *tx, uint8_t *rx, size_t length)
+{
+  spi_stats.transfers++;
+  spi_stats.bytes += length;
+
+  spi_xfer.tx = tx;
+  spi_xfer.rx = rx;
+  spi_xfer.length = length;
+  spi_xfer.sent = 0;
+  spi_xfer.received = 0;
+  spi_xfer.dma = 0;
+
+#ifdef SPI_DMA
+  if( length >= SPI_DMA_THRESHOLD ) {
+    spi_xfer.dma = 1;
+    spi_start_dma(tx, rx, length);
+  }
+#endif
+}
+
+uint8_t spi_poll(void)
+{
+  uint8_t progress;
+
+#ifdef SPI_DMA
+  if( spi_xfer.dma ) {
+    return spi_poll_dma();
+  }
+#endif
+
+  while( spi_xfer.received < spi_xfer.length )
+  {
+    progress = 0;
+    // Queue the next byte whenever the TX buffer is free, but never get more
+    // than one byte ahead of the receiver or RX data would be overrun
+    if( (spi_xfer.sent < spi_xfer.length)
+        && ((spi_xfer.sent - spi_xfer.received) < SPI_MAX_IN_FLIGHT)
+        && (SPI0->S & SPI_S_SPTEF_MASK) )
+    {
+      SPI0->D = spi_xfer.tx ? spi_xfer.tx[spi_xfer.sent] : SPI_FILL_BYTE;
+      spi_xfer.sent++;
+      progress = 1;
+    }
+    // Reading D after SPRF=1 clears the flag for the next byte
+    if( SPI0->S & SPI_S_SPRF_MASK )
+    {
+      uint8_t byte = SPI0->D;
+      if( spi_xfer.rx ) {
+        spi_xfer.rx[spi_xfer.received] = byte;
+      }
+      spi_xfer.received++;
+      progress = 1;
+    }
+    if( !progress ) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void spi_transfer(const uint8_t *tx, uint8_t *rx, size_t length)
+{
+  spi_start(tx, rx, length);
+  while( !spi_poll() ) {};
+}
+
+uint8_t spi_acquire(void)
+{
+  if( spi_owned ) {
+    return 0;
+  }
+  spi_owned = 1;
+  return 1;
+}
+
+void spi_release(void)
+{
+  spi_owned = 0;
+}
+
+void spi_idle(void)
+{
+}
+
+uint32_t spi_time_us(void)
+{
+  return get_usecs();
+}
+
 void spi_read_byte(uint8_t *byte)
 {
-  // Wait for SPI0_S->SPRF=1 (RX full)
-  while( !(SPI0->S & SPI_S_SPRF_MASK) ) {};
-  *byte = SPI0->D;
+  *byte = spi_last_rx;
 }
 
 void spi_write_byte(uint8_t byte)
 {
-  // Wait for SPI0_S->SPTEF=1 (TX empty)
-  //    Tx will be ignored if not read first!
-  spi_flush();
-  SPI0->D = byte;
-  // FIXME: why do we need this delay to get nRF status?
-  delay_us(1);
+  spi_transfer(&byte, &spi_last_rx, 1);
 }
 
 void spi_send_packet(uint8_t *p, size_t length)
 {
-  while( length-- > 0) {
-    spi_flush();
-    SPI0->D = *p++;
-  }
-  // FIXME: why do we need this delay to get nRF status?
-  delay_us(1);
+  spi_transfer(p, NULL, length);
 }
 
 void spi_receive_packet(uint8_t *p, size_t length, uint8_t nop)
 {
-  while( length-- > 0) {
-    spi_write_byte(nop);
-    spi_read_byte(p++);
+  if( nop != SPI_FILL_BYTE ) {
+    // Clock out the requested NOP in place, each byte is replaced as received
+    for( size_t i = 0; i < length; i++ ) {
+      p[i] = nop;
+    }
+    spi_transfer(p, p, length);
+  }
+  else {
+    spi_transfer(NULL, p, length);
   }
 }
 
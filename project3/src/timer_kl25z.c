@@ -3,19 +3,20 @@
  * @brief Function definitions for timer peripherals and SysTick.
  *
  * Includes initialization/configuration of the TPM0 timer and SysTick (system
- * timer) peripherals, profiling functions, and tick-to-time conversions.
+ * timer) peripherals, profiling functions, and tick-to-time conversions. TPM0
+ * runs as a one-shot for the next software timer wheel deadline.
  *
  * @author Jeff Schornick
  * @date 2017/07/22
 **/
 
 #include "MKL25Z4.h"  /* includes core_cm0plus.h */
-#include "led.h"
-#include "logger.h"
+#include "atomics.h"
 #include "timer.h"
+#include "timer_wheel.h"
+#include "event.h"
 
 volatile uint32_t timer_counter = 0;
-volatile uint32_t timer_ticks;
 uint32_t startup_ticks;
 
 void systick_setup(void)
@@ -34,14 +35,46 @@ void systick_setup(void)
   /*   0 = core clock / 16 */
   /*   1 = core clock */
   SysTick->CTRL |= SysTick_CTRL_CLKSOURCE_Msk; // core clock
-  // Disable interrupt trigger
-  SysTick->CTRL &= ~SysTick_CTRL_TICKINT_Msk;
+  // Interrupt on every reload to extend the count
+  clock_init();
+  SysTick->CTRL |= SysTick_CTRL_TICKINT_Msk;
   // Start timer running
   SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
 
   startup_ticks = get_ticks();
 }
 
+/* SysTick reloads every ~0.35 seconds */
+void SysTick_Handler(void)
+{
+  clock_wrap();
+}
+
+/* Clock source for the timer wheel */
+static uint32_t timer_usecs(void)
+{
+  return get_usecs();
+}
+
+/* One-shot overflow `ms` from now, or stop the counter when idle */
+static void timer_program(uint32_t ms)
+{
+  /* CNT and MOD only update immediately while the counter is disabled */
+  BME_AND(TPM0->SC, ~TPM_SC_CMOD_MASK);
+  while( TPM0->SC & TPM_SC_CMOD_MASK ) {};
+  BME_OR(TPM0->SC, TPM_SC_TOF_MASK);
+  NVIC_ClearPendingIRQ(TPM0_IRQn);
+
+  if( ms == TW_IDLE ) {
+    return;
+  }
+  ms = (ms > TIMER_MAX_MS) ? TIMER_MAX_MS : ms;
+  ms = ms ? ms : 1;
+  TPM0->CNT = 0;
+  TPM0->MOD = (ms * TIMER_COUNTS_PER_MS) - 1;
+  BME_OR(TPM0->SC, TPM_SC_CMOD(1));  // Increment on internal clock source (enables timer)
+}
+
 void timer_setup(void)
 {
   /* Make sure peripheral clock is enabled */
@@ -61,33 +94,23 @@ void timer_setup(void)
   /*   (MUST be set before CMOD enables timer!) */
   TPM0->SC |= TPM_SC_PS(TIMER_PS_VAL);
 
-  /* Modulo value, see timer.h */
-  TPM0->MOD = TIMER_MOD_VAL;
-
-  TPM0->SC |= TPM_SC_CMOD(1);  // Increment on internal clock source (enables timer)
-
-  timer_ticks = get_ticks();
+  /* Counter stays stopped (CMOD=0) until the wheel programs a deadline */
 
   /* Allow TPM0 interrupt the CPU */
   /*   (see: core_cm0plus.h, MKL25Z4.h) */
   NVIC_ClearPendingIRQ(TPM0_IRQn);
   NVIC_EnableIRQ(TPM0_IRQn);
-}
 
+  tw_init(timer_usecs, timer_program);
+}
 
-/* Increment counter and process heartbeat every overflow */
+/* Advance the timer wheel every overflow, the wheel reprograms the timer */
 void TPM0_IRQHandler(void)
 {
   timer_counter++;
-  timer_ticks = get_ticks();
-  if (TPM0->SC & TPM_SC_TOF_MASK)
-  {
-    if( (timer_counter % 10 ) == 0) {
-      led_toggle(GREEN_LED);
-    }
-    // Write 1 to TOF to clear flag
-    TPM0->SC |= TPM_SC_TOF_MASK;
-  }
+  // Write 1 to TOF to clear flag, in one bus write
+  BME_OR(TPM0->SC, TPM_SC_TOF_MASK);
+  tw_advance();
 }
 
 
@@ -127,6 +150,7 @@ void rtc_setup(void)
     RTC_TSR = RTC_TIME;
   }
   RTC->SR |= RTC_SR_TCE(1); // Time Counter Enable (read-only, incrementing);
+  clock_second(RTC->TSR);
 
   // Timer seconds interrupt
   RTC->IER = RTC_IER_TSIE(1);
@@ -138,5 +162,6 @@ void rtc_setup(void)
 void RTC_Seconds_IRQHandler(void)
 {
   // No flag to clear Timer Seconds interrupt
-  LOG_ID(HEARTBEAT);
+  clock_second(RTC->TSR);
+  ev_post(EV_RTC_TICK, RTC->TSR);
 }
@@ -0,0 +1,58 @@
+/**
+ * @file timer_linux.c
+ * @brief Timer wheel hardware timer for Linux platforms
+ *
+ * A timerfd stands in for the KL25Z TPM0 one-shot. Instead of an interrupt,
+ * the event loop watches the timerfd and advances the wheel when it fires.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/06
+ **/
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "timer.h"
+#include "timer_wheel.h"
+#include "event.h"
+
+static int timer_fd = -1;
+
+/* Clock source for the timer wheel */
+static uint32_t timer_usecs(void)
+{
+  return get_usecs();
+}
+
+/* One-shot expiry `ms` from now, or disarm when idle */
+static void timer_program(uint32_t ms)
+{
+  struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+
+  if( ms != TW_IDLE ) {
+    ms = ms ? ms : 1;
+    spec.it_value.tv_sec = ms / 1000;
+    spec.it_value.tv_nsec = (ms % 1000) * 1000000;
+  }
+  timerfd_settime(timer_fd, 0, &spec, NULL);
+}
+
+/* The timerfd fired, bring the wheel up to date */
+static void timer_event(uint32_t data)
+{
+  uint64_t expirations;
+
+  if( read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations) ) {
+    tw_advance();
+  }
+}
+
+void timer_setup(void)
+{
+  if( timer_fd < 0 ) {
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ev_watch_fd(timer_fd, EV_TIMER);
+  }
+  ev_register(EV_TIMER, timer_event);
+  tw_init(timer_usecs, timer_program);
+}
@@ -0,0 +1,327 @@
+/**
+ * @file timer_wheel.c
+ * @brief Hierarchical software timer wheel
+ *
+ * Each slot holds an unordered list of timers. A timer lives in the lowest
+ * level whose span covers its remaining delay, in the slot for its expiry at
+ * that level's resolution. Each time the lower level wraps, the next slot of
+ * the level above is redistributed downwards.
+ *
+ * The wheel's time only moves when it is synchronized with the clock, so timers
+ * are always placed relative to a consistent `tw_now`. Catching up steps
+ * straight to the next tick with a timer to expire or a slot to cascade, so a
+ * late sync costs one step per timer rather than one per tick.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/06
+ **/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "platform.h"
+#include "timer_wheel.h"
+
+TW_stats_t tw_stats;
+
+static TW_timer_t *tw_slots[TW_LEVELS][TW_SLOTS];
+static TW_timer_t *tw_ready;           /* Expired, waiting on tw_run() */
+static TW_timer_t **tw_ready_tail;
+
+static uint32_t tw_now;                /* Current wheel tick */
+static uint32_t tw_last_us;            /* Clock reading at tw_now */
+static uint32_t tw_deadline;           /* Tick the hardware timer is armed for */
+static uint8_t tw_armed;
+
+static TW_clock_t tw_clock;
+static TW_program_t tw_program;
+
+/* Slot list manipulation, interrupts must be masked */
+
+static void tw_push(TW_timer_t **head, TW_timer_t *timer)
+{
+  timer->next = *head;
+  if( timer->next ) {
+    timer->next->pprev = &timer->next;
+  }
+  *head = timer;
+  timer->pprev = head;
+}
+
+static void tw_append_ready(TW_timer_t *timer)
+{
+  timer->next = NULL;
+  timer->pprev = tw_ready_tail;
+  *tw_ready_tail = timer;
+  tw_ready_tail = &timer->next;
+  tw_stats.expired++;
+}
+
+static void tw_unlink(TW_timer_t *timer)
+{
+  if( tw_ready_tail == &timer->next ) {
+    tw_ready_tail = timer->pprev;
+  }
+  *timer->pprev = timer->next;
+  if( timer->next ) {
+    timer->next->pprev = timer->pprev;
+  }
+  timer->pprev = NULL;
+}
+
+/* Place a timer by its expiry relative to tw_now */
+static void tw_insert(TW_timer_t *timer)
+{
+  uint32_t delta = timer->expires - tw_now;
+  uint8_t level = 0;
+
+  if( delta == 0 ) {
+    tw_append_ready(timer);
+    return;
+  }
+  while( (level < TW_LEVELS - 1) && (delta >> (TW_SLOT_BITS * (level + 1))) ) {
+    level++;
+  }
+  tw_push(&tw_slots[level][(timer->expires >> (TW_SLOT_BITS * level)) & TW_SLOT_MASK], timer);
+}
+
+/* Redistribute one upper level slot into the levels below */
+static void tw_cascade(uint8_t level)
+{
+  TW_timer_t **head = &tw_slots[level][(tw_now >> (TW_SLOT_BITS * level)) & TW_SLOT_MASK];
+  TW_timer_t *timer = *head;
+  TW_timer_t *next;
+
+  *head = NULL;
+  while( timer ) {
+    next = timer->next;
+    tw_insert(timer);
+    tw_stats.cascaded++;
+    timer = next;
+  }
+}
+
+/* Advance the wheel by one tick, expiring the timers for the new tick */
+static void tw_tick(void)
+{
+  TW_timer_t **head;
+  TW_timer_t *timer;
+  TW_timer_t *next;
+  uint8_t level = 0;
+
+  tw_now++;
+
+  /* Cascade from the top down, so timers can fall through several levels */
+  while( (level < TW_LEVELS - 1) &&
+         !((tw_now >> (TW_SLOT_BITS * level)) & TW_SLOT_MASK) ) {
+    level++;
+  }
+  for( ; level > 0; level-- ) {
+    tw_cascade(level);
+  }
+
+  head = &tw_slots[0][tw_now & TW_SLOT_MASK];
+  timer = *head;
+  *head = NULL;
+  while( timer ) {
+    next = timer->next;
+    tw_append_ready(timer);
+    timer = next;
+  }
+}
+
+/* Catch the wheel up with the clock. The ticks tw_next() skips over have
+   nothing in their slot and no occupied slot above to cascade. */
+static void tw_sync(void)
+{
+  uint32_t ticks = (tw_clock() - tw_last_us) / TW_TICK_US;
+  uint32_t step;
+
+  tw_last_us += ticks * TW_TICK_US;
+  while( ticks ) {
+    step = tw_next();
+    step = (step > ticks) ? ticks : step;
+    tw_now += step - 1;
+    tw_tick();
+    ticks -= step;
+  }
+}
+
+/* Arm the hardware timer early enough for a newly placed timer */
+static void tw_arm(TW_timer_t *timer)
+{
+  if( !tw_program || (timer->expires == tw_now) ) {
+    return;
+  }
+  if( !tw_armed || ((int32_t) (timer->expires - tw_deadline) < 0) ) {
+    uint32_t ticks = timer->expires - tw_now;
+    ticks = (ticks > TW_MAX_SLEEP) ? TW_MAX_SLEEP : ticks;
+    tw_deadline = tw_now + ticks;
+    tw_armed = 1;
+    tw_stats.programmed++;
+    tw_program(ticks);
+  }
+}
+
+TW_status_t tw_init(TW_clock_t clock, TW_program_t program)
+{
+  if( !clock ) {
+    return TW_NULL;
+  }
+
+  START_CRITICAL();
+  for( uint8_t level = 0; level < TW_LEVELS; level++ ) {
+    for( uint32_t slot = 0; slot < TW_SLOTS; slot++ ) {
+      tw_slots[level][slot] = NULL;
+    }
+  }
+  tw_ready = NULL;
+  tw_ready_tail = &tw_ready;
+  tw_clock = clock;
+  tw_program = program;
+  tw_now = 0;
+  tw_last_us = clock();
+  tw_armed = 0;
+  tw_stats = (TW_stats_t) {0};
+  END_CRITICAL();
+
+  if( program ) {
+    program(TW_IDLE);
+  }
+  return TW_OK;
+}
+
+TW_status_t tw_start(TW_timer_t *timer, uint32_t delay, uint32_t period,
+                     TW_callback_t callback, void *arg)
+{
+  if( !timer || !callback ) {
+    return TW_NULL;
+  }
+  if( (delay > TW_MAX_TICKS) || (period > TW_MAX_TICKS) ) {
+    return TW_SIZE_ERR;
+  }
+
+  START_CRITICAL();
+  if( timer->pprev ) {
+    tw_unlink(timer);
+  }
+  tw_sync();
+  timer->expires = tw_now + delay;
+  timer->period = period;
+  timer->callback = callback;
+  timer->arg = arg;
+  tw_insert(timer);
+  tw_arm(timer);
+  tw_stats.started++;
+  END_CRITICAL();
+
+  return TW_OK;
+}
+
+TW_status_t tw_stop(TW_timer_t *timer)
+{
+  if( !timer ) {
+    return TW_NULL;
+  }
+
+  /* The hardware timer is left armed, the wheel just finds nothing to do */
+  START_CRITICAL();
+  if( timer->pprev ) {
+    tw_unlink(timer);
+  }
+  END_CRITICAL();
+
+  return TW_OK;
+}
+
+uint8_t tw_active(const TW_timer_t *timer)
+{
+  return (timer && timer->pprev) ? 1 : 0;
+}
+
+void tw_advance(void)
+{
+  uint32_t ticks;
+
+  START_CRITICAL();
+  tw_sync();
+  ticks = tw_next();
+  if( ticks != TW_IDLE ) {
+    ticks = (ticks > TW_MAX_SLEEP) ? TW_MAX_SLEEP : ticks;
+  }
+  tw_armed = (ticks != TW_IDLE);
+  tw_deadline = tw_now + ticks;
+  if( tw_program ) {
+    tw_stats.programmed++;
+    tw_program(ticks);
+  }
+  END_CRITICAL();
+}
+
+uint32_t tw_run(void)
+{
+  uint32_t count = 0;
+  TW_timer_t *timer;
+  TW_callback_t callback = NULL;
+  void *arg = NULL;
+
+  do {
+    START_CRITICAL();
+    timer = tw_ready;
+    if( timer ) {
+      tw_unlink(timer);
+      callback = timer->callback;
+      arg = timer->arg;
+      if( timer->period ) {
+        /* Keep the phase, skipping expiries already missed */
+        timer->expires += timer->period;
+        if( (int32_t) (timer->expires - tw_now) <= 0 ) {
+          timer->expires += ((tw_now - timer->expires) / timer->period + 1) * timer->period;
+        }
+        tw_insert(timer);
+        tw_arm(timer);
+        tw_stats.started++;
+      }
+    }
+    END_CRITICAL();
+
+    if( timer ) {
+      callback(arg);
+      count++;
+    }
+  } while( timer );
+
+  return count;
+}
+
+uint8_t tw_pending(void)
+{
+  return tw_ready ? 1 : 0;
+}
+
+uint32_t tw_next(void)
+{
+  uint32_t best = TW_IDLE;
+  uint32_t i;
+
+  for( i = 1; i < TW_SLOTS; i++ ) {
+    if( tw_slots[0][(tw_now + i) & TW_SLOT_MASK] ) {
+      best = i;
+      break;
+    }
+  }
+
+  /* Upper levels need attention when their next occupied slot cascades */
+  for( uint8_t level = 1; level < TW_LEVELS; level++ ) {
+    uint8_t shift = TW_SLOT_BITS * level;
+    uint32_t base = tw_now >> shift;
+    for( i = 1; i <= TW_SLOTS; i++ ) {
+      if( tw_slots[level][(base + i) & TW_SLOT_MASK] ) {
+        uint32_t ticks = ((base + i) << shift) - tw_now;
+        best = (ticks < best) ? ticks : best;
+        break;
+      }
+    }
+  }
+
+  return best;
+}
@@ -113,9 +113,10 @@ UART_status_t UART_receive_n(uint8_t *data, size_t num_bytes)
   return UART_OK;
 }
 
+// No RX buffer here, the only byte waiting is the one in the data register
 size_t UART_queued_rx()
 {
-  return -1;
+  return (UART0->S1 & UART0_S1_RDRF_MASK) ? 1 : 0;
 }
 
 void UART_flush()
@@ -12,12 +12,16 @@
 #include "MKL25Z4.h"
 #include "core_cm0plus.h"
 #include "led.h"
+#include "platform.h"
 #include "uart.h"
 #include "circular_buffer.h"
+#include "event.h"
 
 /* Circular buffers used to queue Rx/Tx data for the UART */
 CircBuf_t rxbuf;
 CircBuf_t txbuf;
+static CB_STORAGE(rx_storage, UART_BUF_SIZE, 4);
+static CB_STORAGE(tx_storage, UART_BUF_SIZE, 4);
 
 UART_status_t UART_configure()
 {
@@ -77,8 +81,8 @@ UART_status_t UART_configure()
   UART0->C2 &= ~(UART0_C2_TCIE_MASK); // No interrtupt on TC=1
 
   // Initialize the Rx/Tx circular buffers before first use
-  CB_init(&rxbuf, UART_BUF_SIZE);
-  CB_init(&txbuf, UART_BUF_SIZE);
+  CB_init_static(&rxbuf, rx_storage, UART_BUF_SIZE);
+  CB_init_static(&txbuf, tx_storage, UART_BUF_SIZE);
 
   // Allow UART0 interrupt the CPU
   //  (see: core_cm0plus.h, MKL25Z4.h)
@@ -132,7 +136,7 @@ UART_status_t UART_receive_n(uint8_t *data, size_t num_bytes)
 
 size_t UART_queued_rx()
 {
-  return rxbuf.count;
+  return CB_count(&rxbuf);
 }
 
 void UART_flush()
@@ -141,10 +145,10 @@ void UART_flush()
   return;
 }
 
-void UART0_IRQHandler(void)
+/* The buffers need no masking, the handler is their only producer (rx) or
+   consumer (tx) */
+RAMFUNC void UART0_IRQHandler(void)
 {
-  __disable_irq();
-
   uint8_t item = 0x0;
   if(UART0->S1 & UART0_S1_TDRE_MASK) {
     if(!CB_is_empty(&txbuf)) {
@@ -156,7 +160,6 @@ void UART0_IRQHandler(void)
   if(UART0->S1 & UART0_S1_RDRF_MASK) {
     // reading UART0->D clears the RDRF interrupt flag
     CB_add_item(&rxbuf, UART0->D);
+    ev_signal(EV_UART_RX);
   }
-
-  __enable_irq();
 }
@@ -0,0 +1,89 @@
+/**
+ * @file test_atomics.c
+ * @brief CMocka unittests for the atomic flag and counter updates
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "atomics.h"
+
+#define THREADS (4)
+#define THREAD_LOOPS (100000)
+
+static volatile uint32_t counter;
+static volatile uint32_t flags;
+
+/* Each thread counts up and toggles its own flag bit, racing the others */
+static void *racer(void *arg)
+{
+  uint32_t bit = 1u << (uintptr_t) arg;
+
+  for( uint32_t i = 0; i < THREAD_LOOPS; i++ ) {
+    atomic_add(&counter, 2);
+    atomic_set_bits(&flags, bit);
+    atomic_add(&counter, -1);
+    atomic_clear_bits(&flags, bit);
+  }
+  atomic_set_bits(&flags, bit);
+  return NULL;
+}
+
+void atomics_bits(void **state)
+{
+  volatile uint32_t word = 0x10;
+
+  atomic_set_bits(&word, 0x3);
+  assert_int_equal( word, 0x13 );
+  atomic_clear_bits(&word, 0x11);
+  assert_int_equal( word, 0x2 );
+  assert_int_equal( atomic_test_and_set_bit(&word, 0), 0 );
+  assert_int_equal( atomic_test_and_set_bit(&word, 0), 1 );
+  assert_int_equal( atomic_test_and_set_bit(&word, 1), 1 );
+  assert_int_equal( atomic_test_and_set_bit(&word, 31), 0 );
+  assert_int_equal( word, 0x80000003 );
+}
+
+void atomics_add(void **state)
+{
+  volatile uint32_t value = 5;
+
+  assert_int_equal( atomic_add(&value, 3), 8 );
+  assert_int_equal( atomic_add(&value, -8), 0 );
+  assert_int_equal( atomic_add(&value, -1), UINT32_MAX );
+  assert_int_equal( value, UINT32_MAX );
+}
+
+/* No update is lost, however the threads interleave */
+void atomics_threads(void **state)
+{
+  pthread_t threads[THREADS];
+
+  counter = 0;
+  flags = 0;
+  for( uintptr_t i = 0; i < THREADS; i++ ) {
+    pthread_create(&threads[i], NULL, racer, (void *) i);
+  }
+  for( uint8_t i = 0; i < THREADS; i++ ) {
+    pthread_join(threads[i], NULL);
+  }
+  assert_int_equal( counter, THREADS * THREAD_LOOPS );
+  assert_int_equal( flags, (1u << THREADS) - 1 );
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(atomics_bits),
+    cmocka_unit_test(atomics_add),
+    cmocka_unit_test(atomics_threads),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -11,8 +11,12 @@
 #include <setjmp.h>  /* for cmocka */
 #include <cmocka.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
 #include "circular_buffer.h"
 
+#define SPSC_ITEMS (200000)
+
 /* Verify that CB_init and CB_destory handle dynamic allocation/deallocation of
  * the data buffer. */
 void test_circbuf_allocate_free(void **state)
@@ -47,7 +51,7 @@ void test_circbuf_initialized(void **state)
 
   /* After CB_init, all members should be set to the default values. */
   assert_non_null(cb.buffer);
-  assert_int_equal(cb.count, 0);
+  assert_int_equal(CB_count(&cb), 0);
   assert_int_equal(cb.size, size);
   assert_ptr_equal(cb.head, cb.buffer);
   assert_ptr_equal(cb.tail, cb.buffer);
@@ -325,6 +329,140 @@ void test_circbuf_peek_checks_size(void **state)
 
 }
 
+/* A static buffer uses the given storage, keeps it on destroy, and wraps
+   with a mask when its size is a power of two. */
+static CB_STORAGE(test_storage, 8, 8);
+
+void test_circbuf_static(void **state)
+{
+  CircBuf_t cb;
+  uint8_t item;
+
+  assert_int_equal( CB_init_static(&cb, NULL, 8), CB_NULL );
+  assert_int_equal( CB_init_static(&cb, test_storage, 0), CB_SIZE_ERR );
+  assert_int_equal( (uintptr_t) test_storage % 8, 0 );
+
+  assert_int_equal( CB_init_static(&cb, test_storage, 8), CB_OK );
+  assert_ptr_equal( cb.buffer, test_storage );
+  assert_int_equal( cb.mask, 7 );
+  for(int i=1; i<100; i++){
+    CB_add_item(&cb, i);
+    assert_ptr_equal( cb.head, &test_storage[i % 8] );
+    if(i>=8) {
+      CB_remove_item(&cb, &item);
+      assert_int_equal(item, i-7);
+    }
+  }
+  assert_int_equal( CB_destroy(&cb), CB_OK );
+
+  /* Other sizes still wrap at the end */
+  CB_init_static(&cb, test_storage, 5);
+  assert_int_equal( cb.mask, 0 );
+  for(int i=1; i<20; i++){
+    CB_add_item(&cb, i);
+    CB_remove_item(&cb, &item);
+    assert_int_equal(item, i);
+    assert_ptr_equal( cb.tail, &test_storage[i % 5] );
+  }
+}
+
+/* Spans stop at the end of the storage, unless it is mapped twice */
+void test_circbuf_span_consume(void **state)
+{
+  CircBuf_t cb;
+  const volatile cb_item_t *items;
+  uint8_t item;
+
+  CB_init(&cb, 8);
+  assert_int_equal( CB_span(&cb, &items), 0 );
+  for( uint8_t i = 0; i < 14; i++ ) {
+    if( i >= 8 ) {
+      CB_remove_item(&cb, &item);
+    }
+    CB_add_item(&cb, i);
+  }
+  /* Items 6..13, with only 6 at the end of the storage */
+  assert_int_equal( CB_span(&cb, &items), 1 );
+  assert_int_equal( items[0], 6 );
+  assert_int_equal( CB_consume(&cb, 9), CB_SIZE_ERR );
+  assert_int_equal( CB_consume(&cb, 1), CB_OK );
+  assert_int_equal( CB_span(&cb, &items), 7 );
+  assert_int_equal( items[0], 7 );
+  assert_int_equal( items[6], 13 );
+  assert_int_equal( CB_consume(&cb, 7), CB_OK );
+  assert_int_equal( CB_is_empty(&cb), CB_EMPTY );
+  CB_destroy(&cb);
+}
+
+void test_circbuf_mapped(void **state)
+{
+  CircBuf_t cb;
+  const volatile cb_item_t *items;
+  uint8_t item;
+  size_t size;
+
+  assert_int_equal( CB_init_mapped(NULL, 10), CB_NULL );
+  assert_int_equal( CB_init_mapped(&cb, 10), CB_OK );
+  assert_true( cb.mapped );
+  size = cb.size;
+  assert_true( size >= 10 );
+
+  /* Leave the oldest items at the end of the storage */
+  for( size_t i = 0; i < size + 5; i++ ) {
+    CB_add_item(&cb, i);
+    if( i >= size - 5 ) {
+      CB_remove_item(&cb, &item);
+    }
+  }
+  assert_int_equal( CB_count(&cb), size - 5 );
+  assert_int_equal( CB_span(&cb, &items), size - 5 );
+  for( size_t i = 0; i < size - 5; i++ ) {
+    assert_int_equal( items[i], (uint8_t) (i + 10) );
+  }
+  assert_int_equal( CB_peek(&cb, 0, &item), CB_OK );
+  assert_int_equal( item, (uint8_t) (size + 4) );
+  assert_int_equal( CB_peek(&cb, 7, &item), CB_OK );
+  assert_int_equal( item, (uint8_t) (size - 3) );
+
+  assert_int_equal( CB_consume(&cb, size - 6), CB_OK );
+  assert_int_equal( CB_remove_item(&cb, &item), CB_OK );
+  assert_int_equal( item, (uint8_t) (size + 4) );
+  assert_int_equal( CB_destroy(&cb), CB_OK );
+  assert_null( cb.buffer );
+}
+
+static CircBuf_t spsc_cb;
+
+static void *spsc_producer(void *arg)
+{
+  for( uint32_t i = 0; i < SPSC_ITEMS; i++ ) {
+    while( CB_add_item(&spsc_cb, i & 0xff) == CB_FULL ) {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+/* A producer thread racing the consumer loses and reorders nothing, without
+   any lock */
+void test_circbuf_spsc_threads(void **state)
+{
+  pthread_t thread;
+  uint8_t item;
+
+  CB_init(&spsc_cb, 16);
+  pthread_create(&thread, NULL, spsc_producer, NULL);
+  for( uint32_t i = 0; i < SPSC_ITEMS; i++ ) {
+    while( CB_remove_item(&spsc_cb, &item) == CB_EMPTY ) {
+      sched_yield();
+    }
+    assert_int_equal( item, i & 0xff );
+  }
+  pthread_join(thread, NULL);
+  assert_int_equal( CB_is_empty(&spsc_cb), CB_EMPTY );
+  CB_destroy(&spsc_cb);
+}
+
 int main(void)
 {
   const struct CMUnitTest tests[] = {
@@ -340,7 +478,11 @@ int main(void)
     cmocka_unit_test(test_circbuf_handles_overempty),
     cmocka_unit_test(test_circbuf_peek_returns_value),
     cmocka_unit_test(test_circbuf_peek_wraps_around),
-    cmocka_unit_test(test_circbuf_peek_checks_size)
+    cmocka_unit_test(test_circbuf_peek_checks_size),
+    cmocka_unit_test(test_circbuf_static),
+    cmocka_unit_test(test_circbuf_span_consume),
+    cmocka_unit_test(test_circbuf_mapped),
+    cmocka_unit_test(test_circbuf_spsc_threads)
   };
 
   return cmocka_run_group_tests(tests, NULL, NULL);
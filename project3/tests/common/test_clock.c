@@ -0,0 +1,136 @@
+/**
+ * @file test_clock.c
+ * @brief CMocka unittests for the extended clock, run on a simulated SysTick
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/05
+ **/
+
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include "clock.h"
+#include "clock_sim.h"
+
+#define PERIOD (CLOCK_SIM_PERIOD)
+#define TICKS_PER_US (CLOCK_SIM_TICKS_PER_US)
+
+static int setup(void **state)
+{
+  clock_sim_reset();
+  return 0;
+}
+
+/* Ticks and microseconds carry across counter wraps */
+void clock_counts_wraps(void **state)
+{
+  assert_int_equal(clock_ticks(), 0);
+  clock_sim_advance(PERIOD - 1);
+  assert_int_equal(clock_ticks(), PERIOD - 1);
+  clock_sim_advance(1);
+  assert_int_equal(clock_ticks(), PERIOD);
+
+  clock_sim_advance(2 * PERIOD + 100);
+  assert_int_equal(clock_ticks(), 3ull * PERIOD + 100);
+  assert_int_equal(clock_usecs(), (3ull * PERIOD + 100) / TICKS_PER_US);
+}
+
+/* The period doesn't divide into microseconds, so the remainder must carry */
+void clock_usecs_exact(void **state)
+{
+  uint64_t ticks = 0;
+
+  for( uint32_t i = 0; i < 1000; i++ ) {
+    clock_sim_advance(PERIOD - 7);
+    ticks += PERIOD - 7;
+    assert_int_equal(clock_usecs(), ticks / TICKS_PER_US);
+  }
+
+  /* Well past 32 bits of ticks */
+  assert_true(clock_ticks() > UINT32_MAX);
+  assert_int_equal(clock_ticks(), ticks);
+}
+
+/* A wrap whose interrupt is masked is still counted */
+void clock_wrap_pending(void **state)
+{
+  clock_sim_advance(PERIOD - 10);
+  clock_sim_mask(1);
+  clock_sim_advance(20);
+  assert_int_equal(clock_sim_wrapped(), 1);
+  assert_int_equal(clock_ticks(), PERIOD + 10);
+  assert_int_equal(clock_usecs(), (PERIOD + 10) / TICKS_PER_US);
+
+  clock_sim_mask(0);
+  assert_int_equal(clock_sim_wrapped(), 0);
+  assert_int_equal(clock_ticks(), PERIOD + 10);
+}
+
+/* Wraps landing in the middle of a read never make time go backwards */
+void clock_wrap_mid_read(void **state)
+{
+  uint64_t last = 0;
+  uint64_t now;
+
+  /* Odd step so wraps fall at every point of the read */
+  clock_sim_race(PERIOD / 64 + 3);
+  for( uint32_t i = 0; i < 10000; i++ ) {
+    now = clock_ticks();
+    assert_true(now >= last);
+    last = now;
+  }
+  clock_sim_race(0);
+  assert_true(last > 100ull * PERIOD);
+  assert_true(clock_ticks() > last);
+
+  clock_sim_mask(1);
+  clock_sim_race(PERIOD / 64 + 3);
+  for( uint32_t i = 0; i < 64; i++ ) {
+    now = clock_ticks();
+    assert_true(now >= last);
+    last = now;
+    clock_sim_mask(0);
+    clock_sim_mask(1);
+  }
+  clock_sim_mask(0);
+}
+
+/* Timestamps split into seconds and microseconds since the second began */
+void clock_timestamps(void **state)
+{
+  uint32_t secs;
+  uint32_t usecs;
+
+  clock_sim_advance(1000 * TICKS_PER_US);
+  clock_second(100);
+  clock_sim_advance(250 * TICKS_PER_US);
+  clock_timestamp(&secs, &usecs);
+  assert_int_equal(secs, 100);
+  assert_int_equal(usecs, 250);
+
+  /* The next second's interrupt is late */
+  clock_sim_advance(1500000 * TICKS_PER_US);
+  clock_timestamp(&secs, &usecs);
+  assert_int_equal(secs, 101);
+  assert_int_equal(usecs, 500250);
+
+  clock_second(102);
+  clock_timestamp(&secs, &usecs);
+  assert_int_equal(secs, 102);
+  assert_int_equal(usecs, 0);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup(clock_counts_wraps, setup),
+    cmocka_unit_test_setup(clock_usecs_exact, setup),
+    cmocka_unit_test_setup(clock_wrap_pending, setup),
+    cmocka_unit_test_setup(clock_wrap_mid_read, setup),
+    cmocka_unit_test_setup(clock_timestamps, setup),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
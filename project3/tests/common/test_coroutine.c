@@ -0,0 +1,137 @@
+/**
+ * @file test_coroutine.c
+ * @brief CMocka unittests for the stackless coroutine macros
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/08
+ **/
+
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include "coroutine.h"
+
+/* Waits on a flag, counting the steps taken after each wait */
+typedef struct {
+  CR_t cr;
+  uint8_t ready;
+  uint32_t steps;
+  uint32_t i;
+} Ctx_t;
+
+static CR_status_t waiter(Ctx_t *ctx)
+{
+  CR_BEGIN(&ctx->cr);
+  ctx->steps++;
+  CR_WAIT_UNTIL(&ctx->cr, ctx->ready);
+  ctx->steps++;
+  CR_END(&ctx->cr);
+}
+
+static CR_status_t yielder(Ctx_t *ctx)
+{
+  CR_BEGIN(&ctx->cr);
+  for( ctx->i = 0; ctx->i < 3; ctx->i++ ) {
+    ctx->steps++;
+    CR_YIELD(&ctx->cr);
+  }
+  CR_END(&ctx->cr);
+}
+
+static CR_status_t exiter(Ctx_t *ctx)
+{
+  CR_BEGIN(&ctx->cr);
+  ctx->steps++;
+  if( ctx->ready ) {
+    CR_EXIT(&ctx->cr);
+  }
+  ctx->steps++;
+  CR_END(&ctx->cr);
+}
+
+/* Runs the yielder to completion as a child */
+typedef struct {
+  CR_t cr;
+  Ctx_t child;
+  uint32_t steps;
+} Parent_t;
+
+static CR_status_t parent(Parent_t *p)
+{
+  CR_BEGIN(&p->cr);
+  CR_INIT(&p->child.cr);
+  p->child.steps = 0;
+  CR_WAIT_CR(&p->cr, yielder(&p->child));
+  p->steps++;
+  CR_END(&p->cr);
+}
+
+/* A wait returns until its condition holds, then resumes after it */
+void cr_wait_until(void **state)
+{
+  Ctx_t ctx = { {0}, 0, 0, 0 };
+
+  assert_int_equal(waiter(&ctx), CR_WAITING);
+  assert_int_equal(waiter(&ctx), CR_WAITING);
+  assert_int_equal(ctx.steps, 1);
+  ctx.ready = 1;
+  assert_int_equal(waiter(&ctx), CR_ENDED);
+  assert_int_equal(ctx.steps, 2);
+
+  /* Ending restarts from the top */
+  assert_int_equal(waiter(&ctx), CR_ENDED);
+  assert_int_equal(ctx.steps, 4);
+}
+
+/* Each yield gives up exactly one call, and state lives in the context */
+void cr_yield(void **state)
+{
+  Ctx_t ctx = { {0}, 0, 0, 0 };
+
+  assert_int_equal(yielder(&ctx), CR_YIELDED);
+  assert_int_equal(ctx.steps, 1);
+  assert_int_equal(yielder(&ctx), CR_YIELDED);
+  assert_int_equal(yielder(&ctx), CR_YIELDED);
+  assert_int_equal(ctx.steps, 3);
+  assert_int_equal(yielder(&ctx), CR_ENDED);
+}
+
+/* Exiting early is done, and the next call starts over */
+void cr_exit(void **state)
+{
+  Ctx_t ctx = { {0}, 1, 0, 0 };
+
+  assert_int_equal(exiter(&ctx), CR_EXITED);
+  assert_true(CR_DONE(CR_EXITED));
+  assert_int_equal(ctx.steps, 1);
+  ctx.ready = 0;
+  assert_int_equal(exiter(&ctx), CR_ENDED);
+  assert_int_equal(ctx.steps, 3);
+}
+
+/* A parent waits while its child yields, and CR_RUN drives it all */
+void cr_nested(void **state)
+{
+  Parent_t p = { {0} };
+
+  assert_int_equal(parent(&p), CR_WAITING);
+  assert_int_equal(p.child.steps, 1);
+  assert_int_equal(p.steps, 0);
+  CR_RUN(parent(&p));
+  assert_int_equal(p.child.steps, 3);
+  assert_int_equal(p.steps, 1);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(cr_wait_until),
+    cmocka_unit_test(cr_yield),
+    cmocka_unit_test(cr_exit),
+    cmocka_unit_test(cr_nested),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,213 @@
+/**
+ * @file test_crash_log.c
+ * @brief CMocka unittests for the crash log region
+ *
+ * A file mapped in place of the KL25Z's NOINIT RAM stands in for memory kept
+ * over a reset: the region is saved, unmapped, and mapped again (possibly at
+ * another address) by the "next boot".
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "logger.h"
+#include "log_queue.h"
+#include "crash_log.h"
+
+static char path[] = "/tmp/test_crash_log.XXXXXX";
+static int fd = -1;
+
+static const Crash_regs_t fault_regs = {
+  .r0 = 1, .r1 = 2, .r2 = 3, .r3 = 4, .r12 = 12,
+  .lr = 0x4a5, .pc = 0x1234, .xpsr = 0x01000003, .sp = 0x20002f00,
+  .exc_return = 0xfffffff9
+};
+
+static int make_file(void **state)
+{
+  fd = mkstemp(path);
+  if( (fd < 0) || (ftruncate(fd, sizeof(Crash_log_t)) < 0) ) {
+    return -1;
+  }
+  return 0;
+}
+
+static int remove_file(void **state)
+{
+  close(fd);
+  unlink(path);
+  return 0;
+}
+
+/* "Power up" or "reset": map the region from the file */
+static Crash_log_t *boot(void)
+{
+  Crash_log_t *crash = mmap(NULL, sizeof(Crash_log_t), PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+  assert_true( crash != MAP_FAILED );
+  return crash;
+}
+
+static void halt(Crash_log_t *crash)
+{
+  munmap(crash, sizeof(Crash_log_t));
+}
+
+/* Queue `count` logs of `length` bytes, numbered by their time */
+static void add_logs(Log_q *q, uint32_t first, uint32_t count, size_t length)
+{
+  static uint8_t text[64];
+  Log_t item = { .id = DATA_RECEIVED, .type = LD_DATA, .data = text };
+
+  for( uint32_t i = first; i < first + count; i++ ) {
+    memset(text, i, sizeof(text));
+    item.time = i;
+    item.length = length;
+    assert_int_equal( lq_add(q, &item), LQ_OK );
+  }
+}
+
+/* Memory that was never sealed, or sealed and cleared, isn't a crash */
+void crash_log_invalid(void **state)
+{
+  Crash_log_t *crash = boot();
+
+  memset(crash, 0, sizeof(*crash));
+  assert_false( crash_valid(crash) );
+  crash->magic = CRASH_MAGIC;
+  assert_false( crash_valid(crash) );
+
+  crash_begin(crash, &fault_regs);
+  crash_seal(crash);
+  assert_true( crash_valid(crash) );
+  crash_clear(crash);
+  assert_false( crash_valid(crash) );
+  halt(crash);
+
+  crash = boot();
+  assert_false( crash_valid(crash) );
+  halt(crash);
+}
+
+/* The unflushed logs and registers saved at a fault come back after a reset,
+   oldest first, and the queue itself is left alone */
+void crash_log_restart(void **state)
+{
+  Crash_log_t *crash = boot();
+  Log_q q;
+  Log_t out;
+  uint8_t data[64];
+  uint8_t expect[64];
+  size_t pos = 0;
+  size_t used;
+
+  lq_init(&q, 8 * (LOG_HEADER_SIZE + 20) + 32);
+  /* Flush some, so the unflushed logs wrap */
+  add_logs(&q, 0, 8, 20);
+  for( uint8_t i = 0; i < 6; i++ ) {
+    out.data = data;
+    out.length = sizeof(data);
+    lq_remove(&q, &out);
+  }
+  add_logs(&q, 8, 3, 20);
+  used = lq_used(&q);
+
+  crash_begin(crash, &fault_regs);
+  crash_add_queue(crash, &q);
+  crash_seal(crash);
+  assert_int_equal( lq_used(&q), used );
+  assert_int_equal( crash->dropped, 0 );
+  halt(crash);
+  lq_destroy(&q);
+
+  crash = boot();
+  assert_true( crash_valid(crash) );
+  assert_memory_equal( &crash->regs, &fault_regs, sizeof(fault_regs) );
+  for( uint32_t i = 6; i < 11; i++ ) {
+    out.data = data;
+    out.length = sizeof(data);
+    assert_int_equal( crash_remove(crash, &pos, &out), LQ_OK );
+    assert_int_equal( out.time, i );
+    assert_int_equal( out.id, DATA_RECEIVED );
+    assert_int_equal( out.length, 20 );
+    memset(expect, i, sizeof(expect));
+    assert_memory_equal( data, expect, 20 );
+  }
+  assert_int_equal( crash_remove(crash, &pos, &out), LQ_EMPTY );
+  assert_int_equal( crash_remove(NULL, &pos, &out), LQ_NULL );
+
+  /* A bit flipped while the power was off */
+  crash->log[3] ^= 0x10;
+  assert_false( crash_valid(crash) );
+  halt(crash);
+}
+
+/* Only the newest logs that fit are kept, from each queue in turn */
+void crash_log_newest(void **state)
+{
+  Crash_log_t *crash = boot();
+  Log_q q1;
+  Log_q q2;
+  Log_t out;
+  uint8_t data[64];
+  size_t record = LOG_HEADER_SIZE + 50;
+  size_t fit = CRASH_LOG_SIZE / record;
+  size_t pos = 0;
+  uint32_t first;
+
+  lq_init(&q1, 8192);
+  lq_init(&q2, 256);
+  add_logs(&q1, 0, fit + 4, 50);
+  add_logs(&q2, 1000, 1, 50);
+
+  crash_begin(crash, &fault_regs);
+  crash_add_queue(crash, &q1);
+  crash_add_queue(crash, &q2);
+  crash_seal(crash);
+  assert_int_equal( crash->dropped, 5 );
+  assert_true( crash->used <= CRASH_LOG_SIZE );
+  halt(crash);
+
+  crash = boot();
+  assert_true( crash_valid(crash) );
+  first = fit + 4 - fit;
+  for( uint32_t i = first; i < fit + 4; i++ ) {
+    out.data = data;
+    out.length = sizeof(data);
+    assert_int_equal( crash_remove(crash, &pos, &out), LQ_OK );
+    assert_int_equal( out.time, i );
+  }
+  /* The second queue's log had no room left */
+  assert_int_equal( crash_remove(crash, &pos, &out), LQ_EMPTY );
+
+  /* Data is cut to the reader's buffer */
+  pos = 0;
+  out.data = data;
+  out.length = 4;
+  assert_int_equal( crash_remove(crash, &pos, &out), LQ_OK );
+  assert_int_equal( out.length, 4 );
+  assert_int_equal( pos, record );
+  halt(crash);
+  lq_destroy(&q2);
+  lq_destroy(&q1);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(crash_log_invalid),
+    cmocka_unit_test(crash_log_restart),
+    cmocka_unit_test(crash_log_newest),
+  };
+
+  return cmocka_run_group_tests(tests, make_file, remove_file);
+}
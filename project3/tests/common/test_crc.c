@@ -0,0 +1,67 @@
+/**
+ * @file test_crc.c
+ * @brief CMocka unittests for the CRC-32
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include "crc.h"
+
+/* The standard check value, and nothing for no data */
+void crc32_check(void **state)
+{
+  assert_int_equal( crc32(CRC32_INIT, (uint8_t *) "123456789", 9), 0xCBF43926 );
+  assert_int_equal( crc32(CRC32_INIT, (uint8_t *) "", 0), 0 );
+  assert_int_equal( crc32(CRC32_INIT, (uint8_t *) "a", 1), 0xE8B7BE43 );
+}
+
+/* Data added in pieces gives the same CRC */
+void crc32_pieces(void **state)
+{
+  uint32_t crc = CRC32_INIT;
+
+  crc = crc32(crc, (uint8_t *) "1234", 4);
+  crc = crc32(crc, (uint8_t *) "", 0);
+  crc = crc32(crc, (uint8_t *) "56789", 5);
+  assert_int_equal( crc, 0xCBF43926 );
+}
+
+/* The table-driven CRC matches a bit at a time, at any alignment and length */
+void crc32_bitwise(void **state)
+{
+  uint8_t data[300];
+  uint32_t crc;
+
+  for( uint32_t i = 0; i < sizeof(data); i++ ) {
+    data[i] = i * 131 + 7;
+  }
+  for( uint32_t offset = 0; offset < 8; offset++ ) {
+    for( uint32_t length = 0; length + offset <= sizeof(data); length += 13 ) {
+      crc = 0xffffffff;
+      for( uint32_t i = offset; i < offset + length; i++ ) {
+        crc ^= data[i];
+        for( uint8_t bit = 0; bit < 8; bit++ ) {
+          crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+      }
+      assert_int_equal( crc32(CRC32_INIT, &data[offset], length), ~crc );
+    }
+  }
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(crc32_check),
+    cmocka_unit_test(crc32_pieces),
+    cmocka_unit_test(crc32_bitwise),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
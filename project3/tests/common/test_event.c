@@ -0,0 +1,203 @@
+/**
+ * @file test_event.c
+ * @brief CMocka unittests for the cooperative event loop
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/07
+ **/
+
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include <string.h>
+#include "event.h"
+#include "timer_wheel.h"
+
+/* Handlers record the data they were given, in order */
+#define MAX_HANDLED (64)
+static uint32_t handled[MAX_HANDLED];
+static uint32_t handled_count;
+
+static void record(uint32_t data)
+{
+  if( handled_count < MAX_HANDLED ) {
+    handled[handled_count] = data;
+  }
+  handled_count++;
+}
+
+/* Signals itself again, as an ISR would if more input arrived meanwhile */
+static void resignal(uint32_t data)
+{
+  record(data);
+  if( handled_count < 3 ) {
+    ev_signal(EV_UART_RX);
+  }
+}
+
+/* Ends the loop, as a signal handler would */
+static void stop(uint32_t data)
+{
+  record(data);
+  ev_stop();
+}
+
+static uint32_t fake_us;
+
+static uint32_t fake_clock(void)
+{
+  return fake_us;
+}
+
+static void noop(void *arg)
+{
+}
+
+static int setup(void **state)
+{
+  memset(handled, 0, sizeof(handled));
+  handled_count = 0;
+  fake_us = 0;
+  ev_init();
+  tw_init(fake_clock, NULL);
+  return 0;
+}
+
+/* Posted events reach their handlers in order, with their data */
+void ev_fifo(void **state)
+{
+  assert_int_equal(ev_register(EV_DMA_DONE, record), EV_OK);
+  assert_int_equal(ev_register(EV_RTC_TICK, record), EV_OK);
+  assert_false(ev_ready());
+
+  assert_int_equal(ev_post(EV_DMA_DONE, 1), EV_OK);
+  assert_int_equal(ev_post(EV_RTC_TICK, 2), EV_OK);
+  assert_int_equal(ev_post(EV_DMA_DONE, 3), EV_OK);
+  assert_true(ev_ready());
+
+  assert_int_equal(ev_dispatch(), 3);
+  assert_int_equal(handled_count, 3);
+  assert_int_equal(handled[0], 1);
+  assert_int_equal(handled[1], 2);
+  assert_int_equal(handled[2], 3);
+  assert_false(ev_ready());
+  assert_int_equal(ev_dispatch(), 0);
+}
+
+/* Repeated signals queue once until the handler runs */
+void ev_coalesce(void **state)
+{
+  ev_register(EV_UART_RX, record);
+  assert_int_equal(ev_signal(EV_UART_RX), EV_OK);
+  assert_int_equal(ev_signal(EV_UART_RX), EV_OK);
+  assert_int_equal(ev_signal(EV_UART_RX), EV_OK);
+  assert_int_equal(ev_stats.posted, 1);
+  assert_int_equal(ev_stats.coalesced, 2);
+  assert_int_equal(ev_dispatch(), 1);
+
+  assert_int_equal(ev_signal(EV_UART_RX), EV_OK);
+  assert_int_equal(ev_dispatch(), 1);
+  assert_int_equal(handled_count, 2);
+}
+
+/* A signal raised inside its own handler is dispatched, not lost */
+void ev_signal_in_handler(void **state)
+{
+  ev_register(EV_UART_RX, resignal);
+  ev_signal(EV_UART_RX);
+  assert_int_equal(ev_dispatch(), 3);
+  assert_int_equal(handled_count, 3);
+  assert_false(ev_ready());
+}
+
+/* A full queue drops new events and counts them */
+void ev_overflow(void **state)
+{
+  ev_register(EV_DMA_DONE, record);
+  for( uint32_t i = 0; i < EV_QUEUE_SIZE; i++ ) {
+    assert_int_equal(ev_post(EV_DMA_DONE, i), EV_OK);
+  }
+  assert_int_equal(ev_post(EV_DMA_DONE, 99), EV_FULL);
+  assert_int_equal(ev_stats.dropped, 1);
+
+  assert_int_equal(ev_dispatch(), EV_QUEUE_SIZE);
+  assert_int_equal(handled[EV_QUEUE_SIZE - 1], EV_QUEUE_SIZE - 1);
+  assert_int_equal(ev_post(EV_DMA_DONE, 99), EV_OK);
+}
+
+/* Events without a handler never take a queue slot */
+void ev_unhandled(void **state)
+{
+  assert_int_equal(ev_post(EV_RTC_TICK, 1), EV_OK);
+  assert_int_equal(ev_signal(EV_UART_RX), EV_OK);
+  assert_false(ev_ready());
+  assert_int_equal(ev_stats.posted, 0);
+
+  assert_int_equal(ev_post(EV_ID_MAX, 0), EV_SIZE_ERR);
+  assert_int_equal(ev_signal(EV_ID_MAX), EV_SIZE_ERR);
+  assert_int_equal(ev_register(EV_ID_MAX, record), EV_SIZE_ERR);
+
+  /* Only the log flush is handled after init */
+  assert_int_equal(ev_signal(EV_LOG_FLUSH), EV_OK);
+  assert_int_equal(ev_stats.posted, 1);
+}
+
+/* Expired timer callbacks also keep the loop awake */
+void ev_ready_timers(void **state)
+{
+  TW_timer_t timer;
+
+  memset(&timer, 0, sizeof(timer));
+  tw_start(&timer, 1, 0, noop, NULL);
+  assert_false(ev_ready());
+  fake_us += TW_TICK_US;
+  tw_advance();
+  assert_true(ev_ready());
+  tw_run();
+  assert_false(ev_ready());
+}
+
+/* Latency statistics cover every dispatched event */
+void ev_latency(void **state)
+{
+  ev_register(EV_DMA_DONE, record);
+  for( uint32_t i = 0; i < 5; i++ ) {
+    ev_post(EV_DMA_DONE, i);
+  }
+  ev_dispatch();
+  assert_int_equal(ev_stats.posted, 5);
+  assert_int_equal(ev_stats.dispatched, 5);
+  assert_true(ev_stats.latency_sum >= ev_stats.latency_max);
+  assert_true(ev_stats.latency_sum <= (uint64_t) ev_stats.latency_max * 5);
+}
+
+/* ev_run() finishes the events already queued, then returns */
+void ev_run_stop(void **state)
+{
+  ev_register(EV_DMA_DONE, stop);
+  ev_register(EV_RTC_TICK, record);
+  ev_post(EV_DMA_DONE, 1);
+  ev_post(EV_RTC_TICK, 2);
+  ev_run();
+  assert_int_equal(handled_count, 2);
+  assert_int_equal(handled[1], 2);
+  assert_int_equal(ev_stats.wakeups, 0);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup(ev_fifo, setup),
+    cmocka_unit_test_setup(ev_coalesce, setup),
+    cmocka_unit_test_setup(ev_signal_in_handler, setup),
+    cmocka_unit_test_setup(ev_overflow, setup),
+    cmocka_unit_test_setup(ev_unhandled, setup),
+    cmocka_unit_test_setup(ev_ready_timers, setup),
+    cmocka_unit_test_setup(ev_latency, setup),
+    cmocka_unit_test_setup(ev_run_stop, setup),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
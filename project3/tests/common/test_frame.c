@@ -0,0 +1,189 @@
+/**
+ * @file test_frame.c
+ * @brief CMocka unittests for the CRC-checked log frames
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include <string.h>
+#include "log_queue.h"
+#include "frame.h"
+
+#define RECORDS (200)
+
+/* Frames sent, back to back */
+static uint8_t stream[RECORDS * (FRAME_OVERHEAD + 64)];
+static size_t stream_length;
+
+static void stream_out(uint8_t *data, size_t length)
+{
+  memcpy(&stream[stream_length], data, length);
+  stream_length += length;
+}
+
+/* Send RECORDS records of 8 header and 1-40 data bytes, record i starting with i */
+static void send_records(Frame_t *f)
+{
+  uint8_t header[8];
+  uint8_t data[40];
+
+  stream_length = 0;
+  frame_init(f, stream_out, sizeof(header));
+  memset(data, 0x5A, sizeof(data));
+  for( uint32_t i = 0; i < RECORDS; i++ ) {
+    memset(header, 0xA5, sizeof(header));
+    header[0] = i;
+    header[1] = 1 + (i % 40);
+    assert_int_equal( frame_add(f, header, sizeof(header), data, header[1]), LQ_OK );
+    if( (i % 7) == 6 ) {
+      frame_flush(f);
+    }
+  }
+  frame_flush(f);
+}
+
+/* Read every frame from the stream, marking the records found in `seen` */
+static uint32_t read_records(Frame_reader_t *r, uint8_t *seen)
+{
+  Frame_info_t frame;
+  size_t pos = 0;
+  size_t at;
+  uint32_t records = 0;
+
+  frame_reader_init(r, 1);
+  memset(seen, 0, RECORDS);
+  while( frame_next(r, stream, stream_length, &pos, &frame) == LQ_OK ) {
+    assert_int_equal( frame.record_header, 8 );
+    for( at = 0; at < frame.length; at += 8 + frame.payload[at + 1] ) {
+      assert_false( seen[frame.payload[at]] );
+      seen[frame.payload[at]] = 1;
+      records++;
+    }
+    assert_int_equal( at, frame.length );
+  }
+  assert_int_equal( pos, stream_length );
+  return records;
+}
+
+/* Records come back whole and in order, with nothing skipped */
+void frame_round_trip(void **state)
+{
+  Frame_t f;
+  Frame_reader_t r;
+  uint8_t seen[RECORDS];
+  uint8_t big[FRAME_PAYLOAD + 1] = { 0 };
+
+  send_records(&f);
+  assert_int_equal( f.fill, 0 );
+  assert_int_equal( read_records(&r, seen), RECORDS );
+  assert_int_equal( r.skipped, 0 );
+  assert_int_equal( r.lost, 0 );
+  assert_int_equal( r.frames, f.seq );
+
+  /* Empty flushes send nothing, a record too big for a frame is refused */
+  frame_flush(&f);
+  assert_int_equal( frame_add(&f, big, 1, big, FRAME_PAYLOAD), LQ_SIZE_ERR );
+  assert_int_equal( r.frames, f.seq );
+
+  frame_reader_init(&r, 1);
+  assert_int_equal( frame_next(NULL, stream, stream_length, &stream_length, NULL), LQ_NULL );
+}
+
+/* A corrupted byte costs only its frame, the rest are found again */
+void frame_resync(void **state)
+{
+  Frame_t f;
+  Frame_reader_t r;
+  uint8_t seen[RECORDS];
+  uint32_t records;
+  size_t at;
+
+  send_records(&f);
+  /* Flip a bit in a payload, a CRC and a sync */
+  stream[100] ^= 0x10;
+  stream[stream_length / 2] ^= 0x01;
+  at = stream_length - 1;
+  stream[at] ^= 0x80;
+  records = read_records(&r, seen);
+  assert_true( records < RECORDS );
+  assert_true( records > RECORDS - 3 * 7 );
+  assert_true( r.lost >= 2 );
+  assert_true( r.frames + r.lost <= f.seq );
+  assert_true( r.skipped > 0 );
+}
+
+/* Bytes dropped or other output mixed in between frames */
+void frame_drop_and_junk(void **state)
+{
+  Frame_t f;
+  Frame_reader_t r;
+  uint8_t seen[RECORDS];
+  const char *junk = "\xA5\x5A\x10 some other output \xA5";
+  size_t first;
+
+  send_records(&f);
+  first = FRAME_OVERHEAD + 7 * 8 + (1 + 2 + 3 + 4 + 5 + 6 + 7);
+
+  /* Junk after the first frame, nothing lost */
+  memmove(&stream[first + strlen(junk)], &stream[first], stream_length - first);
+  memcpy(&stream[first], junk, strlen(junk));
+  stream_length += strlen(junk);
+  assert_int_equal( read_records(&r, seen), RECORDS );
+  assert_int_equal( r.skipped, strlen(junk) );
+  assert_int_equal( r.lost, 0 );
+
+  /* Drop 3 bytes of the second frame, which is then lost */
+  first += strlen(junk);
+  memmove(&stream[first + 20], &stream[first + 23], stream_length - first - 23);
+  stream_length -= 3;
+  assert_int_equal( read_records(&r, seen), RECORDS - 7 );
+  assert_int_equal( r.lost, 1 );
+  assert_false( seen[7] );
+  assert_true( seen[14] );
+}
+
+/* A frame cut short waits for the rest, unless the stream is complete */
+void frame_partial(void **state)
+{
+  Frame_t f;
+  Frame_reader_t r;
+  Frame_info_t frame;
+  size_t pos = 0;
+  size_t first;
+
+  send_records(&f);
+  first = FRAME_OVERHEAD + 7 * 8 + (1 + 2 + 3 + 4 + 5 + 6 + 7);
+
+  frame_reader_init(&r, 0);
+  assert_int_equal( frame_next(&r, stream, first + 10, &pos, &frame), LQ_OK );
+  assert_int_equal( pos, first );
+  assert_int_equal( frame_next(&r, stream, first + 10, &pos, &frame), LQ_EMPTY );
+  assert_int_equal( pos, first );
+  assert_int_equal( r.skipped, 0 );
+  assert_int_equal( frame_next(&r, stream, stream_length, &pos, &frame), LQ_OK );
+  assert_int_equal( frame.seq, 1 );
+
+  frame_reader_init(&r, 1);
+  pos = first;
+  assert_int_equal( frame_next(&r, stream, first + 10, &pos, &frame), LQ_EMPTY );
+  assert_int_equal( pos, first + 10 );
+  assert_int_equal( r.skipped, 10 );
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(frame_round_trip),
+    cmocka_unit_test(frame_resync),
+    cmocka_unit_test(frame_drop_and_junk),
+    cmocka_unit_test(frame_partial),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,111 @@
+/**
+ * @file test_gpio.c
+ * @brief CMocka unittests for the fake GPIO trace recorder
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/03
+ **/
+
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "gpio.h"
+#include "nrf_sim.h"
+#include "platform.h"
+
+static int setup(void **state)
+{
+  gpio_nrf_init();
+  gpio_high(NRF_CS);
+  gpio_low(NRF_CE);
+  gpio_trace_clear();
+  return 0;
+}
+
+/* Only level changes are recorded, in order, with the simulated time */
+void gpio_trace_changes(void **state)
+{
+  const GPIO_trace_t *t;
+
+  gpio_high(NRF_CS);  /* already high */
+  assert_int_equal(gpio_trace_count(), 0);
+
+  gpio_low(NRF_CS);
+  nrf_sim_advance(1000);
+  gpio_high(NRF_CE);
+  gpio_high(NRF_CE);
+  gpio_high(NRF_CS);
+  assert_int_equal(gpio_trace_count(), 3);
+
+  t = gpio_trace_get(0);
+  assert_int_equal(t->pin, NRF_CS_PIN);
+  assert_int_equal(t->level, 0);
+  assert_int_equal(t->time, 0);
+  t = gpio_trace_get(1);
+  assert_int_equal(t->pin, NRF_CE_PIN);
+  assert_int_equal(t->level, 1);
+  assert_int_equal(t->time, 1000);
+  t = gpio_trace_get(2);
+  assert_int_equal(t->pin, NRF_CS_PIN);
+  assert_int_equal(t->level, 1);
+  assert_null(gpio_trace_get(3));
+}
+
+/* A full ring keeps the newest transitions */
+void gpio_trace_wraps(void **state)
+{
+  for( size_t i = 0; i < GPIO_TRACE_SIZE + 2; i++ ) {
+    nrf_sim_advance(10);
+    if( i & 1 ) {
+      gpio_high(NRF_CE);
+    }
+    else {
+      gpio_low(NRF_CE);
+    }
+  }
+  /* Entry 0 was a repeat of the idle level */
+  assert_int_equal(gpio_trace_count(), GPIO_TRACE_SIZE);
+  assert_int_equal(gpio_trace_get(0)->time, 30);
+  assert_int_equal(gpio_trace_get(GPIO_TRACE_SIZE - 1)->time, 10 * (GPIO_TRACE_SIZE + 2));
+  assert_null(gpio_trace_get(GPIO_TRACE_SIZE));
+}
+
+/* The trace is written as a value change dump */
+void gpio_trace_vcd(void **state)
+{
+  const char *filename = "test_gpio.vcd";
+  char vcd[1024];
+  size_t length;
+  FILE *f;
+
+  gpio_low(NRF_CS);
+  nrf_sim_advance(500);
+  gpio_high(NRF_CS);
+  assert_int_equal(gpio_trace_write_vcd(filename), 0);
+
+  f = fopen(filename, "r");
+  assert_non_null(f);
+  length = fread(vcd, 1, sizeof(vcd) - 1, f);
+  fclose(f);
+  remove(filename);
+  vcd[length] = '\0';
+
+  assert_non_null(strstr(vcd, "$var wire 1 \" nrf_cs $end\n"));
+  assert_non_null(strstr(vcd, "$var wire 1 # nrf_ce $end\n"));
+  assert_non_null(strstr(vcd, "$end\n0\"\n#500\n1\"\n"));
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup(gpio_trace_changes, setup),
+    cmocka_unit_test_setup(gpio_trace_wraps, setup),
+    cmocka_unit_test_setup(gpio_trace_vcd, setup),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,245 @@
+/**
+ * @file test_io.c
+ * @brief CMocka unittests for buffered input on Linux
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#define _GNU_SOURCE
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "io.h"
+
+#define CAPTURE_SIZE (100000)
+
+/* Byte `i` of a capture */
+#define CAPTURE_BYTE(i) ((uint8_t) ((i) * 7 + ((i) >> 8)))
+
+static char capture_path[] = "/tmp/test_io_XXXXXX";
+
+/* Write a recorded capture to replay */
+static int capture_setup(void **state)
+{
+  uint8_t *data = malloc(CAPTURE_SIZE);
+  int fd = mkstemp(capture_path);
+
+  for( uint32_t i = 0; i < CAPTURE_SIZE; i++ ) {
+    data[i] = CAPTURE_BYTE(i);
+  }
+  assert_int_equal(write(fd, data, CAPTURE_SIZE), CAPTURE_SIZE);
+  close(fd);
+  free(data);
+  return 0;
+}
+
+static int capture_teardown(void **state)
+{
+  unlink(capture_path);
+  return 0;
+}
+
+/* Open a pipe as the input, returning the write end */
+static int pipe_input(void)
+{
+  int fds[2];
+  char path[32];
+
+  assert_int_equal(pipe(fds), 0);
+  snprintf(path, sizeof(path), "/dev/fd/%d", fds[0]);
+  assert_true(io_input_open(path) >= 0);
+  close(fds[0]);
+  return fds[1];
+}
+
+/* A file replays in full, in large reads, then reports its end */
+void io_replay_file(void **state)
+{
+  uint8_t *span;
+  size_t len;
+  uint32_t total = 0;
+  uint32_t reads = 0;
+
+  assert_true(io_input_open(capture_path) >= 0);
+  while( !io_input_eof() ) {
+    if( io_input_read() > 0 ) {
+      reads++;
+    }
+    while( (len = io_input_span(&span)) > 0 ) {
+      for( size_t i = 0; i < len; i++ ) {
+        assert_int_equal(span[i], CAPTURE_BYTE(total + i));
+      }
+      io_input_consume(len);
+      total += len;
+    }
+  }
+  assert_int_equal(total, CAPTURE_SIZE);
+  assert_true(reads <= 4);
+  assert_int_equal(io_input_read(), 0);
+}
+
+/* Input that wraps the ring comes back as two spans, in order */
+void io_span_wrap(void **state)
+{
+  uint8_t *span;
+  size_t first;
+  size_t len;
+
+  assert_true(io_input_open(capture_path) >= 0);
+  first = io_input_read();
+  assert_true(first > 1000);
+  io_input_consume(1000);
+  assert_int_equal(io_input_read(), 1000);
+
+  len = io_input_span(&span);
+  assert_int_equal(len, first - 1000);
+  assert_int_equal(span[0], CAPTURE_BYTE(1000));
+  io_input_consume(len);
+
+  len = io_input_span(&span);
+  assert_int_equal(len, 1000);
+  assert_int_equal(span[0], CAPTURE_BYTE(first));
+  assert_int_equal(span[999], CAPTURE_BYTE(first + 999));
+  io_input_consume(len);
+  assert_int_equal(io_input_span(&span), 0);
+}
+
+/* An empty pipe returns nothing instead of blocking, until the writer closes */
+void io_pipe_nonblocking(void **state)
+{
+  int writer = pipe_input();
+  uint8_t *span;
+
+  assert_int_equal(io_input_read(), 0);
+  assert_false(io_input_eof());
+
+  assert_int_equal(write(writer, "partial", 7), 7);
+  assert_int_equal(io_input_read(), 7);
+  assert_int_equal(io_input_span(&span), 7);
+  assert_memory_equal(span, "partial", 7);
+  io_input_consume(7);
+  assert_int_equal(io_input_read(), 0);
+  assert_false(io_input_eof());
+
+  close(writer);
+  assert_int_equal(io_input_read(), 0);
+  assert_true(io_input_eof());
+}
+
+/* read_str() stops short of the buffer size and keeps the rest */
+void io_read_str(void **state)
+{
+  int writer = pipe_input();
+  char str[4];
+
+  assert_int_equal(read_str(str, sizeof(str)), 0);
+  assert_string_equal(str, "");
+
+  assert_int_equal(write(writer, "hello", 5), 5);
+  assert_int_equal(read_str(str, sizeof(str)), 3);
+  assert_string_equal(str, "hel");
+  assert_int_equal(read_str(str, sizeof(str)), 2);
+  assert_string_equal(str, "lo");
+  close(writer);
+}
+
+/* Send standard output to `fd` instead, returning the original */
+static int redirect_stdout(int fd)
+{
+  int saved;
+
+  fflush(stdout);
+  saved = dup(STDOUT_FILENO);
+  assert_true(dup2(fd, STDOUT_FILENO) >= 0);
+  close(fd);
+  return saved;
+}
+
+static void restore_stdout(int saved)
+{
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+}
+
+static off_t file_size(const char *path)
+{
+  struct stat st;
+
+  assert_int_equal(stat(path, &st), 0);
+  return st.st_size;
+}
+
+/* An O_DIRECT output only takes whole blocks on a flush, the tail goes out
+   at the end */
+void io_direct_flush(void **state)
+{
+  char path[] = "/tmp/test_io_direct_XXXXXX";
+  uint8_t line[100];
+  int fd = mkstemp(path);
+  int saved;
+
+  close(fd);
+  fd = open(path, O_WRONLY | O_TRUNC | O_DIRECT);
+  if( fd < 0 ) {
+    unlink(path);
+    return;  /* the file system has no O_DIRECT */
+  }
+  for( uint32_t i = 0; i < sizeof(line); i++ ) {
+    line[i] = CAPTURE_BYTE(i);
+  }
+  io_stats = (IO_stats_t) {0};
+  saved = redirect_stdout(fd);
+  for( uint32_t i = 0; i < 50; i++ ) {
+    print_n(line, sizeof(line));
+  }
+  io_flush();
+  assert_int_equal(file_size(path), 4096);
+  io_flush();
+  assert_int_equal(file_size(path), 4096);
+  io_finish();
+  restore_stdout(saved);
+
+  assert_int_equal(file_size(path), 5000);
+  assert_int_equal(io_stats.errors, 0);
+  unlink(path);
+}
+
+/* Output that can't be written is counted, not silently lost */
+void io_write_errors(void **state)
+{
+  int saved = redirect_stdout(open("/dev/null", O_RDONLY));
+
+  io_stats = (IO_stats_t) {0};
+  print_str("lost");
+  io_flush();
+  restore_stdout(saved);
+
+  assert_int_equal(io_stats.errors, 1);
+  assert_int_equal(io_stats.dropped, 4);
+  assert_int_equal(io_stats.last_error, EBADF);
+  io_stats = (IO_stats_t) {0};
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(io_replay_file),
+    cmocka_unit_test(io_span_wrap),
+    cmocka_unit_test(io_pipe_nonblocking),
+    cmocka_unit_test(io_read_str),
+    cmocka_unit_test(io_direct_flush),
+    cmocka_unit_test(io_write_errors),
+  };
+
+  return cmocka_run_group_tests(tests, capture_setup, capture_teardown);
+}
@@ -0,0 +1,238 @@
+/**
+ * @file test_log_file.c
+ * @brief CMocka unittests for the memory-mapped log file
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logger.h"
+#include "log_queue.h"
+#include "ring_map.h"
+#include "log_file.h"
+
+static char path[] = "/tmp/test_log_file.XXXXXX";
+
+static int make_path(void **state)
+{
+  int fd = mkstemp(path);
+  if( fd < 0 ) {
+    return -1;
+  }
+  close(fd);
+  return 0;
+}
+
+static int remove_path(void **state)
+{
+  unlink(path);
+  return 0;
+}
+
+/* Read back the record `pos` bytes into the log, returning the next position */
+static uint64_t read_record(Log_file_t *lf, uint64_t pos, Log_t *out, uint8_t *data)
+{
+  uint8_t *record = lf->records + (pos % lf->size);
+
+  memcpy(out, record, LOG_HEADER_SIZE);
+  memcpy(data, record + LOG_HEADER_SIZE, out->length);
+  return pos + LOG_HEADER_SIZE + out->length;
+}
+
+void log_file_open(void **state)
+{
+  Log_file_t lf;
+  Log_t item = { 0 };
+
+  assert_int_equal( lf_open(NULL, path, 4096, LF_WRAP), LQ_NULL );
+  assert_int_equal( lf_open(&lf, NULL, 4096, LF_WRAP), LQ_NULL );
+  assert_int_equal( lf_open(&lf, path, 0, LF_WRAP), LQ_SIZE_ERR );
+  assert_int_equal( lf_open(&lf, "/nonexistent/log.map", 4096, LF_WRAP), LQ_ALLOC_ERR );
+
+  assert_int_equal( lf_open(&lf, path, 100, LF_WRAP), LQ_OK );
+  assert_int_equal( lf.size, ring_map_size(100) );
+  assert_memory_equal( lf.header->magic, LF_MAGIC, 8 );
+  assert_int_equal( lf.header->version, LF_VERSION );
+  assert_int_equal( lf.header->size, lf.size );
+  assert_int_equal( lf.header->record_header, LOG_HEADER_SIZE );
+  assert_int_equal( lf_used(&lf), 0 );
+  assert_int_equal( lf_write(NULL, &item), LQ_NULL );
+  assert_int_equal( lf_write(&lf, NULL), LQ_NULL );
+  assert_int_equal( lf_sync(&lf), LQ_OK );
+  assert_int_equal( lf_close(&lf), LQ_OK );
+  assert_null( lf.header );
+  assert_int_equal( lf_close(&lf), LQ_NULL );
+  assert_int_equal( lf_write(&lf, &item), LQ_NULL );
+  assert_int_equal( lf_sync(&lf), LQ_NULL );
+  unlink(path);
+}
+
+/* Records are stored as header and data, in order, and survive reopening */
+void log_file_records(void **state)
+{
+  Log_file_t lf;
+  Log_t item = { .id = INFO, .type = LD_STR, .time = 7, .us = 9 };
+  Log_t out;
+  uint8_t data[32];
+  uint64_t pos = 0;
+
+  assert_int_equal( lf_open(&lf, path, 4096, LF_WRAP), LQ_OK );
+  item.data = (uint8_t *) "first";
+  item.length = 6;
+  assert_int_equal( lf_write(&lf, &item), LQ_OK );
+  item.id = HEARTBEAT;
+  item.type = LD_NULL;
+  item.length = 0;
+  item.data = NULL;
+  assert_int_equal( lf_write(&lf, &item), LQ_OK );
+  assert_int_equal( lf_used(&lf), 2 * LOG_HEADER_SIZE + 6 );
+  lf_close(&lf);
+
+  /* Not synced, the records are still in the file */
+  assert_int_equal( lf_open(&lf, path, 4096, LF_WRAP), LQ_OK );
+  assert_int_equal( lf_used(&lf), 2 * LOG_HEADER_SIZE + 6 );
+  pos = read_record(&lf, pos, &out, data);
+  assert_int_equal( out.id, INFO );
+  assert_int_equal( out.type, LD_STR );
+  assert_int_equal( out.time, 7 );
+  assert_int_equal( out.us, 9 );
+  assert_string_equal( (char *) data, "first" );
+  pos = read_record(&lf, pos, &out, data);
+  assert_int_equal( out.id, HEARTBEAT );
+  assert_int_equal( out.length, 0 );
+  assert_int_equal( pos, lf.header->head );
+
+  /* A different size starts over */
+  lf_close(&lf);
+  assert_int_equal( lf_open(&lf, path, 8192, LF_WRAP), LQ_OK );
+  assert_int_equal( lf_used(&lf), 0 );
+  lf_close(&lf);
+  unlink(path);
+}
+
+/* When full, LF_WRAP gives up the oldest whole records, and records that wrap
+   past the end read back in one piece */
+void log_file_wrap(void **state)
+{
+  Log_file_t lf;
+  Log_t item = { .id = DATA_RECEIVED, .type = LD_DATA };
+  Log_t out;
+  uint8_t text[100];
+  uint8_t data[100];
+  uint64_t pos;
+
+  for( uint8_t i = 0; i < sizeof(text); i++ ) {
+    text[i] = i;
+  }
+  assert_int_equal( lf_open(&lf, path, 4096, LF_WRAP), LQ_OK );
+  item.data = text;
+  for( uint32_t i = 0; i < 1000; i++ ) {
+    item.time = i;
+    item.length = 1 + (i % 97);
+    assert_int_equal( lf_write(&lf, &item), LQ_OK );
+    assert_true( lf_used(&lf) <= lf.size );
+  }
+  assert_true( lf.header->tail > 0 );
+  assert_true( lf.header->head > 2 * lf.size );
+  assert_int_equal( lf.header->dropped, 0 );
+
+  /* The tail is on a record, and the kept records run up to the head */
+  pos = lf.header->tail;
+  read_record(&lf, pos, &out, data);
+  for( uint32_t i = out.time; i < 1000; i++ ) {
+    pos = read_record(&lf, pos, &out, data);
+    assert_int_equal( out.time, i );
+    assert_int_equal( out.length, 1 + (i % 97) );
+    assert_memory_equal( data, text, out.length );
+  }
+  assert_int_equal( pos, lf.header->head );
+
+  /* Too big for the file at all */
+  item.length = lf.size;
+  assert_int_equal( lf_write(&lf, &item), LQ_SIZE_ERR );
+  assert_int_equal( lf.header->dropped, 1 );
+  lf_close(&lf);
+  unlink(path);
+}
+
+/* When full, LF_STOP keeps the oldest records and counts the dropped ones */
+void log_file_stop(void **state)
+{
+  Log_file_t lf;
+  Log_t item = { .id = INFO, .type = LD_DATA, .length = 64 };
+  uint8_t data[64] = { 0 };
+  uint32_t written = 0;
+
+  assert_int_equal( lf_open(&lf, path, 4096, LF_STOP), LQ_OK );
+  item.data = data;
+  while( lf_write(&lf, &item) == LQ_OK ) {
+    written++;
+  }
+  assert_int_equal( written, lf.size / (LOG_HEADER_SIZE + 64) );
+  assert_int_equal( lf.header->tail, 0 );
+  assert_int_equal( lf.header->dropped, 1 );
+  assert_int_equal( lf_write(&lf, &item), LQ_FULL );
+  assert_int_equal( lf.header->dropped, 2 );
+  lf_close(&lf);
+  unlink(path);
+}
+
+/* A resumed file whose oldest record claims more bytes than are kept is
+   emptied rather than evicted past the head */
+void log_file_corrupt(void **state)
+{
+  Log_file_t lf;
+  Log_t item = { .id = INFO, .type = LD_DATA, .length = 64 };
+  uint8_t data[64] = { 0 };
+  size_t bad = (size_t) -1;
+  uint64_t head;
+
+  assert_int_equal( lf_open(&lf, path, 4096, LF_WRAP), LQ_OK );
+  item.data = data;
+  while( lf_used(&lf) + LOG_HEADER_SIZE + 64 <= lf.size ) {
+    assert_int_equal( lf_write(&lf, &item), LQ_OK );
+  }
+  memcpy(lf.records + offsetof(Log_t, length), &bad, sizeof(bad));
+  lf_close(&lf);
+
+  assert_int_equal( lf_open(&lf, path, 4096, LF_WRAP), LQ_OK );
+  head = lf.header->head;
+  assert_int_equal( lf_write(&lf, &item), LQ_OK );
+  assert_int_equal( lf.header->tail, head );
+  assert_int_equal( lf_used(&lf), LOG_HEADER_SIZE + 64 );
+
+  /* Same for a length that only just overruns the head */
+  while( lf_used(&lf) + LOG_HEADER_SIZE + 64 <= lf.size ) {
+    assert_int_equal( lf_write(&lf, &item), LQ_OK );
+  }
+  bad = lf_used(&lf) - LOG_HEADER_SIZE + 1;
+  memcpy(lf.records + (lf.header->tail % lf.size) + offsetof(Log_t, length),
+         &bad, sizeof(bad));
+  head = lf.header->head;
+  assert_int_equal( lf_write(&lf, &item), LQ_OK );
+  assert_int_equal( lf.header->tail, head );
+  assert_true( lf_used(&lf) <= lf.size );
+  lf_close(&lf);
+  unlink(path);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(log_file_open),
+    cmocka_unit_test(log_file_records),
+    cmocka_unit_test(log_file_wrap),
+    cmocka_unit_test(log_file_stop),
+    cmocka_unit_test(log_file_corrupt),
+  };
+
+  return cmocka_run_group_tests(tests, make_path, remove_path);
+}
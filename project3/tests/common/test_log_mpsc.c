@@ -0,0 +1,241 @@
+/**
+ * @file test_log_mpsc.c
+ * @brief CMocka unittests for the multi-producer log queue
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "logger.h"
+#include "log_queue.h"
+#include "log_mpsc.h"
+
+#define PRODUCERS (4)
+#define PRODUCER_LOGS (20000)
+
+/* What each producer thread logs, so the consumer can check it */
+typedef struct {
+  uint32_t thread;
+  uint32_t count;
+  uint32_t check;
+} Mpsc_msg_t;
+
+static Log_mpsc_t shared;
+static LQ_STORAGE(storage, 128, LQM_ALIGN);
+
+static void *producer(void *arg)
+{
+  uint32_t thread = (uintptr_t) arg;
+  Mpsc_msg_t msg = { .thread = thread };
+  Log_t item = { .id = INFO, .type = LD_DATA, .length = sizeof(msg),
+                 .data = (uint8_t *) &msg };
+
+  for( msg.count = 0; msg.count < PRODUCER_LOGS; msg.count++ ) {
+    msg.check = ~(msg.thread + msg.count);
+    item.time = msg.count;
+    while( lqm_add(&shared, &item) == LQ_FULL ) {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+void log_mpsc_init(void **state)
+{
+  Log_mpsc_t q;
+  Log_t item;
+
+  assert_int_equal( lqm_init(NULL, 64), LQ_NULL );
+  assert_int_equal( lqm_init(&q, 32), LQ_SIZE_ERR );
+  assert_int_equal( lqm_init(&q, 100), LQ_SIZE_ERR );
+  assert_int_equal( lqm_init(&q, 128), LQ_OK );
+  assert_int_equal( lqm_used(&q), 0 );
+  assert_int_equal( lqm_add(NULL, &item), LQ_NULL );
+  assert_int_equal( lqm_peek(&q, NULL), LQ_NULL );
+  assert_int_equal( lqm_remove(&q, NULL), LQ_NULL );
+  assert_int_equal( lqm_peek(&q, &item), LQ_EMPTY );
+  assert_int_equal( lqm_remove(&q, &item), LQ_EMPTY );
+  assert_int_equal( lqm_destroy(&q), LQ_OK );
+  assert_null( q.buffer );
+
+  /* Static storage must be aligned for the commit words */
+  assert_int_equal( lqm_init_static(&q, NULL, 64), LQ_NULL );
+  assert_int_equal( lqm_init_static(&q, storage + 1, 64), LQ_SIZE_ERR );
+  assert_int_equal( lqm_init_static(&q, storage, 64), LQ_OK );
+  assert_ptr_equal( q.buffer, storage );
+  assert_int_equal( lqm_peek(&q, &item), LQ_EMPTY );
+}
+
+/* Items come back in order, with their data, across many wraps */
+void log_mpsc_fifo_wrap(void **state)
+{
+  Log_mpsc_t q;
+  Log_t item;
+  Log_t out;
+  Log_t head;
+  char text[] = "wrapping data";
+  uint8_t buf[32];
+
+  /* Record sizes that don't divide the queue, so records start everywhere */
+  lqm_init(&q, 256);
+  memset(&item, 0, sizeof(item));
+  item.id = DATA_RECEIVED;
+  item.type = LD_DATA;
+  item.data = (uint8_t *) text;
+  for( uint32_t i = 0; i < 100; i++ ) {
+    item.length = 1 + (i % 13);
+    for( uint8_t j = 0; j < 3; j++ ) {
+      item.time = 3 * i + j;
+      assert_int_equal( lqm_add(&q, &item), LQ_OK );
+    }
+    for( uint8_t j = 0; j < 3; j++ ) {
+      assert_int_equal( lqm_peek(&q, &head), LQ_OK );
+      assert_int_equal( head.time, 3 * i + j );
+      out.data = buf;
+      out.length = sizeof(buf);
+      assert_int_equal( lqm_remove(&q, &out), LQ_OK );
+      assert_int_equal( out.time, 3 * i + j );
+      assert_int_equal( out.seq, (3 * i + j) & 0xffff );
+      assert_int_equal( out.id, DATA_RECEIVED );
+      assert_int_equal( out.length, 1 + (i % 13) );
+      assert_memory_equal( out.data, text, out.length );
+    }
+    assert_int_equal( lqm_used(&q), 0 );
+  }
+  lqm_destroy(&q);
+}
+
+/* A full queue drops the item, but still uses up a sequence number */
+void log_mpsc_full(void **state)
+{
+  Log_mpsc_t q;
+  Log_t item;
+  Log_t out;
+  uint32_t added = 0;
+
+  lqm_init(&q, 64);
+  memset(&item, 0, sizeof(item));
+  while( lqm_add(&q, &item) == LQ_OK ) {
+    added++;
+  }
+  assert_true( added > 0 );
+  assert_int_equal( item.seq, added );
+  assert_true( lqm_used(&q) <= 64 );
+
+  out.data = NULL;
+  out.length = 0;
+  assert_int_equal( lqm_remove(&q, &out), LQ_OK );
+  assert_int_equal( out.seq, 0 );
+  assert_int_equal( lqm_add(&q, &item), LQ_OK );
+  assert_int_equal( item.seq, added + 1 );
+  lqm_destroy(&q);
+}
+
+/* Data that doesn't fit the reader's buffer is dropped with its item */
+void log_mpsc_truncate(void **state)
+{
+  Log_mpsc_t q;
+  Log_t item = { .length = 14, .data = (uint8_t *) "A long message" };
+  Log_t out;
+  uint8_t buf[4];
+
+  lqm_init(&q, 128);
+  assert_int_equal( lqm_add(&q, &item), LQ_OK );
+  out.data = buf;
+  out.length = sizeof(buf);
+  assert_int_equal( lqm_remove(&q, &out), LQ_OK );
+  assert_int_equal( out.length, 4 );
+  assert_memory_equal( buf, "A lo", 4 );
+  assert_int_equal( lqm_used(&q), 0 );
+  assert_int_equal( lqm_peek(&q, &out), LQ_EMPTY );
+  lqm_destroy(&q);
+}
+
+/* The consumer waits on a reserved item until its commit word is set */
+void log_mpsc_uncommitted(void **state)
+{
+  Log_mpsc_t q;
+  Log_t item;
+  Log_t out;
+  uint32_t commit;
+
+  lqm_init(&q, 128);
+  memset(&item, 0, sizeof(item));
+  assert_int_equal( lqm_add(&q, &item), LQ_OK );
+
+  /* Take the record back to how it looks while it is still being copied */
+  memcpy(&commit, q.buffer, sizeof(commit));
+  memset(q.buffer, 0, sizeof(commit));
+  out.data = NULL;
+  out.length = 0;
+  assert_int_equal( lqm_peek(&q, &out), LQ_EMPTY );
+  assert_int_equal( lqm_remove(&q, &out), LQ_EMPTY );
+  assert_true( lqm_used(&q) > 0 );
+
+  memcpy(q.buffer, &commit, sizeof(commit));
+  assert_int_equal( lqm_remove(&q, &out), LQ_OK );
+  lqm_destroy(&q);
+}
+
+/* Producers racing each other and the consumer lose and corrupt nothing, and
+   each producer's logs stay in order */
+void log_mpsc_threads(void **state)
+{
+  pthread_t threads[PRODUCERS];
+  uint32_t next[PRODUCERS] = { 0 };
+  uint32_t received = 0;
+  Mpsc_msg_t msg;
+  Log_t out;
+
+  /* Small, so the producers keep finding it full */
+  lqm_init(&shared, 1024);
+  for( uintptr_t i = 0; i < PRODUCERS; i++ ) {
+    pthread_create(&threads[i], NULL, producer, (void *) i);
+  }
+
+  while( received < PRODUCERS * PRODUCER_LOGS ) {
+    out.data = (uint8_t *) &msg;
+    out.length = sizeof(msg);
+    if( lqm_remove(&shared, &out) != LQ_OK ) {
+      sched_yield();
+      continue;
+    }
+    assert_int_equal( out.length, sizeof(msg) );
+    assert_true( msg.thread < PRODUCERS );
+    assert_int_equal( msg.count, next[msg.thread] );
+    assert_int_equal( msg.check, ~(msg.thread + msg.count) );
+    assert_int_equal( out.time, msg.count );
+    next[msg.thread]++;
+    received++;
+  }
+
+  for( uint8_t i = 0; i < PRODUCERS; i++ ) {
+    pthread_join(threads[i], NULL);
+    assert_int_equal( next[i], PRODUCER_LOGS );
+  }
+  assert_int_equal( lqm_remove(&shared, &out), LQ_EMPTY );
+  assert_int_equal( lqm_used(&shared), 0 );
+  lqm_destroy(&shared);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(log_mpsc_init),
+    cmocka_unit_test(log_mpsc_fifo_wrap),
+    cmocka_unit_test(log_mpsc_full),
+    cmocka_unit_test(log_mpsc_truncate),
+    cmocka_unit_test(log_mpsc_uncommitted),
+    cmocka_unit_test(log_mpsc_threads),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -11,8 +11,13 @@
 #include <setjmp.h>  /* for cmocka */
 #include <cmocka.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
 #include "log_queue.h"
 
+#define SPSC_LOGS (100000)
+
 #include <stdio.h>
 
 /* Verify that lq_init and lq_destory handle dynamic allocation/deallocation of
@@ -50,17 +55,41 @@ void log_queue_initialize(void **state)
 
   /* After lq_init, all members should be set to the default values. */
   assert_non_null(lq.buffer);
-  assert_int_equal(lq.free, size);
+  assert_int_equal(lq_free(&lq), size);
   assert_int_equal(lq.size, size);
   assert_ptr_equal(lq.head, lq.buffer);
   assert_ptr_equal(lq.tail, lq.buffer);
 }
 
+/* A static queue uses the given storage and keeps it on destroy */
+static LQ_STORAGE(test_storage, 64, 4);
+
+void log_queue_static(void **state)
+{
+  Log_q lq;
+  Log_t item;
+  uint8_t data[] = "static";
+
+  assert_int_equal( lq_init_static(&lq, NULL, 64), LQ_NULL );
+  assert_int_equal( lq_init_static(&lq, test_storage, 0), LQ_SIZE_ERR );
+  assert_int_equal( lq_init_static(&lq, test_storage, sizeof(test_storage)), LQ_OK );
+  assert_ptr_equal( lq.buffer, test_storage );
+  assert_int_equal( lq_free(&lq), 64 );
+
+  memset(&item, 0, sizeof(item));
+  item.length = sizeof(data);
+  item.data = data;
+  assert_int_equal( lq_add(&lq, &item), LQ_OK );
+  assert_int_equal( lq_free(&lq), 64 - LOG_HEADER_SIZE - sizeof(data) );
+  assert_int_equal( lq_destroy(&lq), LQ_OK );
+  assert_int_equal( test_storage[LOG_HEADER_SIZE], 's' );
+}
+
 /* Do all the log queue functions handle null pointers gracefully? */
 void log_queue_handles_null(void **state)
 {
   Log_q lq;
-  Log_t x = {LOGGER_INITIALIZED, LD_NULL, 1234, 0, 0, NULL};
+  Log_t x = { .id = LOGGER_INITIALIZED, .type = LD_NULL, .time = 1234 };
 
   /* Check that we can handle NULL Log_q pointers. Any null parameter should
      result in a status of LQ_NULL. */
@@ -68,11 +97,13 @@ void log_queue_handles_null(void **state)
   assert_int_equal( lq_destroy(NULL), LQ_NULL );
   assert_int_equal( lq_add(NULL, &x), LQ_NULL );
   assert_int_equal( lq_remove(NULL, &x), LQ_NULL );
+  assert_int_equal( lq_peek(NULL, &x), LQ_NULL );
   assert_int_equal( lq_empty(NULL), LQ_NULL );
 
   /* Check that we can handle NULL item pointers as well. */
   lq_init(&lq, 10);
   assert_int_equal( lq_remove(&lq, NULL), LQ_NULL );
+  assert_int_equal( lq_peek(&lq, NULL), LQ_NULL );
 }
 
 /* Ensure we can add and remove the same items for the entire length of the
@@ -197,7 +228,7 @@ void log_queue_wrap_header(void **state)
 void log_queue_wrap_data(void **state)
 {
   Log_q lq;
-  size_t size = 50; // will wrap at data of second add
+  size_t size = LOG_HEADER_SIZE + 26; // will wrap at data of second add
   Log_t item_msg1;
   Log_t item_msg2;
   Log_t item_tmp;
@@ -328,6 +359,140 @@ void log_queue_reports_full(void **state)
   assert_int_equal( lq_add(&lq, &item_no_data), LQ_FULL );
 }
 
+/* Peeking returns the oldest header, even across the wrap, without removing */
+void log_queue_peek(void **state)
+{
+  Log_q lq;
+  Log_t item;
+  Log_t head;
+  Log_t tmp_item;
+  uint8_t tmp_data[4];
+
+  /* Room for two headers, plus a little so the third wraps mid-header */
+  lq_init(&lq, 2 * LOG_HEADER_SIZE + 5);
+  assert_int_equal( lq_peek(&lq, &head), LQ_EMPTY );
+
+  memset(&item, 0, sizeof(item));
+  item.id = INFO;
+  for( uint8_t i = 0; i < 3; i++ ) {
+    item.time = 100 + i;
+    assert_int_equal( lq_add(&lq, &item), LQ_OK );
+    assert_int_equal( lq_peek(&lq, &head), LQ_OK );
+    assert_int_equal( head.time, 100 + i );
+    assert_int_equal( head.seq, i );
+    tmp_item.data = tmp_data;
+    tmp_item.length = sizeof(tmp_data);
+    assert_int_equal( lq_remove(&lq, &tmp_item), LQ_OK );
+    assert_int_equal( tmp_item.time, head.time );
+  }
+  assert_true( lq_empty(&lq) );
+}
+
+/* Every add takes a sequence number, so dropped items leave a gap */
+void log_queue_sequence_gaps(void **state)
+{
+  Log_q lq;
+  Log_t item;
+  Log_t tmp_item;
+
+  lq_init(&lq, LOG_HEADER_SIZE);
+  memset(&item, 0, sizeof(item));
+  assert_int_equal( lq_add(&lq, &item), LQ_OK );
+  assert_int_equal( item.seq, 0 );
+  assert_int_equal( lq_add(&lq, &item), LQ_FULL );
+  assert_int_equal( item.seq, 1 );
+
+  tmp_item.length = 0;
+  tmp_item.data = NULL;
+  lq_remove(&lq, &tmp_item);
+  assert_int_equal( tmp_item.seq, 0 );
+  assert_int_equal( lq_add(&lq, &item), LQ_OK );
+  lq_remove(&lq, &tmp_item);
+  assert_int_equal( tmp_item.seq, 2 );
+}
+
+/* Items that wrap come back whole from storage mapped twice */
+void log_queue_mapped(void **state)
+{
+  Log_q lq;
+  Log_t item;
+  Log_t out;
+  Log_t head;
+  uint8_t data[13] = "mapped data!";
+  uint8_t buf[sizeof(data)];
+
+  assert_int_equal( lq_init_mapped(NULL, 100), LQ_NULL );
+  assert_int_equal( lq_init_mapped(&lq, 100), LQ_OK );
+  assert_true( lq.mapped );
+  assert_true( lq.size >= 100 );
+
+  memset(&item, 0, sizeof(item));
+  item.data = data;
+  /* Enough items of an odd size that they wrap at many offsets */
+  for( uint32_t i = 0; i < 3 * lq.size / LOG_HEADER_SIZE; i++ ) {
+    item.length = 1 + (i % sizeof(data));
+    item.time = i;
+    assert_int_equal( lq_add(&lq, &item), LQ_OK );
+    assert_int_equal( lq_peek(&lq, &head), LQ_OK );
+    assert_int_equal( head.time, i );
+    out.data = buf;
+    out.length = sizeof(buf);
+    assert_int_equal( lq_remove(&lq, &out), LQ_OK );
+    assert_int_equal( out.time, i );
+    assert_int_equal( out.length, item.length );
+    assert_memory_equal( buf, data, out.length );
+    assert_true( lq.head >= lq.buffer && lq.head < lq.buffer + lq.size );
+    assert_ptr_equal( lq.head, lq.tail );
+  }
+  assert_int_equal( lq_destroy(&lq), LQ_OK );
+  assert_null( lq.buffer );
+}
+
+static Log_q spsc_lq;
+
+static void *spsc_producer(void *arg)
+{
+  uint32_t count;
+  Log_t item = { .id = INFO, .type = LD_DATA, .data = (uint8_t *) &count };
+
+  for( count = 0; count < SPSC_LOGS; count++ ) {
+    /* Vary the length, so items wrap at every offset */
+    item.length = 1 + (count % sizeof(count));
+    item.time = count;
+    while( lq_add_spsc(&spsc_lq, &item) == LQ_FULL ) {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+/* A producer thread racing the consumer loses and corrupts nothing, without
+   any lock */
+void log_queue_spsc_threads(void **state)
+{
+  pthread_t thread;
+  Log_t out;
+  uint32_t data;
+
+  assert_int_equal( lq_add_spsc(NULL, &out), LQ_NULL );
+  lq_init(&spsc_lq, 100);
+  pthread_create(&thread, NULL, spsc_producer, NULL);
+  for( uint32_t i = 0; i < SPSC_LOGS; i++ ) {
+    data = 0;
+    out.data = (uint8_t *) &data;
+    out.length = sizeof(data);
+    while( lq_remove(&spsc_lq, &out) == LQ_EMPTY ) {
+      sched_yield();
+    }
+    assert_int_equal( out.time, i );
+    assert_int_equal( out.length, 1 + (i % sizeof(i)) );
+    assert_memory_equal( &data, &i, out.length );
+  }
+  pthread_join(thread, NULL);
+  assert_true( lq_empty(&spsc_lq) );
+  lq_destroy(&spsc_lq);
+}
+
 int main(void)
 {
   const struct CMUnitTest tests[] = {
@@ -339,7 +504,12 @@ int main(void)
     cmocka_unit_test(log_queue_wrap_data),
     cmocka_unit_test(log_queue_drops_if_item_too_small),
     cmocka_unit_test(log_queue_reports_full),
-    cmocka_unit_test(log_queue_initialize)
+    cmocka_unit_test(log_queue_peek),
+    cmocka_unit_test(log_queue_sequence_gaps),
+    cmocka_unit_test(log_queue_initialize),
+    cmocka_unit_test(log_queue_static),
+    cmocka_unit_test(log_queue_mapped),
+    cmocka_unit_test(log_queue_spsc_threads)
   };
 
   return cmocka_run_group_tests(tests, NULL, NULL);
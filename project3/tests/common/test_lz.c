@@ -0,0 +1,201 @@
+/**
+ * @file test_lz.c
+ * @brief CMocka unittests for the LZ log compressor
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lz.h"
+
+#define STREAM_MAX (256 * 1024)
+
+static LZ_t lz;
+static uint8_t frames[STREAM_MAX];
+static size_t frames_length;
+static uint32_t frame_count;
+static uint8_t input[STREAM_MAX];
+static uint8_t output[STREAM_MAX];
+
+static void capture(uint8_t *data, size_t length)
+{
+  assert_true( frames_length + length <= STREAM_MAX );
+  memcpy(&frames[frames_length], data, length);
+  frames_length += length;
+  frame_count++;
+}
+
+/* Decode every captured frame, returning the bytes decoded */
+static size_t decode(void)
+{
+  size_t in = 0;
+  size_t out = 0;
+  size_t raw;
+  size_t length;
+
+  while( in < frames_length ) {
+    assert_true( in + LZ_FRAME_HEADER <= frames_length );
+    raw = frames[in] | (frames[in + 1] << 8);
+    length = frames[in + 2] | (frames[in + 3] << 8);
+    in += LZ_FRAME_HEADER;
+    assert_true( in + length <= frames_length );
+    if( raw & LZ_STORED ) {
+      raw &= ~LZ_STORED;
+      assert_int_equal( length, raw );
+      memcpy(&output[out], &frames[in], raw);
+    }
+    else {
+      assert_true( length < raw );
+      assert_int_equal( lz_decompress(&frames[in], length, &output[out], out, raw), raw );
+    }
+    assert_true( raw <= LZ_BLOCK );
+    in += length;
+    out += raw;
+  }
+  return out;
+}
+
+static int reset(void **state)
+{
+  frames_length = 0;
+  frame_count = 0;
+  lz_init(&lz, capture);
+  return 0;
+}
+
+/* Something like a run of log records: repeated ids and labels, counters and
+   timestamps that change a little */
+static size_t make_logs(uint32_t count)
+{
+  size_t length = 0;
+
+  for( uint32_t i = 0; i < count; i++ ) {
+    uint32_t time = 1500000000 + i / 100;
+    uint32_t us = (i * 1237) % 1000000;
+    input[length++] = 5;
+    input[length++] = 4;
+    memcpy(&input[length], &time, 4);
+    memcpy(&input[length + 4], &us, 4);
+    length += 8;
+    input[length++] = 0;
+    memcpy(&input[length], &i, 2);
+    length += 2;
+    input[length++] = 20;
+    memset(&input[length], 0, 3);
+    length += 3;
+    memcpy(&input[length], &i, 4);
+    memcpy(&input[length + 4], "Log records flushed", 16);
+    length += 20;
+  }
+  return length;
+}
+
+/* Nothing is sent until a block fills or the stream is flushed */
+void lz_empty(void **state)
+{
+  lz_flush(&lz);
+  assert_int_equal( frame_count, 0 );
+  lz_write(&lz, (uint8_t *) "abc", 3);
+  assert_int_equal( frame_count, 0 );
+  lz_flush(&lz);
+  assert_int_equal( frame_count, 1 );
+  assert_int_equal( decode(), 3 );
+  assert_memory_equal( output, "abc", 3 );
+}
+
+/* Log-like data compresses well, and decodes to what went in, across block
+   boundaries and flushes in odd places */
+void lz_round_trip(void **state)
+{
+  size_t length = make_logs(2000);
+  size_t pos = 0;
+  size_t chunk = 1;
+
+  while( pos < length ) {
+    if( chunk > length - pos ) {
+      chunk = length - pos;
+    }
+    lz_write(&lz, &input[pos], chunk);
+    pos += chunk;
+    chunk = (chunk * 7 + 3) % 300;
+    if( (pos % 5) == 0 ) {
+      lz_flush(&lz);
+    }
+  }
+  lz_flush(&lz);
+  assert_int_equal( decode(), length );
+  assert_memory_equal( output, input, length );
+  assert_true( frames_length * 2 < length );
+}
+
+/* Data with no repeats is sent as stored blocks, never bigger than a header
+   per block */
+void lz_stored(void **state)
+{
+  size_t length = 8 * LZ_BLOCK;
+
+  srand(1);
+  for( size_t i = 0; i < length; i++ ) {
+    input[i] = rand();
+  }
+  lz_write(&lz, input, length);
+  lz_flush(&lz);
+  assert_int_equal( frame_count, 8 );
+  assert_int_equal( frames_length, length + 8 * LZ_FRAME_HEADER );
+  assert_int_equal( decode(), length );
+  assert_memory_equal( output, input, length );
+}
+
+/* Long runs and long matches use the extra length bytes */
+void lz_long_runs(void **state)
+{
+  size_t length = 6 * LZ_BLOCK;
+
+  memset(input, 'x', length);
+  memcpy(&input[100], "a different bit", 15);
+  lz_write(&lz, input, length);
+  lz_flush(&lz);
+  assert_int_equal( decode(), length );
+  assert_memory_equal( output, input, length );
+  assert_true( frames_length < length / 10 );
+}
+
+/* Corrupt payloads are rejected rather than read or written out of bounds */
+void lz_corrupt(void **state)
+{
+  uint8_t out[64];
+  /* 2 literals then a match 8 back, before the start */
+  uint8_t far[] = { 0x20, 'a', 'b', 8, 0 };
+  /* 15+ literals, with the count running off the end */
+  uint8_t runoff[] = { 0xf0, 255 };
+  /* Literals past the payload */
+  uint8_t short_literals[] = { 0x50, 'a', 'b' };
+  uint8_t good[] = { 0x20, 'a', 'b', 2, 0, 0x10, 'c' };
+
+  assert_int_equal( lz_decompress(far, sizeof(far), out, 0, 10), 0 );
+  assert_int_equal( lz_decompress(runoff, sizeof(runoff), out, 0, 40), 0 );
+  assert_int_equal( lz_decompress(short_literals, sizeof(short_literals), out, 0, 5), 0 );
+  assert_int_equal( lz_decompress(good, sizeof(good), out, 0, 3), 0 );
+  assert_int_equal( lz_decompress(good, sizeof(good), out, 0, 7), 7 );
+  assert_memory_equal( out, "abababc", 7 );
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup(lz_empty, reset),
+    cmocka_unit_test_setup(lz_round_trip, reset),
+    cmocka_unit_test_setup(lz_stored, reset),
+    cmocka_unit_test_setup(lz_long_runs, reset),
+    cmocka_unit_test(lz_corrupt),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
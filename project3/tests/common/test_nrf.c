@@ -0,0 +1,393 @@
+/**
+ * @file test_nrf.c
+ * @brief CMocka unittests for the nRF driver, run against simulated modules
+ *
+ * Module 0 is driven by the driver under test. Module 1 listens as the peer,
+ * handing received packets straight to `peer()`.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/02
+ **/
+
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include "nrf.h"
+#include "nrf_sim.h"
+#include "spi.h"
+
+/* Everything the peer has received, and an optional ACK payload to return */
+static uint8_t peer_data[1024];
+static size_t peer_length;
+static uint8_t peer_ack[NRF_MAX_PAYLOAD];
+static size_t peer_ack_length;
+
+static size_t peer(const uint8_t *data, size_t length, uint8_t *ack)
+{
+  for( size_t i = 0; i < length; i++ ) {
+    peer_data[peer_length++] = data[i];
+  }
+  for( size_t i = 0; i < peer_ack_length; i++ ) {
+    ack[i] = peer_ack[i];
+  }
+  return peer_ack_length;
+}
+
+/* Configure the peer through the driver, then hand the driver to module 0 */
+static void peer_listen(uint8_t dynamic)
+{
+  nrf_sim_select(1);
+  nrf_init();
+  if( dynamic ) {
+    nrf_enable_dynamic_payloads(1);
+  }
+  else {
+    nrf_write_register(NRF_REG_FEATURE, 0);
+    nrf_write_register(NRF_REG_RX_PW_P0, NRF_MAX_PAYLOAD);
+  }
+  nrf_start_rx();
+  nrf_sim_select(0);
+  nrf_init();
+}
+
+static int setup(void **state)
+{
+  nrf_sim_reset();
+  nrf_sim_set_sink(1, peer);
+  peer_length = 0;
+  peer_ack_length = 0;
+  peer_listen(1);
+  nrf_stats = (NRF_stats_t) {0};
+  return 0;
+}
+
+/* Register writes reach the module and cached reads skip the SPI bus */
+void nrf_register_cache(void **state)
+{
+  assert_int_equal(nrf_read_config(), 0x08);  /* reset value */
+  nrf_write_config(0x0e);
+  assert_int_equal(nrf_read_config(), 0x0e);
+  assert_int_equal(nrf_stats.transactions, 2);
+  assert_int_equal(nrf_stats.cache_hits, 1);
+
+  /* Bypass the cache to confirm the module really changed */
+  nrf_cache_invalidate();
+  assert_int_equal(nrf_read_config(), 0x0e);
+}
+
+/* The fourth payload doesn't fit in the 3-deep TX FIFO */
+void nrf_tx_fifo_full(void **state)
+{
+  uint8_t data[NRF_MAX_PAYLOAD] = {0};
+
+  assert_int_equal(nrf_write_payload(data, 0), NRF_SIZE_ERR);
+  assert_int_equal(nrf_write_payload(data, NRF_MAX_PAYLOAD + 1), NRF_SIZE_ERR);
+  for( uint8_t i = 0; i < NRF_TX_FIFO_DEPTH; i++ ) {
+    assert_int_equal(nrf_write_payload(data, sizeof(data)), NRF_OK);
+  }
+  assert_int_equal(nrf_write_payload(data, sizeof(data)), NRF_FULL);
+  assert_true(nrf_read_status() & NRF_STAT_TX_FULL_MASK);
+
+  nrf_flush_tx_fifo();
+  assert_true(nrf_read_fifo_status() & NRF_FS_TX_EMPTY_MASK);
+}
+
+/* A stream is delivered intact, in order, with a short final packet */
+void nrf_stream_delivers_all(void **state)
+{
+  uint8_t data[1000];
+  for( size_t i = 0; i < sizeof(data); i++ ) {
+    data[i] = i * 7;
+  }
+
+  nrf_enable_dynamic_payloads(0);
+  assert_int_equal(nrf_send_stream(data, sizeof(data)), sizeof(data));
+  assert_int_equal(peer_length, sizeof(data));
+  assert_memory_equal(peer_data, data, sizeof(data));
+  assert_int_equal(nrf_stats.tx_packets, 32);
+  assert_true(nrf_read_fifo_status() & NRF_FS_TX_EMPTY_MASK);
+
+  /* SPI work overlaps the air time, so packets go back-to-back */
+  assert_true(nrf_stats.transactions < 4 * nrf_stats.tx_packets);
+}
+
+/* Commands wait for the SPI bus, so other sequences can run alongside */
+void nrf_command_coroutine(void **state)
+{
+  NRF_cmd_t cmd;
+  uint8_t channel = 0;
+
+  assert_true(spi_acquire());
+  nrf_command_start(&cmd, NRF_CMD_READ|NRF_REG_RF_CH, NULL, &channel, 1);
+  assert_int_equal(nrf_command_cr(&cmd), CR_WAITING);
+  assert_int_equal(nrf_command_cr(&cmd), CR_WAITING);
+  spi_release();
+  CR_RUN(nrf_command_cr(&cmd));
+  assert_false(spi_acquire() == 0);  /* released again */
+  spi_release();
+  assert_int_equal(channel, 2);  /* reset value */
+  assert_int_equal(cmd.status, nrf_last_status());
+}
+
+/* A stream coroutine sharing the bus with another command sequence */
+void nrf_stream_coroutine(void **state)
+{
+  NRF_stream_t stream;
+  NRF_cmd_t cmd;
+  uint8_t data[300];
+  uint8_t fifo;
+  uint32_t calls = 0;
+  for( size_t i = 0; i < sizeof(data); i++ ) {
+    data[i] = i * 3;
+  }
+
+  nrf_enable_dynamic_payloads(0);
+  nrf_stream_start(&stream, data, sizeof(data));
+  nrf_command_start(&cmd, NRF_CMD_READ|NRF_REG_FIFO_STATUS, NULL, &fifo, 1);
+  while( !CR_DONE(nrf_stream_cr(&stream)) ) {
+    if( CR_DONE(nrf_command_cr(&cmd)) ) {
+      nrf_command_start(&cmd, NRF_CMD_READ|NRF_REG_FIFO_STATUS, NULL, &fifo, 1);
+      calls++;
+    }
+  }
+  CR_RUN(nrf_command_cr(&cmd));
+  assert_int_equal(stream.sent, sizeof(data));
+  assert_int_equal(peer_length, sizeof(data));
+  assert_memory_equal(peer_data, data, sizeof(data));
+  assert_true(calls > 0);
+}
+
+/* ACK payloads returned by the peer land in the receive queue */
+void nrf_stream_ack_payloads(void **state)
+{
+  uint8_t data[3 * NRF_MAX_PAYLOAD] = {0};
+  uint8_t rx[NRF_MAX_PAYLOAD];
+  uint8_t pipe = 0xff;
+
+  peer_ack[0] = 0xa5;
+  peer_ack[1] = 0x5a;
+  peer_ack_length = 2;
+  nrf_enable_dynamic_payloads(1);
+  assert_int_equal(nrf_send_stream(data, sizeof(data)), sizeof(data));
+
+  /* Only NRF_RX_FIFO_DEPTH fit in the module while the queue drains them */
+  assert_int_equal(nrf_stats.rx_packets, 3);
+  assert_int_equal(nrf_receive(rx, sizeof(rx), &pipe), 2);
+  assert_int_equal(pipe, 0);
+  assert_int_equal(rx[0], 0xa5);
+  assert_int_equal(rx[1], 0x5a);
+}
+
+/* Received packets are drained on IRQ using the dynamic payload width */
+void nrf_receive_dynamic(void **state)
+{
+  uint8_t rx[NRF_MAX_PAYLOAD];
+  uint8_t pipe;
+
+  nrf_enable_dynamic_payloads(1);
+  nrf_start_rx();
+  assert_int_equal(nrf_receive(rx, sizeof(rx), &pipe), 0);
+  assert_int_equal(nrf_write_ack_payload(1, (uint8_t *) "ok", 2), NRF_OK);
+
+  uint8_t ack[NRF_MAX_PAYLOAD];
+  assert_int_equal(nrf_sim_inject(0, 1, (uint8_t *) "hello", 5, ack), 2);
+  assert_memory_equal(ack, "ok", 2);
+  assert_int_equal(nrf_sim_inject(0, 0, (uint8_t *) "hi", 2, NULL), 0);
+  assert_true(nrf_irq_pending);
+
+  assert_int_equal(nrf_receive(rx, sizeof(rx), &pipe), 5);
+  assert_int_equal(pipe, 1);
+  assert_memory_equal(rx, "hello", 5);
+  assert_int_equal(nrf_receive(rx, sizeof(rx), &pipe), 2);
+  assert_int_equal(pipe, 0);
+  assert_int_equal(nrf_receive(rx, sizeof(rx), &pipe), 0);
+  nrf_standby();
+}
+
+/* Without dynamic payloads the static width from RX_PW_Px is used */
+void nrf_receive_static(void **state)
+{
+  uint8_t rx[NRF_MAX_PAYLOAD];
+  uint8_t data[4] = { 1, 2, 3, 4 };
+
+  nrf_write_register(NRF_REG_RX_PW_P0, sizeof(data));
+  nrf_start_rx();
+  assert_int_equal(nrf_sim_inject(0, 0, data, 3, NULL), -1);  /* wrong width */
+  assert_int_equal(nrf_sim_inject(0, 0, data, sizeof(data), NULL), 0);
+
+  assert_int_equal(nrf_receive(rx, sizeof(rx), NULL), sizeof(data));
+  assert_memory_equal(rx, data, sizeof(data));
+  nrf_standby();
+}
+
+/* Packets beyond the driver queue are counted as dropped, not corrupted */
+void nrf_receive_queue_overflow(void **state)
+{
+  uint8_t rx[NRF_MAX_PAYLOAD];
+
+  nrf_enable_dynamic_payloads(0);
+  nrf_start_rx();
+  for( uint8_t i = 0; i < NRF_RX_QUEUE_DEPTH + 1; i++ ) {
+    assert_int_equal(nrf_sim_inject(0, 0, &i, 1, NULL), 0);
+    nrf_service();
+  }
+  assert_int_equal(nrf_stats.rx_dropped, 1);
+  for( uint8_t i = 0; i < NRF_RX_QUEUE_DEPTH; i++ ) {
+    assert_int_equal(nrf_receive(rx, sizeof(rx), NULL), 1);
+    assert_int_equal(rx[0], i);
+  }
+  nrf_standby();
+}
+
+/* Lost packets and ACKs are retransmitted, and duplicates are discarded */
+void nrf_stream_lossy_link(void **state)
+{
+  uint8_t data[1000];
+  for( size_t i = 0; i < sizeof(data); i++ ) {
+    data[i] = i * 13;
+  }
+
+  nrf_sim_set_link(0, 20);
+  nrf_write_register(NRF_REG_SETUP_RETR, NRF_RETR_ARD(1) | NRF_RETR_ARC(15));
+  nrf_enable_dynamic_payloads(0);
+  assert_int_equal(nrf_send_stream(data, sizeof(data)), sizeof(data));
+  assert_int_equal(peer_length, sizeof(data));
+  assert_memory_equal(peer_data, data, sizeof(data));
+  assert_int_equal(nrf_stats.max_rt, 0);
+
+  const NRF_sim_stats_t *stats = nrf_sim_stats(0);
+  assert_true(stats->retransmits > 0);
+  assert_int_equal(stats->transmits, 32 + stats->retransmits);
+  assert_true(nrf_sim_stats(1)->duplicates > 0);
+}
+
+/* With nobody listening the sender gives up after ARC retransmits */
+void nrf_stream_max_rt(void **state)
+{
+  uint8_t data[2 * NRF_MAX_PAYLOAD] = {0};
+
+  nrf_sim_select(1);
+  nrf_standby();
+  nrf_sim_select(0);
+  nrf_write_register(NRF_REG_SETUP_RETR, NRF_RETR_ARD(0) | NRF_RETR_ARC(5));
+  assert_int_equal(nrf_send_stream(data, sizeof(data)), 0);
+  assert_int_equal(nrf_stats.max_rt, 1);
+  assert_int_equal(nrf_sim_stats(0)->transmits, 6);
+  assert_int_equal(nrf_read_register(NRF_REG_OBSERVE_TX), 0x15);  /* PLOS 1, ARC 5 */
+  assert_true(nrf_read_fifo_status() & NRF_FS_TX_EMPTY_MASK);
+}
+
+/* Takes packets until `peer_fail_after`, then the link goes down */
+static size_t peer_fail_after;
+
+static size_t peer_failing(const uint8_t *data, size_t length, uint8_t *ack)
+{
+  if( peer_length + length >= peer_fail_after ) {
+    nrf_sim_set_link(0, 100);
+  }
+  return peer(data, length, ack);
+}
+
+/* Giving up part way through counts the packets that left the FIFO, however
+   many TX_DS flags were coalesced */
+void nrf_stream_max_rt_partial(void **state)
+{
+  NRF_stream_t stream;
+  uint8_t data[10 * NRF_MAX_PAYLOAD] = {0};
+
+  peer_fail_after = 5 * NRF_MAX_PAYLOAD;
+  nrf_sim_set_sink(1, peer_failing);
+  nrf_enable_dynamic_payloads(0);
+  nrf_write_register(NRF_REG_SETUP_RETR, NRF_RETR_ARD(0) | NRF_RETR_ARC(2));
+  nrf_stream_start(&stream, data, sizeof(data));
+  while( !CR_DONE(nrf_stream_cr(&stream)) ) {
+    /* Long enough for the whole FIFO to go out between steps */
+    nrf_sim_advance(10000000);
+  }
+  assert_int_equal(stream.sent, 4 * NRF_MAX_PAYLOAD);
+  assert_int_equal(nrf_stats.max_rt, 1);
+  assert_int_equal(peer_length, 5 * NRF_MAX_PAYLOAD);
+}
+
+/* An ACK slower than the retransmit delay is never seen */
+void nrf_stream_link_latency(void **state)
+{
+  uint8_t data[NRF_MAX_PAYLOAD] = {0};
+
+  nrf_sim_set_link(100000, 0);
+  nrf_enable_dynamic_payloads(0);
+  assert_int_equal(nrf_send_stream(data, sizeof(data)), 0);
+
+  /* The peer did get every copy, but only the first was new */
+  assert_int_equal(peer_length, sizeof(data));
+  assert_int_equal(nrf_sim_stats(1)->duplicates, 3);
+
+  nrf_write_register(NRF_REG_SETUP_RETR, NRF_RETR_ARD(3) | NRF_RETR_ARC(3));
+  nrf_flush_tx_fifo();
+  assert_int_equal(nrf_send_stream(data, sizeof(data)), sizeof(data));
+}
+
+/* Static width packets only reach a peer expecting the same width */
+void nrf_stream_static_width(void **state)
+{
+  uint8_t data[2 * NRF_MAX_PAYLOAD] = {0};
+
+  peer_listen(0);
+  assert_int_equal(nrf_send_stream(data, sizeof(data)), sizeof(data));
+  assert_int_equal(peer_length, sizeof(data));
+
+  /* A short final payload would need dynamic payloads */
+  assert_int_equal(nrf_send_stream(data, NRF_MAX_PAYLOAD + 1), NRF_MAX_PAYLOAD);
+}
+
+/* A stream never blocks on the bus, including while it powers up the module,
+   drains ACK payloads and clears flags */
+void nrf_stream_bus_held(void **state)
+{
+  NRF_stream_t stream;
+  uint8_t data[3 * NRF_MAX_PAYLOAD] = {0};
+  uint32_t transactions;
+  CR_status_t status = CR_WAITING;
+
+  peer_ack[0] = 0xa5;
+  peer_ack_length = 1;
+  nrf_enable_dynamic_payloads(1);
+  nrf_cache_invalidate();
+  nrf_stream_start(&stream, data, sizeof(data));
+  while( !CR_DONE(status) ) {
+    assert_true(spi_acquire());
+    transactions = nrf_stats.transactions;
+    assert_false(CR_DONE(nrf_stream_cr(&stream)));
+    assert_int_equal(nrf_stats.transactions, transactions);
+    spi_release();
+    status = nrf_stream_cr(&stream);
+  }
+  assert_int_equal(stream.sent, sizeof(data));
+  assert_int_equal(peer_length, sizeof(data));
+  assert_int_equal(nrf_stats.rx_packets, 3);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup(nrf_register_cache, setup),
+    cmocka_unit_test_setup(nrf_tx_fifo_full, setup),
+    cmocka_unit_test_setup(nrf_stream_delivers_all, setup),
+    cmocka_unit_test_setup(nrf_stream_ack_payloads, setup),
+    cmocka_unit_test_setup(nrf_receive_dynamic, setup),
+    cmocka_unit_test_setup(nrf_receive_static, setup),
+    cmocka_unit_test_setup(nrf_receive_queue_overflow, setup),
+    cmocka_unit_test_setup(nrf_stream_lossy_link, setup),
+    cmocka_unit_test_setup(nrf_stream_max_rt, setup),
+    cmocka_unit_test_setup(nrf_stream_max_rt_partial, setup),
+    cmocka_unit_test_setup(nrf_stream_link_latency, setup),
+    cmocka_unit_test_setup(nrf_stream_static_width, setup),
+    cmocka_unit_test_setup(nrf_command_coroutine, setup),
+    cmocka_unit_test_setup(nrf_stream_coroutine, setup),
+    cmocka_unit_test_setup(nrf_stream_bus_held, setup),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,132 @@
+/**
+ * @file test_pool.c
+ * @brief CMocka unittests for the fixed-block pools and the arena
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include <string.h>
+#include "pool.h"
+
+#define TEST_BLOCKS (4)
+
+POOL_DEFINE(test_pool, 12, TEST_BLOCKS);
+
+/* Every block is distinct and aligned, and the pool refuses a fifth */
+void pool_exhaust(void **state)
+{
+  uint8_t *blocks[TEST_BLOCKS];
+
+  assert_int_equal( test_pool.block_size, 16 );
+  for( uint8_t i = 0; i < TEST_BLOCKS; i++ ) {
+    blocks[i] = pool_alloc(&test_pool);
+    assert_non_null( blocks[i] );
+    assert_int_equal( (uintptr_t) blocks[i] % POOL_ALIGN, 0 );
+    memset(blocks[i], i, 12);
+    for( uint8_t j = 0; j < i; j++ ) {
+      assert_true( blocks[i] != blocks[j] );
+    }
+  }
+  assert_null( pool_alloc(&test_pool) );
+  assert_null( pool_alloc(&test_pool) );
+  assert_int_equal( test_pool.failures, 2 );
+  assert_int_equal( test_pool.used, TEST_BLOCKS );
+  assert_int_equal( test_pool.high_water, TEST_BLOCKS );
+
+  for( uint8_t i = 0; i < TEST_BLOCKS; i++ ) {
+    pool_free(&test_pool, blocks[i]);
+  }
+  assert_int_equal( test_pool.used, 0 );
+  assert_int_equal( test_pool.high_water, TEST_BLOCKS );
+}
+
+/* Returned blocks are handed out again, latest first */
+void pool_reuse(void **state)
+{
+  void *a;
+  void *b;
+
+  a = pool_alloc(&test_pool);
+  b = pool_alloc(&test_pool);
+  pool_free(&test_pool, a);
+  pool_free(&test_pool, b);
+  pool_free(&test_pool, NULL);
+  assert_ptr_equal( pool_alloc(&test_pool), b );
+  assert_ptr_equal( pool_alloc(&test_pool), a );
+  assert_int_equal( test_pool.used, 2 );
+  pool_free(&test_pool, a);
+  pool_free(&test_pool, b);
+}
+
+/* Allocations are aligned and don't overlap, and freeing them in reverse
+   order returns all the space */
+void arena_lifo(void **state)
+{
+  size_t start = arena_stats.used;
+  uint8_t *a;
+  uint8_t *b;
+
+  a = arena_alloc(3);
+  b = arena_alloc(100);
+  assert_non_null( a );
+  assert_non_null( b );
+  assert_int_equal( (uintptr_t) a % POOL_ALIGN, 0 );
+  assert_int_equal( (uintptr_t) b % POOL_ALIGN, 0 );
+  assert_true( b >= a + 3 );
+  memset(a, 0xaa, 3);
+  memset(b, 0x55, 100);
+  assert_int_equal( a[2], 0xaa );
+
+  arena_free(b);
+  assert_ptr_equal( arena_alloc(100), b );
+  arena_free(b);
+  arena_free(a);
+  assert_int_equal( arena_stats.used, start );
+  assert_true( arena_stats.high_water > start );
+  arena_free(NULL);
+}
+
+/* Space freed out of order is returned once the later allocations go */
+void arena_out_of_order(void **state)
+{
+  size_t start = arena_stats.used;
+  void *a = arena_alloc(64);
+  void *b = arena_alloc(64);
+  size_t held = arena_stats.used;
+
+  arena_free(a);
+  assert_int_equal( arena_stats.used, held );
+  arena_free(b);
+  assert_int_equal( arena_stats.used, start );
+}
+
+/* Too large a request fails and is counted, without using any space */
+void arena_too_large(void **state)
+{
+  size_t start = arena_stats.used;
+  uint32_t failures = arena_stats.failures;
+
+  assert_int_equal( arena_stats.size, ARENA_SIZE );
+  assert_null( arena_alloc(ARENA_SIZE) );
+  assert_int_equal( arena_stats.failures, failures + 1 );
+  assert_int_equal( arena_stats.used, start );
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(pool_exhaust),
+    cmocka_unit_test(pool_reuse),
+    cmocka_unit_test(arena_lifo),
+    cmocka_unit_test(arena_out_of_order),
+    cmocka_unit_test(arena_too_large),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
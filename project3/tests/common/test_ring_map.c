@@ -0,0 +1,56 @@
+/**
+ * @file test_ring_map.c
+ * @brief CMocka unittests for the double-mapped ring storage
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "ring_map.h"
+
+/* Sizes are whole pages */
+void ring_map_sizes(void **state)
+{
+  size_t page = sysconf(_SC_PAGESIZE);
+
+  assert_int_equal( ring_map_size(1), page );
+  assert_int_equal( ring_map_size(page), page );
+  assert_int_equal( ring_map_size(page + 1), 2 * page );
+  assert_null( ring_map(0) );
+  assert_null( ring_map(page + 1) );
+  ring_unmap(NULL, page);
+}
+
+/* Writes through either mapping show up in the other, so a copy across the
+   end of the ring lands at the start */
+void ring_map_mirrors(void **state)
+{
+  size_t size = 2 * sysconf(_SC_PAGESIZE);
+  uint8_t *ring = ring_map(size);
+
+  assert_non_null( ring );
+  memset(ring, 0, size);
+  memcpy(ring + size - 4, "wrapping", 8);
+  assert_memory_equal( ring + size - 4, "wrap", 4 );
+  assert_memory_equal( ring, "ping", 4 );
+  ring[size + 100] = 0x5a;
+  assert_int_equal( ring[100], 0x5a );
+  ring_unmap(ring, size);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(ring_map_sizes),
+    cmocka_unit_test(ring_map_mirrors),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
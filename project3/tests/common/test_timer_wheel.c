@@ -0,0 +1,264 @@
+/**
+ * @file test_timer_wheel.c
+ * @brief CMocka unittests for the software timer wheel
+ *
+ * The wheel runs on a fake microsecond clock, and the fake hardware timer only
+ * records what it was programmed with.
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/06
+ **/
+
+#include <stdarg.h>  /* for cmocka */
+#include <stddef.h>  /* for cmocka */
+#include <setjmp.h>  /* for cmocka */
+#include <cmocka.h>
+#include <stdint.h>
+#include <string.h>
+#include "timer_wheel.h"
+
+static uint32_t fake_us;   /* wraps during the longest delays */
+static uint32_t fake_ms;
+static uint32_t fake_programmed;
+
+static uint32_t fake_clock(void)
+{
+  return fake_us;
+}
+
+static void fake_program(uint32_t ticks)
+{
+  fake_programmed = ticks;
+}
+
+/* Move the clock forward and take the hardware timer interrupt */
+static void advance_ms(uint32_t ms)
+{
+  fake_us += ms * TW_TICK_US;
+  fake_ms += ms;
+  tw_advance();
+}
+
+/* Each callback records the wheel time it ran at, and its place in line */
+#define MAX_TIMERS (1000)
+static TW_timer_t timers[MAX_TIMERS];
+static uint32_t fired[MAX_TIMERS];
+static uint32_t fired_at[MAX_TIMERS];
+static uint32_t fired_order[MAX_TIMERS];
+static uint32_t fire_count;
+
+static void callback(void *arg)
+{
+  uint32_t index = (TW_timer_t *) arg - timers;
+  fired[index]++;
+  fired_at[index] = fake_ms;
+  fired_order[index] = fire_count++;
+}
+
+static int setup(void **state)
+{
+  fake_us = 12345;  /* not tick aligned */
+  fake_ms = 0;
+  memset(timers, 0, sizeof(timers));
+  memset(fired, 0, sizeof(fired));
+  fire_count = 0;
+  assert_int_equal(tw_init(fake_clock, fake_program), TW_OK);
+  assert_int_equal(fake_programmed, TW_IDLE);
+  return 0;
+}
+
+/* Callbacks wait for tw_run(), never running from the interrupt */
+void tw_one_shot(void **state)
+{
+  assert_int_equal(tw_start(&timers[0], 10, 0, callback, &timers[0]), TW_OK);
+  assert_int_equal(fake_programmed, 10);
+  assert_true(tw_active(&timers[0]));
+
+  advance_ms(9);
+  assert_false(tw_pending());
+  assert_int_equal(fake_programmed, 1);
+  advance_ms(1);
+  assert_true(tw_pending());
+  assert_int_equal(fired[0], 0);
+  assert_int_equal(fake_programmed, TW_IDLE);
+
+  assert_int_equal(tw_run(), 1);
+  assert_int_equal(fired[0], 1);
+  assert_false(tw_active(&timers[0]));
+  advance_ms(100);
+  assert_int_equal(tw_run(), 0);
+}
+
+/* Periodic timers keep their phase, skipping expiries missed entirely */
+void tw_periodic(void **state)
+{
+  tw_start(&timers[0], 5, 20, callback, &timers[0]);
+  advance_ms(5);
+  assert_int_equal(tw_run(), 1);
+  assert_int_equal(fake_programmed, 20);
+
+  advance_ms(20);
+  advance_ms(3);  /* the callback runs late */
+  assert_int_equal(tw_run(), 1);
+  assert_int_equal(fake_programmed, 17);
+  assert_int_equal(fired[0], 2);
+
+  /* Stalled for several periods, it runs once and rejoins the schedule */
+  advance_ms(75);
+  assert_int_equal(tw_run(), 1);
+  assert_int_equal(fake_programmed, 2);
+  assert_int_equal(fired[0], 3);
+
+  tw_stop(&timers[0]);
+  advance_ms(100);
+  assert_int_equal(tw_run(), 0);
+}
+
+/* Stopping an expired timer still cancels its callback */
+void tw_stop_expired(void **state)
+{
+  tw_start(&timers[0], 1, 0, callback, &timers[0]);
+  tw_start(&timers[1], 1, 0, callback, &timers[1]);
+  tw_start(&timers[2], 1, 0, callback, &timers[2]);
+  advance_ms(1);
+  assert_int_equal(tw_stop(&timers[2]), TW_OK);
+  assert_int_equal(tw_stop(&timers[1]), TW_OK);
+  assert_int_equal(tw_stop(&timers[1]), TW_OK);
+  assert_int_equal(tw_run(), 1);
+  assert_int_equal(fired[0], 1);
+  assert_int_equal(fired[1] + fired[2], 0);
+
+  /* The ready list is still usable after removing its tail */
+  tw_start(&timers[3], 0, 0, callback, &timers[3]);
+  assert_int_equal(tw_run(), 1);
+  assert_int_equal(fired[3], 1);
+}
+
+void tw_bad_params(void **state)
+{
+  assert_int_equal(tw_init(NULL, NULL), TW_NULL);
+  assert_int_equal(tw_start(NULL, 1, 0, callback, NULL), TW_NULL);
+  assert_int_equal(tw_start(&timers[0], 1, 0, NULL, NULL), TW_NULL);
+  assert_int_equal(tw_start(&timers[0], TW_MAX_TICKS + 1, 0, callback, NULL), TW_SIZE_ERR);
+  assert_int_equal(tw_start(&timers[0], 1, TW_MAX_TICKS + 1, callback, NULL), TW_SIZE_ERR);
+  assert_int_equal(tw_stop(NULL), TW_NULL);
+  assert_false(tw_active(&timers[0]));
+}
+
+/* Timers in every level fire on their exact tick */
+void tw_levels_exact(void **state)
+{
+  uint32_t delays[] = { 63, 64, 65, 4095, 4096, 4097, 300000, 262144, TW_MAX_TICKS };
+  size_t count = sizeof(delays) / sizeof(delays[0]);
+
+  for( size_t i = 0; i < count; i++ ) {
+    tw_start(&timers[i], delays[i], 0, callback, &timers[i]);
+  }
+
+  /* Only wake when the hardware timer would */
+  while( fake_programmed != TW_IDLE ) {
+    advance_ms(fake_programmed);
+    tw_run();
+  }
+  for( size_t i = 0; i < count; i++ ) {
+    assert_int_equal(fired[i], 1);
+    assert_int_equal(fired_at[i], delays[i]);
+  }
+}
+
+/* A lone long timer costs a handful of interrupts, not one per tick */
+void tw_tickless(void **state)
+{
+  uint32_t wakeups = 0;
+
+  tw_start(&timers[0], 10000, 0, callback, &timers[0]);
+  while( !fired[0] ) {
+    advance_ms(fake_programmed);
+    tw_run();
+    wakeups++;
+  }
+  assert_true(wakeups <= TW_LEVELS);
+  assert_int_equal(fake_programmed, TW_IDLE);
+}
+
+/* A sync long overdue expires every timer passed over, in expiry order, and
+   periodic timers carry on in phase */
+void tw_late_sync(void **state)
+{
+  uint32_t delays[] = { 1, 64, 4097, 300000, 5, 262144, 63, 1000 };
+  size_t count = sizeof(delays) / sizeof(delays[0]);
+  size_t periodic = count - 1;
+
+  for( size_t i = 0; i < count; i++ ) {
+    tw_start(&timers[i], delays[i], (i == periodic) ? 1000 : 0, callback, &timers[i]);
+  }
+
+  fake_us += 400000 * TW_TICK_US;
+  fake_ms += 400000;
+  tw_advance();
+  assert_int_equal(tw_stats.expired, count);
+  tw_run();
+  for( size_t i = 0; i < count; i++ ) {
+    assert_int_equal(fired[i], 1);
+    for( size_t j = 0; j < count; j++ ) {
+      if( delays[i] < delays[j] ) {
+        assert_true(fired_order[i] < fired_order[j]);
+      }
+    }
+  }
+
+  /* Missed periods are skipped, the next is on the next multiple */
+  assert_int_equal(timers[periodic].expires, 401000);
+  advance_ms(fake_programmed);
+  tw_run();
+  assert_int_equal(fired[periodic], 2);
+  assert_int_equal(fired_at[periodic], 401000);
+}
+
+/* Many timers, started and stopped at random, all fire exactly on time */
+void tw_many_random(void **state)
+{
+  uint32_t seed = 42;
+  uint32_t expected[MAX_TIMERS];
+  uint32_t wakeups = 0;
+
+  for( uint32_t i = 0; i < MAX_TIMERS; i++ ) {
+    seed = seed * 1103515245 + 12345;
+    advance_ms((seed >> 28) & 1);
+    tw_start(&timers[i], 1 + (seed >> 8) % 200000, 0, callback, &timers[i]);
+    expected[i] = timers[i].expires;
+  }
+  for( uint32_t i = 0; i < MAX_TIMERS; i += 7 ) {
+    tw_stop(&timers[i]);
+  }
+
+  while( fake_programmed != TW_IDLE ) {
+    advance_ms(fake_programmed);
+    tw_run();
+    wakeups++;
+  }
+  for( uint32_t i = 0; i < MAX_TIMERS; i++ ) {
+    assert_int_equal(fired[i], (i % 7) ? 1 : 0);
+    if( fired[i] ) {
+      assert_int_equal(fired_at[i] - fired_at[1] + expected[1], expected[i]);
+    }
+  }
+  assert_true(wakeups < 2 * MAX_TIMERS);
+  assert_true(tw_stats.cascaded > 0);
+}
+
+int main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup(tw_one_shot, setup),
+    cmocka_unit_test_setup(tw_periodic, setup),
+    cmocka_unit_test_setup(tw_stop_expired, setup),
+    cmocka_unit_test_setup(tw_bad_params, setup),
+    cmocka_unit_test_setup(tw_levels_exact, setup),
+    cmocka_unit_test_setup(tw_tickless, setup),
+    cmocka_unit_test_setup(tw_late_sync, setup),
+    cmocka_unit_test_setup(tw_many_random, setup),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,302 @@
+/**
+ * @file perf_bench.c
+ * @brief Microbenchmarks of the hot library functions, for `make perfcheck`
+ *
+ * Each benchmark times a fixed number of calls per sample and reports the
+ * average cost of one call in nanoseconds. All samples are printed as JSON
+ * for script/perfcheck.py, which compares them with the recorded baseline.
+ *
+ * Usage: perf_bench.run [samples]
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include "circular_buffer.h"
+#include "conversion.h"
+#include "crc.h"
+#include "log_queue.h"
+#include "memory.h"
+
+#define PERF_SAMPLES (25)
+#define PERF_WARMUP  (3)
+#define PERF_MAX_SAMPLES (1000)
+
+/* Largest number of calls in one sample, sizes the queues */
+#define PERF_MAX_OPS (8192)
+
+/* Rings compared with and without the double mapping, one page each */
+#define PERF_RING_SIZE (4096)
+
+typedef struct {
+  const char *name;
+  uint32_t ops;                /* Calls per sample */
+  void (*reset)(void);         /* Untimed, before each sample */
+  void (*run)(uint32_t ops);   /* Timed */
+} Perf_bench_t;
+
+/* Results are written here, so calls can't be optimized away */
+volatile uint32_t perf_sink;
+
+static Log_q perf_lq;
+static CircBuf_t perf_cb;
+static Log_q perf_ring_lq;
+static Log_q perf_mapped_lq;
+static CircBuf_t perf_ring_cb;
+static CircBuf_t perf_mapped_cb;
+static uint8_t perf_mem[2 * 4096 + 64];
+static uint8_t perf_payload[16] = "perfcheck data";
+
+/* Empty the queue again, it is allocated once in main() */
+static void lq_reset(void)
+{
+  Log_t item = { .length = 0, .data = NULL };
+
+  while( lq_remove(&perf_lq, &item) == LQ_OK ) {
+    item.length = 0;
+  }
+}
+
+static void lq_add_run(uint32_t ops)
+{
+  Log_t item = { .id = INFO, .type = LD_DATA,
+                 .length = sizeof(perf_payload), .data = perf_payload };
+
+  for( uint32_t i = 0; i < ops; i++ ) {
+    item.us = i;
+    perf_sink += lq_add(&perf_lq, &item);
+  }
+}
+
+static void cb_reset(void)
+{
+  cb_item_t item;
+
+  while( CB_remove_item(&perf_cb, &item) == CB_OK ) {
+  }
+}
+
+static void cb_add_run(uint32_t ops)
+{
+  for( uint32_t i = 0; i < ops; i++ ) {
+    perf_sink += CB_add_item(&perf_cb, (cb_item_t) i);
+  }
+}
+
+static void no_reset(void)
+{
+}
+
+/* Items of every length up to the payload size, so they straddle the end of
+   the ring at every offset */
+static void lq_ring_run(Log_q *queue, uint32_t ops)
+{
+  uint8_t data[sizeof(perf_payload)];
+  Log_t item = { .id = INFO, .type = LD_DATA, .data = perf_payload };
+  Log_t out;
+
+  for( uint32_t i = 0; i < ops; i++ ) {
+    item.length = 1 + (i % sizeof(perf_payload));
+    perf_sink += lq_add(queue, &item);
+    out.data = data;
+    out.length = sizeof(data);
+    perf_sink += lq_remove(queue, &out);
+  }
+}
+
+static void lq_add_remove_run(uint32_t ops)
+{
+  lq_ring_run(&perf_ring_lq, ops);
+}
+
+static void lq_add_remove_mapped_run(uint32_t ops)
+{
+  lq_ring_run(&perf_mapped_lq, ops);
+}
+
+/* Peeks spread over the whole ring, half of them from before the wrap */
+static void cb_peek_ring_run(CircBuf_t *circbuf, uint32_t ops)
+{
+  cb_item_t item;
+
+  for( uint32_t i = 0; i < ops; i++ ) {
+    CB_peek(circbuf, (i * 2654435761u) % PERF_RING_SIZE, &item);
+    perf_sink += item;
+  }
+}
+
+static void cb_peek_run(uint32_t ops)
+{
+  cb_peek_ring_run(&perf_ring_cb, ops);
+}
+
+static void cb_peek_mapped_run(uint32_t ops)
+{
+  cb_peek_ring_run(&perf_mapped_cb, ops);
+}
+
+static void memmove_64_run(uint32_t ops)
+{
+  for( uint32_t i = 0; i < ops; i++ ) {
+    perf_sink += *my_memmove(perf_mem, perf_mem + 4096, 64);
+  }
+}
+
+/* Overlapping regions, copied in both directions */
+static void memmove_4k_overlap_run(uint32_t ops)
+{
+  for( uint32_t i = 0; i < ops; i++ ) {
+    if( i & 1 ) {
+      perf_sink += *my_memmove(perf_mem + 64, perf_mem, 4096);
+    }
+    else {
+      perf_sink += *my_memmove(perf_mem, perf_mem + 64, 4096);
+    }
+  }
+}
+
+static void itoa_10_run(uint32_t ops)
+{
+  uint8_t str[40];
+
+  for( uint32_t i = 0; i < ops; i++ ) {
+    /* Spread the values over every length, and both signs */
+    perf_sink += my_itoa((int32_t) (i * 2654435761u) >> (i & 31), str, 10);
+  }
+}
+
+static void itoa_16_run(uint32_t ops)
+{
+  uint8_t str[40];
+
+  for( uint32_t i = 0; i < ops; i++ ) {
+    perf_sink += my_itoa((int32_t) (i * 2654435761u) >> (i & 31), str, 16);
+  }
+}
+
+/* A frame's worth, as checked by the log framing */
+static void crc32_1k_run(uint32_t ops)
+{
+  for( uint32_t i = 0; i < ops; i++ ) {
+    perf_sink += crc32(CRC32_INIT, perf_mem + (i & 7), 1024);
+  }
+}
+
+static const Perf_bench_t perf_benches[] = {
+  { "lq_add",                PERF_MAX_OPS, lq_reset, lq_add_run },
+  { "CB_add_item",           PERF_MAX_OPS, cb_reset, cb_add_run },
+  { "lq_add_remove",         4096,         no_reset, lq_add_remove_run },
+  { "lq_add_remove_mapped",  4096,         no_reset, lq_add_remove_mapped_run },
+  { "CB_peek",               4096,         no_reset, cb_peek_run },
+  { "CB_peek_mapped",        4096,         no_reset, cb_peek_mapped_run },
+  { "my_memmove_64",         4096,         no_reset, memmove_64_run },
+  { "my_memmove_4k_overlap", 64,           no_reset, memmove_4k_overlap_run },
+  { "my_itoa_10",            4096,         no_reset, itoa_10_run },
+  { "my_itoa_16",            4096,         no_reset, itoa_16_run },
+  { "crc32_1k",              256,          no_reset, crc32_1k_run },
+};
+
+#define PERF_BENCH_COUNT (sizeof(perf_benches) / sizeof(perf_benches[0]))
+
+static double perf_results[PERF_BENCH_COUNT][PERF_MAX_SAMPLES];
+
+static uint64_t perf_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Time one sample, in nanoseconds per call */
+static double perf_sample(const Perf_bench_t *bench)
+{
+  uint64_t start;
+
+  bench->reset();
+  start = perf_ns();
+  bench->run(bench->ops);
+  return (double) (perf_ns() - start) / bench->ops;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t samples = (argc > 1) ? strtoul(argv[1], NULL, 10) : PERF_SAMPLES;
+  cpu_set_t cpus;
+
+  /* Stay on one core, so samples don't include migrations */
+  if( sched_getaffinity(0, sizeof(cpus), &cpus) == 0 ) {
+    for( int cpu = 0; cpu < CPU_SETSIZE; cpu++ ) {
+      if( CPU_ISSET(cpu, &cpus) ) {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        sched_setaffinity(0, sizeof(cpus), &cpus);
+        break;
+      }
+    }
+  }
+
+  if( samples == 0 || samples > PERF_MAX_SAMPLES ) {
+    samples = PERF_SAMPLES;
+  }
+
+  memset(perf_mem, 0x5a, sizeof(perf_mem));
+  lq_init(&perf_lq, PERF_MAX_OPS * (LOG_HEADER_SIZE + sizeof(perf_payload)));
+  CB_init(&perf_cb, PERF_MAX_OPS);
+  lq_init(&perf_ring_lq, PERF_RING_SIZE);
+  CB_init(&perf_ring_cb, PERF_RING_SIZE);
+  if( (lq_init_mapped(&perf_mapped_lq, PERF_RING_SIZE) != LQ_OK) ||
+      (CB_init_mapped(&perf_mapped_cb, PERF_RING_SIZE) != CB_OK) ||
+      (perf_mapped_cb.size != PERF_RING_SIZE) ) {
+    fprintf(stderr, "Can't map the ring buffers\n");
+    return 1;
+  }
+  /* Full, with the newest item halfway round */
+  for( uint32_t i = 0; i < PERF_RING_SIZE + PERF_RING_SIZE / 2; i++ ) {
+    cb_item_t item;
+
+    if( CB_is_full(&perf_ring_cb) ) {
+      CB_remove_item(&perf_ring_cb, &item);
+      CB_remove_item(&perf_mapped_cb, &item);
+    }
+    CB_add_item(&perf_ring_cb, i);
+    CB_add_item(&perf_mapped_cb, i);
+  }
+  for( uint32_t i = 0; i < PERF_WARMUP; i++ ) {
+    for( uint32_t b = 0; b < PERF_BENCH_COUNT; b++ ) {
+      perf_sample(&perf_benches[b]);
+    }
+  }
+  /* Take the samples in turns, so a slow spell of the machine is spread
+     over every benchmark instead of landing on one */
+  for( uint32_t i = 0; i < samples; i++ ) {
+    for( uint32_t b = 0; b < PERF_BENCH_COUNT; b++ ) {
+      perf_results[b][i] = perf_sample(&perf_benches[b]);
+    }
+  }
+
+  printf("{\n  \"unit\": \"ns/call\",\n  \"benchmarks\": {");
+  for( uint32_t b = 0; b < PERF_BENCH_COUNT; b++ ) {
+    printf("%s\n    \"%s\": [", b ? "," : "", perf_benches[b].name);
+    for( uint32_t i = 0; i < samples; i++ ) {
+      printf("%s%.3f", i ? ", " : "", perf_results[b][i]);
+    }
+    printf("]");
+  }
+  printf("\n  }\n}\n");
+
+  CB_destroy(&perf_mapped_cb);
+  CB_destroy(&perf_ring_cb);
+  lq_destroy(&perf_mapped_lq);
+  lq_destroy(&perf_ring_lq);
+  CB_destroy(&perf_cb);
+  lq_destroy(&perf_lq);
+  return 0;
+}
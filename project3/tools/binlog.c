@@ -0,0 +1,1009 @@
+/**
+ * @file binlog.c
+ * @brief Native decoder and indexer for binary log captures (Linux)
+ *
+ * Decodes the same captures as script/binlog.py: Binlog_Start, Binlog_LZ and
+ * Binlog_Framed streams, and LOG_OUT_FILE files. The capture is mapped
+ * rather than read, the magic is found with memmem(), and records are
+ * formatted into a buffer rather than printed one by one. Record headers from
+ * the KL25Z, BBB or HOST are told apart by their size.
+ *
+ * With -i, a sparse sidecar index (<capture>.idx) is written as well: one
+ * entry per block of up to BL_INDEX_STRIDE consecutive records, with its
+ * offset, time range and the log ids in it. Later queries by id or time (-e,
+ * -s, -t) decode only the blocks that can hold a match, scanning forward from
+ * each block's offset, as long as the capture hasn't changed since.
+ *
+ * Usage: binlog.run [-o text|csv|json|none] [-i] [-e id] [-s start] [-t end]
+ *                   [-r header] [-v] capture
+ *
+ *   -o  Output format, `none` only counts (default text)
+ *   -i  Build the index, even if a current one exists
+ *   -e  Only records with this log id, by name or number
+ *   -s  Only records at or after this time, in seconds since the epoch
+ *   -t  Only records before this time
+ *   -r  Record header size of a Binlog_Start stream, if not guessed right
+ *   -v  Report counts and speed on stderr
+ *
+ * @author Jeff Schornick
+ * @date 2017/08/09
+ **/
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "logger.h"
+#include "log_queue.h"
+#include "lz.h"
+#include "frame.h"
+#include "log_file.h"
+
+/* Longest record data believed, anything longer is corruption */
+#define BL_DATA_MAX (4096)
+#define BL_OUT_SIZE (1 << 16)
+#define BL_NO_TIME (UINT64_MAX)
+
+#define BL_MAGIC "Binlog_"
+#define BL_MAGIC_START "Binlog_Start"
+#define BL_MAGIC_LZ "Binlog_LZ"
+#define BL_MAGIC_FRAMED "Binlog_Framed"
+
+#define BL_INDEX_MAGIC "BinlogIX"
+#define BL_INDEX_VERSION (2)
+/* Most records in an index block, each block is 32 bytes of index */
+#define BL_INDEX_STRIDE (256)
+
+/* The KL25Z layout below is the HOST one with short enums and a 32-bit size_t */
+_Static_assert(offsetof(Log_t, length) + sizeof(size_t) == LOG_HEADER_SIZE,
+               "Log_t header layout changed, update bl_layout()");
+_Static_assert(LOG_ID_MAX <= 32, "Bl_block_t.ids has a bit per log id");
+
+typedef enum { BL_TEXT, BL_CSV, BL_JSON, BL_NONE } Bl_format_t;
+typedef enum { BL_RAW, BL_LZ, BL_FRAMED, BL_FILE } Bl_kind_t;
+
+/* A record header, from any platform's layout */
+typedef struct
+{
+  uint32_t id;
+  uint32_t type;
+  uint32_t time;
+  uint32_t us;
+  uint8_t shard;
+  uint16_t seq;
+  uint64_t length;
+} Bl_record_t;
+
+/* Field sizes of a record header, which vary by platform */
+typedef struct
+{
+  size_t header;    /* LOG_HEADER_SIZE of the sender */
+  size_t id;        /* sizeof the enums, id and type */
+  size_t length;    /* sizeof size_t */
+} Bl_layout_t;
+
+/* Index file: this header, then the blocks in capture order */
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t kind;            /* Bl_kind_t */
+  uint64_t capture_size;    /* Capture the index is for */
+  int64_t capture_mtime;    /* In ns */
+  uint32_t record_header;
+  uint32_t id_count;        /* LOG_ID_MAX */
+  uint64_t count;           /* Blocks */
+  uint64_t ring_start;      /* Record area of a LOG_OUT_FILE file */
+  uint64_t ring_size;
+} Bl_index_header_t;
+
+/* Consecutive records, each straight after the one before (around the ring of
+   a LOG_OUT_FILE file). A block never spans a frame or stream boundary. */
+typedef struct
+{
+  uint64_t offset;  /* Of the first record in the capture */
+  uint64_t first;   /* Earliest record time, in us */
+  uint64_t last;    /* Latest record time, in us */
+  uint32_t ids;     /* Bit per log id found in the block */
+  uint32_t count;   /* Records */
+} Bl_block_t;
+
+typedef struct
+{
+  const uint8_t *base;      /* The mapped capture */
+  size_t size;
+  Bl_kind_t kind;
+  Bl_layout_t layout;
+  uint64_t ring_start;
+  uint64_t ring_size;
+
+  /* Which records to show */
+  Bl_format_t format;
+  int32_t id;               /* -1 for any */
+  uint64_t from;            /* In us, or BL_NO_TIME */
+  uint64_t to;
+
+  /* Output, and the formatted seconds of the last record */
+  char out[BL_OUT_SIZE];
+  size_t fill;
+  uint32_t last_time;
+  char time_str[32];
+  size_t time_length;
+
+  /* Index being built, and where the open block's next record would be */
+  uint8_t indexing;
+  Bl_block_t *blocks;
+  size_t count;
+  size_t capacity;
+  uint64_t next;
+
+  /* Counts */
+  uint64_t records;
+  uint64_t shown;
+  uint64_t skipped;
+  uint64_t lost;
+} Binlog_t;
+
+static const char *bl_type_str[] = { "NULL", "DATA", "INT", "STR", "NVAL" };
+static const char bl_hex[] = "0123456789abcdef";
+
+static void bl_fail(const char *what, const char *name)
+{
+  fprintf(stderr, "binlog: %s%s%s\n", what, name ? ": " : "", name ? name : "");
+  exit(1);
+}
+
+/* Little-endian field of 1, 2, 4 or 8 bytes, as every target here is */
+static inline uint64_t bl_read(const uint8_t *p, size_t size)
+{
+  uint64_t v = 0;
+  memcpy(&v, p, size);
+  return v;
+}
+
+/* The layout with this header size, from the fixed fields around the enums
+   and size_t. Returns 0 if no platform sends one that size. */
+static int bl_layout(Bl_layout_t *layout, size_t header)
+{
+  /* time, us, shard, seq */
+  const size_t fixed = 4 + 4 + 1 + 2;
+  size_t enums[] = { 1, 4 };
+  size_t length;
+
+  for( uint8_t i = 0; i < 2; i++ ) {
+    if( header < fixed + 2 * enums[i] ) {
+      continue;
+    }
+    length = header - fixed - 2 * enums[i];
+    if( (length == 4) || (length == 8) ) {
+      layout->header = header;
+      layout->id = enums[i];
+      layout->length = length;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void bl_parse(const Bl_layout_t *layout, const uint8_t *p, Bl_record_t *r)
+{
+  r->id = bl_read(p, layout->id);
+  p += layout->id;
+  r->type = bl_read(p, layout->id);
+  p += layout->id;
+  r->time = bl_read(p, 4);
+  r->us = bl_read(p + 4, 4);
+  r->shard = p[8];
+  r->seq = bl_read(p + 9, 2);
+  r->length = bl_read(p + 11, layout->length);
+}
+
+/* Size of the valid record at `p`, with `avail` bytes there, or 0 */
+static size_t bl_check(const Bl_layout_t *layout, const uint8_t *p, size_t avail, Bl_record_t *r)
+{
+  if( avail < layout->header ) {
+    return 0;
+  }
+  bl_parse(layout, p, r);
+  if( (r->id >= LOG_ID_MAX) || (r->type > LD_NVAL) || (r->us >= 1000000) ||
+      (r->length > BL_DATA_MAX) || (r->length > avail - layout->header) ) {
+    return 0;
+  }
+  return layout->header + r->length;
+}
+
+static void bl_flush(Binlog_t *b)
+{
+  if( b->fill && (fwrite(b->out, 1, b->fill, stdout) != b->fill) ) {
+    bl_fail("write failed", NULL);
+  }
+  b->fill = 0;
+}
+
+static inline void bl_put(Binlog_t *b, const char *s, size_t length)
+{
+  if( b->fill + length > BL_OUT_SIZE ) {
+    bl_flush(b);
+  }
+  memcpy(&b->out[b->fill], s, length);
+  b->fill += length;
+}
+
+static inline void bl_put_str(Binlog_t *b, const char *s)
+{
+  bl_put(b, s, strlen(s));
+}
+
+/* One of two string literals, without measuring them */
+#define BL_PUT_EITHER(b, first, s1, s2) \
+  ((first) ? bl_put((b), (s1), sizeof(s1) - 1) : bl_put((b), (s2), sizeof(s2) - 1))
+
+static void bl_put_uint(Binlog_t *b, uint64_t v, uint8_t width)
+{
+  static const char pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+  char digits[24];
+  char *p = &digits[sizeof(digits)];
+  uint32_t v32;
+
+  /* Two digits per division, and 32-bit divisions once it fits */
+  while( v > UINT32_MAX ) {
+    p -= 2;
+    memcpy(p, &pairs[2 * (v % 100)], 2);
+    v /= 100;
+  }
+  for( v32 = v; v32 >= 100; v32 /= 100 ) {
+    p -= 2;
+    memcpy(p, &pairs[2 * (v32 % 100)], 2);
+  }
+  if( v32 >= 10 ) {
+    p -= 2;
+    memcpy(p, &pairs[2 * v32], 2);
+  }
+  else {
+    *--p = '0' + v32;
+  }
+  while( p > &digits[sizeof(digits) - width] ) {
+    *--p = '0';
+  }
+  bl_put(b, p, &digits[sizeof(digits)] - p);
+}
+
+static void bl_put_int(Binlog_t *b, int32_t v)
+{
+  if( v < 0 ) {
+    bl_put(b, "-", 1);
+    bl_put_uint(b, -(int64_t) v, 0);
+  }
+  else {
+    bl_put_uint(b, v, 0);
+  }
+}
+
+/* The string in record data, up to its NUL */
+static size_t bl_strlen(const uint8_t *data, size_t length)
+{
+  const uint8_t *nul = memchr(data, 0, length);
+  return nul ? (size_t) (nul - data) : length;
+}
+
+/* Text inside double quotes, for CSV (quotes doubled) or JSON (escaped) */
+static void bl_put_quoted(Binlog_t *b, const uint8_t *s, size_t length)
+{
+  char esc[6] = "\\u00";
+
+  bl_put(b, "\"", 1);
+  for( size_t i = 0; i < length; i++ ) {
+    if( b->format == BL_CSV ) {
+      bl_put(b, (char *) &s[i], 1);
+      if( s[i] == '"' ) {
+        bl_put(b, "\"", 1);
+      }
+    }
+    else if( (s[i] == '"') || (s[i] == '\\') ) {
+      bl_put(b, "\\", 1);
+      bl_put(b, (char *) &s[i], 1);
+    }
+    else if( (s[i] < 0x20) || (s[i] >= 0x7f) ) {
+      /* Bytes past ASCII are taken as Latin-1, so the output is valid UTF-8 */
+      esc[4] = bl_hex[s[i] >> 4];
+      esc[5] = bl_hex[s[i] & 0xf];
+      bl_put(b, esc, 6);
+    }
+    else {
+      bl_put(b, (char *) &s[i], 1);
+    }
+  }
+  bl_put(b, "\"", 1);
+}
+
+static void bl_put_bytes(Binlog_t *b, const uint8_t *data, size_t length, const char *prefix)
+{
+  char hex[2];
+
+  for( size_t i = 0; i < length; i++ ) {
+    if( i || (b->format == BL_TEXT) ) {
+      bl_put(b, " ", 1);
+    }
+    bl_put_str(b, prefix);
+    hex[0] = bl_hex[data[i] >> 4];
+    hex[1] = bl_hex[data[i] & 0xf];
+    bl_put(b, hex, 2);
+  }
+}
+
+/* As script/binlog.py prints it, local time to the us */
+static void bl_put_text(Binlog_t *b, const Bl_record_t *r, const uint8_t *data)
+{
+  struct tm tm;
+  time_t t;
+
+  /* Records come many to the second, only format the seconds once */
+  if( (r->time != b->last_time) || (b->time_length == 0) ) {
+    t = r->time;
+    localtime_r(&t, &tm);
+    b->time_length = strftime(b->time_str, sizeof(b->time_str), "%Y-%m-%d %H:%M:%S.", &tm);
+    b->last_time = r->time;
+  }
+  bl_put(b, b->time_str, b->time_length);
+  bl_put_uint(b, r->us, 6);
+  if( r->shard ) {
+    bl_put(b, " <", 2);
+    bl_put_uint(b, r->shard, 0);
+    bl_put(b, ">", 1);
+  }
+  bl_put(b, " [", 2);
+  bl_put_str(b, log_id_str[r->id]);
+  bl_put(b, "]", 1);
+  switch( r->type ) {
+    case LD_DATA:
+      bl_put_bytes(b, data, r->length, "0x");
+      break;
+    case LD_INT:
+      if( r->length >= 4 ) {
+        bl_put(b, " ", 1);
+        bl_put_int(b, bl_read(data, 4));
+      }
+      break;
+    case LD_STR:
+      bl_put(b, " ", 1);
+      bl_put(b, (char *) data, bl_strlen(data, r->length));
+      break;
+    case LD_NVAL:
+      if( r->length >= 4 ) {
+        bl_put(b, " ", 1);
+        bl_put(b, (char *) data + 4, bl_strlen(data + 4, r->length - 4));
+        bl_put(b, " = ", 3);
+        bl_put_int(b, bl_read(data, 4));
+      }
+      break;
+  }
+  bl_put(b, "\n", 1);
+}
+
+/* CSV columns time,us,shard,seq,id,type,value,text, or a JSON object per
+   line with the same names, leaving out an empty value and text */
+static void bl_put_fields(Binlog_t *b, const Bl_record_t *r, const uint8_t *data)
+{
+  uint8_t json = (b->format == BL_JSON);
+  uint8_t has_value = ((r->type == LD_INT) || (r->type == LD_NVAL)) && (r->length >= 4);
+  const uint8_t *text = data;
+  size_t text_length = 0;
+
+  if( r->type == LD_STR ) {
+    text_length = bl_strlen(data, r->length);
+  }
+  else if( (r->type == LD_NVAL) && has_value ) {
+    text = data + 4;
+    text_length = bl_strlen(text, r->length - 4);
+  }
+
+  BL_PUT_EITHER(b, json, "{\"time\":", "");
+  bl_put_uint(b, r->time, 0);
+  BL_PUT_EITHER(b, json, ",\"us\":", ",");
+  bl_put_uint(b, r->us, 0);
+  BL_PUT_EITHER(b, json, ",\"shard\":", ",");
+  bl_put_uint(b, r->shard, 0);
+  BL_PUT_EITHER(b, json, ",\"seq\":", ",");
+  bl_put_uint(b, r->seq, 0);
+  BL_PUT_EITHER(b, json, ",\"id\":\"", ",");
+  bl_put_str(b, log_id_str[r->id]);
+  BL_PUT_EITHER(b, json, "\",\"type\":\"", ",");
+  bl_put_str(b, bl_type_str[r->type]);
+  BL_PUT_EITHER(b, json, "\"", ",");
+  if( has_value ) {
+    /* log_int() and log_val() both take an int32_t */
+    BL_PUT_EITHER(b, json, ",\"value\":", "");
+    bl_put_int(b, bl_read(data, 4));
+  }
+  if( !json ) {
+    bl_put(b, ",", 1);
+  }
+  if( r->type == LD_DATA ) {
+    BL_PUT_EITHER(b, json, ",\"text\":\"", "\"");
+    bl_put_bytes(b, data, r->length, "");
+    bl_put(b, "\"", 1);
+  }
+  else if( text_length || (r->type == LD_STR) ) {
+    BL_PUT_EITHER(b, json, ",\"text\":", "");
+    bl_put_quoted(b, text, text_length);
+  }
+  BL_PUT_EITHER(b, json, "}\n", "\n");
+}
+
+static int bl_wanted(const Binlog_t *b, const Bl_record_t *r)
+{
+  uint64_t t = (uint64_t) r->time * 1000000 + r->us;
+
+  return ((b->id < 0) || (r->id == (uint32_t) b->id)) &&
+         ((b->from == BL_NO_TIME) || (t >= b->from)) &&
+         ((b->to == BL_NO_TIME) || (t < b->to));
+}
+
+/* Offset of the record after the one at `offset`, taking `size` bytes */
+static uint64_t bl_next_offset(const Binlog_t *b, uint64_t offset, size_t size)
+{
+  if( b->kind == BL_FILE ) {
+    return b->ring_start + (offset - b->ring_start + size) % b->ring_size;
+  }
+  return offset + size;
+}
+
+/* Add a record to the open block, or start a new one if it is full or the
+   record doesn't follow straight on */
+static void bl_index_add(Binlog_t *b, const Bl_record_t *r, uint64_t offset, size_t size)
+{
+  uint64_t t = (uint64_t) r->time * 1000000 + r->us;
+  Bl_block_t *k = b->count ? &b->blocks[b->count - 1] : NULL;
+
+  if( (k == NULL) || (k->count == BL_INDEX_STRIDE) || (offset != b->next) ) {
+    if( b->count == b->capacity ) {
+      b->capacity = b->capacity ? 2 * b->capacity : 4096;
+      b->blocks = realloc(b->blocks, b->capacity * sizeof(*b->blocks));
+      if( b->blocks == NULL ) {
+        bl_fail("out of memory for the index", NULL);
+      }
+    }
+    k = &b->blocks[b->count++];
+    k->offset = offset;
+    k->first = t;
+    k->last = t;
+    k->ids = 0;
+    k->count = 0;
+  }
+  k->first = (t < k->first) ? t : k->first;
+  k->last = (t > k->last) ? t : k->last;
+  k->ids |= 1u << r->id;
+  k->count++;
+  b->next = bl_next_offset(b, offset, size);
+}
+
+/* Take the record at `p`, returning its size, or 0 if it isn't valid */
+static size_t bl_record(Binlog_t *b, const uint8_t *p, size_t avail, uint64_t offset)
+{
+  Bl_record_t r;
+  size_t size = bl_check(&b->layout, p, avail, &r);
+
+  if( size == 0 ) {
+    return 0;
+  }
+  b->records++;
+  if( b->indexing ) {
+    bl_index_add(b, &r, offset, size);
+  }
+  if( !bl_wanted(b, &r) ) {
+    return size;
+  }
+  b->shown++;
+  if( b->format == BL_TEXT ) {
+    bl_put_text(b, &r, p + b->layout.header);
+  }
+  else if( b->format != BL_NONE ) {
+    bl_put_fields(b, &r, p + b->layout.header);
+  }
+  return size;
+}
+
+/* Records in a row that parse with this layout, up to `most` */
+static uint32_t bl_run(const Bl_layout_t *layout, const uint8_t *p, size_t avail, uint32_t most)
+{
+  Bl_record_t r;
+  uint32_t count = 0;
+  size_t size;
+
+  while( (count < most) && (size = bl_check(layout, p, avail, &r)) ) {
+    p += size;
+    avail -= size;
+    count++;
+  }
+  return count;
+}
+
+/* A Binlog_Start stream, until a record doesn't parse. The header size isn't
+   sent, so take the layout that parses the longest run. */
+static size_t bl_decode_raw(Binlog_t *b, size_t pos, size_t header)
+{
+  const size_t sizes[] = { 17, 23, 27 };
+  Bl_layout_t layout;
+  uint32_t best = 0;
+  uint32_t run;
+  size_t size;
+
+  if( header ) {
+    bl_layout(&b->layout, header);
+  }
+  else {
+    for( uint8_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ ) {
+      bl_layout(&layout, sizes[i]);
+      run = bl_run(&layout, b->base + pos, b->size - pos, 256);
+      if( run > best ) {
+        best = run;
+        b->layout = layout;
+      }
+    }
+    if( best == 0 ) {
+      return pos;
+    }
+  }
+  b->kind = BL_RAW;
+  while( (size = bl_record(b, b->base + pos, b->size - pos, pos)) ) {
+    pos += size;
+  }
+  return pos;
+}
+
+/* A Binlog_LZ stream, decompressed whole, until a frame doesn't decode.
+   Records can only be found from the start of the stream, so it isn't
+   indexed. */
+static size_t bl_decode_lz(Binlog_t *b, size_t pos)
+{
+  uint8_t *out = NULL;
+  size_t length = 0;
+  size_t capacity = 0;
+  size_t raw;
+  size_t payload;
+  size_t at;
+  size_t size;
+
+  if( (pos >= b->size) || !bl_layout(&b->layout, b->base[pos]) ) {
+    return pos;
+  }
+  pos++;
+  b->kind = BL_LZ;
+  while( pos + LZ_FRAME_HEADER <= b->size ) {
+    raw = bl_read(b->base + pos, 2);
+    payload = bl_read(b->base + pos + 2, 2);
+    if( ((raw & ~LZ_STORED) > LZ_BLOCK) || (payload > LZ_BLOCK) ||
+        (pos + LZ_FRAME_HEADER + payload > b->size) ) {
+      break;
+    }
+    if( length + LZ_BLOCK > capacity ) {
+      capacity = capacity ? 2 * capacity : (1 << 20);
+      out = realloc(out, capacity);
+      if( out == NULL ) {
+        bl_fail("out of memory for the LZ stream", NULL);
+      }
+    }
+    if( raw & LZ_STORED ) {
+      raw &= ~LZ_STORED;
+      if( raw != payload ) {
+        break;
+      }
+      memcpy(out + length, b->base + pos + LZ_FRAME_HEADER, raw);
+    }
+    else if( lz_decompress(b->base + pos + LZ_FRAME_HEADER, payload, out + length, length, raw) != raw ) {
+      break;
+    }
+    length += raw;
+    pos += LZ_FRAME_HEADER + payload;
+  }
+
+  for( at = 0; (size = bl_record(b, out + at, length - at, at)); at += size );
+  free(out);
+  return pos;
+}
+
+/* A Binlog_Framed stream, skipping whatever isn't a good frame */
+static size_t bl_decode_framed(Binlog_t *b, size_t pos)
+{
+  Frame_reader_t reader;
+  Frame_info_t frame;
+  uint64_t offset;
+  size_t at;
+  size_t size;
+
+  b->kind = BL_FRAMED;
+  frame_reader_init(&reader, 1);
+  while( frame_next(&reader, b->base, b->size, &pos, &frame) == LQ_OK ) {
+    if( (frame.record_header != b->layout.header) &&
+        !bl_layout(&b->layout, frame.record_header) ) {
+      continue;
+    }
+    offset = frame.payload - b->base;
+    for( at = 0; at < frame.length; at += size ) {
+      size = bl_record(b, frame.payload + at, frame.length - at, offset + at);
+      if( size == 0 ) {
+        break;
+      }
+    }
+  }
+  b->skipped += reader.skipped;
+  b->lost += reader.lost;
+  return pos;
+}
+
+/* The record at `offset` in a LOG_OUT_FILE file, copied to `copy` if it wraps
+   past the end of the record area */
+static const uint8_t *bl_file_record(Binlog_t *b, uint64_t offset, uint8_t *copy, size_t *avail)
+{
+  uint64_t end = b->ring_start + b->ring_size;
+  Bl_record_t r;
+  size_t first = end - offset;
+  size_t length;
+
+  if( first >= b->layout.header ) {
+    bl_parse(&b->layout, b->base + offset, &r);
+  }
+  else {
+    memcpy(copy, b->base + offset, first);
+    memcpy(copy + first, b->base + b->ring_start, b->layout.header - first);
+    bl_parse(&b->layout, copy, &r);
+  }
+  length = b->layout.header + (r.length < BL_DATA_MAX ? r.length : BL_DATA_MAX);
+  if( first >= length ) {
+    *avail = first;
+    return b->base + offset;
+  }
+  memcpy(copy, b->base + offset, first);
+  memcpy(copy + first, b->base + b->ring_start, length - first);
+  *avail = length;
+  return copy;
+}
+
+/* A LOG_OUT_FILE file, from its oldest record to its newest */
+static void bl_decode_file(Binlog_t *b)
+{
+  const Log_file_header_t *header = (const Log_file_header_t *) b->base;
+  static uint8_t copy[64 + BL_DATA_MAX];
+  const uint8_t *p;
+  uint64_t head = header->head;
+  uint64_t tail = header->tail;
+  uint64_t pos;
+  size_t avail;
+  size_t size;
+
+  if( (b->size < sizeof(*header)) || (header->version != LF_VERSION) ||
+      (header->header_size + header->size > b->size) ||
+      !bl_layout(&b->layout, header->record_header) ) {
+    bl_fail("not a log file this decoder knows", NULL);
+  }
+  b->kind = BL_FILE;
+  b->ring_start = header->header_size;
+  b->ring_size = header->size;
+  for( pos = tail; pos < head; pos += size ) {
+    p = bl_file_record(b, b->ring_start + pos % b->ring_size, copy, &avail);
+    size = bl_record(b, p, avail, b->ring_start + pos % b->ring_size);
+    if( size == 0 ) {
+      b->skipped += head - pos;
+      break;
+    }
+  }
+  /* The writer moves the tail before overwriting records */
+  if( header->tail > tail ) {
+    fprintf(stderr, "binlog: %lu bytes of records were overwritten while decoding\n",
+            (unsigned long) (header->tail - tail));
+  }
+}
+
+/* Every log stream in the capture, each found by its magic */
+static void bl_decode(Binlog_t *b, size_t header)
+{
+  const uint8_t *magic;
+  size_t pos = 0;
+  size_t at;
+
+  if( (b->size >= sizeof(LF_MAGIC) - 1) && !memcmp(b->base, LF_MAGIC, sizeof(LF_MAGIC) - 1) ) {
+    bl_decode_file(b);
+    return;
+  }
+  while( (magic = memmem(b->base + pos, b->size - pos, BL_MAGIC, sizeof(BL_MAGIC) - 1)) ) {
+    at = magic - b->base;
+    b->skipped += at - pos;
+    pos = at + sizeof(BL_MAGIC) - 1;
+    if( (b->size - at >= sizeof(BL_MAGIC_START) - 1) &&
+        !memcmp(magic, BL_MAGIC_START, sizeof(BL_MAGIC_START) - 1) ) {
+      pos = bl_decode_raw(b, at + sizeof(BL_MAGIC_START) - 1, header);
+    }
+    else if( (b->size - at >= sizeof(BL_MAGIC_FRAMED) - 1) &&
+             !memcmp(magic, BL_MAGIC_FRAMED, sizeof(BL_MAGIC_FRAMED) - 1) ) {
+      pos = bl_decode_framed(b, at + sizeof(BL_MAGIC_FRAMED) - 1);
+    }
+    else if( (b->size - at >= sizeof(BL_MAGIC_LZ) - 1) &&
+             !memcmp(magic, BL_MAGIC_LZ, sizeof(BL_MAGIC_LZ) - 1) ) {
+      pos = bl_decode_lz(b, at + sizeof(BL_MAGIC_LZ) - 1);
+    }
+    else {
+      b->skipped += pos - at;
+    }
+  }
+  b->skipped += b->size - pos;
+}
+
+static int64_t bl_mtime(const struct stat *st)
+{
+  return (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+/* Write the blocks collected while decoding */
+static void bl_index_write(Binlog_t *b, const char *path, const struct stat *st)
+{
+  Bl_index_header_t header = { .magic = BL_INDEX_MAGIC };
+  char tmp[4096];
+  FILE *fp;
+
+  if( b->kind == BL_LZ ) {
+    fprintf(stderr, "binlog: LZ streams can't be indexed, decode them whole\n");
+    return;
+  }
+
+  header.version = BL_INDEX_VERSION;
+  header.kind = b->kind;
+  header.capture_size = st->st_size;
+  header.capture_mtime = bl_mtime(st);
+  header.record_header = b->layout.header;
+  header.id_count = LOG_ID_MAX;
+  header.count = b->count;
+  header.ring_start = b->ring_start;
+  header.ring_size = b->ring_size;
+
+  /* Written aside and renamed, so a reader never sees half an index */
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  fp = fopen(tmp, "wb");
+  if( fp == NULL ) {
+    bl_fail("can't write the index", tmp);
+  }
+  fwrite(&header, sizeof(header), 1, fp);
+  if( b->count ) {
+    fwrite(b->blocks, sizeof(*b->blocks), b->count, fp);
+  }
+  if( (fclose(fp) != 0) || (rename(tmp, path) != 0) ) {
+    bl_fail("can't write the index", path);
+  }
+}
+
+/* Whether a block can hold a record the query wants */
+static int bl_block_wanted(const Binlog_t *b, const Bl_block_t *k)
+{
+  return ((b->id < 0) || (k->ids & (1u << b->id))) &&
+         ((b->from == BL_NO_TIME) || (k->last >= b->from)) &&
+         ((b->to == BL_NO_TIME) || (k->first < b->to));
+}
+
+/* Answer the query from a current index, returning 0 if there isn't one.
+   Matches come out in capture order, as they do without the index. */
+static int bl_index_query(Binlog_t *b, const char *path, const struct stat *st)
+{
+  const Bl_index_header_t *header;
+  const Bl_block_t *blocks;
+  const Bl_block_t *k;
+  static uint8_t copy[64 + BL_DATA_MAX];
+  const uint8_t *p;
+  struct stat ist;
+  uint64_t offset;
+  uint64_t i;
+  uint32_t j;
+  size_t avail;
+  size_t size;
+  void *map;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if( fd < 0 ) {
+    return 0;
+  }
+  if( (fstat(fd, &ist) < 0) || (ist.st_size < (off_t) sizeof(*header)) ) {
+    close(fd);
+    return 0;
+  }
+  map = mmap(NULL, ist.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if( map == MAP_FAILED ) {
+    return 0;
+  }
+  header = map;
+  if( memcmp(header->magic, BL_INDEX_MAGIC, sizeof(header->magic)) ||
+      (header->version != BL_INDEX_VERSION) || (header->id_count != LOG_ID_MAX) ||
+      (header->capture_size != (uint64_t) st->st_size) ||
+      (header->capture_mtime != bl_mtime(st)) ||
+      ((uint64_t) ist.st_size != sizeof(*header) + header->count * sizeof(Bl_block_t)) ||
+      !bl_layout(&b->layout, header->record_header) ) {
+    fprintf(stderr, "binlog: index is out of date, rebuild it with -i\n");
+    munmap(map, ist.st_size);
+    return 0;
+  }
+
+  blocks = (const Bl_block_t *) (header + 1);
+  b->kind = header->kind;
+  b->ring_start = header->ring_start;
+  b->ring_size = header->ring_size;
+
+  for( i = 0; i < header->count; i++ ) {
+    k = &blocks[i];
+    if( !bl_block_wanted(b, k) ) {
+      continue;
+    }
+    offset = k->offset;
+    for( j = 0; j < k->count; j++ ) {
+      if( b->kind == BL_FILE ) {
+        p = bl_file_record(b, offset, copy, &avail);
+      }
+      else {
+        p = b->base + offset;
+        avail = b->size - offset;
+      }
+      size = bl_record(b, p, avail, offset);
+      if( size == 0 ) {
+        break;
+      }
+      offset = bl_next_offset(b, offset, size);
+    }
+  }
+  munmap(map, ist.st_size);
+  return 1;
+}
+
+/* Seconds since the epoch, with any fraction, in us */
+static uint64_t bl_time_arg(const char *arg)
+{
+  char *end;
+  double t = strtod(arg, &end);
+
+  if( (*end != '\0') || (t < 0) ) {
+    bl_fail("bad time", arg);
+  }
+  return (uint64_t) (t * 1000000 + 0.5);
+}
+
+static int32_t bl_id_arg(const char *arg)
+{
+  char *end;
+  long id = strtol(arg, &end, 10);
+
+  if( (*end == '\0') && (id >= 0) && (id < LOG_ID_MAX) ) {
+    return id;
+  }
+  for( id = 0; id < LOG_ID_MAX; id++ ) {
+    if( !strcmp(arg, log_id_str[id]) ) {
+      return id;
+    }
+  }
+  bl_fail("unknown log id", arg);
+  return -1;
+}
+
+static double bl_seconds(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[])
+{
+  static Binlog_t b;
+  const char *formats[] = { "text", "csv", "json", "none" };
+  char index_path[4096];
+  size_t header = 0;
+  uint8_t build = 0;
+  uint8_t verbose = 0;
+  uint8_t queried = 0;
+  struct stat st;
+  double start;
+  void *map;
+  int opt;
+  int fd;
+
+  b.id = -1;
+  b.from = BL_NO_TIME;
+  b.to = BL_NO_TIME;
+  while( (opt = getopt(argc, argv, "o:ie:s:t:r:v")) != -1 ) {
+    switch( opt ) {
+      case 'o':
+        for( b.format = 0; (b.format <= BL_NONE) && strcmp(optarg, formats[b.format]); b.format++ );
+        if( b.format > BL_NONE ) {
+          bl_fail("unknown output format", optarg);
+        }
+        break;
+      case 'i':
+        build = 1;
+        break;
+      case 'e':
+        b.id = bl_id_arg(optarg);
+        break;
+      case 's':
+        b.from = bl_time_arg(optarg);
+        break;
+      case 't':
+        b.to = bl_time_arg(optarg);
+        break;
+      case 'r':
+        header = atoi(optarg);
+        if( !bl_layout(&b.layout, header) ) {
+          bl_fail("no platform has that record header size", optarg);
+        }
+        break;
+      case 'v':
+        verbose = 1;
+        break;
+      default:
+        return 1;
+    }
+  }
+  if( optind != argc - 1 ) {
+    fprintf(stderr, "Usage: %s [-o text|csv|json|none] [-i] [-e id] [-s start] [-t end]"
+                    " [-r header] [-v] capture\n", argv[0]);
+    return 1;
+  }
+
+  fd = open(argv[optind], O_RDONLY);
+  if( (fd < 0) || (fstat(fd, &st) < 0) ) {
+    bl_fail("can't open", argv[optind]);
+  }
+  if( st.st_size == 0 ) {
+    return 0;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if( map == MAP_FAILED ) {
+    bl_fail("can't map", argv[optind]);
+  }
+  b.base = map;
+  b.size = st.st_size;
+  snprintf(index_path, sizeof(index_path), "%s.idx", argv[optind]);
+
+  if( b.format == BL_CSV ) {
+    bl_put_str(&b, "time,us,shard,seq,id,type,value,text\n");
+  }
+
+  start = bl_seconds();
+  if( !build && ((b.id >= 0) || (b.from != BL_NO_TIME) || (b.to != BL_NO_TIME)) ) {
+    queried = bl_index_query(&b, index_path, &st);
+  }
+  if( !queried ) {
+    madvise(map, b.size, MADV_SEQUENTIAL);
+    b.indexing = build;
+    bl_decode(&b, header);
+  }
+  bl_flush(&b);
+  fflush(stdout);
+  if( build ) {
+    bl_index_write(&b, index_path, &st);
+  }
+
+  if( verbose ) {
+    start = bl_seconds() - start;
+    if( queried ) {
+      fprintf(stderr, "binlog: %lu records from the index in %.3f s\n",
+              (unsigned long) b.shown, start);
+    }
+    else {
+      fprintf(stderr, "binlog: %lu records, %lu shown, %lu bytes skipped, %lu frames lost\n",
+              (unsigned long) b.records, (unsigned long) b.shown, (unsigned long) b.skipped,
+              (unsigned long) b.lost);
+      fprintf(stderr, "binlog: %.1f MB in %.3f s, %.0f MB/s, %.2f M records/s\n",
+              b.size / 1e6, start, b.size / 1e6 / start, b.records / 1e6 / start);
+    }
+  }
+  munmap(map, b.size);
+  return 0;
+}